@@ -0,0 +1,142 @@
+#include "arena.h"
+#include "fiber_local.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <new>
+
+namespace sylar {
+
+static std::atomic<size_t> s_cache_capacity{64}; // 每个线程最多缓存的标准内存块数量
+
+// 线程退出时释放缓存的内存块
+// 线程主协程的局部变量可能在缓存析构之后才销毁，t_cache_dead 之后的内存块直接 free
+static thread_local bool t_cache_dead = false;
+struct ChunkCache
+{
+	std::vector<void*> chunks;
+
+	~ChunkCache()
+	{
+		for(void* chunk : chunks)
+		{
+			free(chunk);
+		}
+		t_cache_dead = true;
+	}
+};
+static thread_local ChunkCache t_chunk_cache;
+
+static FiberLocal<Arena> s_fiber_arena;
+
+Arena::~Arena()
+{
+	release();
+}
+
+void Arena::release()
+{
+	while(m_chunks)
+	{
+		Chunk* next = m_chunks->next;
+		FreeChunk(m_chunks);
+		m_chunks = next;
+	}
+	while(m_large)
+	{
+		Chunk* next = m_large->next;
+		free(m_large);
+		m_large = next;
+	}
+	m_cur = m_end = nullptr;
+	m_allocated = 0;
+}
+
+Arena& Arena::GetThis()
+{
+	return s_fiber_arena.get();
+}
+
+void Arena::SetCacheCapacity(size_t chunks)
+{
+	s_cache_capacity = chunks;
+}
+
+void* Arena::do_allocate(size_t bytes, size_t alignment)
+{
+	// 快路径：在当前块中对齐后直接切出
+	uintptr_t p = ((uintptr_t)m_cur + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	if(m_cur && p + bytes <= (uintptr_t)m_end)
+	{
+		m_allocated += p + bytes - (uintptr_t)m_cur;
+		m_cur = (char*)(p + bytes);
+		return (void*)p;
+	}
+	return allocateSlow(bytes, alignment);
+}
+
+void* Arena::allocateSlow(size_t bytes, size_t alignment)
+{
+	size_t header = (sizeof(Chunk) + alignment - 1) & ~(alignment - 1);
+	if(bytes > kChunkSize / 2 || header + bytes > kChunkSize)
+	{
+		// 大块单独申请，不占用标准块剩余的空间
+		size_t size = header + bytes + alignment;
+		Chunk* chunk = (Chunk*)malloc(size);
+		if(!chunk)
+		{
+			throw std::bad_alloc();
+		}
+		chunk->size = size;
+		chunk->next = m_large;
+		m_large = chunk;
+		uintptr_t p = ((uintptr_t)chunk + sizeof(Chunk) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		m_allocated += bytes;
+		return (void*)p;
+	}
+
+	Chunk* chunk = NewChunk();
+	chunk->next = m_chunks;
+	m_chunks = chunk;
+	m_cur = (char*)chunk + sizeof(Chunk);
+	m_end = (char*)chunk + kChunkSize;
+	return do_allocate(bytes, alignment);
+}
+
+Arena::Chunk* Arena::NewChunk()
+{
+	Chunk* chunk;
+	if(!t_cache_dead && !t_chunk_cache.chunks.empty())
+	{
+		chunk = (Chunk*)t_chunk_cache.chunks.back();
+		t_chunk_cache.chunks.pop_back();
+	}
+	else
+	{
+		chunk = (Chunk*)malloc(kChunkSize);
+		if(!chunk)
+		{
+			throw std::bad_alloc();
+		}
+	}
+	chunk->size = kChunkSize;
+	chunk->next = nullptr;
+	return chunk;
+}
+
+void Arena::FreeChunk(Chunk* chunk)
+{
+	// 协程可能在其他线程上结束，块放回结束时所在线程的缓存
+	if(!t_cache_dead && t_chunk_cache.chunks.size() < s_cache_capacity.load(std::memory_order_relaxed))
+	{
+		t_chunk_cache.chunks.push_back(chunk);
+	}
+	else
+	{
+		free(chunk);
+	}
+}
+
+}
@@ -0,0 +1,67 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <memory_resource>
+#include <cstddef>
+
+namespace sylar {
+
+// 区域分配器（bump allocator）：从大块内存中顺序切出小块，单个对象的释放什么都不做，整个区域一起释放
+// 继承 std::pmr::memory_resource，可以直接交给 std::pmr::vector / std::pmr::string 等容器使用
+// 标准大小的内存块在释放时放回当前线程的缓存，下一个区域直接复用，稳定之后不再调用 malloc / free
+// 不是线程安全的，一个区域只能同时被一个协程使用
+class Arena : public std::pmr::memory_resource
+{
+public:
+	// 标准内存块的大小，超过它一半的分配单独向系统申请
+	static const size_t kChunkSize = 16 * 1024;
+
+	Arena() = default;
+	~Arena();
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	// 释放区域中所有的分配，之前分配出去的内存都不能再使用
+	void release();
+
+	// 已经分配出去的字节数（包括对齐的填充）
+	size_t bytesAllocated() const {return m_allocated;}
+
+	// 当前协程的区域：第一次使用时创建，协程结束、被 reset 复用或析构时随协程局部变量一起释放
+	// 从中分配的对象不能比协程活得更久，也不能交给其他协程在本协程结束之后使用
+	//     std::pmr::vector<std::pmr::string> names(&sylar::Arena::GetThis());
+	static Arena& GetThis();
+
+	// 设置每个线程最多缓存的标准内存块数量
+	static void SetCacheCapacity(size_t chunks);
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* /*p*/, size_t /*bytes*/, size_t /*alignment*/) override {}
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {return this == &other;}
+
+private:
+	// 内存块头部，后面紧跟可分配的空间
+	struct Chunk
+	{
+		Chunk* next;
+		size_t size; // 包括头部在内的大小
+	};
+
+	// 当前块不够时换一个新块再分配
+	void* allocateSlow(size_t bytes, size_t alignment);
+
+	static Chunk* NewChunk();
+	static void FreeChunk(Chunk* chunk);
+
+private:
+	Chunk* m_chunks = nullptr; // 标准内存块链表，头部是正在切分的块
+	Chunk* m_large = nullptr; // 单独申请的大块
+	char* m_cur = nullptr;
+	char* m_end = nullptr;
+	size_t m_allocated = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,179 @@
+// 短连接的建连速率：kClients 个客户端线程各自循环 connect / 发请求 / 读到对端关闭，服务端每个连接回一个 HTTP 响应后关闭
+// 对比三种服务端：main.cpp 的写法（一个监听 fd，每接收一个连接重新注册一次读事件）、Listener + accept、Listener + accept4
+// 服务端 IOManager 使用 kThreads 个线程，Listener 为每个线程打开一个 SO_REUSEPORT 监听套接字
+#include "ioscheduler.h"
+#include "hook.h"
+#include "listener.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const int kThreads = 4;
+static const int kClients = 8;
+static const int kConnections = 4000; // 每个客户端线程的连接数
+
+static const char* kResponse = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain\r\n"
+                               "Content-Length: 13\r\n"
+                               "Connection: close\r\n"
+                               "\r\n"
+                               "Hello, World!";
+
+static int s_listen_fd = -1;
+static std::atomic<bool> s_accepting{false}; // 结束时先置为 false，cancelAll 触发的回调不再重新注册监听 fd
+
+#define HOOKED(call) (sylar::set_hook_enable(true), call)
+
+static void serve(int fd)
+{
+	char buffer[1024];
+	if(HOOKED(recv(fd, buffer, sizeof(buffer), 0)) > 0)
+	{
+		HOOKED(send(fd, kResponse, strlen(kResponse), 0));
+	}
+	HOOKED(close(fd));
+}
+
+// main.cpp 的写法：读事件回调里 accept 一个连接，再重新注册监听 fd 的读事件
+static void on_accept()
+{
+	if(!s_accepting)
+	{
+		return;
+	}
+	int fd = HOOKED(accept(s_listen_fd, nullptr, nullptr));
+	if(fd >= 0)
+	{
+		sylar::IOManager::GetThis()->scheduleLock([fd]() {serve(fd);});
+	}
+	sylar::IOManager::GetThis()->addEvent(s_listen_fd, sylar::IOManager::READ, on_accept);
+}
+
+static int request(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	// SO_LINGER 为 0 时 close 直接发 RST，客户端不进入 TIME_WAIT，大量短连接不会耗尽本地端口
+	linger lg = {1, 0};
+	setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+	const char req[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	send(fd, req, sizeof(req) - 1, 0);
+	char buffer[256];
+	size_t got = 0;
+	ssize_t n;
+	while((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+	{
+		got += n;
+	}
+	close(fd);
+	return got == strlen(kResponse) ? 0 : -1;
+}
+
+// 所有客户端跑完返回每秒连接数
+static double clients(int port, int& failed)
+{
+	std::atomic<int> fails{0};
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for(int c = 0; c < kClients; c++)
+	{
+		threads.emplace_back([port, &fails]()
+		{
+			for(int i = 0; i < kConnections; i++)
+			{
+				fails += request(port) < 0;
+			}
+		});
+	}
+	for(auto& t : threads)
+	{
+		t.join();
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	failed = fails;
+	return (double)kClients * kConnections / sec;
+}
+
+static double runSingle(int& failed)
+{
+	s_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(s_listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(s_listen_fd, (sockaddr*)&addr, sizeof(addr));
+	listen(s_listen_fd, 1024);
+	socklen_t len = sizeof(addr);
+	getsockname(s_listen_fd, (sockaddr*)&addr, &len);
+	fcntl(s_listen_fd, F_SETFL, O_NONBLOCK);
+
+	double rate = 0;
+	{
+		sylar::IOManager iom(kThreads + 1, true, "single");
+		s_accepting = true;
+		iom.addEvent(s_listen_fd, sylar::IOManager::READ, on_accept);
+		rate = clients(ntohs(addr.sin_port), failed);
+		s_accepting = false;
+		iom.cancelAll(s_listen_fd);
+	}
+	sylar::set_hook_enable(false);
+	close(s_listen_fd);
+	return rate;
+}
+
+static double runListener(bool use_accept4, int& failed)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	double rate = 0;
+	{
+		// 主线程在析构中的 stop() 才开始调度，多建一个线程保证测量期间有 kThreads 个线程在接收连接
+		sylar::IOManager iom(kThreads + 1, true, "listener");
+		std::shared_ptr<sylar::Listener> listener = std::make_shared<sylar::Listener>(&iom, (sockaddr*)&addr, sizeof(addr), serve, use_accept4);
+		if(!listener->start())
+		{
+			return 0;
+		}
+		rate = clients(listener->getPort(), failed);
+		listener->stop();
+	}
+	sylar::set_hook_enable(false);
+	return rate;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit); // 屏蔽调度器的调试输出
+	int failed[3] = {0, 0, 0};
+	double single = runSingle(failed[0]);
+	double listener = runListener(false, failed[1]);
+	double listener4 = runListener(true, failed[2]);
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "main.cpp style (one listen fd, addEvent per accept)   " << single << " conn/s" << (failed[0] ? "  failed " + std::to_string(failed[0]) : "") << std::endl;
+	std::cout << "Listener, SO_REUSEPORT per thread, accept            " << listener << " conn/s" << (failed[1] ? "  failed " + std::to_string(failed[1]) : "") << std::endl;
+	std::cout << "Listener, SO_REUSEPORT per thread, accept4           " << listener4 << " conn/s" << (failed[2] ? "  failed " + std::to_string(failed[2]) : "") << std::endl;
+	return 0;
+}
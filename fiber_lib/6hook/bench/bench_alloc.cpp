@@ -0,0 +1,183 @@
+// 稳态下每个请求的内存分配次数：替换全局 operator new 计数，服务端的写法与 main.cpp 相同（监听 fd 的读事件回调里 accept，连接的读事件回调里 recv / send / close）
+// 另一种模式在 accept 之后直接 recv，并设置了 SO_RCVTIMEO，每个请求都要经过 do_io 的挂起等待和超时定时器
+// 客户端在普通线程中用阻塞 socket 逐个发请求，热身之后统计 kRequests 个请求期间的分配次数
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <iostream>
+#include <iomanip>
+
+static std::atomic<long> s_allocs{0};
+
+void* operator new(size_t size)
+{
+	s_allocs.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if(!p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+void operator delete(void* p) noexcept {free(p);}
+void operator delete(void* p, size_t) noexcept {free(p);}
+
+static const int kWarmup = 2000;
+static const int kRequests = 10000;
+
+static const char* kResponse = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain\r\n"
+                               "Content-Length: 13\r\n"
+                               "Connection: keep-alive\r\n"
+                               "\r\n"
+                               "Hello, World!";
+
+static int s_listen_fd = -1;
+static bool s_blocking = false;
+static std::atomic<bool> s_accepting{false}; // 结束时先置为 false，cancelAll 触发的回调不再重新注册监听 fd
+
+#define HOOKED(call) (sylar::set_hook_enable(true), call)
+
+static void serve(int fd)
+{
+	char buffer[1024];
+	while(true)
+	{
+		int ret = HOOKED(recv(fd, buffer, sizeof(buffer), 0));
+		if(ret > 0)
+		{
+			HOOKED(send(fd, kResponse, strlen(kResponse), 0));
+			HOOKED(close(fd));
+			break;
+		}
+		if(ret == 0 || errno != EAGAIN)
+		{
+			HOOKED(close(fd));
+			break;
+		}
+	}
+}
+
+static void on_accept()
+{
+	if(!s_accepting)
+	{
+		return;
+	}
+	int fd = HOOKED(accept(s_listen_fd, nullptr, nullptr));
+	if(fd >= 0)
+	{
+		if(s_blocking)
+		{
+			timeval tv = {5, 0};
+			HOOKED(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+			sylar::IOManager::GetThis()->scheduleLock([fd]() {serve(fd);});
+		}
+		else
+		{
+			sylar::IOManager::GetThis()->addEvent(fd, sylar::IOManager::READ, [fd]() {serve(fd);});
+		}
+	}
+	sylar::IOManager::GetThis()->addEvent(s_listen_fd, sylar::IOManager::READ, on_accept);
+}
+
+static int request(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	// 阻塞模式下先让服务端的 recv 挂起，再发请求
+	if(s_blocking)
+	{
+		usleep(50);
+	}
+	const char req[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	send(fd, req, sizeof(req) - 1, 0);
+	char buffer[256];
+	size_t got = 0;
+	ssize_t n;
+	while((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+	{
+		got += n;
+	}
+	close(fd);
+	return got == strlen(kResponse) ? 0 : -1;
+}
+
+static double run(bool blocking, int& failed)
+{
+	s_blocking = blocking;
+	s_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(s_listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(s_listen_fd, (sockaddr*)&addr, sizeof(addr));
+	listen(s_listen_fd, 1024);
+	socklen_t len = sizeof(addr);
+	getsockname(s_listen_fd, (sockaddr*)&addr, &len);
+	int port = ntohs(addr.sin_port);
+	fcntl(s_listen_fd, F_SETFL, O_NONBLOCK);
+
+	double per_request = 0;
+	failed = 0;
+	{
+		sylar::IOManager iom(2, true, "alloc");
+		s_accepting = true;
+		iom.addEvent(s_listen_fd, sylar::IOManager::READ, on_accept);
+
+		std::thread client([&]()
+		{
+			for(int i = 0; i < kWarmup; i++)
+			{
+				failed += request(port) < 0;
+			}
+			long before = s_allocs.load();
+			for(int i = 0; i < kRequests; i++)
+			{
+				failed += request(port) < 0;
+			}
+			per_request = (double)(s_allocs.load() - before) / kRequests;
+		});
+		client.join();
+		s_accepting = false;
+		iom.cancelAll(s_listen_fd);
+	}
+	sylar::set_hook_enable(false);
+	close(s_listen_fd);
+	return per_request;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit); // 屏蔽调度器的调试输出
+	int failed_event = 0, failed_blocking = 0;
+	double event = run(false, failed_event);
+	double blocking = run(true, failed_blocking);
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "main.cpp style (read event callback)   " << event << " allocations/request";
+	std::cout << (failed_event ? " (" + std::to_string(failed_event) + " failed)" : "") << std::endl;
+	std::cout << "blocking recv + SO_RCVTIMEO (do_io)    " << blocking << " allocations/request";
+	std::cout << (failed_blocking ? " (" + std::to_string(failed_blocking) + " failed)" : "") << std::endl;
+	return 0;
+}
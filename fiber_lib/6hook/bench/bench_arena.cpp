@@ -0,0 +1,67 @@
+// 请求处理中临时对象的分配开销：kFibers 个短协程，每个构造 kStrings 个超过短字符串优化长度的字符串放进 vector 后退出
+// 对比默认分配器（std::vector<std::string>）和当前协程的区域分配器（std::pmr::vector<std::pmr::string> + Arena::GetThis()）
+#include "ioscheduler.h"
+#include "arena.h"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+static const int kFibers = 100000;
+static const int kStrings = 100;
+static const char* kValue = "header-value-0123456789abcdefghijklmnop"; // 40 字节
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 只用主线程调度：所有协程在析构中的 stop() 里依次执行，不受线程间唤醒的干扰
+template<class F>
+static double perFiberNs(F f)
+{
+	double start = nowSec();
+	{
+		sylar::IOManager iom(1, true, "bench");
+		for(int i = 0; i < kFibers; i++)
+		{
+			iom.scheduleLock(f);
+		}
+	}
+	return (nowSec() - start) * 1e9 / kFibers;
+}
+
+static size_t s_check = 0;
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	double base = perFiberNs([]() {});
+	double heap = perFiberNs([]()
+	{
+		std::vector<std::string> values;
+		for(int i = 0; i < kStrings; i++)
+		{
+			values.emplace_back(kValue);
+		}
+		s_check += values.size();
+	});
+	double arena = perFiberNs([]()
+	{
+		std::pmr::vector<std::pmr::string> values(&sylar::Arena::GetThis());
+		for(int i = 0; i < kStrings; i++)
+		{
+			values.emplace_back(kValue);
+		}
+		s_check += values.size();
+	});
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "empty fiber                  " << base << " ns/fiber" << std::endl;
+	std::cout << "std::string + malloc         " << heap << " ns/fiber" << std::endl;
+	std::cout << "std::pmr::string + Arena     " << arena << " ns/fiber" << std::endl;
+	std::cout << "check " << s_check << " expect " << 2L * kFibers * kStrings << std::endl;
+	return 0;
+}
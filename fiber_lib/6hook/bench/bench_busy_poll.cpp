@@ -0,0 +1,100 @@
+// 唤醒延迟基准：一个协程阻塞在 socketpair 的 recv 上，外部线程每隔 kGapUs 微秒写 1 字节，
+// 统计从 write 到协程从 recv 返回的延迟分布（p50 / p99），对比关闭忙轮询和 setBusyPoll(kBusyPollUs)
+// 忙轮询需要工作线程独占 CPU 核，在核数少于线程数的机器上自旋会和写线程抢 CPU，结果没有参考意义
+#include "ioscheduler.h"
+#include "hook.h"
+#include "fd_manager.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const int kSamples = 20000;
+static const int kGapUs = 50;
+static const uint64_t kBusyPollUs = 200;
+
+#define HOOKED(call) (sylar::set_hook_enable(true), call)
+
+static uint64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::vector<uint64_t> bench(uint64_t busy_poll_us)
+{
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	sylar::FdMgr::GetInstance()->get(sv[0], true); // 读端交给 hook 管理，设置为非阻塞
+
+	std::vector<uint64_t> latencies;
+	latencies.reserve(kSamples);
+	std::atomic<uint64_t> sent_at{0};
+	std::atomic<int> received{0};
+	{
+		// 主线程在析构中的 stop() 才开始调度，多建一个线程作为测量期间唯一的工作线程
+		sylar::IOManager iom(2, true, "bench");
+		iom.setBusyPoll(busy_poll_us);
+		int fd = sv[0];
+		iom.scheduleLock([fd, &latencies, &sent_at, &received]()
+		{
+			char c;
+			for(int i = 0; i < kSamples; i++)
+			{
+				if(HOOKED(recv(fd, &c, 1, 0)) == 1)
+				{
+					latencies.push_back(nowNs() - sent_at.load());
+				}
+				received++;
+			}
+		});
+
+		std::thread writer([&sv, &sent_at, &received]()
+		{
+			for(int i = 0; i < kSamples; i++)
+			{
+				uint64_t gap_end = nowNs() + kGapUs * 1000;
+				while(nowNs() < gap_end); // 忙等而不是 sleep，间隔更稳定，也不会在写线程这边引入唤醒延迟
+				sent_at = nowNs();
+				write(sv[1], "x", 1);
+				while(received <= i)
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+		writer.join();
+	}
+
+	sylar::FdMgr::GetInstance()->del(sv[0]);
+	close(sv[0]);
+	close(sv[1]);
+	std::sort(latencies.begin(), latencies.end());
+	return latencies;
+}
+
+static double percentileUs(const std::vector<uint64_t>& sorted, double p)
+{
+	if(sorted.empty())
+	{
+		return 0;
+	}
+	return sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * p))] / 1000.0;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	std::vector<uint64_t> off = bench(0);
+	std::vector<uint64_t> on = bench(kBusyPollUs);
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << std::setw(16) << "busy poll" << std::setw(12) << "p50 (us)" << std::setw(12) << "p99 (us)" << std::endl;
+	std::cout << std::setw(16) << "off" << std::setw(12) << percentileUs(off, 0.5) << std::setw(12) << percentileUs(off, 0.99) << std::endl;
+	std::cout << std::setw(16) << (std::to_string(kBusyPollUs) + " us") << std::setw(12) << percentileUs(on, 0.5) << std::setw(12) << percentileUs(on, 0.99) << std::endl;
+	return 0;
+}
@@ -0,0 +1,98 @@
+// 协程之间传递消息的吞吐量：kPairs 对生产者 / 消费者，每对传递 kMessages 个整数，统计每秒消息数
+// 对比三种写法：生产者对每条消息 scheduleLock 一个处理回调（现在流水线各级之间的写法，没有背压）、
+// 有界 Channel（容量 kCapacity，满时生产者挂起）、无界 Channel
+#include "ioscheduler.h"
+#include "channel.h"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const int kMessages = 1000000;
+static const size_t kCapacity = 1024;
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 返回每秒消息数，消息总和不对时返回 -1
+static double viaCallbacks(int pairs)
+{
+	std::atomic<long> sum{0};
+	double start = nowSec();
+	{
+		// 主线程在析构中的 stop() 才开始调度，多建一个线程保证测量期间有 pairs 个工作线程
+		sylar::IOManager iom(pairs + 1, true, "bench");
+		for(int p = 0; p < pairs; p++)
+		{
+			iom.scheduleLock([&iom, &sum]()
+			{
+				for(int i = 1; i <= kMessages; i++)
+				{
+					iom.scheduleLock([&sum, i]() {sum.fetch_add(i, std::memory_order_relaxed);});
+				}
+			});
+		}
+	}
+	double sec = nowSec() - start;
+	return sum == (long)pairs * kMessages * (kMessages + 1) / 2 ? (double)pairs * kMessages / sec : -1;
+}
+
+static double viaChannel(int pairs, size_t capacity)
+{
+	std::vector<std::unique_ptr<sylar::Channel<int>>> channels;
+	for(int p = 0; p < pairs; p++)
+	{
+		channels.emplace_back(new sylar::Channel<int>(capacity));
+	}
+	std::atomic<long> sum{0};
+	double start = nowSec();
+	{
+		sylar::IOManager iom(pairs + 1, true, "bench");
+		for(int p = 0; p < pairs; p++)
+		{
+			sylar::Channel<int>* ch = channels[p].get();
+			iom.scheduleLock([ch]()
+			{
+				for(int i = 1; i <= kMessages; i++)
+				{
+					ch->send(i);
+				}
+				ch->close();
+			});
+			iom.scheduleLock([ch, &sum]()
+			{
+				long local = 0;
+				int v;
+				while(ch->recv(v))
+				{
+					local += v;
+				}
+				sum += local;
+			});
+		}
+	}
+	double sec = nowSec() - start;
+	return sum == (long)pairs * kMessages * (kMessages + 1) / 2 ? (double)pairs * kMessages / sec : -1;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	std::vector<std::vector<double>> rows;
+	for(int pairs : {1, 4})
+	{
+		rows.push_back({(double)pairs, viaCallbacks(pairs), viaChannel(pairs, kCapacity), viaChannel(pairs, 0)});
+	}
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << std::setw(8) << "pairs" << std::setw(20) << "scheduleLock/msg" << std::setw(20) << "Channel(1024)" << std::setw(20) << "Channel(unbounded)" << "   (msgs/s)" << std::endl;
+	for(auto& row : rows)
+	{
+		std::cout << std::setw(8) << row[0] << std::setw(20) << row[1] << std::setw(20) << row[2] << std::setw(20) << row[3] << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+// 每个请求新建连接 vs ConnectionPool：kFibers 个协程各发 kRequests 个 32 字节的请求到回环地址上的 TcpServer（回显），等到回显后算一次请求
+// 新建连接：socket + connect_with_timeout + 一次往返 + close；连接池：acquire + 一次往返 + 归还，池的上限为 kFibers / 2，一半的协程要挂起等待
+// 报告每个请求的平均耗时和 p99（在客户端协程内计时）以及连接池新建 / 复用的连接数
+#include "ioscheduler.h"
+#include "hook.h"
+#include "tcp_server.h"
+#include "connection_pool.h"
+#include "fiber_sync.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const int kFibers = 16;
+static const int kRequests = 300;
+
+typedef std::chrono::steady_clock Clock;
+
+static void echo(sylar::TcpConnection& conn)
+{
+	char buf[256];
+	while(true)
+	{
+		ssize_t n = conn.recv(buf, sizeof(buf));
+		if(n <= 0 || conn.sendAll(buf, n) < 0)
+		{
+			break;
+		}
+	}
+}
+
+static bool roundTrip(int fd)
+{
+	char msg[32];
+	memset(msg, 'x', sizeof(msg));
+	if(send(fd, msg, sizeof(msg), 0) != sizeof(msg))
+	{
+		return false;
+	}
+	size_t got = 0;
+	while(got < sizeof(msg))
+	{
+		ssize_t n = recv(fd, msg + got, sizeof(msg) - got, 0);
+		if(n <= 0)
+		{
+			return false;
+		}
+		got += n;
+	}
+	return true;
+}
+
+// 在 kFibers 个协程中执行 request，收集每个请求的耗时
+static std::vector<double> run(sylar::IOManager& iom, std::function<bool()> request)
+{
+	std::vector<double> us;
+	std::mutex mutex;
+	sylar::WaitGroup wg(kFibers);
+	for(int i = 0; i < kFibers; i++)
+	{
+		iom.scheduleLock([&]()
+		{
+			sylar::set_hook_enable(true);
+			std::vector<double> local;
+			for(int k = 0; k < kRequests; k++)
+			{
+				auto start = Clock::now();
+				if(request())
+				{
+					local.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+				}
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			us.insert(us.end(), local.begin(), local.end());
+			wg.done();
+		});
+	}
+	while(wg.count())
+	{
+		usleep(1000);
+	}
+	return us;
+}
+
+static void report(const char* name, std::vector<double> us)
+{
+	std::sort(us.begin(), us.end());
+	double sum = 0;
+	for(double v : us)
+	{
+		sum += v;
+	}
+	double avg = us.empty() ? 0 : sum / us.size();
+	double p99 = us.empty() ? 0 : us[us.size() * 99 / 100];
+	std::cout << std::setw(18) << name << std::setw(8) << us.size() << " ok" << std::setw(10) << avg << " us avg" << std::setw(10) << p99 << " us p99" << std::endl;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	std::vector<double> fresh, pooled;
+	uint64_t created = 0, reused = 0;
+	{
+		sylar::IOManager iom(2, false, "pool");
+		auto server = std::make_shared<sylar::TcpServer>(&iom, echo);
+		server->start(0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(server->getPort());
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		fresh = run(iom, [&]()
+		{
+			int fd = socket(AF_INET, SOCK_STREAM, 0);
+			bool ok = connect_with_timeout(fd, (sockaddr*)&addr, sizeof(addr), 3000) == 0 && roundTrip(fd);
+			close(fd);
+			return ok;
+		});
+
+		auto pool = std::make_shared<sylar::ConnectionPool>(&iom, kFibers / 2, kFibers / 2);
+		pooled = run(iom, [&]()
+		{
+			sylar::PooledConnection conn = pool->acquire((sockaddr*)&addr, sizeof(addr));
+			if(!conn)
+			{
+				return false;
+			}
+			if(!roundTrip(conn.getFd()))
+			{
+				conn.markBroken();
+				return false;
+			}
+			return true;
+		});
+		created = pool->getCreatedCount();
+		reused = pool->getReusedCount();
+		pool->clear();
+		server->stop(1000);
+	}
+	std::cout.clear();
+	std::cout << kFibers << " fibers x " << kRequests << " requests, 2 threads, loopback echo" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	report("connect per req", fresh);
+	report("ConnectionPool", pooled);
+	std::cout << "pool created " << created << " connections, reused " << reused << std::endl;
+	return 0;
+}
@@ -0,0 +1,103 @@
+// 上下文切换 ping-pong 基准：报告每一对 resume/yield 的耗时（ns）
+// 1.Fiber::resume / Fiber::yield，使用编译期选择的后端（加 -DSYLAR_CONTEXT_UCONTEXT 编译即可测试 ucontext 后端）
+// 2.直接调用 swapcontext，作为 ucontext 后端的下限
+// 3.直接调用 Context::Swap，作为当前后端的下限
+#include "fiber.h"
+#include "context.h"
+
+#include <ucontext.h>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+static const long kRounds = 2000000;
+
+static double nsPerRound(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / kRounds;
+}
+
+static double benchFiber()
+{
+	sylar::Fiber::GetThis(); // 初始化主协程
+	bool stop = false;
+	auto fiber = std::make_shared<sylar::Fiber>([&stop]()
+	{
+		while(!stop)
+		{
+			sylar::Fiber::GetThis()->yield();
+		}
+	}, 0, false);
+
+	auto start = std::chrono::steady_clock::now();
+	for(long i = 0; i < kRounds; i++)
+	{
+		fiber->resume();
+	}
+	double ns = nsPerRound(start);
+	stop = true; // 让协程运行结束，否则它栈上的 shared_ptr 会让自己一直不被释放
+	fiber->resume();
+	return ns;
+}
+
+static ucontext_t s_main_uctx, s_peer_uctx;
+
+static void ucontextPeer()
+{
+	while(true)
+	{
+		swapcontext(&s_peer_uctx, &s_main_uctx);
+	}
+}
+
+static double benchSwapcontext()
+{
+	static char stack[64 * 1024];
+	getcontext(&s_peer_uctx);
+	s_peer_uctx.uc_link = nullptr;
+	s_peer_uctx.uc_stack.ss_sp = stack;
+	s_peer_uctx.uc_stack.ss_size = sizeof(stack);
+	makecontext(&s_peer_uctx, &ucontextPeer, 0);
+
+	auto start = std::chrono::steady_clock::now();
+	for(long i = 0; i < kRounds; i++)
+	{
+		swapcontext(&s_main_uctx, &s_peer_uctx);
+	}
+	return nsPerRound(start);
+}
+
+static sylar::Context s_main_ctx, s_peer_ctx;
+
+static void contextPeer()
+{
+	sylar::Context::Entered();
+	while(true)
+	{
+		sylar::Context::Swap(s_peer_ctx, s_main_ctx);
+	}
+}
+
+static double benchContext()
+{
+	static char stack[64 * 1024];
+	s_main_ctx.init();
+	s_peer_ctx.make(stack, sizeof(stack), &contextPeer);
+
+	auto start = std::chrono::steady_clock::now();
+	for(long i = 0; i < kRounds; i++)
+	{
+		sylar::Context::Swap(s_main_ctx, s_peer_ctx);
+	}
+	return nsPerRound(start);
+}
+
+int main()
+{
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "backend: " << sylar::Context::Backend() << std::endl;
+	std::cout << std::setw(28) << "Fiber resume/yield" << std::setw(10) << benchFiber() << " ns" << std::endl;
+	std::cout << std::setw(28) << "raw swapcontext" << std::setw(10) << benchSwapcontext() << " ns" << std::endl;
+	std::cout << std::setw(28) << "raw Context::Swap" << std::setw(10) << benchContext() << " ns" << std::endl;
+	return 0;
+}
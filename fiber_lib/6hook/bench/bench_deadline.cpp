@@ -0,0 +1,82 @@
+// 后端不响应时请求占用协程的时间：kRequests 个请求各自在不响应的后端连接上依次 recv 三次（例如读头部、读正文、读尾部）
+// 对比只用 SO_RCVTIMEO 50 毫秒（每次 recv 都各等 50 毫秒）和 DeadlineScope(50)（整个请求共用 50 毫秒的预算）
+// 统计每个请求从开始到失败返回的平均耗时，以及全部请求的总耗时
+#include "ioscheduler.h"
+#include "deadline.h"
+#include "fd_manager.h"
+#include "hook.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const int kRequests = 1000;
+static const int kReads = 3;
+static const int kBudgetMs = 50;
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 返回 {平均每个请求的耗时, 总耗时}，单位毫秒
+static std::pair<double, double> run(bool deadline)
+{
+	std::vector<int> fds(kRequests * 2);
+	for(int i = 0; i < kRequests; i++)
+	{
+		socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2]);
+		sylar::FdMgr::GetInstance()->get(fds[i * 2], true);
+	}
+	std::atomic<double> total_ms{0};
+	double start = nowSec();
+	{
+		sylar::IOManager iom(2, true, "bench");
+		for(int i = 0; i < kRequests; i++)
+		{
+			int fd = fds[i * 2];
+			iom.scheduleLock([fd, deadline, &total_ms]()
+			{
+				sylar::set_hook_enable(true);
+				double begin = nowSec();
+				char buf[64];
+				if(deadline)
+				{
+					sylar::DeadlineScope scope(kBudgetMs);
+					for(int r = 0; r < kReads && recv(fd, buf, sizeof(buf), 0) < 0; r++);
+				}
+				else
+				{
+					timeval tv{0, kBudgetMs * 1000};
+					setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+					for(int r = 0; r < kReads && recv(fd, buf, sizeof(buf), 0) < 0; r++);
+				}
+				double ms = (nowSec() - begin) * 1000;
+				double old = total_ms.load();
+				while(!total_ms.compare_exchange_weak(old, old + ms));
+			});
+		}
+	}
+	double elapsed = (nowSec() - start) * 1000;
+	for(int fd : fds)
+	{
+		close(fd);
+	}
+	return {total_ms / kRequests, elapsed};
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	auto per_fd = run(false);
+	auto budget = run(true);
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "SO_RCVTIMEO 50ms x 3 recv    " << per_fd.first << " ms/request, total " << per_fd.second << " ms" << std::endl;
+	std::cout << "DeadlineScope(50)            " << budget.first << " ms/request, total " << budget.second << " ms" << std::endl;
+	return 0;
+}
@@ -0,0 +1,153 @@
+// DnsResolver：本进程内的假名字服务器（独立线程，每个查询延迟 kServerDelayMs 再回复），IOManager 只有 1 个工作线程
+// 1.阻塞查询：协程中关闭 hook 再解析，相当于 getaddrinfo，等待回复时占住工作线程，kLookups 个不同的名字只能一个一个查
+// 2.协程查询：开启 hook，等待回复时挂起协程，kLookups 个查询同时在路上
+// 3.合并：kLookups 个协程同时解析同一个名字，只发出一个查询
+// 4.缓存命中：已经缓存的名字再解析一次的耗时
+#include "ioscheduler.h"
+#include "hook.h"
+#include "dns.h"
+#include "fiber_sync.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+
+static const int kLookups = 32;
+static const int kServerDelayMs = 10;
+static const int kCacheRounds = 200000;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> s_running{true};
+static std::atomic<int> s_queries{0};
+
+// 对任何 A 查询回复 10.0.0.1，TTL 300 秒
+static void fakeServer(int fd)
+{
+	uint8_t buf[1500];
+	while(s_running)
+	{
+		sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		int n = recvfrom_f(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
+		if(n < 12)
+		{
+			continue;
+		}
+		s_queries++;
+		size_t pos = 12;
+		while(pos < (size_t)n && buf[pos])
+		{
+			pos += 1 + buf[pos];
+		}
+		size_t qend = pos + 5;
+		// 延迟在单独的线程里，不影响同时到达的其他查询
+		std::string query((char*)buf, qend);
+		std::thread([fd, from, fromlen, query]()
+		{
+			usleep(kServerDelayMs * 1000);
+			uint8_t out[512];
+			memcpy(out, query.data(), query.size());
+			out[2] = 0x81;
+			out[3] = 0x80;
+			memset(out + 6, 0, 6);
+			out[7] = 1;
+			size_t o = query.size();
+			const uint8_t rr[] = {0xc0, 12, 0, 1, 0, 1, 0, 0, 1, 0x2c, 0, 4, 10, 0, 0, 1};
+			memcpy(out + o, rr, sizeof(rr));
+			o += sizeof(rr);
+			sendto_f(fd, out, o, 0, (const sockaddr*)&from, fromlen);
+		}).detach();
+	}
+}
+
+// 在 kLookups 个协程中解析 name(i)，返回全部完成的时间（毫秒）
+static double run(sylar::IOManager& iom, bool hook, std::function<std::string(int)> name)
+{
+	sylar::WaitGroup wg(kLookups);
+	auto start = Clock::now();
+	for(int i = 0; i < kLookups; i++)
+	{
+		iom.scheduleLock([&, i]()
+		{
+			sylar::set_hook_enable(hook);
+			std::vector<sockaddr_storage> out;
+			sylar::DnsMgr::GetInstance()->resolve(name(i), 80, out);
+			wg.done();
+		});
+	}
+	while(wg.count())
+	{
+		usleep(100);
+	}
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main()
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(fd, (sockaddr*)&addr, sizeof(addr));
+	socklen_t len = sizeof(addr);
+	getsockname(fd, (sockaddr*)&addr, &len);
+	timeval tv = {0, 100000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	std::thread server(fakeServer, fd);
+
+	sylar::DnsResolver* resolver = sylar::DnsMgr::GetInstance();
+	resolver->setNameservers({"127.0.0.1:" + std::to_string(ntohs(addr.sin_port))});
+
+	std::cout.setstate(std::ios::badbit);
+	double blocking_ms, fiber_ms, coalesced_ms, hit_ns;
+	int coalesced_queries;
+	{
+		sylar::IOManager iom(1, false, "dns");
+		blocking_ms = run(iom, false, [](int i) {return "blocking" + std::to_string(i) + ".test";});
+		fiber_ms = run(iom, true, [](int i) {return "fiber" + std::to_string(i) + ".test";});
+		int before = s_queries;
+		coalesced_ms = run(iom, true, [](int) {return std::string("same.test");});
+		coalesced_queries = s_queries - before;
+
+		std::atomic<bool> done{false};
+		iom.scheduleLock([&]()
+		{
+			sylar::set_hook_enable(true);
+			std::vector<sockaddr_storage> out;
+			auto start = Clock::now();
+			for(int i = 0; i < kCacheRounds; i++)
+			{
+				resolver->resolve("same.test", 80, out);
+			}
+			hit_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kCacheRounds;
+			done = true;
+		});
+		while(!done)
+		{
+			usleep(1000);
+		}
+	}
+	s_running = false;
+	server.join();
+	close(fd);
+	std::cout.clear();
+
+	std::cout << kLookups << " lookups, server delay " << kServerDelayMs << " ms, 1 worker thread" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << std::setw(26) << "blocking (hook off)" << std::setw(10) << blocking_ms << " ms" << std::endl;
+	std::cout << std::setw(26) << "fiber (hook on)" << std::setw(10) << fiber_ms << " ms" << std::endl;
+	std::cout << std::setw(26) << "same name, coalesced" << std::setw(10) << coalesced_ms << " ms, " << coalesced_queries << " query" << std::endl;
+	std::cout << std::setw(26) << "cache hit" << std::setw(10) << hit_ns << " ns" << std::endl;
+	return 0;
+}
@@ -0,0 +1,79 @@
+// 弹性线程池：kWorkers 个工作线程，kTasks 个短任务中每 kBlockEvery 个有一个不经过 hook 的阻塞调用（::usleep 20ms，模拟磁盘 IO 或第三方库）
+// 对比固定线程数和 setElastic(kMaxExtra, 5)，统计短任务从提交到开始执行的排队延迟（p50 / p99 / max）和总耗时
+#include "ioscheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+
+static const int kWorkers = 2;
+static const int kTasks = 2000;
+static const int kBlockEvery = 50;
+static const int kBlockUs = 20000;
+static const int kMaxExtra = 8;
+
+static double nowUs()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result
+{
+	double p50, p99, max, totalMs;
+	size_t extras;
+};
+
+static Result run(bool elastic)
+{
+	std::vector<double> latency(kTasks, 0);
+	std::atomic<size_t> peak{0};
+	double start = nowUs();
+	{
+		// 主线程参与调度但要到 stop() 中才开始执行任务，提交期间由 kWorkers 个新线程处理
+		sylar::IOManager iom(kWorkers + 1, true, "bench");
+		if(elastic)
+		{
+			iom.setElastic(kMaxExtra, 5, 100);
+		}
+		// 按固定节奏提交任务，模拟持续到达的请求
+		for(int i = 0; i < kTasks; i++)
+		{
+			double submit = nowUs();
+			iom.scheduleLock([i, submit, &latency, &peak, &iom]()
+			{
+				latency[i] = nowUs() - submit;
+				if(i % kBlockEvery == 0)
+				{
+					::usleep(kBlockUs); // 工作线程没有开启 hook，这里真正阻塞线程
+				}
+				peak = std::max(peak.load(), iom.getExtraThreadCount());
+			});
+			::usleep(100);
+		}
+		iom.stop();
+	}
+	Result r;
+	r.totalMs = (nowUs() - start) / 1000;
+	std::sort(latency.begin(), latency.end());
+	r.p50 = latency[kTasks / 2];
+	r.p99 = latency[kTasks * 99 / 100];
+	r.max = latency.back();
+	r.extras = peak;
+	return r;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	Result fixed = run(false);
+	Result elastic = run(true);
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "fixed workers    p50 " << fixed.p50 << " us  p99 " << fixed.p99 << " us  max " << fixed.max << " us  total " << fixed.totalMs << " ms" << std::endl;
+	std::cout << "elastic workers  p50 " << elastic.p50 << " us  p99 " << elastic.p99 << " us  max " << elastic.max << " us  total " << elastic.totalMs << " ms  peak extra " << elastic.extras << std::endl;
+	return 0;
+}
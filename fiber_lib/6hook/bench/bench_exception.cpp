@@ -0,0 +1,54 @@
+// 协程边界捕获异常的开销：kFibers 个短协程，统计每个协程从调度到结束的平均耗时
+// 对比不抛异常（受 try/catch 保护的正常路径）、每个协程都抛出 std::runtime_error（捕获 + 调用处理函数 + 以 EXCEPT 状态回收）
+// 以及处理函数中只有计数、不打印
+#include "ioscheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+
+static const int kFibers = 200000;
+
+static std::atomic<long> s_handled{0};
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 只用主线程调度：所有协程在析构中的 stop() 里依次执行，不受线程间唤醒的干扰
+template<class F>
+static double perFiberNs(F f)
+{
+	double start = nowSec();
+	{
+		sylar::IOManager iom(1, true, "bench");
+		for(int i = 0; i < kFibers; i++)
+		{
+			iom.scheduleLock(f);
+		}
+	}
+	return (nowSec() - start) * 1e9 / kFibers;
+}
+
+static long s_sink = 0;
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	sylar::Fiber::SetExceptionHandler([](uint64_t, std::exception_ptr) {s_handled++;});
+	double normal = perFiberNs([]() {s_sink++;});
+	double thrown = perFiberNs([]()
+	{
+		s_sink++;
+		throw std::runtime_error("bad request");
+	});
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "no exception                 " << normal << " ns/fiber" << std::endl;
+	std::cout << "throw std::runtime_error     " << thrown << " ns/fiber" << std::endl;
+	std::cout << "handled " << s_handled << " expect " << kFibers << ", EXCEPT fibers " << sylar::Fiber::GetExceptionCount() << std::endl;
+	return 0;
+}
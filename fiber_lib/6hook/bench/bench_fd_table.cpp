@@ -0,0 +1,101 @@
+// fd 上下文查找基准：每次 hook 的 IO 都要按 fd 查找 FdCtx
+// 对比旧的"读写锁 + vector<shared_ptr>"（每次查找加读锁并增加引用计数）和新的无锁分段表 FdManager，1/4/16 线程
+#include "fd_manager.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <shared_mutex>
+#include <iostream>
+#include <iomanip>
+
+static const long kLookups = 4000000; // 所有线程合计的查找次数
+static const int kFds = 64;
+
+// 旧的实现：查找加共享读锁，返回持有所有权的 shared_ptr
+class LegacyFdManager
+{
+public:
+	LegacyFdManager() {m_datas.resize(64);}
+
+	std::shared_ptr<sylar::FdCtx> get(int fd, bool auto_create = false)
+	{
+		std::shared_lock<std::shared_mutex> read_lock(m_mutex);
+		if((int)m_datas.size() > fd && (m_datas[fd] || !auto_create))
+		{
+			return m_datas[fd];
+		}
+		read_lock.unlock();
+		std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+		if((int)m_datas.size() <= fd)
+		{
+			m_datas.resize(fd * 1.5);
+		}
+		m_datas[fd] = std::make_shared<sylar::FdCtx>(fd);
+		return m_datas[fd];
+	}
+
+private:
+	std::shared_mutex m_mutex;
+	std::vector<std::shared_ptr<sylar::FdCtx>> m_datas;
+};
+
+template<class Manager>
+static double bench(Manager& manager, const std::vector<int>& fds, int threads)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	std::atomic<long> sockets{0};
+	for(int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&manager, &fds, &sockets, threads, t]()
+		{
+			long count = 0;
+			for(long i = 0; i < kLookups / threads; i++)
+			{
+				auto ctx = manager.get(fds[(i + t) % fds.size()]);
+				count += ctx && ctx->isSocket();
+			}
+			sockets += count;
+		});
+	}
+	for(auto& w : workers)
+	{
+		w.join();
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return sockets / sec;
+}
+
+int main()
+{
+	std::vector<int> fds;
+	for(int i = 0; i < kFds / 2; i++)
+	{
+		int sv[2];
+		socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+		fds.push_back(sv[0]);
+		fds.push_back(sv[1]);
+	}
+
+	LegacyFdManager legacy;
+	sylar::FdManager table;
+	for(int fd : fds)
+	{
+		legacy.get(fd, true);
+		table.get(fd, true);
+	}
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << std::setw(10) << "threads" << std::setw(22) << "shared_mutex (M/s)" << std::setw(20) << "fd table (M/s)" << std::endl;
+	for(int threads : {1, 4, 16})
+	{
+		double a = bench(legacy, fds, threads);
+		double b = bench(table, fds, threads);
+		std::cout << std::setw(10) << threads << std::setw(22) << a / 1e6 << std::setw(20) << b / 1e6 << std::endl;
+	}
+	return 0;
+}
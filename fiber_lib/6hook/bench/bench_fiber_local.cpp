@@ -0,0 +1,105 @@
+// 请求级上下文的访问开销：在协程里对一个“当前上下文”的计数器反复自增，统计每次访问的耗时
+// 对比 thread_local（不跟随协程，只作为开销的参照）、FiberLocal<long>、以及按 Fiber::GetFiberId() 为键的加锁 unordered_map（现在的替代写法）
+// 另外统计协程结束时销毁局部变量的开销：kFibers 个协程各写一次 FiberLocal 后退出
+#include "ioscheduler.h"
+#include "fiber_local.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+static const int kAccesses = 20000000;
+static const int kFibers = 200000;
+
+static thread_local long t_counter = 0;
+static sylar::FiberLocal<long> s_counter;
+static sylar::FiberLocal<std::string> s_trace_id;
+static std::mutex s_map_mutex;
+static std::unordered_map<uint64_t, long> s_map;
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 阻止编译器把循环里的访问合并掉
+static inline void clobber()
+{
+	asm volatile("" ::: "memory");
+}
+
+template<class F>
+static double inFiberNs(F f, int n)
+{
+	double ns = 0;
+	{
+		sylar::IOManager iom(2, true, "bench");
+		iom.scheduleLock([&f, &ns, n]()
+		{
+			double start = nowSec();
+			for(int i = 0; i < n; i++)
+			{
+				f();
+				clobber();
+			}
+			ns = (nowSec() - start) * 1e9 / n;
+		});
+	}
+	return ns;
+}
+
+// 只用主线程调度：所有协程在析构中的 stop() 里依次执行，不受线程间唤醒的干扰
+static double fiberExitNs()
+{
+	double start = nowSec();
+	{
+		sylar::IOManager iom(1, true, "bench");
+		for(int i = 0; i < kFibers; i++)
+		{
+			iom.scheduleLock([]()
+			{
+				*s_trace_id = "trace-0123456789abcdef"; // 超过短字符串优化的长度，析构时要释放内存
+				(*s_counter)++;
+			});
+		}
+	}
+	return (nowSec() - start) * 1e9 / kFibers;
+}
+
+static double fiberExitBaselineNs()
+{
+	double start = nowSec();
+	{
+		sylar::IOManager iom(1, true, "bench");
+		for(int i = 0; i < kFibers; i++)
+		{
+			iom.scheduleLock([]() {t_counter++;});
+		}
+	}
+	return (nowSec() - start) * 1e9 / kFibers;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	double tls = inFiberNs([]() {t_counter++;}, kAccesses);
+	double local = inFiberNs([]() {(*s_counter)++;}, kAccesses);
+	double map = inFiberNs([]()
+	{
+		std::lock_guard<std::mutex> lock(s_map_mutex);
+		s_map[sylar::Fiber::GetFiberId()]++;
+	}, kAccesses / 10);
+	double exit_base = fiberExitBaselineNs();
+	double exit_local = fiberExitNs();
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "thread_local                 " << tls << " ns/access" << std::endl;
+	std::cout << "FiberLocal                   " << local << " ns/access" << std::endl;
+	std::cout << "mutex + unordered_map[id]    " << map << " ns/access" << std::endl;
+	std::cout << std::setprecision(0);
+	std::cout << "short fiber, no locals       " << exit_base << " ns/fiber" << std::endl;
+	std::cout << "short fiber, 2 FiberLocals   " << exit_local << " ns/fiber" << std::endl;
+	return 0;
+}
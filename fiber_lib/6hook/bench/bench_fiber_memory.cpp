@@ -0,0 +1,94 @@
+// 协程内存占用基准：创建大量协程，每个运行到第一次 yield 后挂起，报告每个挂起协程增加的常驻内存（RSS）
+// 1.malloc 私有栈（默认分配器）
+// 2.mmap 私有栈（带保护页，按需提交物理页），每个栈占两个 VMA，数量受 vm.max_map_count 限制
+// 3.共享栈，挂起时只保存实际用到的那部分栈
+// 每种模式在单独的子进程中运行，互不影响 RSS
+#include "fiber.h"
+#include "stack_allocator.h"
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+static const size_t kDefaultFibers = 100000;
+static const size_t kMmapFibers = 30000;
+
+static size_t rssBytes()
+{
+	std::ifstream in("/proc/self/statm");
+	size_t pages = 0, resident = 0;
+	in >> pages >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 挂起前在栈上用掉一些空间，模拟真实协程在 IO 等待点的栈深度
+static void parkedBody()
+{
+	volatile char buf[512];
+	memset((char*)buf, 1, sizeof(buf));
+	sylar::Fiber::GetThis()->yield();
+	buf[0] = 0;
+}
+
+static void runMode(const char* name, size_t n, sylar::StackAllocator* allocator, bool shared)
+{
+	sylar::Fiber::GetThis(); // 初始化主协程
+	std::vector<std::shared_ptr<sylar::Fiber>> fibers;
+	fibers.reserve(n);
+
+	size_t before = rssBytes();
+	for(size_t i = 0; i < n; i++)
+	{
+		fibers.push_back(std::make_shared<sylar::Fiber>(&parkedBody, 0, false, allocator, shared));
+		fibers.back()->resume();
+	}
+	size_t after = rssBytes();
+
+	std::cout << std::setw(16) << name << std::setw(10) << n
+		<< std::setw(12) << (after - before) / n << " B/fiber"
+		<< std::setw(10) << (after - before) / (1024 * 1024) << " MB total";
+	if(shared)
+	{
+		std::cout << "  (saved " << fibers[0]->getSavedStackSize() << " B)";
+	}
+	std::cout << std::endl;
+
+	for(auto& f : fibers)
+	{
+		f->resume();
+	}
+}
+
+static void forkMode(const char* name, size_t n, sylar::StackAllocator* allocator, bool shared)
+{
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		runMode(name, n, allocator, shared);
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		std::cout << std::setw(16) << name << "  failed" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t n = argc > 1 ? atol(argv[1]) : kDefaultFibers;
+	static sylar::MallocStackAllocator malloc_allocator;
+	static sylar::MmapStackAllocator mmap_allocator;
+
+	std::cout << std::setw(16) << "mode" << std::setw(10) << "fibers" << std::setw(12) << "rss" << std::endl;
+	forkMode("malloc-private", n, &malloc_allocator, false);
+	forkMode("mmap-private", std::min(n, kMmapFibers), &mmap_allocator, false);
+	forkMode("shared", n, nullptr, true);
+	return 0;
+}
@@ -0,0 +1,153 @@
+// 协程同步原语的开销：
+// 1.没有竞争时一次 lock / unlock 的耗时，std::mutex vs FiberMutex
+// 2.kThreads 个工作线程上的 kFibers 个协程争抢同一把锁做计数，std::mutex vs FiberMutex
+// 3.两个协程用一对 FiberSemaphore 来回交接（ping-pong）的每次交接耗时
+// 4.持锁期间 hook 的 usleep 挂起协程：单工作线程上 kFibers 个协程轮流持锁睡眠，std::mutex 在这种写法下会死锁，只测 FiberMutex
+#include "ioscheduler.h"
+#include "hook.h"
+#include "fiber_sync.h"
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+static const int kThreads = 4;
+static const int kFibers = 256;
+static const int kIters = 20000; // 每个协程加锁的次数
+static const int kUncontended = 5000000;
+static const int kPingPong = 200000;
+static const int kSleepers = 64;
+
+#define HOOKED(call) (sylar::set_hook_enable(true), call)
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class Mutex>
+static double uncontendedNs()
+{
+	Mutex mutex;
+	long counter = 0;
+	double ns = 0;
+	{
+		sylar::IOManager iom(2, true, "bench");
+		iom.scheduleLock([&mutex, &counter, &ns]()
+		{
+			double start = nowSec();
+			for(int i = 0; i < kUncontended; i++)
+			{
+				mutex.lock();
+				counter++;
+				mutex.unlock();
+			}
+			ns = (nowSec() - start) * 1e9 / kUncontended;
+		});
+	}
+	return counter == kUncontended ? ns : -1;
+}
+
+// 返回每秒加锁次数，计数不对时返回 -1
+template<class Mutex>
+static double contended()
+{
+	Mutex mutex;
+	long counter = 0;
+	double start = nowSec();
+	{
+		// 主线程在析构中的 stop() 才开始调度，多建一个线程保证测量期间有 kThreads 个工作线程
+		sylar::IOManager iom(kThreads + 1, true, "bench");
+		for(int f = 0; f < kFibers; f++)
+		{
+			iom.scheduleLock([&mutex, &counter]()
+			{
+				for(int i = 0; i < kIters; i++)
+				{
+					mutex.lock();
+					counter++;
+					mutex.unlock();
+				}
+			});
+		}
+	}
+	double sec = nowSec() - start;
+	return counter == (long)kFibers * kIters ? (double)kFibers * kIters / sec : -1;
+}
+
+static double pingPongNs()
+{
+	sylar::FiberSemaphore ping, pong;
+	double ns = 0;
+	{
+		sylar::IOManager iom(kThreads + 1, true, "bench");
+		iom.scheduleLock([&ping, &pong]()
+		{
+			for(int i = 0; i < kPingPong; i++)
+			{
+				ping.wait();
+				pong.post();
+			}
+		});
+		iom.scheduleLock([&ping, &pong, &ns]()
+		{
+			double start = nowSec();
+			for(int i = 0; i < kPingPong; i++)
+			{
+				ping.post();
+				pong.wait();
+			}
+			ns = (nowSec() - start) * 1e9 / kPingPong;
+		});
+	}
+	return ns;
+}
+
+// 返回总耗时（毫秒），kSleepers 个协程各持锁睡 1 毫秒，理想值约为 kSleepers 毫秒
+static double sleepInsideLockMs()
+{
+	sylar::FiberMutex mutex;
+	sylar::WaitGroup wg(kSleepers);
+	double ms = 0;
+	{
+		sylar::IOManager iom(2, true, "bench");
+		for(int f = 0; f < kSleepers; f++)
+		{
+			iom.scheduleLock([&mutex, &wg]()
+			{
+				std::lock_guard<sylar::FiberMutex> lock(mutex);
+				HOOKED(usleep(1000));
+				wg.done();
+			});
+		}
+		iom.scheduleLock([&wg, &ms]()
+		{
+			double start = nowSec();
+			wg.wait();
+			ms = (nowSec() - start) * 1e3;
+		});
+	}
+	return ms;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	double std_ns = uncontendedNs<std::mutex>();
+	double fiber_ns = uncontendedNs<sylar::FiberMutex>();
+	double std_ops = contended<std::mutex>();
+	double fiber_ops = contended<sylar::FiberMutex>();
+	double ping_ns = pingPongNs();
+	double sleep_ms = sleepInsideLockMs();
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "uncontended lock/unlock      std::mutex " << std_ns << " ns    FiberMutex " << fiber_ns << " ns" << std::endl;
+	std::cout << std::setprecision(0);
+	std::cout << "contended (" << kThreads << " threads, " << kFibers << " fibers)   std::mutex " << std_ops << " ops/s    FiberMutex " << fiber_ops << " ops/s" << std::endl;
+	std::cout << "FiberSemaphore ping-pong     " << ping_ns << " ns per handoff" << std::endl;
+	std::cout << std::setprecision(1);
+	std::cout << "sleep 1 ms inside FiberMutex " << kSleepers << " fibers on 1 thread   " << sleep_ms << " ms (std::mutex deadlocks)" << std::endl;
+	return 0;
+}
@@ -0,0 +1,57 @@
+// hook 的 recv 在数据已经就绪（不需要挂起协程）时的固定开销
+// 每轮先用原始 send 写入 1 字节，再分别计时原始 recv 和 hook 的 recv，两者之差就是 hook 层查找 fd 记录、检查标志的开销
+// x86 上用 rdtsc 计数周期，其他平台退回 steady_clock 的纳秒
+#include "fd_manager.h"
+#include "hook.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t ticks() {return __rdtsc();}
+static const char* kUnit = "cycles";
+#else
+static inline uint64_t ticks() {return std::chrono::steady_clock::now().time_since_epoch().count();}
+static const char* kUnit = "ns";
+#endif
+
+static const int kRounds = 1000000;
+
+int main()
+{
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	// socketpair 没有被 hook，手动登记，和 hook 的 socket() 一样会把 fd 设为系统非阻塞
+	sylar::FdMgr::GetInstance()->get(sv[0], true);
+	sylar::FdMgr::GetInstance()->get(sv[1], true);
+
+	char c = 'x';
+	uint64_t raw = 0, hooked = 0;
+	for(int i = 0; i < kRounds; i++)
+	{
+		send_f(sv[0], &c, 1, 0);
+		uint64_t t0 = ticks();
+		recv_f(sv[1], &c, 1, 0);
+		uint64_t t1 = ticks();
+		raw += t1 - t0;
+
+		send_f(sv[0], &c, 1, 0);
+		sylar::set_hook_enable(true);
+		t0 = ticks();
+		recv(sv[1], &c, 1, 0);
+		t1 = ticks();
+		sylar::set_hook_enable(false);
+		hooked += t1 - t0;
+	}
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "raw recv     " << (double)raw / kRounds << " " << kUnit << std::endl;
+	std::cout << "hooked recv  " << (double)hooked / kRounds << " " << kUnit << std::endl;
+	std::cout << "hook overhead " << (double)(hooked - raw) / kRounds << " " << kUnit << std::endl;
+	close(sv[0]);
+	close(sv[1]);
+	return 0;
+}
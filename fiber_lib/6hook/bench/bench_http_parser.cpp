@@ -0,0 +1,226 @@
+// HTTP/1.1 请求解析和 HttpServer 流水线吞吐
+// 1.解析：逐字节找 "\r\n"、每行 substr 成 std::string、头部放进 std::map 的常见写法 vs HttpRequestParser（SIMD 扫描控制字符，字段是 string_view），
+//   分别解析一个 40 字节左右的小请求和一个带长 Cookie 的 600 字节左右的浏览器请求，报告每个请求的耗时和 operator new 次数
+// 2.服务端：一个客户端线程通过回环连接每次写出 kDepth 个流水线请求，再读完 kDepth 个响应，报告 HttpServer 的请求数 / 秒和稳态下每个请求的 operator new 次数
+#include "ioscheduler.h"
+#include "http_server.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <map>
+#include <new>
+#include <iostream>
+#include <iomanip>
+
+static std::atomic<long> s_allocs{0};
+
+void* operator new(size_t n)
+{
+	s_allocs.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(n ? n : 1);
+	if(!p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+static const int kParseRounds = 200000;
+static const int kBatches = 3000;
+static const int kDepth = 16;
+
+static const std::string kSmall = "GET / HTTP/1.1\r\n"
+                                  "Host: 127.0.0.1\r\n"
+                                  "\r\n";
+static const std::string kBrowser = "GET /static/js/app.min.js?v=20261014 HTTP/1.1\r\n"
+                                    "Host: www.example.com\r\n"
+                                    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+                                    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+                                    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                                    "Accept-Encoding: gzip, deflate, br\r\n"
+                                    "Referer: https://www.example.com/index.html\r\n"
+                                    "Cookie: session=4f2d8a9c1e7b3d5f6a0c2e4b8d1f3a5c; theme=dark; lang=zh-CN; _ga=GA1.2.1234567890.1700000000; _gid=GA1.2.987654321.1700000000\r\n"
+                                    "Connection: keep-alive\r\n"
+                                    "\r\n";
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// 常见写法：逐字节找行尾，请求行和每个头部都拷贝成 std::string
+struct NaiveRequest
+{
+	std::string method;
+	std::string target;
+	std::string version;
+	std::map<std::string, std::string> headers;
+};
+
+static bool naiveParse(const std::string& data, NaiveRequest& req)
+{
+	size_t pos = 0;
+	bool first = true;
+	while(true)
+	{
+		size_t eol = pos;
+		while(eol + 1 < data.size() && !(data[eol] == '\r' && data[eol + 1] == '\n'))
+		{
+			eol++;
+		}
+		if(eol + 1 >= data.size())
+		{
+			return false;
+		}
+		std::string line = data.substr(pos, eol - pos);
+		pos = eol + 2;
+		if(line.empty())
+		{
+			return true;
+		}
+		if(first)
+		{
+			size_t a = line.find(' ');
+			size_t b = line.rfind(' ');
+			req.method = line.substr(0, a);
+			req.target = line.substr(a + 1, b - a - 1);
+			req.version = line.substr(b + 1);
+			first = false;
+			continue;
+		}
+		size_t colon = line.find(':');
+		size_t v = colon + 1;
+		while(v < line.size() && line[v] == ' ')
+		{
+			v++;
+		}
+		req.headers[line.substr(0, colon)] = line.substr(v);
+	}
+}
+
+static void benchParse(const char* name, const std::string& data)
+{
+	size_t sink = 0;
+	long allocs = s_allocs.load();
+	auto start = Clock::now();
+	for(int i = 0; i < kParseRounds; i++)
+	{
+		NaiveRequest req;
+		naiveParse(data, req);
+		sink += req.headers.size();
+	}
+	double naive_ns = seconds(start, Clock::now()) * 1e9 / kParseRounds;
+	double naive_allocs = (double)(s_allocs.load() - allocs) / kParseRounds;
+
+	sylar::HttpRequestParser parser;
+	sylar::HttpRequest req;
+	allocs = s_allocs.load();
+	start = Clock::now();
+	for(int i = 0; i < kParseRounds; i++)
+	{
+		parser.reset();
+		sink += parser.parse(data.data(), data.size(), req);
+	}
+	double fast_ns = seconds(start, Clock::now()) * 1e9 / kParseRounds;
+	double fast_allocs = (double)(s_allocs.load() - allocs) / kParseRounds;
+
+	std::cout << name << " (" << data.size() << " bytes, sink " << sink % 10 << ")" << std::endl;
+	std::cout << std::setw(20) << "naive" << std::setw(10) << naive_ns << " ns/req" << std::setw(8) << naive_allocs << " allocs/req" << std::endl;
+	std::cout << std::setw(20) << "HttpRequestParser" << std::setw(10) << fast_ns << " ns/req" << std::setw(8) << fast_allocs << " allocs/req" << std::endl;
+}
+
+static void benchServer()
+{
+	std::cout.setstate(std::ios::badbit);
+	double secs = 0;
+	double allocs_per_req = 0;
+	long requests = 0;
+	{
+		sylar::IOManager iom(1, false, "http");
+		auto server = std::make_shared<sylar::HttpServer>(&iom);
+		server->router().add("GET", "/", [](const sylar::HttpRequest&, sylar::HttpResponse& resp)
+		{
+			resp.append("Hello, World!");
+		});
+		server->start(0);
+
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(server->getPort());
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		connect(fd, (sockaddr*)&addr, sizeof(addr));
+
+		std::string batch;
+		for(int i = 0; i < kDepth; i++)
+		{
+			batch += kSmall;
+		}
+		// 每个响应的长度固定，读够 kDepth 个响应的字节数
+		const size_t kResponseSize = strlen("HTTP/1.1 200 OK\r\nContent-Length: 13\r\nConnection: keep-alive\r\n\r\nHello, World!");
+		char buf[64 * 1024];
+		auto roundTrip = [&]()
+		{
+			send(fd, batch.data(), batch.size(), MSG_NOSIGNAL);
+			size_t got = 0;
+			while(got < kResponseSize * kDepth)
+			{
+				ssize_t n = recv(fd, buf, sizeof(buf), 0);
+				if(n <= 0)
+				{
+					return;
+				}
+				got += n;
+			}
+		};
+		// 预热：连接的缓冲区和内存块缓存都建好之后再统计
+		for(int i = 0; i < 100; i++)
+		{
+			roundTrip();
+		}
+		long before = server->getRequestCount();
+		long allocs = s_allocs.load();
+		auto start = Clock::now();
+		for(int i = 0; i < kBatches; i++)
+		{
+			roundTrip();
+		}
+		secs = seconds(start, Clock::now());
+		requests = server->getRequestCount() - before;
+		allocs_per_req = (double)(s_allocs.load() - allocs) / (requests ? requests : 1);
+		close(fd);
+		server->stop(1000);
+	}
+	std::cout.clear();
+	std::cout << "HttpServer, 1 worker thread, pipeline depth " << kDepth << std::endl;
+	std::cout << std::setw(20) << requests / secs << " req/s" << std::setw(8) << allocs_per_req << " allocs/req (whole process)" << std::endl;
+}
+
+int main()
+{
+	std::cout << std::fixed << std::setprecision(1);
+	benchParse("small request", kSmall);
+	benchParse("browser request", kBrowser);
+	benchServer();
+	return 0;
+}
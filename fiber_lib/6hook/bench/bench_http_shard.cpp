@@ -0,0 +1,164 @@
+// HTTP keep-alive 吞吐基准：服务端沿用 main.cpp 的回调写法，但回复后不关闭连接，重新注册 READ 等待下一个请求
+// 客户端是进程内的普通线程，每个线程一条连接，阻塞地发请求、收响应
+// 对比所有线程共用一个 epoll 实例和每个工作线程一个 epoll 实例（shard_epoll）两种模式，服务端 1/4/8 个线程
+#include "ioscheduler.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const int kClients = 16;
+static const int kSeconds = 2;
+
+static const char* kRequest = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+static const char* kResponse = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain\r\n"
+                               "Content-Length: 13\r\n"
+                               "Connection: keep-alive\r\n"
+                               "\r\n"
+                               "Hello, World!";
+
+static int s_listen_fd = -1;
+static std::atomic<bool> s_accepting{false};
+
+static void onReadable(int fd)
+{
+	char buffer[1024];
+	while(true)
+	{
+		int ret = recv(fd, buffer, sizeof(buffer), 0);
+		if(ret > 0)
+		{
+			send(fd, kResponse, strlen(kResponse), 0);
+			continue;
+		}
+		if(ret < 0 && errno == EAGAIN)
+		{
+			// 读完了当前的请求，等待同一条连接上的下一个请求
+			sylar::IOManager::GetThis()->addEvent(fd, sylar::IOManager::READ, [fd](){ onReadable(fd); });
+			return;
+		}
+		close(fd);
+		return;
+	}
+}
+
+static void onAccept()
+{
+	while(true)
+	{
+		int fd = accept(s_listen_fd, nullptr, nullptr);
+		if(fd < 0)
+		{
+			break;
+		}
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		sylar::IOManager::GetThis()->addEvent(fd, sylar::IOManager::READ, [fd](){ onReadable(fd); });
+	}
+	if(s_accepting)
+	{
+		sylar::IOManager::GetThis()->addEvent(s_listen_fd, sylar::IOManager::READ, onAccept);
+	}
+}
+
+static double run(int threads, bool shard)
+{
+	s_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	bind(s_listen_fd, (sockaddr*)&addr, sizeof(addr));
+	listen(s_listen_fd, 1024);
+	socklen_t len = sizeof(addr);
+	getsockname(s_listen_fd, (sockaddr*)&addr, &len);
+	fcntl(s_listen_fd, F_SETFL, O_NONBLOCK);
+
+	std::atomic<long> requests{0};
+	{
+		// 主线程参与调度时要到析构（stop）才进入调度，所以额外多要一个线程，真正处理连接的是 threads 个新建线程
+		sylar::IOManager iom(threads + 1, true, "http", sylar::TimerManager::HEAP, shard);
+		s_accepting = true;
+		iom.addEvent(s_listen_fd, sylar::IOManager::READ, onAccept);
+
+		std::atomic<bool> running{true};
+		std::vector<std::thread> clients;
+		auto start = std::chrono::steady_clock::now();
+		for(int c = 0; c < kClients; c++)
+		{
+			clients.emplace_back([&addr, &running, &requests]()
+			{
+				int fd = socket(AF_INET, SOCK_STREAM, 0);
+				int yes = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+				if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+				{
+					close(fd);
+					return;
+				}
+				char buffer[1024];
+				size_t want = strlen(kResponse);
+				while(running)
+				{
+					send(fd, kRequest, strlen(kRequest), 0);
+					size_t got = 0;
+					while(got < want)
+					{
+						int n = recv(fd, buffer, sizeof(buffer), 0);
+						if(n <= 0)
+						{
+							close(fd);
+							return;
+						}
+						got += n;
+					}
+					requests++;
+				}
+				close(fd); // 服务端读到 0 后关闭连接，不再注册事件
+			});
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(kSeconds));
+		running = false;
+		for(auto& t : clients)
+		{
+			t.join();
+		}
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		s_accepting = false;
+		iom.cancelAll(s_listen_fd);
+		iom.stop(); // 等监听 fd 上被取消的回调执行完再关闭它
+		close(s_listen_fd);
+		return requests / sec;
+	}
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit); // 屏蔽调度器的调试输出
+	std::vector<std::pair<int, std::pair<double, double>>> results;
+	for(int threads : {1, 4, 8})
+	{
+		double shared = run(threads, false);
+		double sharded = run(threads, true);
+		results.push_back({threads, {shared, sharded}});
+	}
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << std::setw(10) << "threads" << std::setw(18) << "shared (req/s)" << std::setw(18) << "sharded (req/s)" << std::endl;
+	for(auto& r : results)
+	{
+		std::cout << std::setw(10) << r.first << std::setw(18) << r.second.first << std::setw(18) << r.second.second << std::endl;
+	}
+	return 0;
+}
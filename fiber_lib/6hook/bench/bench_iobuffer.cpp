@@ -0,0 +1,207 @@
+// 扁平缓冲区 vs IOBuffer，两端都是 IOManager 中使用 hook 的协程，走 socketpair
+// 1.大响应：每个响应为 100 字节左右的头部 + 64KB 的响应体。扁平写法把头部和响应体拼成一个 std::string 再 send，
+//   IOBuffer 写法追加头部后共享同一份响应体的内存块，用 writev 一次写出多个块
+// 2.流水线请求：客户端一次写出 16 个请求，服务端按 "\r\n\r\n" 切分。扁平写法 recv 到 char buffer[1024] 后追加到 std::string，
+//   切出一个请求后 erase 开头；IOBuffer 写法 readFrom 后 find + cut，不拷贝数据
+// 报告吞吐和每个响应 / 请求拷贝的字节数（只统计缓冲区自身的拷贝）
+#include "ioscheduler.h"
+#include "hook.h"
+#include "iobuffer.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+
+static const int kResponses = 5000;
+static const size_t kBodySize = 64 * 1024;
+static const int kPipelineBatches = 5000;
+static const int kPipelineDepth = 16;
+
+static const std::string kHeader = "HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: application/octet-stream\r\n"
+                                   "Content-Length: 65536\r\n"
+                                   "\r\n";
+static const std::string kRequest = "GET /index.html HTTP/1.1\r\n"
+                                    "Host: 127.0.0.1:8080\r\n"
+                                    "User-Agent: bench_iobuffer\r\n"
+                                    "Accept: */*\r\n"
+                                    "\r\n";
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// 在一个 IOManager 中同时运行写端和读端协程，返回读端读完的时间
+static double runPair(std::function<void(int)> writer, std::function<void(int)> reader)
+{
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	Clock::time_point start, end;
+	std::cout.setstate(std::ios::badbit); // 屏蔽运行期间 hook 的错误输出，结果在外面打印
+	{
+		sylar::IOManager iom(2, false, "bench");
+		start = Clock::now();
+		iom.scheduleLock([&]()
+		{
+			sylar::set_hook_enable(true);
+			writer(sv[0]);
+			shutdown(sv[0], SHUT_WR);
+		});
+		iom.scheduleLock([&]()
+		{
+			sylar::set_hook_enable(true);
+			reader(sv[1]);
+			end = Clock::now();
+		});
+	}
+	std::cout.clear();
+	close(sv[0]);
+	close(sv[1]);
+	return seconds(start, end);
+}
+
+static void drain(int fd)
+{
+	char buf[64 * 1024];
+	while(recv(fd, buf, sizeof(buf), 0) > 0)
+	{
+	}
+}
+
+static void sendAll(int fd, const char* data, size_t len)
+{
+	while(len)
+	{
+		ssize_t rt = send(fd, data, len, 0);
+		if(rt <= 0)
+		{
+			return;
+		}
+		data += rt;
+		len -= rt;
+	}
+}
+
+static void benchResponse()
+{
+	std::string body(kBodySize, 'x');
+	size_t flat_copied = 0;
+	double flat = runPair([&](int fd)
+	{
+		for(int i = 0; i < kResponses; i++)
+		{
+			std::string resp;
+			resp.reserve(kHeader.size() + body.size());
+			resp += kHeader;
+			resp += body;
+			flat_copied += resp.size();
+			sendAll(fd, resp.data(), resp.size());
+		}
+	}, drain);
+
+	sylar::IOBuffer shared_body;
+	shared_body.append(body);
+	size_t iobuf_copied = 0;
+	double iobuf = runPair([&](int fd)
+	{
+		for(int i = 0; i < kResponses; i++)
+		{
+			sylar::IOBuffer resp;
+			resp.append(kHeader);
+			resp.append(shared_body);
+			iobuf_copied += kHeader.size();
+			resp.writeTo(fd);
+		}
+	}, drain);
+
+	double mb = (double)kResponses * (kHeader.size() + kBodySize) / (1024 * 1024);
+	std::cout << "large responses (" << kResponses << " x 64KB)" << std::endl;
+	std::cout << std::setw(24) << "flat std::string" << std::setw(10) << std::fixed << std::setprecision(1) << mb / flat << " MB/s"
+	          << std::setw(10) << flat_copied / kResponses << " bytes copied per response" << std::endl;
+	std::cout << std::setw(24) << "IOBuffer + writev" << std::setw(10) << mb / iobuf << " MB/s"
+	          << std::setw(10) << iobuf_copied / kResponses << " bytes copied per response" << std::endl;
+}
+
+static void writePipelined(int fd)
+{
+	std::string batch;
+	for(int i = 0; i < kPipelineDepth; i++)
+	{
+		batch += kRequest;
+	}
+	for(int i = 0; i < kPipelineBatches; i++)
+	{
+		sendAll(fd, batch.data(), batch.size());
+	}
+}
+
+static void benchPipeline()
+{
+	const long total = (long)kPipelineBatches * kPipelineDepth;
+	long flat_count = 0;
+	size_t flat_copied = 0;
+	double flat = runPair(writePipelined, [&](int fd)
+	{
+		char buffer[1024];
+		std::string pending;
+		while(true)
+		{
+			int ret = recv(fd, buffer, sizeof(buffer), 0);
+			if(ret <= 0)
+			{
+				break;
+			}
+			pending.append(buffer, ret);
+			flat_copied += ret;
+			size_t pos;
+			while((pos = pending.find("\r\n\r\n")) != std::string::npos)
+			{
+				std::string req = pending.substr(0, pos + 4);
+				flat_copied += req.size() + pending.size() - pos - 4; // 取出一个请求，再把剩下的数据移到开头
+				pending.erase(0, pos + 4);
+				flat_count++;
+			}
+		}
+	});
+
+	long iobuf_count = 0;
+	double iobuf = runPair(writePipelined, [&](int fd)
+	{
+		sylar::IOBuffer in;
+		while(in.readFrom(fd) > 0)
+		{
+			size_t pos;
+			while((pos = in.find("\r\n\r\n")) != sylar::IOBuffer::npos)
+			{
+				sylar::IOBuffer req = in.cut(pos + 4);
+				iobuf_count++;
+			}
+		}
+	});
+
+	std::cout << "pipelined requests (" << total << " in batches of " << kPipelineDepth << ")" << std::endl;
+	std::cout << std::setw(24) << "recv 1024 + std::string" << std::setw(10) << std::fixed << std::setprecision(0) << flat_count / flat << " req/s"
+	          << std::setw(10) << flat_copied / (flat_count ? flat_count : 1) << " bytes copied per request" << std::endl;
+	std::cout << std::setw(24) << "IOBuffer find + cut" << std::setw(10) << iobuf_count / iobuf << " req/s"
+	          << std::setw(10) << 0 << " bytes copied per request" << std::endl;
+	if(flat_count != total || iobuf_count != total)
+	{
+		std::cout << "request count mismatch: " << flat_count << " / " << iobuf_count << " expect " << total << std::endl;
+	}
+}
+
+int main()
+{
+	benchResponse();
+	benchPipeline();
+	return 0;
+}
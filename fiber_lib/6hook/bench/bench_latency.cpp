@@ -0,0 +1,110 @@
+// 调度延迟直方图和看门狗：
+// 1.延迟统计的开销：两个工作线程上 kTasks 个空回调任务，关闭 / 开启 Metrics::SetLatencyTracking 时每个任务的平均耗时
+// 2.开启延迟统计跑一段 socketpair 上的 ping-pong，其中夹一个不让出、阻塞 30ms 的任务，打印三个直方图的分位数，
+//   看门狗（阈值 10ms，带调用栈）在 std::cerr 上报告这个任务
+#include "ioscheduler.h"
+#include "hook.h"
+#include "metrics.h"
+#include "fd_manager.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+static const int kTasks = 1000000;
+static const int kPairs = 64;
+static const int kRounds = 500;
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double perTaskNs(bool tracking)
+{
+	sylar::Metrics::SetLatencyTracking(tracking);
+	std::atomic<int> done{0};
+	double start = 0, end = 0;
+	{
+		sylar::IOManager iom(2, true, "bench");
+		std::vector<std::function<void()>> cbs;
+		for(int i = 0; i < kTasks; i++)
+		{
+			// 最后一个任务记下结束时间，不计入 stop() 的收尾
+			cbs.push_back([&done, &end]() {if(++done == kTasks) end = nowSec();});
+		}
+		start = nowSec();
+		iom.scheduleBatch(cbs.data(), cbs.size());
+	}
+	sylar::Metrics::SetLatencyTracking(false);
+	return (end - start) * 1e9 / kTasks;
+}
+
+// 模拟不经过 hook、也不让出的阻塞调用
+static void blockingCall()
+{
+	struct timespec ts = {0, 30000000};
+	syscall(SYS_nanosleep, &ts, nullptr);
+}
+
+static void printLatency(const char* name, const sylar::LatencySnapshot& l)
+{
+	std::cout << std::left << std::setw(14) << name << std::right
+		<< " count " << std::setw(8) << l.count
+		<< "  p50 " << std::setw(8) << l.percentile(0.5) / 1000.0
+		<< "  p99 " << std::setw(8) << l.percentile(0.99) / 1000.0
+		<< "  p99.9 " << std::setw(8) << l.percentile(0.999) / 1000.0
+		<< "  max " << std::setw(8) << l.maxNs / 1000.0 << " us" << std::endl;
+}
+
+int main()
+{
+	// 先跑 ping-pong，直方图中只有它的样本
+	std::cout.setstate(std::ios::badbit);
+	sylar::Metrics::SetLatencyTracking(true);
+	{
+		sylar::IOManager iom(2, true, "bench");
+		iom.setWatchdog(10, true);
+		for(int i = 0; i < kPairs; i++)
+		{
+			iom.scheduleLock([]()
+			{
+				sylar::set_hook_enable(true);
+				int sv[2];
+				socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+				sylar::FdMgr::GetInstance()->get(sv[0], true);
+				sylar::FdMgr::GetInstance()->get(sv[1], true);
+				char c = 0;
+				for(int r = 0; r < kRounds; r++)
+				{
+					sylar::IOManager::GetThis()->scheduleLock([fd = sv[1]]() {char x = 1; send(fd, &x, 1, 0);});
+					recv(sv[0], &c, 1, 0);
+				}
+				close(sv[0]);
+				close(sv[1]);
+			});
+		}
+		iom.scheduleLock(blockingCall);
+	}
+	sylar::MetricsSnapshot s = sylar::Metrics::Snapshot();
+	sylar::Metrics::SetLatencyTracking(false);
+
+	double off = perTaskNs(false);
+	double on = perTaskNs(true);
+	std::cout.clear();
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "empty task, latency tracking off  " << off << " ns/task" << std::endl;
+	std::cout << "empty task, latency tracking on   " << on << " ns/task" << std::endl;
+
+	static const char* const kNames[sylar::METRIC_LATENCY_NUM] = {"queue wait", "event resume", "task run"};
+	for(int h = 0; h < sylar::METRIC_LATENCY_NUM; h++)
+	{
+		printLatency(kNames[h], s.latency[h]);
+	}
+	return 0;
+}
@@ -0,0 +1,90 @@
+// 运行时指标的开销：kThreads 个线程各计数 kIncrements 次，所有线程共用一个 std::atomic 的 fetch_add vs Metrics::Add（每个线程一份计数器）
+// 先跑一段 echo 负载，打印 Prometheus 格式的快照
+#include "ioscheduler.h"
+#include "hook.h"
+#include "metrics.h"
+#include "fd_manager.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <sys/socket.h>
+
+static const int kThreads = 4;
+static const long kIncrements = 10000000;
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::atomic<uint64_t> s_shared{0};
+
+template<class F>
+static double perIncrementNs(F f)
+{
+	double start = nowSec();
+	std::vector<std::thread> threads;
+	for(int t = 0; t < kThreads; t++)
+	{
+		threads.emplace_back([&f]()
+		{
+			for(long i = 0; i < kIncrements; i++)
+			{
+				f();
+			}
+		});
+	}
+	for(auto& t : threads)
+	{
+		t.join();
+	}
+	return (nowSec() - start) * 1e9 / kIncrements;
+}
+
+int main()
+{
+	std::string text;
+	std::cout.setstate(std::ios::badbit);
+	{
+		sylar::IOManager iom(2, true, "bench");
+		for(int i = 0; i < 64; i++)
+		{
+			iom.scheduleLock([]()
+			{
+				sylar::set_hook_enable(true);
+				int sv[2];
+				socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+				sylar::FdMgr::GetInstance()->get(sv[0], true);
+				sylar::FdMgr::GetInstance()->get(sv[1], true);
+				char c = 0;
+				for(int r = 0; r < 200; r++)
+				{
+					sylar::IOManager::GetThis()->scheduleLock([fd = sv[1]]() {char x = 1; send(fd, &x, 1, 0);});
+					recv(sv[0], &c, 1, 0);
+				}
+				close(sv[0]);
+				close(sv[1]);
+			});
+		}
+		iom.scheduleLock([&text, &iom]()
+		{
+			sylar::set_hook_enable(true);
+			usleep(20000);
+			text = sylar::Metrics::ToPrometheus(sylar::Metrics::Snapshot(&iom));
+		});
+	}
+	std::cout.clear();
+
+	// 快照之后再测计数的开销，不影响上面输出的 tasks_run_total
+	double shared = perIncrementNs([]() {s_shared.fetch_add(1, std::memory_order_relaxed);});
+	double local = perIncrementNs([]() {sylar::Metrics::Add(sylar::METRIC_TASKS_RUN);});
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << kThreads << " threads, shared atomic fetch_add  " << shared << " ns/increment" << std::endl;
+	std::cout << kThreads << " threads, Metrics::Add            " << local << " ns/increment" << std::endl;
+	std::cout << text;
+	return 0;
+}
@@ -0,0 +1,100 @@
+// 阻塞调用线程池：一个工作线程上 kRequests 个请求协程，每个请求 kRounds 轮，每轮向自己的文件写 64KB + fdatasync，再调用一次 2ms 的阻塞库函数
+// 对比直接在工作线程上执行（关闭 hook、直接调用）和交给线程池（hook 的 write / fdatasync + runBlocking），
+// 统计总耗时和同一线程上一个每 1ms 醒来一次的心跳协程的最大延迟
+#include "ioscheduler.h"
+#include "hook.h"
+#include "offload.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static const int kRequests = 32;
+static const int kRounds = 10;
+static const size_t kBlock = 64 * 1024;
+
+static double nowUs()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 模拟不经过 hook 的第三方阻塞调用
+static void slowLibraryCall()
+{
+	struct timespec ts = {0, 2000000};
+	syscall(SYS_nanosleep, &ts, nullptr);
+}
+
+static void request(int id, bool offload, std::atomic<int>& done)
+{
+	sylar::set_hook_enable(offload);
+	std::string path = "/tmp/bench_offload_" + std::to_string(getpid()) + "_" + std::to_string(id);
+	std::vector<char> block(kBlock, 'x');
+	int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	for(int r = 0; r < kRounds; r++)
+	{
+		write(fd, block.data(), block.size());
+		fdatasync(fd);
+		if(offload)
+		{
+			sylar::runBlocking(slowLibraryCall);
+		}
+		else
+		{
+			slowLibraryCall();
+		}
+	}
+	close(fd);
+	unlink(path.c_str());
+	done++;
+}
+
+struct Result
+{
+	double totalMs;
+	double maxLateUs;
+};
+
+static Result run(bool offload)
+{
+	std::atomic<int> done{0};
+	double max_late = 0;
+	double start = nowUs();
+	{
+		sylar::IOManager iom(1, true, "bench");
+		// 心跳协程先入队，先于请求开始计时
+		iom.scheduleLock([&done, &max_late]()
+		{
+			sylar::set_hook_enable(true);
+			while(done < kRequests)
+			{
+				double before = nowUs();
+				usleep(1000);
+				max_late = std::max(max_late, nowUs() - before - 1000);
+			}
+		});
+		for(int i = 0; i < kRequests; i++)
+		{
+			iom.scheduleLock([i, offload, &done]() {request(i, offload, done);});
+		}
+	}
+	return Result{(nowUs() - start) / 1000, max_late};
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	Result inline_run = run(false);
+	Result offload_run = run(true);
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "inline on worker   total " << inline_run.totalMs << " ms  heartbeat max late " << inline_run.maxLateUs << " us" << std::endl;
+	std::cout << "blocking pool      total " << offload_run.totalMs << " ms  heartbeat max late " << offload_run.maxLateUs << " us  pool threads " << sylar::BlockingPool::GetInstance()->getThreadCount() << std::endl;
+	return 0;
+}
@@ -0,0 +1,129 @@
+// 一次唤醒大量就绪 fd 的开销：kFds 个协程各自阻塞在一个 socketpair 的 recv 上，外部线程每轮向所有 fd 各写 1 字节（fan-out），
+// 等全部协程收到后再开始下一轮，统计每轮的平均耗时，idle() 一次 epoll_wait 拿到的就绪事件整批入队
+// 分别测试 1/4 个工作线程下关闭和开启 runnext（第一个就绪的协程不经过任务队列，由轮询线程直接执行）
+// 同时统计每轮的唤醒次数：进程的 write 系统调用次数（/proc/self/io 的 syscw）减去外部线程写数据的次数，剩下的是 tickle() 写 eventfd
+#include "ioscheduler.h"
+#include "hook.h"
+#include "fd_manager.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <string>
+#include <iostream>
+#include <iomanip>
+
+static const int kFds = 128;
+static const int kRounds = 2000;
+
+#define HOOKED(call) (sylar::set_hook_enable(true), call)
+
+static long writeSyscalls()
+{
+	std::ifstream in("/proc/self/io");
+	std::string key;
+	long value = 0;
+	while(in >> key >> value)
+	{
+		if(key == "syscw:")
+		{
+			return value;
+		}
+	}
+	return -1;
+}
+
+struct Result
+{
+	double us; // 每轮耗时
+	double wakes; // 每轮的唤醒次数
+};
+
+static Result bench(int threads, bool run_next)
+{
+	std::vector<int> readers, writers;
+	for(int i = 0; i < kFds; i++)
+	{
+		int sv[2];
+		socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+		sylar::FdMgr::GetInstance()->get(sv[0], true); // 读端交给 hook 管理，设置为非阻塞
+		readers.push_back(sv[0]);
+		writers.push_back(sv[1]);
+	}
+
+	std::atomic<long> received{0};
+	double us = 0;
+	long wakes = 0;
+	{
+		// 主线程在析构中的 stop() 才开始调度，多建一个线程保证测量期间有 threads 个工作线程
+		sylar::IOManager iom(threads + 1, true, "bench");
+		iom.setRunNext(run_next);
+		for(int fd : readers)
+		{
+			iom.scheduleLock([fd, &received]()
+			{
+				char c;
+				for(int r = 0; r < kRounds; r++)
+				{
+					if(HOOKED(recv(fd, &c, 1, 0)) == 1)
+					{
+						received++;
+					}
+				}
+			});
+		}
+
+		std::thread writer([&writers, &received, &us, &wakes]()
+		{
+			long writes_before = writeSyscalls();
+			auto start = std::chrono::steady_clock::now();
+			for(int r = 0; r < kRounds; r++)
+			{
+				for(int fd : writers)
+				{
+					write(fd, "x", 1);
+				}
+				while(received < (long)(r + 1) * kFds)
+				{
+					std::this_thread::yield();
+				}
+			}
+			us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / kRounds;
+			wakes = writeSyscalls() - writes_before - (long)kFds * kRounds;
+		});
+		writer.join();
+	}
+
+	for(int i = 0; i < kFds; i++)
+	{
+		sylar::FdMgr::GetInstance()->del(readers[i]);
+		close(readers[i]);
+		close(writers[i]);
+	}
+	return {us, (double)wakes / kRounds};
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	std::vector<std::pair<int, Result>> rows;
+	for(int threads : {1, 4})
+	{
+		for(bool run_next : {false, true})
+		{
+			rows.push_back({threads, bench(threads, run_next)});
+		}
+	}
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << std::setw(10) << "threads" << std::setw(12) << "runnext" << std::setw(16) << "us/round" << std::setw(16) << "wakes/round" << std::endl;
+	for(size_t i = 0; i < rows.size(); i++)
+	{
+		std::cout << std::setw(10) << rows[i].first << std::setw(12) << (i % 2 ? "on" : "off")
+			<< std::setw(16) << rows[i].second.us << std::setw(16) << rows[i].second.wakes << std::endl;
+	}
+	return 0;
+}
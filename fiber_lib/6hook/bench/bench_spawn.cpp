@@ -0,0 +1,109 @@
+// 扇出子请求的开销：kParents 个父协程各并发发出 kChildren 个子请求（子任务 usleep(1000) 模拟一次后端调用），等它们全部完成后汇总结果
+// 对比现在的写法（子任务通过 scheduleLock 提交、计数器记完成数，父协程每 100 微秒 usleep 一次轮询计数器）和 spawn + wait_all + join
+// 父协程不能只 yield 轮询：一直有就绪任务时工作线程不会进入 idle，定时器和 IO 事件都得不到处理，子任务的 usleep 永远不会返回
+// 统计总耗时和父协程被恢复的次数（轮询时每次恢复都是一次空转）
+#include "ioscheduler.h"
+#include "spawn.h"
+#include "hook.h"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+static const int kParents = 2000;
+static const int kChildren = 8;
+
+static double nowSec()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::atomic<long> s_resumes{0};
+static std::atomic<long> s_sum{0};
+
+static long child(int i)
+{
+	sylar::set_hook_enable(true);
+	usleep(1000);
+	return i;
+}
+
+static void pollParent(sylar::IOManager* iom)
+{
+	struct Shared
+	{
+		std::atomic<int> done{0};
+		std::atomic<long> sum{0};
+	};
+	auto shared = std::make_shared<Shared>();
+	for(int i = 0; i < kChildren; i++)
+	{
+		iom->scheduleLock([shared, i]()
+		{
+			shared->sum += child(i);
+			shared->done++;
+		});
+	}
+	while(shared->done.load() < kChildren)
+	{
+		usleep(100);
+		s_resumes++;
+	}
+	s_sum += shared->sum;
+}
+
+static void spawnParent()
+{
+	std::vector<sylar::JoinHandle<long>> children;
+	for(int i = 0; i < kChildren; i++)
+	{
+		children.push_back(sylar::spawn([i]() {return child(i);}));
+	}
+	sylar::wait_all(children);
+	s_resumes++;
+	long sum = 0;
+	for(auto& handle : children)
+	{
+		sum += handle.join();
+	}
+	s_sum += sum;
+}
+
+// 返回总耗时（毫秒），结果不对时返回 -1
+template<class F>
+static double run(F parent)
+{
+	s_resumes = 0;
+	s_sum = 0;
+	double start = nowSec();
+	{
+		// 只用主线程调度，避免单核上两个线程互相唤醒带来的双峰耗时
+		sylar::IOManager iom(1, true, "bench");
+		for(int p = 0; p < kParents; p++)
+		{
+			iom.scheduleLock([&iom, &parent]()
+			{
+				sylar::set_hook_enable(true);
+				parent(&iom);
+			});
+		}
+	}
+	double ms = (nowSec() - start) * 1000;
+	return s_sum == (long)kParents * kChildren * (kChildren - 1) / 2 ? ms : -1;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	double poll = run([](sylar::IOManager* iom) {pollParent(iom);});
+	long poll_resumes = s_resumes;
+	double join = run([](sylar::IOManager*) {spawnParent();});
+	long join_resumes = s_resumes;
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "scheduleLock + poll counter   " << poll << " ms, parent resumes " << poll_resumes << std::endl;
+	std::cout << "spawn + wait_all + join       " << join << " ms, parent resumes " << join_resumes << std::endl;
+	return 0;
+}
@@ -0,0 +1,126 @@
+// 任务队列出队复杂度基准：先积压 depth 个任务再全部取出，对比 vector::erase(begin)、std::deque 与 RingQueue 的吞吐
+// 旧的 m_tasks 每次出队都要搬移整个积压队列，吞吐随积压深度线性下降，整体是 O(n^2)
+#include "scheduler.h"
+#include "task_queue.h"
+
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+
+struct Task
+{
+	std::shared_ptr<int> fiber;
+	std::function<void()> cb;
+	int thread = -1;
+};
+
+static Task makeTask(long* sink)
+{
+	Task t;
+	t.cb = [sink](){ (*sink)++; };
+	return t;
+}
+
+// 返回每秒完成的入队+出队次数
+static double benchVector(size_t depth)
+{
+	long sink = 0;
+	std::vector<Task> q;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < depth; i++)
+	{
+		q.push_back(makeTask(&sink));
+	}
+	while(!q.empty())
+	{
+		Task t = std::move(*q.begin());
+		q.erase(q.begin());
+		t.cb();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return sink / secs;
+}
+
+static double benchDeque(size_t depth)
+{
+	long sink = 0;
+	std::deque<Task> q;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < depth; i++)
+	{
+		q.push_back(makeTask(&sink));
+	}
+	while(!q.empty())
+	{
+		Task t = std::move(q.front());
+		q.pop_front();
+		t.cb();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return sink / secs;
+}
+
+static double benchRing(size_t depth)
+{
+	long sink = 0;
+	sylar::RingQueue<Task> q;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < depth; i++)
+	{
+		q.push_back(makeTask(&sink));
+	}
+	Task t;
+	while(!q.empty())
+	{
+		q.pop_front(t);
+		t.cb();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return sink / secs;
+}
+
+// 端到端：主线程一次性提交 depth 个回调（类似 cancelAll 风暴或 listExpiredCb 的定时器洪峰），再由 stop() 全部执行完
+static double benchScheduler(size_t depth)
+{
+	std::atomic<long> sink{0};
+	auto start = std::chrono::steady_clock::now();
+	{
+		sylar::Scheduler sc(1, true, "bench");
+		sc.start();
+		for(size_t i = 0; i < depth; i++)
+		{
+			sc.scheduleLock([&sink](){ sink++; });
+		}
+		sc.stop();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return sink / secs;
+}
+
+int main()
+{
+	const size_t depths[] = {1000, 10000, 100000};
+	const size_t kVectorLimit = 30000; // vector 在更深的积压下要跑几十秒，直接跳过
+
+	std::cout << std::setw(10) << "depth" << std::setw(14) << "vector" << std::setw(14) << "deque"
+			  << std::setw(14) << "RingQueue" << std::setw(14) << "Scheduler" << "   (tasks/s)" << std::endl;
+	for(size_t depth : depths)
+	{
+		std::cout << std::setw(10) << depth;
+		if(depth <= kVectorLimit)
+		{
+			std::cout << std::setw(14) << (long)benchVector(depth);
+		}
+		else
+		{
+			std::cout << std::setw(14) << "skipped";
+		}
+		std::cout << std::setw(14) << (long)benchDeque(depth)
+				  << std::setw(14) << (long)benchRing(depth)
+				  << std::setw(14) << (long)benchScheduler(depth) << std::endl;
+	}
+	return 0;
+}
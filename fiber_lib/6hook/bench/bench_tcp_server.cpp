@@ -0,0 +1,181 @@
+// 手写的 main.cpp 式连接处理 vs TcpServer：kClients 条 keep-alive 连接，客户端每收到一个响应后停 1ms 再发下一个请求
+// main.cpp 式：读事件回调中不开 hook，循环 recv 直到收到请求，两个请求之间一直在 EAGAIN 上空转，占住工作线程
+// TcpServer：每条连接一个协程，hook 的 recv 在没有数据时挂起协程
+// 服务端都是 2 个线程的 IOManager，统计 kSeconds 秒内完成的请求数和进程的 CPU 时间（客户端线程大部分时间在睡眠）
+#include "ioscheduler.h"
+#include "hook.h"
+#include "tcp_server.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+static const int kClients = 8;
+static const int kSeconds = 2;
+
+static const char* kRequest = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+static const char* kResponse = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain\r\n"
+                               "Content-Length: 13\r\n"
+                               "Connection: keep-alive\r\n"
+                               "\r\n"
+                               "Hello, World!";
+
+static double cpuSeconds()
+{
+	rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// 客户端：阻塞 socket，收不到响应超过 100ms 就放弃这一轮（被空转的连接占住线程时会发生）
+static long runClients(uint16_t port)
+{
+	std::atomic<long> done{0};
+	std::atomic<bool> running{true};
+	std::vector<std::thread> threads;
+	for(int i = 0; i < kClients; i++)
+	{
+		threads.emplace_back([&]()
+		{
+			int fd = socket(AF_INET, SOCK_STREAM, 0);
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(port);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			timeval tv = {0, 100000};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+			if(connect(fd, (sockaddr*)&addr, sizeof(addr)))
+			{
+				close(fd);
+				return;
+			}
+			char buf[256];
+			while(running)
+			{
+				send(fd, kRequest, strlen(kRequest), MSG_NOSIGNAL);
+				if(recv(fd, buf, sizeof(buf), 0) > 0)
+				{
+					done++;
+				}
+				usleep(1000);
+			}
+			close(fd);
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(kSeconds));
+	running = false;
+	for(auto& t : threads)
+	{
+		t.join();
+	}
+	return done;
+}
+
+static int s_listen_fd = -1;
+static std::atomic<bool> s_accepting{false};
+
+static void manualAccept()
+{
+	if(!s_accepting)
+	{
+		return;
+	}
+	int fd = accept(s_listen_fd, nullptr, nullptr);
+	if(fd >= 0)
+	{
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		sylar::IOManager::GetThis()->addEvent(fd, sylar::IOManager::READ, [fd]()
+		{
+			char buffer[1024];
+			while(true)
+			{
+				int ret = recv(fd, buffer, sizeof(buffer), 0);
+				if(ret > 0)
+				{
+					send(fd, kResponse, strlen(kResponse), MSG_NOSIGNAL);
+					continue; // keep-alive：接着等下一个请求
+				}
+				if(ret == 0 || errno != EAGAIN)
+				{
+					close(fd);
+					break;
+				}
+			}
+		});
+	}
+	sylar::IOManager::GetThis()->addEvent(s_listen_fd, sylar::IOManager::READ, manualAccept);
+}
+
+static void benchManual(long& requests, double& cpu)
+{
+	s_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(s_listen_fd, (sockaddr*)&addr, sizeof(addr));
+	listen(s_listen_fd, 1024);
+	socklen_t len = sizeof(addr);
+	getsockname(s_listen_fd, (sockaddr*)&addr, &len);
+	fcntl(s_listen_fd, F_SETFL, O_NONBLOCK);
+	{
+		sylar::IOManager iom(2, false, "manual");
+		s_accepting = true;
+		iom.addEvent(s_listen_fd, sylar::IOManager::READ, manualAccept);
+		double start = cpuSeconds();
+		requests = runClients(ntohs(addr.sin_port));
+		cpu = cpuSeconds() - start;
+		s_accepting = false;
+		iom.cancelAll(s_listen_fd);
+	}
+	close(s_listen_fd);
+}
+
+static void benchServer(long& requests, double& cpu)
+{
+	sylar::IOManager iom(2, false, "server");
+	auto server = std::make_shared<sylar::TcpServer>(&iom, [](sylar::TcpConnection& conn)
+	{
+		char buffer[1024];
+		while(conn.recv(buffer, sizeof(buffer)) > 0)
+		{
+			if(conn.sendAll(kResponse, strlen(kResponse)) < 0)
+			{
+				break;
+			}
+		}
+	});
+	server->start(0);
+	double start = cpuSeconds();
+	requests = runClients(server->getPort());
+	cpu = cpuSeconds() - start;
+	server->stop(1000);
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit);
+	long manual_requests, server_requests;
+	double manual_cpu, server_cpu;
+	benchManual(manual_requests, manual_cpu);
+	benchServer(server_requests, server_cpu);
+	std::cout.clear();
+	std::cout << kClients << " keep-alive clients, 1 ms think time, " << kSeconds << " s, 2 server threads" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << std::setw(22) << "main.cpp style" << std::setw(10) << manual_requests << " requests" << std::setw(8) << manual_cpu << " cpu s" << std::endl;
+	std::cout << std::setw(22) << "TcpServer" << std::setw(10) << server_requests << " requests" << std::setw(8) << server_cpu << " cpu s" << std::endl;
+	return 0;
+}
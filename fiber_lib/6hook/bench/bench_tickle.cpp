@@ -0,0 +1,72 @@
+// 唤醒开销基准：多个外部线程同时向 IOManager 提交小任务（fan-in），每轮提交一批后停顿一会儿，让工作线程回到 epoll_wait 休眠
+// 统计吞吐和进程的 write 系统调用次数，write 次数来自 /proc/self/io 的 syscw，测量期间关闭 std::cout，剩下的基本都是 tickle() 写唤醒 fd 产生的
+#include "ioscheduler.h"
+
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <string>
+#include <iostream>
+#include <iomanip>
+
+static const int kProducers = 4;
+static const int kRounds = 2000;
+static const int kBurst = 64; // 每轮每个生产者提交的任务数
+
+static long writeSyscalls()
+{
+	std::ifstream in("/proc/self/io");
+	std::string key;
+	long value = 0;
+	while(in >> key >> value)
+	{
+		if(key == "syscw:")
+		{
+			return value;
+		}
+	}
+	return -1;
+}
+
+int main()
+{
+	std::atomic<long> done{0};
+	const long total = (long)kProducers * kRounds * kBurst;
+
+	std::cout.setstate(std::ios::badbit); // 屏蔽调度器的调试输出，避免干扰 write 计数
+	sylar::IOManager iom(4, true, "bench");
+	long writes_before = writeSyscalls();
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> producers;
+	for(int p = 0; p < kProducers; p++)
+	{
+		producers.emplace_back([&iom, &done]()
+		{
+			for(int r = 0; r < kRounds; r++)
+			{
+				for(int i = 0; i < kBurst; i++)
+				{
+					iom.scheduleLock([&done](){ done++; });
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		});
+	}
+	for(auto& t : producers)
+	{
+		t.join();
+	}
+	while(done < total)
+	{
+		std::this_thread::yield();
+	}
+
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	long writes = writeSyscalls() - writes_before;
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "tasks " << total << "  " << total / sec / 1e6 << " M tasks/s  write syscalls " << writes
+		<< "  (" << (double)writes / total << " per task)" << std::endl;
+	return 0;
+}
@@ -0,0 +1,65 @@
+// 定时器添加/取消基准：模拟 do_io 设置了 SO_RCVTIMEO 时的用法，每次 IO 都先添加一个超时定时器，IO 完成后马上取消
+// 对比 TimerManager 的两种后端：HEAP（有序集合）和 WHEEL（分层时间轮）
+// 管理器中预先放入一批不会触发的长定时器，模拟大量空闲连接的超时定时器
+// 多线程时再对比分片：1 个分片（所有线程争用同一把锁）vs 每个线程一个分片
+#include "timer.h"
+
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+static const long kOps = 1000000; // 总共添加并取消的定时器数量
+static const int kIdleTimers = 10000;
+
+static double benchArmCancel(sylar::TimerManager::Backend backend, int threads, size_t shards)
+{
+	sylar::TimerManager manager(backend, shards);
+	std::vector<std::shared_ptr<sylar::Timer>> idle;
+	for(int i = 0; i < kIdleTimers; i++)
+	{
+		idle.push_back(manager.addTimer(600000 + i, [](){}));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for(int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&manager, threads]()
+		{
+			std::shared_ptr<int> cond = std::make_shared<int>(0);
+			for(long i = 0; i < kOps / threads; i++)
+			{
+				auto timer = manager.addConditionTimer(5000, [](){}, cond);
+				timer->cancel();
+			}
+		});
+	}
+	for(auto& w : workers)
+	{
+		w.join();
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return kOps / sec;
+}
+
+int main()
+{
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << std::setw(10) << "backend" << std::setw(10) << "threads" << std::setw(10) << "shards" << std::setw(20) << "arm+cancel (M/s)" << std::endl;
+	for(int threads : {1, 4})
+	{
+		std::vector<size_t> counts = {1};
+		if(threads > 1)
+		{
+			counts.push_back(threads);
+		}
+		for(size_t shards : counts)
+		{
+			std::cout << std::setw(10) << "heap" << std::setw(10) << threads << std::setw(10) << shards << std::setw(20) << benchArmCancel(sylar::TimerManager::HEAP, threads, shards) / 1e6 << std::endl;
+			std::cout << std::setw(10) << "wheel" << std::setw(10) << threads << std::setw(10) << shards << std::setw(20) << benchArmCancel(sylar::TimerManager::WHEEL, threads, shards) / 1e6 << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,124 @@
+// hook IO 后端对比：协程通过 hook 的 connect/accept/send/recv/read/writev 做 echo ping-pong
+// epoll 后端每次阻塞的 IO 要 试探-epoll_ctl 注册-等待-epoll_ctl 重新注册-重试，io_uring 后端直接提交 SQE，在 idle() 中成批提交、由 CQE 恢复
+// 调度器线程默认不开启 hook，每次调用前都在当前线程上打开（协程可能在另一个线程上恢复）
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+static const int kConnections = 16;
+static const int kRounds = 5000;
+static const int kMessage = 512;
+
+#define HOOKED(call) (sylar::set_hook_enable(true), call)
+
+static double run(bool use_uring, bool& enabled)
+{
+	std::atomic<int> port{0};
+	std::atomic<long> done{0};
+	auto start = std::chrono::steady_clock::now();
+	{
+		sylar::IOManager iom(3, true, "bench", sylar::TimerManager::HEAP, false, use_uring);
+		enabled = iom.isUringEnabled();
+
+		// 服务端：accept 之后每个连接一个 echo 协程
+		iom.scheduleLock([&iom, &port]()
+		{
+			int listen_fd = HOOKED(socket(AF_INET, SOCK_STREAM, 0));
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			bind(listen_fd, (sockaddr*)&addr, sizeof(addr));
+			listen(listen_fd, 128);
+			socklen_t len = sizeof(addr);
+			getsockname(listen_fd, (sockaddr*)&addr, &len);
+			port = ntohs(addr.sin_port);
+			for(int i = 0; i < kConnections; i++)
+			{
+				int fd = HOOKED(accept(listen_fd, nullptr, nullptr));
+				iom.scheduleLock([fd]()
+				{
+					char buffer[kMessage];
+					while(true)
+					{
+						ssize_t n = HOOKED(recv(fd, buffer, sizeof(buffer), 0));
+						if(n <= 0)
+						{
+							break;
+						}
+						iovec iov = {buffer, (size_t)n};
+						HOOKED(writev(fd, &iov, 1));
+					}
+					HOOKED(close(fd));
+				});
+			}
+			HOOKED(close(listen_fd));
+		});
+		while(port == 0)
+		{
+			usleep(1000);
+		}
+
+		// 客户端：每个连接发送 kRounds 条消息，每条都等完整的回显
+		start = std::chrono::steady_clock::now();
+		for(int c = 0; c < kConnections; c++)
+		{
+			iom.scheduleLock([&port, &done]()
+			{
+				int fd = HOOKED(socket(AF_INET, SOCK_STREAM, 0));
+				sockaddr_in addr;
+				memset(&addr, 0, sizeof(addr));
+				addr.sin_family = AF_INET;
+				addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				addr.sin_port = htons(port);
+				if(HOOKED(connect(fd, (sockaddr*)&addr, sizeof(addr))) < 0)
+				{
+					HOOKED(close(fd));
+					return;
+				}
+				char buffer[kMessage];
+				memset(buffer, 'x', sizeof(buffer));
+				for(int r = 0; r < kRounds; r++)
+				{
+					HOOKED(send(fd, buffer, sizeof(buffer), 0));
+					size_t got = 0;
+					while(got < sizeof(buffer))
+					{
+						ssize_t n = HOOKED(read(fd, buffer + got, sizeof(buffer) - got));
+						if(n <= 0)
+						{
+							HOOKED(close(fd));
+							return;
+						}
+						got += n;
+					}
+					done++;
+				}
+				HOOKED(close(fd));
+			});
+		}
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	sylar::set_hook_enable(false); // 主线程在 stop() 中也执行过任务，关掉 hook，避免下一轮的 usleep 被 hook
+	return done / sec;
+}
+
+int main()
+{
+	std::cout.setstate(std::ios::badbit); // 屏蔽调度器的调试输出
+	bool epoll_enabled = false, uring_enabled = false;
+	double epoll = run(false, epoll_enabled);
+	double uring = run(true, uring_enabled);
+	std::cout.clear();
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "epoll   " << epoll << " round trips/s" << std::endl;
+	std::cout << "io_uring" << (uring_enabled ? " " : " (unavailable, fell back to epoll) ") << uring << " round trips/s" << std::endl;
+	return 0;
+}
@@ -0,0 +1,212 @@
+// 任务队列竞争基准：对比旧的"全局互斥锁 + vector"任务队列与新的"本地工作窃取队列 + 全局注入队列"在 1/4/16 线程下的吞吐
+// 第一部分只测试队列本身，第二部分通过 Scheduler 端到端地测试任务调度吞吐
+#include "scheduler.h"
+#include "task_queue.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <condition_variable>
+
+struct Task
+{
+	std::function<void()> cb;
+	int thread = -1;
+};
+
+// 旧的任务队列：所有线程共享一把锁和一个 vector，出队时线性扫描并从头部 erase
+class LegacyQueue
+{
+public:
+	void push(Task&& t)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(t));
+	}
+
+	bool pop(Task& t, int thread_id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(auto it = m_tasks.begin(); it != m_tasks.end(); ++it)
+		{
+			if(it->thread != -1 && it->thread != thread_id)
+			{
+				continue;
+			}
+			t = std::move(*it);
+			m_tasks.erase(it);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::vector<Task> m_tasks;
+};
+
+// 新的任务队列：每个线程一个工作窃取队列，本地为空时轮询窃取其他线程
+class StealingQueues
+{
+public:
+	explicit StealingQueues(int n)
+	{
+		for(int i = 0; i < n; i++)
+		{
+			m_queues.emplace_back(new sylar::WorkStealQueue<Task>());
+		}
+	}
+
+	void push(Task&& t, int index)
+	{
+		m_queues[index]->push(std::move(t));
+	}
+
+	bool pop(Task& t, int index)
+	{
+		if(m_queues[index]->pop(t))
+		{
+			return true;
+		}
+		size_t n = m_queues.size();
+		for(size_t i = 1; i < n; i++)
+		{
+			if(m_queues[(index + i) % n]->steal(t))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	std::vector<std::unique_ptr<sylar::WorkStealQueue<Task>>> m_queues;
+};
+
+static const int kBatch = 64; // 每轮每个线程先入队 kBatch 个任务，再尽量全部取出
+static const int kRounds = 2000;
+
+template<class PushFn, class PopFn>
+static double runQueueBench(int threads, PushFn push, PopFn pop)
+{
+	std::atomic<long> executed{0};
+	std::vector<std::thread> thrs;
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < threads; i++)
+	{
+		thrs.emplace_back([&, i]()
+		{
+			for(int r = 0; r < kRounds; r++)
+			{
+				for(int k = 0; k < kBatch; k++)
+				{
+					push(Task{[&](){ executed.fetch_add(1, std::memory_order_relaxed); }, -1}, i);
+				}
+				Task t;
+				while(pop(t, i))
+				{
+					t.cb();
+				}
+			}
+		});
+	}
+	for(auto& t : thrs)
+	{
+		t.join();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return executed / secs;
+}
+
+// 基类 Scheduler 的 idle() 固定 sleep(1) 且 tickle() 为空，这里用条件变量实现唤醒，避免测出来的都是睡眠时间
+class BenchScheduler : public sylar::Scheduler
+{
+public:
+	using Scheduler::Scheduler;
+
+protected:
+	void tickle() override
+	{
+		m_cv.notify_one();
+	}
+
+	void idle() override
+	{
+		while(!stopping())
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait_for(lock, std::chrono::milliseconds(1));
+			}
+			sylar::Fiber::GetThis()->yield();
+		}
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+};
+
+// 端到端：每个根任务在工作线程中再派生 kFanout 个子任务，子任务进入本地队列并被空闲线程窃取
+static const int kRoots = 2000;
+static const int kFanout = 32;
+
+static double runSchedulerBench(int threads)
+{
+	std::atomic<long> executed{0};
+	const long total = (long)kRoots * kFanout;
+
+	// 主线程不参与调度，只负责提交根任务并等待全部完成
+	BenchScheduler sc(threads + 1, true, "bench");
+	sc.start();
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < kRoots; i++)
+	{
+		sc.scheduleLock([&sc, &executed]()
+		{
+			for(int k = 0; k < kFanout; k++)
+			{
+				sc.scheduleLock([&executed](){ executed.fetch_add(1, std::memory_order_relaxed); });
+			}
+		});
+	}
+	while(executed < total)
+	{
+		std::this_thread::yield();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	sc.stop();
+	return total / secs;
+}
+
+int main()
+{
+	const int counts[] = {1, 4, 16};
+
+	std::cout << "queue only (tasks/s)" << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(16) << "legacy" << std::setw(16) << "stealing" << std::endl;
+	for(int n : counts)
+	{
+		LegacyQueue legacy;
+		double a = runQueueBench(n,
+			[&](Task&& t, int){ legacy.push(std::move(t)); },
+			[&](Task& t, int i){ return legacy.pop(t, i); });
+
+		StealingQueues stealing(n);
+		double b = runQueueBench(n,
+			[&](Task&& t, int i){ stealing.push(std::move(t), i); },
+			[&](Task& t, int i){ return stealing.pop(t, i); });
+
+		std::cout << std::setw(8) << n << std::setw(16) << (long)a << std::setw(16) << (long)b << std::endl;
+	}
+
+	std::cout << "Scheduler end-to-end (tasks/s)" << std::endl;
+	for(int n : counts)
+	{
+		std::cout << std::setw(8) << n << std::setw(16) << (long)runSchedulerBench(n) << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# 比较两份 Google Benchmark 的 JSON 输出（--benchmark_out_format=json），任何一项比基线慢超过阈值时返回 1
+#     python3 compare_micro.py [--threshold 0.25] micro_baseline.json micro_current.json
+# 有重复运行的聚合结果（--benchmark_repetitions）时取中位数，否则取同名结果的平均值；
+# 带 UseRealTime 的项（名字中有 /real_time）比较 real_time，其余比较 cpu_time
+import argparse
+import json
+import sys
+
+UNIT_NS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    medians, samples = {}, {}
+    for b in data.get("benchmarks", []):
+        name = b.get("run_name", b["name"])
+        field = "real_time" if "/real_time" in name else "cpu_time"
+        ns = b[field] * UNIT_NS[b.get("time_unit", "ns")]
+        if b.get("run_type") == "aggregate":
+            if b.get("aggregate_name") == "median":
+                medians[name] = ns
+        else:
+            samples.setdefault(name, []).append(ns)
+    result = {name: sum(v) / len(v) for name, v in samples.items()}
+    result.update(medians)
+    return data.get("context", {}), result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare microbench results against a baseline.")
+    parser.add_argument("--threshold", type=float, default=0.25, help="allowed slowdown, 0.25 means 25%%")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    args = parser.parse_args()
+
+    base_ctx, base = load(args.baseline)
+    cur_ctx, cur = load(args.current)
+    for key in ("num_cpus", "mhz_per_cpu", "library_build_type"):
+        if key in base_ctx and key in cur_ctx and base_ctx[key] != cur_ctx[key]:
+            print("warning: %s differs (baseline %s, current %s), results may not be comparable"
+                  % (key, base_ctx[key], cur_ctx[key]))
+
+    width = max([len(n) for n in base] + [len(n) for n in cur] + [9])
+    print("%-*s %14s %14s %9s" % (width, "benchmark", "baseline ns", "current ns", "change"))
+    regressions = []
+    for name in sorted(set(base) | set(cur)):
+        if name not in cur:
+            print("%-*s %14.1f %14s %9s" % (width, name, base[name], "-", "missing"))
+            continue
+        if name not in base:
+            print("%-*s %14s %14.1f %9s" % (width, name, "-", cur[name], "new"))
+            continue
+        change = cur[name] / base[name] - 1 if base[name] > 0 else 0
+        mark = ""
+        if change > args.threshold:
+            mark = "  REGRESSION"
+            regressions.append(name)
+        print("%-*s %14.1f %14.1f %+8.1f%%%s" % (width, name, base[name], cur[name], change * 100, mark))
+
+    if regressions:
+        print("%d benchmark(s) slower than baseline by more than %.0f%%" % (len(regressions), args.threshold * 100))
+        return 1
+    print("no regressions above %.0f%%" % (args.threshold * 100))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,279 @@
+// HTTP 压测客户端：基于 IOManager 和 hook 的 connect / send / recv，每个连接一个协程，在 duration 秒内循环发送请求
+// 用于对比 fiber_lib/epoll、fiber_lib/libevent 和 6hook/main.cpp 三个服务端（见 run_compare.sh），结果按 CSV 输出一行
+//     loadgen -p 8080 -c 256 -t 4 -d 5 -k -s 512 -l fiber
+// -c 并发连接数  -t 压测端线程数  -d 持续秒数  -k 保持连接（默认每个请求新建连接）  -s 请求体字节数（0 时发 GET，否则发 POST）
+// -l 写在 CSV 第一列的名称  -H 只输出 CSV 表头
+// 保持连接时如果服务端在响应后关闭了连接（仓库中的三个服务端都是这样），下一个请求在新连接上重发一次，计入 reconnects
+// 延迟从发送请求（不保持连接时从 connect）开始到读完整个响应，用 metrics.h 的对数分桶统计，误差不超过 12.5%
+#include "ioscheduler.h"
+#include "hook.h"
+#include "metrics.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+struct Options
+{
+	std::string host = "127.0.0.1";
+	int port = 8080;
+	int concurrency = 64;
+	int threads = 4;
+	double duration = 5;
+	bool keepalive = false;
+	size_t payload = 0;
+	std::string label = "server";
+};
+
+struct Stats
+{
+	std::mutex mutex;
+	sylar::LatencySnapshot latency;
+	uint64_t errors = 0;
+	uint64_t reconnects = 0;
+};
+
+static Options s_opt;
+static std::string s_request;
+static struct sockaddr_in s_addr;
+
+static uint64_t nowNs()
+{
+	return sylar::Metrics::NowNs();
+}
+
+static int connectServer()
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	int yes = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	if(connect(fd, (struct sockaddr*)&s_addr, sizeof(s_addr)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool sendAll(int fd, const char* data, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if(n <= 0)
+		{
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+// 读一个完整的响应：头部到 \r\n\r\n 为止，再按 Content-Length 读完响应体
+// 返回 1 表示成功，0 表示一个字节都没读到连接就关闭了，-1 表示出错；server_close 返回响应结束后服务端是否会关闭连接
+static int readResponse(int fd, std::string& buf, bool& server_close)
+{
+	buf.clear();
+	size_t header_end = std::string::npos;
+	size_t total = 0;
+	char chunk[4096];
+	while(header_end == std::string::npos || buf.size() < total)
+	{
+		ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+		if(n <= 0)
+		{
+			return buf.empty() ? 0 : -1;
+		}
+		buf.append(chunk, n);
+		if(header_end != std::string::npos)
+		{
+			continue;
+		}
+		header_end = buf.find("\r\n\r\n");
+		if(header_end == std::string::npos)
+		{
+			continue;
+		}
+		if(buf.compare(0, 12, "HTTP/1.1 200") != 0 && buf.compare(0, 12, "HTTP/1.0 200") != 0)
+		{
+			return -1;
+		}
+		size_t length = 0;
+		server_close = false;
+		size_t pos = buf.find("\r\n") + 2;
+		while(pos < header_end)
+		{
+			size_t eol = buf.find("\r\n", pos);
+			const char* line = buf.c_str() + pos;
+			if(strncasecmp(line, "Content-Length:", 15) == 0)
+			{
+				length = strtoul(line + 15, nullptr, 10);
+			}
+			else if(strncasecmp(line, "Connection:", 11) == 0 && strstr(std::string(line, eol - pos).c_str(), "close"))
+			{
+				server_close = true;
+			}
+			pos = eol + 2;
+		}
+		total = header_end + 4 + length;
+	}
+	return 1;
+}
+
+// 一个连接的压测循环，结果合并到 stats
+static void client(uint64_t end_ns, Stats& stats)
+{
+	sylar::set_hook_enable(true);
+	sylar::LatencySnapshot latency;
+	uint64_t errors = 0, reconnects = 0;
+	std::string buf;
+	int fd = -1;
+	while(nowNs() < end_ns)
+	{
+		uint64_t start = nowNs();
+		bool reused = fd >= 0;
+		if(fd < 0)
+		{
+			fd = connectServer();
+		}
+		int rt = -1;
+		bool server_close = false;
+		if(fd >= 0 && sendAll(fd, s_request.data(), s_request.size()))
+		{
+			rt = readResponse(fd, buf, server_close);
+		}
+		// 复用的连接已经被服务端关闭：新建连接重发一次
+		if(rt != 1 && reused)
+		{
+			close(fd);
+			reconnects++;
+			fd = connectServer();
+			if(fd >= 0 && sendAll(fd, s_request.data(), s_request.size()))
+			{
+				rt = readResponse(fd, buf, server_close);
+			}
+		}
+		if(rt == 1)
+		{
+			uint64_t ns = nowNs() - start;
+			latency.buckets[sylar::LatencyBuckets::Index(ns)]++;
+			latency.count++;
+			latency.sumNs += ns;
+			latency.maxNs = std::max(latency.maxNs, ns);
+		}
+		else
+		{
+			errors++;
+			usleep(1000); // 服务端不可用时不要空转
+		}
+		if(fd >= 0 && (rt != 1 || !s_opt.keepalive || server_close))
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+
+	std::lock_guard<std::mutex> lock(stats.mutex);
+	for(int b = 0; b < sylar::LatencyBuckets::kCount; b++)
+	{
+		stats.latency.buckets[b] += latency.buckets[b];
+	}
+	stats.latency.count += latency.count;
+	stats.latency.sumNs += latency.sumNs;
+	stats.latency.maxNs = std::max(stats.latency.maxNs, latency.maxNs);
+	stats.errors += errors;
+	stats.reconnects += reconnects;
+}
+
+static void printHeader()
+{
+	std::cout << "server,port,threads,concurrency,keepalive,payload,requests,errors,reconnects,seconds,rps,mean_us,p50_us,p90_us,p99_us,p999_us,max_us" << std::endl;
+}
+
+static void usage(const char* prog)
+{
+	std::cerr << "usage: " << prog << " [-h host] [-p port] [-c concurrency] [-t threads] [-d seconds] [-k] [-s payload] [-l label] [-H]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while((opt = getopt(argc, argv, "h:p:c:t:d:ks:l:H")) != -1)
+	{
+		switch(opt)
+		{
+			case 'h': s_opt.host = optarg; break;
+			case 'p': s_opt.port = atoi(optarg); break;
+			case 'c': s_opt.concurrency = atoi(optarg); break;
+			case 't': s_opt.threads = atoi(optarg); break;
+			case 'd': s_opt.duration = atof(optarg); break;
+			case 'k': s_opt.keepalive = true; break;
+			case 's': s_opt.payload = strtoul(optarg, nullptr, 10); break;
+			case 'l': s_opt.label = optarg; break;
+			case 'H': printHeader(); return 0;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	memset(&s_addr, 0, sizeof(s_addr));
+	s_addr.sin_family = AF_INET;
+	s_addr.sin_port = htons(s_opt.port);
+	if(s_opt.concurrency <= 0 || s_opt.threads <= 0 || s_opt.duration <= 0 || inet_pton(AF_INET, s_opt.host.c_str(), &s_addr.sin_addr) != 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::string connection = s_opt.keepalive ? "keep-alive" : "close";
+	if(s_opt.payload == 0)
+	{
+		s_request = "GET / HTTP/1.1\r\nHost: " + s_opt.host + "\r\nConnection: " + connection + "\r\n\r\n";
+	}
+	else
+	{
+		s_request = "POST / HTTP/1.1\r\nHost: " + s_opt.host + "\r\nConnection: " + connection
+			+ "\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(s_opt.payload) + "\r\n\r\n"
+			+ std::string(s_opt.payload, 'x');
+	}
+
+	Stats stats;
+	uint64_t start = nowNs();
+	uint64_t end = start + (uint64_t)(s_opt.duration * 1e9);
+	std::cout.setstate(std::ios::badbit);
+	{
+		sylar::IOManager iom(s_opt.threads, true, "loadgen");
+		for(int i = 0; i < s_opt.concurrency; i++)
+		{
+			iom.scheduleLock([end, &stats]() {client(end, stats);});
+		}
+	}
+	std::cout.clear();
+
+	const sylar::LatencySnapshot& l = stats.latency;
+	double seconds = s_opt.duration;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << s_opt.label << "," << s_opt.port << "," << s_opt.threads << "," << s_opt.concurrency << ","
+		<< (s_opt.keepalive ? 1 : 0) << "," << s_opt.payload << "," << l.count << "," << stats.errors << "," << stats.reconnects << ","
+		<< seconds << "," << l.count / seconds << "," << l.meanNs() / 1000 << ","
+		<< l.percentile(0.5) / 1000.0 << "," << l.percentile(0.9) / 1000.0 << "," << l.percentile(0.99) / 1000.0 << ","
+		<< l.percentile(0.999) / 1000.0 << "," << l.maxNs / 1000.0 << std::endl;
+	return 0;
+}
@@ -0,0 +1,193 @@
+// 核心原语的微基准（Google Benchmark）：协程创建 / 销毁、resume / yield 往返、scheduleLock 吞吐（单 / 多生产者）、
+// 定时器添加 + 取消、addEvent / delEvent、socketpair 上 hook 的 recv
+// 用 CMake 的 microbench 目标编译，microbench_compare 目标和 micro_baseline.json 比较（见 compare_micro.py）
+#include "ioscheduler.h"
+#include "hook.h"
+#include "fd_manager.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// 协程创建和销毁（包括分配和释放协程栈），协程不运行
+static void BM_FiberCreateDestroy(benchmark::State& state)
+{
+	sylar::Fiber::GetThis();
+	for(auto _ : state)
+	{
+		std::shared_ptr<sylar::Fiber> fiber = std::make_shared<sylar::Fiber>([]() {}, 0, false);
+		benchmark::DoNotOptimize(fiber.get());
+	}
+}
+BENCHMARK(BM_FiberCreateDestroy);
+
+// 从协程缓存取出、运行到结束、放回缓存，调度器执行回调任务时走的就是这条路径
+static void BM_FiberPooledRun(benchmark::State& state)
+{
+	sylar::Fiber::GetThis();
+	for(auto _ : state)
+	{
+		std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetPooled([]() {});
+		fiber->resume();
+		sylar::Fiber::ReturnToPool(std::move(fiber));
+	}
+}
+BENCHMARK(BM_FiberPooledRun);
+
+// 一次 resume + 一次 yield
+static void BM_ResumeYield(benchmark::State& state)
+{
+	sylar::Fiber::GetThis();
+	bool stop = false;
+	std::shared_ptr<sylar::Fiber> fiber = std::make_shared<sylar::Fiber>([&stop]()
+	{
+		while(!stop)
+		{
+			sylar::Fiber::GetThis()->yield();
+		}
+	}, 0, false);
+	for(auto _ : state)
+	{
+		fiber->resume();
+	}
+	stop = true;
+	fiber->resume();
+}
+BENCHMARK(BM_ResumeYield);
+
+// scheduleLock 吞吐：生产者线程提交空任务，积压超过 kBacklog 时等工作线程追上，所以结果包含执行任务的开销
+// 多生产者时所有生产者共享一个 IOManager
+static const uint64_t kBacklog = 4096;
+static sylar::IOManager* s_iom = nullptr;
+static std::atomic<uint64_t> s_produced{0};
+static std::atomic<uint64_t> s_consumed{0};
+
+static void ScheduleSetup(const benchmark::State&)
+{
+	s_produced = 0;
+	s_consumed = 0;
+	s_iom = new sylar::IOManager(2, false, "micro");
+}
+
+static void ScheduleTeardown(const benchmark::State&)
+{
+	delete s_iom;
+	s_iom = nullptr;
+}
+
+static void BM_ScheduleLock(benchmark::State& state)
+{
+	for(auto _ : state)
+	{
+		s_iom->scheduleLock([]() {s_consumed.fetch_add(1, std::memory_order_relaxed);});
+		uint64_t produced = s_produced.fetch_add(1, std::memory_order_relaxed) + 1;
+		if((produced & 255) == 0)
+		{
+			// 其他生产者的任务可能已经让 consumed 超过这里的 produced，不能直接相减
+			while(s_consumed.load(std::memory_order_relaxed) + kBacklog < produced)
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ScheduleLock)->Setup(ScheduleSetup)->Teardown(ScheduleTeardown)->Threads(1)->Threads(4)->UseRealTime();
+
+// 定时器添加 + 取消，Arg 为存储后端：0 有序集合，1 时间轮
+static void BM_TimerAddCancel(benchmark::State& state)
+{
+	sylar::IOManager iom(1, false, "micro", (sylar::TimerManager::Backend)state.range(0));
+	for(auto _ : state)
+	{
+		std::shared_ptr<sylar::Timer> timer = iom.addTimer(1000, []() {});
+		timer->cancel();
+	}
+}
+BENCHMARK(BM_TimerAddCancel)->Arg(sylar::TimerManager::HEAP)->Arg(sylar::TimerManager::WHEEL);
+
+// 侵入式定时器节点的添加 + 取消，不分配内存
+static void BM_TimerNodeAddCancel(benchmark::State& state)
+{
+	sylar::IOManager iom(1, false, "micro");
+	sylar::TimerNode node;
+	node.cb = [](sylar::TimerNode*) {};
+	for(auto _ : state)
+	{
+		iom.addTimerNode(&node, std::chrono::seconds(1));
+		iom.cancelTimerNode(&node);
+	}
+}
+BENCHMARK(BM_TimerNodeAddCancel);
+
+// 在 socketpair 的一端注册读事件再删除，每次都要 epoll_ctl
+static void BM_AddDelEvent(benchmark::State& state)
+{
+	sylar::IOManager iom(1, false, "micro");
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	for(auto _ : state)
+	{
+		iom.addEvent(sv[0], sylar::IOManager::READ, []() {});
+		iom.delEvent(sv[0], sylar::IOManager::READ);
+	}
+	close(sv[0]);
+	close(sv[1]);
+}
+BENCHMARK(BM_AddDelEvent);
+
+// 数据已经就绪时 hook 的 recv（一次 FdManager 查找加原始 recv），Arg 为 1 时开启 hook，0 时作为对照直接调用
+static void BM_HookedRecvReady(benchmark::State& state)
+{
+	sylar::set_hook_enable(state.range(0) != 0);
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	sylar::FdMgr::GetInstance()->get(sv[0], true);
+	sylar::FdMgr::GetInstance()->get(sv[1], true);
+	char c = 0;
+	for(auto _ : state)
+	{
+		send(sv[1], &c, 1, 0);
+		recv(sv[0], &c, 1, 0);
+	}
+	close(sv[0]);
+	close(sv[1]);
+	sylar::set_hook_enable(false);
+}
+BENCHMARK(BM_HookedRecvReady)->Arg(0)->Arg(1);
+
+// 跨线程 ping-pong：基准线程直接阻塞读写，IOManager 中的协程用 hook 的 recv 等待（挂起、epoll 唤醒、恢复）后回写
+static void BM_HookedRecvPingPong(benchmark::State& state)
+{
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	{
+		sylar::IOManager iom(1, false, "micro");
+		iom.scheduleLock([fd = sv[1]]()
+		{
+			sylar::set_hook_enable(true);
+			sylar::FdMgr::GetInstance()->get(fd, true);
+			char c;
+			while(recv(fd, &c, 1, 0) == 1 && c)
+			{
+				send(fd, &c, 1, 0);
+			}
+		});
+		char c = 1;
+		for(auto _ : state)
+		{
+			send(sv[0], &c, 1, 0);
+			recv(sv[0], &c, 1, 0);
+		}
+		c = 0;
+		send(sv[0], &c, 1, 0);
+	}
+	close(sv[0]);
+	close(sv[1]);
+}
+BENCHMARK(BM_HookedRecvPingPong)->UseRealTime();
+
+BENCHMARK_MAIN();
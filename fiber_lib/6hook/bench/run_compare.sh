@@ -0,0 +1,59 @@
+#!/bin/sh
+# 用 loadgen 依次压测 fiber_lib/epoll、fiber_lib/libevent（有 libevent 时）和 6hook/main.cpp 三个服务端，结果写成一个 CSV
+#     sh run_compare.sh > result.csv
+# 可以用环境变量调整：CONCURRENCY、PAYLOADS（请求体字节数）、MODES（close / keepalive）、DURATION（秒）、
+# CLIENT_THREADS（压测端线程数）、SERVER_THREADS（6hook 服务端的 IOManager 线程数）、BUILD_DIR（编译输出目录）
+# 压测端和服务端在同一台机器上时最好用 taskset 把两边分到不同的 CPU 上
+set -e
+
+CONCURRENCY=${CONCURRENCY:-"16 64 256"}
+PAYLOADS=${PAYLOADS:-"0 512"}
+MODES=${MODES:-"close keepalive"}
+DURATION=${DURATION:-5}
+CLIENT_THREADS=${CLIENT_THREADS:-4}
+SERVER_THREADS=${SERVER_THREADS:-4}
+BUILD_DIR=${BUILD_DIR:-/tmp/coroframe_bench}
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+HOOK_DIR=$(dirname "$BENCH_DIR")
+LIB_DIR=$(dirname "$HOOK_DIR")
+mkdir -p "$BUILD_DIR"
+
+# 编译信息写到 stderr，stdout 只有 CSV
+LIB_SRCS=$(ls "$HOOK_DIR"/*.cpp | grep -v '/main.cpp$')
+echo "building into $BUILD_DIR" >&2
+g++ -std=c++17 -O2 -I"$HOOK_DIR" "$BENCH_DIR/loadgen.cpp" $LIB_SRCS -o "$BUILD_DIR/loadgen" -ldl -lpthread
+g++ -std=c++17 -O2 "$HOOK_DIR"/*.cpp -o "$BUILD_DIR/server_fiber" -ldl -lpthread
+gcc -O2 "$LIB_DIR/epoll/main.cpp" -o "$BUILD_DIR/server_epoll"
+SERVERS="epoll:8888 fiber:8080"
+if pkg-config --exists libevent 2>/dev/null; then
+	gcc -O2 "$LIB_DIR/libevent/main.cpp" -o "$BUILD_DIR/server_libevent" $(pkg-config --cflags --libs libevent)
+	SERVERS="$SERVERS libevent:8080"
+else
+	echo "libevent not found, skipping the libevent server" >&2
+fi
+
+"$BUILD_DIR/loadgen" -H
+for entry in $SERVERS; do
+	name=${entry%%:*}
+	port=${entry##*:}
+	if [ "$name" = fiber ]; then
+		"$BUILD_DIR/server_$name" "$SERVER_THREADS" >/dev/null 2>&1 &
+	else
+		"$BUILD_DIR/server_$name" >/dev/null 2>&1 &
+	fi
+	pid=$!
+	sleep 0.5
+	for c in $CONCURRENCY; do
+		for mode in $MODES; do
+			for payload in $PAYLOADS; do
+				keep=""
+				[ "$mode" = keepalive ] && keep="-k"
+				"$BUILD_DIR/loadgen" -p "$port" -c "$c" -t "$CLIENT_THREADS" -d "$DURATION" -s "$payload" $keep -l "$name"
+			done
+		done
+	done
+	kill "$pid"
+	wait "$pid" 2>/dev/null || true
+	sleep 0.5
+done
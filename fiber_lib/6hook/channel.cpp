@@ -0,0 +1,271 @@
+#include "channel.h"
+#include "ioscheduler.h"
+
+#include <cassert>
+#include <optional>
+
+namespace sylar {
+
+void ChannelBase::WaitList::push(ChannelWaitEntry* entry)
+{
+	entry->prev = tail;
+	entry->next = nullptr;
+	if(tail)
+	{
+		tail->next = entry;
+	}
+	else
+	{
+		head = entry;
+	}
+	tail = entry;
+	entry->linked = true;
+	count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ChannelBase::WaitList::remove(ChannelWaitEntry* entry)
+{
+	if(entry->prev)
+	{
+		entry->prev->next = entry->next;
+	}
+	else
+	{
+		head = entry->next;
+	}
+	if(entry->next)
+	{
+		entry->next->prev = entry->prev;
+	}
+	else
+	{
+		tail = entry->prev;
+	}
+	entry->prev = entry->next = nullptr;
+	entry->linked = false;
+	count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ChannelBase::close()
+{
+	m_closed.store(true, std::memory_order_seq_cst);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	while(wakeOneLocked(m_recvWaiters));
+	while(wakeOneLocked(m_sendWaiters));
+}
+
+void ChannelBase::notify(WaitList& list)
+{
+	// 与 Park 中“先登记、再重试”配对：这边先发布数据再读登记数，两边各有一次全序屏障，至少有一边能看到对方
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(list.count.load(std::memory_order_relaxed) == 0)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	wakeOneLocked(list);
+}
+
+bool ChannelBase::wakeOneLocked(WaitList& list)
+{
+	while(list.head)
+	{
+		ChannelWaitEntry* entry = list.head;
+		list.remove(entry);
+		ChannelWaiter* owner = entry->owner;
+		int expected = ChannelWaiter::WAITING;
+		if(owner->fired.compare_exchange_strong(expected, entry->index, std::memory_order_acq_rel))
+		{
+			// 被唤醒的协程要拿到这把锁才能注销登记、释放 owner，这里持有锁期间访问 owner 是安全的
+			owner->waiter.wake();
+			return true;
+		}
+		// 已经被其他通道或超时唤醒的登记项，丢弃后继续找下一个
+	}
+	return false;
+}
+
+void ChannelBase::link(ChannelWaitEntry* entry, bool send)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	(send ? m_sendWaiters : m_recvWaiters).push(entry);
+}
+
+void ChannelBase::unlink(ChannelWaitEntry* entry, bool send)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(entry->linked)
+	{
+		(send ? m_sendWaiters : m_recvWaiters).remove(entry);
+	}
+}
+
+void ChannelBase::Renotify(const ChannelOp& op)
+{
+	if(op.send)
+	{
+		// 唤醒发送者的是一个空位
+		op.channel->notifySend();
+	}
+	else
+	{
+		op.channel->notifyRecv();
+	}
+}
+
+void ChannelBase::OnTimeout(TimerNode* node)
+{
+	// 在 TimerManager 的锁内执行，cancelTimerNode 返回之后不会再访问 waiter
+	ChannelWaiter* waiter = static_cast<ChannelWaiter*>(node);
+	int expected = ChannelWaiter::WAITING;
+	if(waiter->fired.compare_exchange_strong(expected, ChannelWaiter::TIMEOUT, std::memory_order_acq_rel))
+	{
+		waiter->waiter.wake();
+	}
+}
+
+namespace {
+
+// 挂起期间其他线程会访问的状态：普通协程放在自己的栈上，共享栈协程挂起后栈会被覆盖，改为放在堆上
+struct ParkState
+{
+	ChannelWaiter waiter;
+	ChannelWaitEntry single;
+	std::unique_ptr<ChannelWaitEntry[]> multiple;
+
+	explicit ParkState(size_t n)
+	{
+		if(n > 1)
+		{
+			multiple.reset(new ChannelWaitEntry[n]);
+		}
+	}
+	ChannelWaitEntry* entries() {return multiple ? multiple.get() : &single;}
+};
+
+}
+
+int ChannelBase::Park(ChannelOp* ops, size_t n, uint64_t timeout_ms)
+{
+	assert(n > 0);
+	bool finite = timeout_ms != ~0ull;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(finite ? timeout_ms : 0);
+
+	while(true)
+	{
+		for(size_t i = 0; i < n; i++)
+		{
+			if(ops[i].tryOp(ops[i].channel, ops[i].value, ops[i].ok))
+			{
+				return i;
+			}
+		}
+		std::chrono::nanoseconds remaining{0};
+		if(finite)
+		{
+			remaining = deadline - std::chrono::steady_clock::now();
+			if(remaining.count() <= 0)
+			{
+				return -1;
+			}
+		}
+
+		Fiber* self = Fiber::GetThis().get();
+		std::unique_ptr<ParkState> heap_state;
+		std::optional<ParkState> local_state;
+		if(self->isSharedStack())
+		{
+			heap_state.reset(new ParkState(n));
+		}
+		else
+		{
+			local_state.emplace(n);
+		}
+		ParkState& state = heap_state ? *heap_state : *local_state;
+		ChannelWaitEntry* entries = state.entries();
+		state.waiter.waiter = FiberWaiter::Current();
+
+		// 1.在每个通道上登记
+		for(size_t i = 0; i < n; i++)
+		{
+			entries[i].owner = &state.waiter;
+			entries[i].index = i;
+			ops[i].channel->link(&entries[i], ops[i].send);
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		// 2.登记之后再试一次，登记之前完成的收发不会再来唤醒我们
+		int done = -1;
+		for(size_t i = 0; i < n; i++)
+		{
+			if(ops[i].tryOp(ops[i].channel, ops[i].value, ops[i].ok))
+			{
+				done = i;
+				break;
+			}
+		}
+
+		int fired;
+		if(done >= 0)
+		{
+			int expected = ChannelWaiter::WAITING;
+			if(!state.waiter.fired.compare_exchange_strong(expected, ChannelWaiter::SELF, std::memory_order_acq_rel))
+			{
+				// 已经有通道唤醒了我们，协程已经被放回调度器，要让出一次把这次调度消耗掉
+				self->yield();
+			}
+			fired = expected;
+		}
+		else
+		{
+			// 3.挂起，等待某个通道或超时唤醒
+			IOManager* iom = finite ? IOManager::GetThis() : nullptr;
+			if(finite)
+			{
+				assert(iom && "channel timeout needs an IOManager");
+				state.waiter.cb = &ChannelBase::OnTimeout;
+				iom->addTimerNode(&state.waiter, remaining);
+			}
+			self->yield();
+			if(finite)
+			{
+				iom->cancelTimerNode(&state.waiter);
+			}
+			fired = state.waiter.fired.load(std::memory_order_acquire);
+		}
+
+		// 4.注销所有登记，之后不会再有通道访问 state
+		for(size_t i = 0; i < n; i++)
+		{
+			ops[i].channel->unlink(&entries[i], ops[i].send);
+		}
+
+		if(done >= 0)
+		{
+			if(fired >= 0 && fired != done)
+			{
+				Renotify(ops[fired]);
+			}
+			return done;
+		}
+		if(fired == ChannelWaiter::TIMEOUT)
+		{
+			// 超时和数据同时到达时以数据为准
+			for(size_t i = 0; i < n; i++)
+			{
+				if(ops[i].tryOp(ops[i].channel, ops[i].value, ops[i].ok))
+				{
+					return i;
+				}
+			}
+			return -1;
+		}
+		// 被 fired 号操作唤醒：先试它，没成功（被其他协程抢先了）就回到开头重新尝试所有操作
+		if(ops[fired].tryOp(ops[fired].channel, ops[fired].value, ops[fired].ok))
+		{
+			return fired;
+		}
+	}
+}
+
+}
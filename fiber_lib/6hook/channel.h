@@ -0,0 +1,348 @@
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "fiber_sync.h"
+#include "timer.h"
+#include "task_queue.h"
+
+namespace sylar {
+
+class ChannelBase;
+
+// 一个挂起在通道上的协程，可以同时挂在多个通道上（select），被第一个成功的通道或超时唤醒
+// fired 记录唤醒它的操作序号，唤醒方必须先 CAS 成功才能唤醒，保证协程只被放回调度器一次
+struct ChannelWaiter : public TimerNode
+{
+	enum : int
+	{
+		WAITING = -1,
+		TIMEOUT = -2,
+		SELF = -3 // 协程自己在挂起前完成了操作，不再接受唤醒
+	};
+	FiberWaiter waiter;
+	std::atomic<int> fired = {WAITING};
+};
+
+// 等待者在某个通道上的登记项，侵入式双向链表，挂起期间由通道的锁保护
+struct ChannelWaitEntry
+{
+	ChannelWaitEntry* prev = nullptr;
+	ChannelWaitEntry* next = nullptr;
+	ChannelWaiter* owner = nullptr;
+	int index = 0; // 在 select 中的操作序号
+	bool linked = false;
+};
+
+// 一次通道操作：Channel 自己的 send / recv 是只有一个操作的 select
+// tryOp 不阻塞地尝试完成操作：完成（或通道已关闭）时返回 true，并通过 ok 报告是否真正收发了数据
+struct ChannelOp
+{
+	ChannelBase* channel = nullptr;
+	bool send = false;
+	void* value = nullptr;
+	bool* ok = nullptr;
+	bool (*tryOp)(ChannelBase* channel, void* value, bool* ok) = nullptr;
+};
+
+// 通道中与元素类型无关的部分：等待者链表、关闭标志，以及挂起 / 唤醒协程的逻辑
+class ChannelBase
+{
+public:
+	ChannelBase() = default;
+	ChannelBase(const ChannelBase&) = delete;
+	ChannelBase& operator=(const ChannelBase&) = delete;
+
+	// 关闭通道并唤醒所有等待者：之后 send 返回 false，recv 取完剩余元素后返回 false
+	void close();
+	bool isClosed() const {return m_closed.load(std::memory_order_acquire);}
+
+	// 挂起当前协程直到 ops 中的某个操作完成，返回这个操作的序号；timeout_ms 毫秒内都没有完成时返回 -1
+	// timeout_ms 为 0 时只尝试一次，为 ~0ull 时一直等待；超时依赖当前线程的 IOManager 定时器
+	static int Park(ChannelOp* ops, size_t n, uint64_t timeout_ms);
+
+protected:
+	struct WaitList
+	{
+		ChannelWaitEntry* head = nullptr;
+		ChannelWaitEntry* tail = nullptr;
+		// 登记项的个数，收发成功之后不加锁读取，为 0 时不需要唤醒任何人
+		std::atomic<size_t> count = {0};
+
+		void push(ChannelWaitEntry* entry);
+		void remove(ChannelWaitEntry* entry);
+	};
+
+	// 收发成功之后调用：唤醒一个等待对方操作的协程，没有等待者时只有一次原子读
+	void notifyRecv() {notify(m_recvWaiters);}
+	void notifySend() {notify(m_sendWaiters);}
+
+private:
+	void notify(WaitList& list);
+	// 取出登记项直到唤醒一个还在等待的协程，调用时需要持有 m_mutex
+	bool wakeOneLocked(WaitList& list);
+	void link(ChannelWaitEntry* entry, bool send);
+	void unlink(ChannelWaitEntry* entry, bool send);
+
+	// 登记之后自己完成了另一个操作，却已经被 op 所在的通道唤醒：把这次唤醒转交给该通道上的下一个等待者，避免它的数据没人取
+	static void Renotify(const ChannelOp& op);
+	static void OnTimeout(TimerNode* node);
+
+private:
+	std::mutex m_mutex; // 保护两个等待者链表，收发数据本身不经过这把锁
+	WaitList m_recvWaiters;
+	WaitList m_sendWaiters;
+	std::atomic<bool> m_closed = {false};
+};
+
+// 多生产者多消费者的通道，在协程之间传递 T 类型的消息，T 需要可以默认构造和移动
+// capacity 大于 0 为有界通道：元素放在无锁环形缓冲区中（容量向上取整到 2 的幂），满时 send 挂起发送协程，形成背压
+// capacity 为 0 为无界通道：元素放在加锁的环形队列中，send 从不挂起
+// 缓冲区有空位 / 有数据时收发不加锁、不经过调度器；只有需要挂起或唤醒对方时才加锁
+template<class T>
+class Channel : public ChannelBase
+{
+public:
+	explicit Channel(size_t capacity = 0)
+	{
+		if(capacity > 0)
+		{
+			size_t cap = 1;
+			while(cap < capacity)
+			{
+				cap <<= 1;
+			}
+			m_mask = cap - 1;
+			m_cells.reset(new Cell[cap]);
+			for(size_t i = 0; i < cap; i++)
+			{
+				m_cells[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+		else
+		{
+			m_queue.reset(new RingQueue<T>(64));
+		}
+	}
+
+	// 发送：有界通道满时挂起直到有空位，通道已关闭时返回 false
+	bool send(T value)
+	{
+		bool ok;
+		if(TrySend(this, &value, &ok))
+		{
+			return ok;
+		}
+		ChannelOp op = sendOp(value, ok);
+		Park(&op, 1, ~0ull);
+		return ok;
+	}
+
+	// 接收：通道为空时挂起直到有数据；通道已关闭且没有剩余元素时返回 false
+	bool recv(T& out)
+	{
+		return recv(out, ~0ull);
+	}
+
+	// 带超时的接收：timeout_ms 毫秒内没有数据时返回 false，可以用 isClosed() 区分超时和关闭
+	bool recv(T& out, uint64_t timeout_ms)
+	{
+		bool ok = false;
+		if(TryRecv(this, &out, &ok))
+		{
+			return ok;
+		}
+		ChannelOp op = recvOp(out, ok);
+		return Park(&op, 1, timeout_ms) == 0 && ok;
+	}
+
+	// 不挂起的收发：不能立即完成时返回 false，trySend 失败时 value 保持不变
+	bool trySend(T& value)
+	{
+		bool ok = false;
+		return TrySend(this, &value, &ok) && ok;
+	}
+	bool tryRecv(T& out)
+	{
+		bool ok = false;
+		return TryRecv(this, &out, &ok) && ok;
+	}
+
+	// 供 Select 使用
+	ChannelOp sendOp(T& value, bool& ok) {return {this, true, &value, &ok, &Channel::TrySend};}
+	ChannelOp recvOp(T& out, bool& ok) {return {this, false, &out, &ok, &Channel::TryRecv};}
+
+	size_t capacity() const {return m_cells ? m_mask + 1 : 0;}
+
+private:
+	static bool TrySend(ChannelBase* base, void* value, bool* ok)
+	{
+		Channel* ch = static_cast<Channel*>(base);
+		if(ch->isClosed())
+		{
+			*ok = false;
+			return true;
+		}
+		if(!ch->push(*static_cast<T*>(value)))
+		{
+			return false;
+		}
+		*ok = true;
+		ch->notifyRecv();
+		return true;
+	}
+
+	static bool TryRecv(ChannelBase* base, void* value, bool* ok)
+	{
+		Channel* ch = static_cast<Channel*>(base);
+		T& out = *static_cast<T*>(value);
+		if(ch->pop(out))
+		{
+			*ok = true;
+			ch->notifySend();
+			return true;
+		}
+		if(ch->isClosed())
+		{
+			// 关闭之前发送成功的元素要先取完
+			*ok = ch->pop(out);
+			return true;
+		}
+		return false;
+	}
+
+	// 有界通道使用 Vyukov 的 MPMC 环形队列：每个槽位带一个序号，生产者和消费者各自 CAS 自己的位置，不需要锁
+	// 槽位序号等于写位置时可写，等于写位置 + 1 时可读，读走之后加上容量留给下一圈
+	bool push(T& value)
+	{
+		if(!m_cells)
+		{
+			std::lock_guard<std::mutex> lock(m_queueMutex);
+			m_queue->push_back(std::move(value));
+			return true;
+		}
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		while(true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(diff == 0)
+			{
+				if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				return false; // 已满
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->value = std::move(value);
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& out)
+	{
+		if(!m_cells)
+		{
+			std::lock_guard<std::mutex> lock(m_queueMutex);
+			if(m_queue->empty())
+			{
+				return false;
+			}
+			m_queue->pop_front(out);
+			return true;
+		}
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		while(true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if(diff == 0)
+			{
+				if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				return false; // 为空
+			}
+			else
+			{
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+		out = std::move(cell->value);
+		cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> seq;
+		T value;
+	};
+
+	// 有界通道
+	std::unique_ptr<Cell[]> m_cells;
+	size_t m_mask = 0;
+	alignas(64) std::atomic<size_t> m_enqueuePos = {0};
+	alignas(64) std::atomic<size_t> m_dequeuePos = {0};
+
+	// 无界通道
+	std::mutex m_queueMutex;
+	std::unique_ptr<RingQueue<T>> m_queue;
+};
+
+// 同时等待多个通道操作，完成其中第一个可以完成的：
+//     Select sel;
+//     sel.recv(ch1, v1, ok1).recv(ch2, v2, ok2);
+//     int index = sel.wait(100); // 返回完成的操作序号（按添加顺序从 0 开始），100 毫秒内都没有完成时返回 -1
+// 通道关闭时对它的操作也算完成，此时 ok 为 false
+class Select
+{
+public:
+	template<class T>
+	Select& send(Channel<T>& ch, T& value, bool& ok)
+	{
+		m_ops.push_back(ch.sendOp(value, ok));
+		return *this;
+	}
+
+	template<class T>
+	Select& recv(Channel<T>& ch, T& out, bool& ok)
+	{
+		m_ops.push_back(ch.recvOp(out, ok));
+		return *this;
+	}
+
+	// timeout_ms 为 ~0ull 时一直等待，为 0 时只尝试一次（相当于带 default 分支的 select）
+	int wait(uint64_t timeout_ms = ~0ull)
+	{
+		return ChannelBase::Park(m_ops.data(), m_ops.size(), timeout_ms);
+	}
+
+private:
+	std::vector<ChannelOp> m_ops;
+};
+
+}
+
+#endif
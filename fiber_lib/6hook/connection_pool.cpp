@@ -0,0 +1,357 @@
+#include "connection_pool.h"
+#include "hook.h"
+#include "dns.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+namespace sylar {
+
+static uint64_t NowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 地址的规范化字节串：只取族、端口和地址，sockaddr_in 中没有清零的填充字节不影响分组
+static std::string EndpointKey(const sockaddr* addr, socklen_t addrlen)
+{
+	std::string key;
+	if(addr->sa_family == AF_INET)
+	{
+		const sockaddr_in* in = (const sockaddr_in*)addr;
+		key.assign((const char*)&in->sin_family, sizeof(in->sin_family));
+		key.append((const char*)&in->sin_port, sizeof(in->sin_port));
+		key.append((const char*)&in->sin_addr, sizeof(in->sin_addr));
+	}
+	else if(addr->sa_family == AF_INET6)
+	{
+		const sockaddr_in6* in6 = (const sockaddr_in6*)addr;
+		key.assign((const char*)&in6->sin6_family, sizeof(in6->sin6_family));
+		key.append((const char*)&in6->sin6_port, sizeof(in6->sin6_port));
+		key.append((const char*)&in6->sin6_addr, sizeof(in6->sin6_addr));
+		key.append((const char*)&in6->sin6_scope_id, sizeof(in6->sin6_scope_id));
+	}
+	else
+	{
+		key.assign((const char*)addr, addrlen);
+	}
+	return key;
+}
+
+PooledConnection::PooledConnection(PooledConnection&& other) noexcept:
+m_pool(std::move(other.m_pool)), m_endpoint(other.m_endpoint), m_fd(other.m_fd), m_reused(other.m_reused), m_broken(other.m_broken)
+{
+	other.m_endpoint = nullptr;
+	other.m_fd = -1;
+}
+
+PooledConnection& PooledConnection::operator=(PooledConnection&& other) noexcept
+{
+	if(this != &other)
+	{
+		release();
+		m_pool = std::move(other.m_pool);
+		m_endpoint = other.m_endpoint;
+		m_fd = other.m_fd;
+		m_reused = other.m_reused;
+		m_broken = other.m_broken;
+		other.m_endpoint = nullptr;
+		other.m_fd = -1;
+	}
+	return *this;
+}
+
+void PooledConnection::release()
+{
+	if(m_fd < 0)
+	{
+		return;
+	}
+	m_pool->giveBack(m_endpoint, m_fd, m_broken);
+	m_fd = -1;
+	m_endpoint = nullptr;
+	m_pool.reset();
+}
+
+ConnectionPool::ConnectionPool(IOManager* iom, size_t max_total, size_t max_idle):
+m_iom(iom), m_maxTotal(max_total ? max_total : 1), m_maxIdle(max_idle)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+	// 借出的连接持有连接池的引用，走到这里时只剩空闲连接
+	stopHealthCheck();
+	clear();
+}
+
+void ConnectionPool::startHealthCheck(uint64_t interval_ms)
+{
+	stopHealthCheck();
+	// 定时器只持有弱引用，不影响连接池析构
+	std::weak_ptr<ConnectionPool> weak = shared_from_this();
+	std::shared_ptr<Timer> timer = m_iom->addTimer(interval_ms, [weak]()
+	{
+		std::shared_ptr<ConnectionPool> self = weak.lock();
+		if(self)
+		{
+			self->checkIdle();
+		}
+	}, true);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_healthTimer = timer;
+}
+
+void ConnectionPool::stopHealthCheck()
+{
+	std::shared_ptr<Timer> timer;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		timer.swap(m_healthTimer);
+	}
+	if(timer)
+	{
+		timer->cancel();
+	}
+}
+
+bool ConnectionPool::IsAlive(int fd)
+{
+	// 空闲连接上不应该有数据：读到 0 是对端已经关闭，读到数据说明协议状态已经乱了，两种情况都不能再用
+	// 用原始的 recv，hook 的 recv 在 EAGAIN 时会挂起协程
+	char c;
+	ssize_t rt = recv_f(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+ConnectionPool::Endpoint* ConnectionPool::getEndpoint(const sockaddr* addr, socklen_t addrlen)
+{
+	std::string key = EndpointKey(addr, addrlen);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::unique_ptr<Endpoint>& ep = m_endpoints[key];
+	if(!ep)
+	{
+		ep.reset(new Endpoint);
+		memcpy(&ep->addr, addr, std::min<size_t>(addrlen, sizeof(ep->addr)));
+		ep->addrlen = addrlen;
+	}
+	return ep.get();
+}
+
+int ConnectionPool::connectSlot(Endpoint* ep)
+{
+	int fd = socket(ep->addr.ss_family, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		int err = errno;
+		giveBack(ep, -1, true);
+		errno = err;
+		return -1;
+	}
+	if(connect_with_timeout(fd, (const sockaddr*)&ep->addr, ep->addrlen, m_connectTimeout) != 0)
+	{
+		int err = errno;
+		close(fd);
+		giveBack(ep, -1, true);
+		errno = err;
+		return -1;
+	}
+	if(m_noDelay)
+	{
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	}
+	m_created.fetch_add(1, std::memory_order_relaxed);
+	return fd;
+}
+
+PooledConnection ConnectionPool::acquire(const sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms)
+{
+	Endpoint* ep = getEndpoint(addr, addrlen);
+	int fd = -1;
+	bool wait = false;
+	{
+		std::lock_guard<std::mutex> lock(ep->mutex);
+		// 从最近归还的开始取，它们最不可能已经被对端的空闲超时关闭
+		while(!ep->idle.empty())
+		{
+			int idle_fd = ep->idle.back().fd;
+			ep->idle.pop_back();
+			if(IsAlive(idle_fd))
+			{
+				fd = idle_fd;
+				break;
+			}
+			close(idle_fd);
+			ep->total--;
+		}
+		if(fd < 0)
+		{
+			if(ep->total < m_maxTotal)
+			{
+				ep->total++; // 先占住名额，在锁外新建连接
+			}
+			else
+			{
+				ep->waiting++;
+				wait = true;
+			}
+		}
+	}
+
+	if(fd >= 0)
+	{
+		m_reused.fetch_add(1, std::memory_order_relaxed);
+		return PooledConnection(shared_from_this(), ep, fd, true);
+	}
+
+	if(wait)
+	{
+		int handed = -1;
+		bool got = ep->handoff.recv(handed, timeout_ms);
+		if(!got)
+		{
+			std::lock_guard<std::mutex> lock(ep->mutex);
+			// 归还方可能在超时之后、加锁之前把连接交给了一个等待者：等待者之间没有区别，这里直接取走它
+			got = ep->handoff.tryRecv(handed);
+			if(!got)
+			{
+				ep->waiting--;
+				errno = ETIMEDOUT;
+				return PooledConnection();
+			}
+		}
+		if(handed >= 0)
+		{
+			m_reused.fetch_add(1, std::memory_order_relaxed);
+			return PooledConnection(shared_from_this(), ep, handed, true);
+		}
+		// 拿到的是一个名额，下面新建连接
+	}
+
+	fd = connectSlot(ep);
+	if(fd < 0)
+	{
+		return PooledConnection();
+	}
+	return PooledConnection(shared_from_this(), ep, fd, false);
+}
+
+PooledConnection ConnectionPool::acquire(const std::string& host, uint16_t port, uint64_t timeout_ms)
+{
+	sockaddr_storage addr;
+	socklen_t addrlen;
+	int error = DnsMgr::GetInstance()->resolveOne(host, port, addr, addrlen);
+	if(error)
+	{
+		errno = error;
+		return PooledConnection();
+	}
+	return acquire((const sockaddr*)&addr, addrlen, timeout_ms);
+}
+
+void ConnectionPool::giveBack(Endpoint* ep, int fd, bool broken)
+{
+	if(fd >= 0 && broken)
+	{
+		close(fd);
+		fd = -1;
+	}
+	std::lock_guard<std::mutex> lock(ep->mutex);
+	if(ep->waiting)
+	{
+		// 连接（或关闭之后空出的名额）直接交给一个等待者，total 不变；无界通道的 send 不会挂起
+		ep->waiting--;
+		ep->handoff.send(fd);
+		return;
+	}
+	if(fd >= 0 && ep->idle.size() < m_maxIdle)
+	{
+		ep->idle.push_back(Endpoint::Idle{fd, NowMs()});
+		return;
+	}
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+	ep->total--;
+}
+
+void ConnectionPool::checkIdle()
+{
+	std::vector<Endpoint*> endpoints;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		endpoints.reserve(m_endpoints.size());
+		for(auto& it : m_endpoints)
+		{
+			endpoints.push_back(it.second.get());
+		}
+	}
+	uint64_t now = NowMs();
+	for(Endpoint* ep : endpoints)
+	{
+		std::lock_guard<std::mutex> lock(ep->mutex);
+		size_t kept = 0;
+		for(size_t i = 0; i < ep->idle.size(); i++)
+		{
+			const Endpoint::Idle& item = ep->idle[i];
+			bool expired = m_idleTimeout && now - item.since_ms >= m_idleTimeout;
+			if(expired || !IsAlive(item.fd))
+			{
+				close(item.fd);
+				ep->total--;
+				continue;
+			}
+			ep->idle[kept++] = item;
+		}
+		ep->idle.resize(kept);
+	}
+}
+
+void ConnectionPool::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(auto& it : m_endpoints)
+	{
+		Endpoint* ep = it.second.get();
+		std::lock_guard<std::mutex> ep_lock(ep->mutex);
+		for(const Endpoint::Idle& item : ep->idle)
+		{
+			close(item.fd);
+		}
+		ep->total -= ep->idle.size();
+		ep->idle.clear();
+	}
+}
+
+size_t ConnectionPool::getIdleCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t n = 0;
+	for(auto& it : m_endpoints)
+	{
+		std::lock_guard<std::mutex> ep_lock(it.second->mutex);
+		n += it.second->idle.size();
+	}
+	return n;
+}
+
+size_t ConnectionPool::getTotalCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t n = 0;
+	for(auto& it : m_endpoints)
+	{
+		std::lock_guard<std::mutex> ep_lock(it.second->mutex);
+		n += it.second->total;
+	}
+	return n;
+}
+
+}
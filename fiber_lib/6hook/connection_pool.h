@@ -0,0 +1,148 @@
+#ifndef _CONNECTION_POOL_H_
+#define _CONNECTION_POOL_H_
+
+#include <sys/socket.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "ioscheduler.h"
+#include "channel.h"
+
+namespace sylar {
+
+class ConnectionPool;
+
+// 从连接池借出的一条连接，析构时自动归还；收发出错或协议状态不确定（比如响应没读完）时调用 markBroken()，析构时关闭而不是放回池中
+class PooledConnection
+{
+	friend class ConnectionPool;
+public:
+	PooledConnection() = default;
+	~PooledConnection() {release();}
+
+	PooledConnection(PooledConnection&& other) noexcept;
+	PooledConnection& operator=(PooledConnection&& other) noexcept;
+	PooledConnection(const PooledConnection&) = delete;
+	PooledConnection& operator=(const PooledConnection&) = delete;
+
+	int getFd() const {return m_fd;}
+	explicit operator bool() const {return m_fd >= 0;}
+	// 是否复用了池中的空闲连接（false 表示这次新建了连接）
+	bool isReused() const {return m_reused;}
+
+	void markBroken() {m_broken = true;}
+	// 提前归还（或在 markBroken 之后关闭），之后 getFd() 返回 -1
+	void release();
+
+private:
+	struct Endpoint;
+	PooledConnection(std::shared_ptr<ConnectionPool> pool, Endpoint* endpoint, int fd, bool reused):
+	m_pool(std::move(pool)), m_endpoint(endpoint), m_fd(fd), m_reused(reused) {}
+
+private:
+	std::shared_ptr<ConnectionPool> m_pool;
+	Endpoint* m_endpoint = nullptr;
+	int m_fd = -1;
+	bool m_reused = false;
+	bool m_broken = false;
+};
+
+// 出站连接池：按对端地址分组，每个地址最多 max_total 条连接（借出 + 空闲），最多保留 max_idle 条空闲连接
+// acquire 优先取最近归还的空闲连接（取出前用 MSG_PEEK 检查对端没有关闭），没有时用 hook 的 connect_with_timeout 新建；
+// 连接数已满时挂起当前协程，等其他协程归还或关闭连接，不阻塞工作线程
+// startHealthCheck 用 IOManager 的循环定时器定期关闭空闲过久或已经被对端关闭的空闲连接
+// acquire 只能在开启 hook 的协程中调用；和 TcpServer 一样必须用 std::make_shared 创建，借出的连接持有连接池的引用
+//     auto pool = std::make_shared<sylar::ConnectionPool>(&iom);
+//     sylar::PooledConnection conn = pool->acquire("127.0.0.1", 6379, 100);
+//     if(!conn) ...; if(send(conn.getFd(), ...) < 0) conn.markBroken();
+class ConnectionPool : public std::enable_shared_from_this<ConnectionPool>
+{
+	friend class PooledConnection;
+public:
+	ConnectionPool(IOManager* iom, size_t max_total = 64, size_t max_idle = 16);
+	~ConnectionPool();
+
+	ConnectionPool(const ConnectionPool&) = delete;
+	ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+	// 新建连接的超时，默认 3000ms
+	void setConnectTimeout(uint64_t ms) {m_connectTimeout = ms;}
+	// 空闲超过这个时间的连接由健康检查关闭，默认 60000ms，0 为不按时间关闭
+	void setIdleTimeout(uint64_t ms) {m_idleTimeout = ms;}
+	// 新建的连接设置 TCP_NODELAY，默认开启
+	void setNoDelay(bool enable) {m_noDelay = enable;}
+
+	// 每隔 interval_ms 检查一次所有空闲连接
+	void startHealthCheck(uint64_t interval_ms = 5000);
+	void stopHealthCheck();
+
+	// 借出一条到 addr 的连接；timeout_ms 为等待空闲名额的时间（~0ull 为一直等待），新建连接的超时由 setConnectTimeout 决定
+	// 失败时返回的连接为空，errno 为 ETIMEDOUT（等待名额超时）或 connect 的错误
+	PooledConnection acquire(const sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms = ~0ull);
+	// host 为 IP 字面量或域名，域名通过 DnsMgr 解析（挂起协程，结果有缓存），取第一个 IPv4 地址；解析失败时 errno 为 DnsResolver::resolve 的返回值
+	PooledConnection acquire(const std::string& host, uint16_t port, uint64_t timeout_ms = ~0ull);
+
+	// 关闭所有空闲连接，借出的连接不受影响
+	void clear();
+
+	size_t getIdleCount();
+	size_t getTotalCount();
+	uint64_t getCreatedCount() const {return m_created.load(std::memory_order_relaxed);}
+	uint64_t getReusedCount() const {return m_reused.load(std::memory_order_relaxed);}
+
+private:
+	typedef PooledConnection::Endpoint Endpoint;
+
+	Endpoint* getEndpoint(const sockaddr* addr, socklen_t addrlen);
+	// 用拿到的名额新建连接，失败时把名额还回去
+	int connectSlot(Endpoint* ep);
+	// 连接归还（broken 为 false）或关闭之后，把连接或名额交给一个等待者，没有等待者时放回空闲列表或减少连接数
+	void giveBack(Endpoint* ep, int fd, bool broken);
+	void checkIdle();
+
+	static bool IsAlive(int fd);
+
+private:
+	IOManager* m_iom;
+	size_t m_maxTotal;
+	size_t m_maxIdle;
+	uint64_t m_connectTimeout = 3000;
+	uint64_t m_idleTimeout = 60000;
+	bool m_noDelay = true;
+
+	std::mutex m_mutex; // 保护 m_endpoints
+	// 地址的规范化字节串 -> 地址状态，条目不会删除，借出的连接可以一直持有 Endpoint 指针
+	std::unordered_map<std::string, std::unique_ptr<Endpoint>> m_endpoints;
+	std::shared_ptr<Timer> m_healthTimer;
+
+	std::atomic<uint64_t> m_created = {0};
+	std::atomic<uint64_t> m_reused = {0};
+};
+
+// 一个对端地址的连接
+struct PooledConnection::Endpoint
+{
+	struct Idle
+	{
+		int fd;
+		uint64_t since_ms; // 放回空闲列表的时间
+	};
+
+	sockaddr_storage addr;
+	socklen_t addrlen = 0;
+
+	std::mutex mutex; // 保护下面的成员
+	std::vector<Idle> idle; // 末尾是最近归还的
+	size_t total = 0; // 借出 + 空闲 + 交给等待者途中的连接数
+	size_t waiting = 0; // 还没有分到连接或名额的等待者数
+	// 归还时有等待者，连接的 fd（或 -1 表示一个可以新建连接的名额）直接通过通道交给等待者
+	Channel<int> handoff;
+};
+
+}
+
+#endif
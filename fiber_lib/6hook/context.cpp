@@ -0,0 +1,312 @@
+#include "context.h"
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef SYLAR_CONTEXT_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
+#ifdef SYLAR_CONTEXT_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+#ifdef SYLAR_CONTEXT_SANITIZER
+
+namespace sylar {
+
+// 正在被切走的上下文：切换完成后由目标一侧回填它的栈范围，切换总是在同一个线程内完成
+static thread_local Context* t_switch_from = nullptr;
+
+void Context::onMake(void* stack, size_t size)
+{
+	m_stackBottom = stack;
+	m_stackSize = size;
+#ifdef SYLAR_CONTEXT_ASAN
+	// 复用的栈上还留着之前的协程没有展开的栈帧红区
+	ASAN_UNPOISON_MEMORY_REGION(stack, size);
+#endif
+#ifdef SYLAR_CONTEXT_TSAN
+	// 协程被 reset 复用时重新创建 TSan 协程对象：上一次运行结束时没有从入口函数返回，旧对象的影子调用栈会越积越深
+	if(m_ownTsanFiber)
+	{
+		__tsan_destroy_fiber(m_tsanFiber);
+	}
+	m_tsanFiber = __tsan_create_fiber(0);
+	m_ownTsanFiber = true;
+#endif
+}
+
+void Context::BeforeSwap(Context& from, Context& to, void** fake_stack)
+{
+	t_switch_from = &from;
+#ifdef SYLAR_CONTEXT_ASAN
+	__sanitizer_start_switch_fiber(fake_stack, to.m_stackBottom, to.m_stackSize);
+#endif
+#ifdef SYLAR_CONTEXT_TSAN
+	if(!from.m_tsanFiber) // 线程原来的执行流
+	{
+		from.m_tsanFiber = __tsan_get_current_fiber();
+	}
+	__tsan_switch_to_fiber(to.m_tsanFiber, 0);
+#endif
+}
+
+void Context::AfterSwap(void* fake_stack)
+{
+#ifdef SYLAR_CONTEXT_ASAN
+	Context* from = t_switch_from;
+	__sanitizer_finish_switch_fiber(fake_stack, &from->m_stackBottom, &from->m_stackSize);
+#endif
+}
+
+void Context::Entered()
+{
+	AfterSwap(nullptr);
+}
+
+Context::~Context()
+{
+#ifdef SYLAR_CONTEXT_TSAN
+	if(m_ownTsanFiber)
+	{
+		__tsan_destroy_fiber(m_tsanFiber);
+	}
+#endif
+}
+
+}
+
+#define SYLAR_SWAP(switch_stmt) \
+	void* fake_stack = nullptr; \
+	BeforeSwap(from, to, &fake_stack); \
+	switch_stmt; \
+	AfterSwap(fake_stack)
+#else
+#define SYLAR_SWAP(switch_stmt) switch_stmt
+#endif
+
+#ifdef SYLAR_CONTEXT_ASM
+
+// sylar_switch_context(void** from_sp, void* to_sp)
+// 把被调用者保存的寄存器压到当前栈上，当前栈指针存入 *from_sp，然后切换到 to_sp 并弹出目标上下文的寄存器
+// sylar_context_trampoline：新上下文第一次被切换到时从这里开始执行，调用保存在寄存器中的入口函数
+extern "C" void sylar_switch_context(void** from_sp, void* to_sp);
+extern "C" void sylar_context_trampoline();
+
+#if defined(__x86_64__)
+
+// 栈布局（从低地址到高地址）：fpu 控制字 | mxcsr | r12 | r13 | r14 | r15 | rbx | rbp | 返回地址
+asm(R"(
+.text
+.globl sylar_switch_context
+.type sylar_switch_context,@function
+.align 16
+sylar_switch_context:
+	pushq %rbp
+	pushq %rbx
+	pushq %r15
+	pushq %r14
+	pushq %r13
+	pushq %r12
+	subq $16, %rsp
+	stmxcsr 8(%rsp)
+	fnstcw (%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	ldmxcsr 8(%rsp)
+	fldcw (%rsp)
+	addq $16, %rsp
+	popq %r12
+	popq %r13
+	popq %r14
+	popq %r15
+	popq %rbx
+	popq %rbp
+	ret
+.size sylar_switch_context,.-sylar_switch_context
+
+.globl sylar_context_trampoline
+.type sylar_context_trampoline,@function
+.align 16
+sylar_context_trampoline:
+	.cfi_startproc
+	.cfi_undefined rip
+	callq *%r12
+	ud2
+	.cfi_endproc
+.size sylar_context_trampoline,.-sylar_context_trampoline
+)");
+
+namespace sylar {
+
+bool Context::make(void* stack, size_t size, Entry entry)
+{
+	onMake(stack, size);
+	// 栈顶按 16 字节对齐，trampoline 执行 call 之前栈指针需要 16 字节对齐
+	uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+	uint64_t* sp = (uint64_t*)(top - 16);
+
+	*--sp = (uint64_t)&sylar_context_trampoline; // 返回地址
+	*--sp = 0; // rbp
+	*--sp = 0; // rbx
+	*--sp = 0; // r15
+	*--sp = 0; // r14
+	*--sp = 0; // r13
+	*--sp = (uint64_t)entry; // r12：入口函数
+	*--sp = 0x1F80; // mxcsr 默认值
+	*--sp = 0x037F; // x87 fpu 控制字默认值
+
+	m_sp = sp;
+	return true;
+}
+
+}
+
+#elif defined(__aarch64__)
+
+// 栈布局（从低地址到高地址）：d8-d15 | x19-x28 | x29(fp) | x30(lr)
+asm(R"(
+.text
+.globl sylar_switch_context
+.type sylar_switch_context,%function
+.align 4
+sylar_switch_context:
+	sub sp, sp, #0xa0
+	stp d8, d9, [sp, #0x00]
+	stp d10, d11, [sp, #0x10]
+	stp d12, d13, [sp, #0x20]
+	stp d14, d15, [sp, #0x30]
+	stp x19, x20, [sp, #0x40]
+	stp x21, x22, [sp, #0x50]
+	stp x23, x24, [sp, #0x60]
+	stp x25, x26, [sp, #0x70]
+	stp x27, x28, [sp, #0x80]
+	stp x29, x30, [sp, #0x90]
+	mov x9, sp
+	str x9, [x0]
+	mov sp, x1
+	ldp d8, d9, [sp, #0x00]
+	ldp d10, d11, [sp, #0x10]
+	ldp d12, d13, [sp, #0x20]
+	ldp d14, d15, [sp, #0x30]
+	ldp x19, x20, [sp, #0x40]
+	ldp x21, x22, [sp, #0x50]
+	ldp x23, x24, [sp, #0x60]
+	ldp x25, x26, [sp, #0x70]
+	ldp x27, x28, [sp, #0x80]
+	ldp x29, x30, [sp, #0x90]
+	add sp, sp, #0xa0
+	ret
+.size sylar_switch_context,.-sylar_switch_context
+
+.globl sylar_context_trampoline
+.type sylar_context_trampoline,%function
+.align 4
+sylar_context_trampoline:
+	.cfi_startproc
+	.cfi_undefined x30
+	blr x19
+	brk #0
+	.cfi_endproc
+.size sylar_context_trampoline,.-sylar_context_trampoline
+)");
+
+namespace sylar {
+
+bool Context::make(void* stack, size_t size, Entry entry)
+{
+	onMake(stack, size);
+	uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+	uint64_t* sp = (uint64_t*)(top - 0xa0);
+	memset(sp, 0, 0xa0);
+
+	sp[8] = (uint64_t)entry; // x19：入口函数
+	sp[19] = (uint64_t)&sylar_context_trampoline; // x30：返回地址
+
+	m_sp = sp;
+	return true;
+}
+
+}
+
+#endif
+
+namespace sylar {
+
+// 主协程的上下文在第一次被切走时才会真正保存，这里不需要做任何事
+bool Context::init()
+{
+	return true;
+}
+
+bool Context::Swap(Context& from, Context& to)
+{
+	SYLAR_SWAP(sylar_switch_context(&from.m_sp, to.m_sp));
+	return true;
+}
+
+void* Context::stackPointer() const
+{
+	return m_sp;
+}
+
+const char* Context::Backend()
+{
+	return "asm";
+}
+
+}
+
+#else // ucontext
+
+namespace sylar {
+
+bool Context::init()
+{
+	m_initialized = (getcontext(&m_ctx) == 0);
+	return m_initialized;
+}
+
+bool Context::make(void* stack, size_t size, Entry entry)
+{
+	onMake(stack, size);
+	// 第一次使用时需要 getcontext 初始化；协程被 reset 复用时上下文已经初始化过，只需要 makecontext 重新绑定入口函数和栈
+	if(!m_initialized && !init())
+	{
+		return false;
+	}
+
+	m_ctx.uc_link = nullptr; // 因为没有设置后继，所以在运行完该协程入口函数后，协程退出并调用一次 yield 返回主协程 
+	m_ctx.uc_stack.ss_sp = stack;
+	m_ctx.uc_stack.ss_size = size;
+	makecontext(&m_ctx, entry, 0); // 将上下文与入口函数绑定
+	return true;
+}
+
+bool Context::Swap(Context& from, Context& to)
+{
+	// swapcontext 会保存当前协程的上下文到 from，并切换到指定协程的上下文 to
+	int rt;
+	SYLAR_SWAP(rt = swapcontext(&from.m_ctx, &to.m_ctx));
+	return rt == 0;
+}
+
+void* Context::stackPointer() const
+{
+#if defined(__x86_64__)
+	return (void*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+	return (void*)m_ctx.uc_mcontext.sp;
+#else
+	return nullptr;
+#endif
+}
+
+const char* Context::Backend()
+{
+	return "ucontext";
+}
+
+}
+
+#endif
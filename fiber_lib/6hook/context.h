@@ -0,0 +1,96 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <cstddef>
+
+// 协程上下文切换的后端在编译期选择：
+// 1.x86-64 / AArch64 默认使用手写汇编，只保存被调用者保存的寄存器，不保存信号掩码，切换时没有系统调用
+// 2.其他平台，或者定义了 SYLAR_CONTEXT_UCONTEXT（例如 g++ -DSYLAR_CONTEXT_UCONTEXT），使用 ucontext 的 swapcontext
+#if !defined(SYLAR_CONTEXT_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define SYLAR_CONTEXT_ASM 1
+#else
+#include <ucontext.h>
+#endif
+
+// 用 AddressSanitizer / ThreadSanitizer 编译时，切换前后要告诉它们换了一个栈，否则会把协程栈上的访问误报为栈溢出或数据竞争
+#if defined(__SANITIZE_ADDRESS__)
+#define SYLAR_CONTEXT_ASAN 1
+#endif
+#if defined(__SANITIZE_THREAD__)
+#define SYLAR_CONTEXT_TSAN 1
+#endif
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) && !defined(SYLAR_CONTEXT_ASAN)
+#define SYLAR_CONTEXT_ASAN 1
+#endif
+#if __has_feature(thread_sanitizer) && !defined(SYLAR_CONTEXT_TSAN)
+#define SYLAR_CONTEXT_TSAN 1
+#endif
+#endif
+#if defined(SYLAR_CONTEXT_ASAN) || defined(SYLAR_CONTEXT_TSAN)
+#define SYLAR_CONTEXT_SANITIZER 1
+#endif
+
+// 能否取到被切走的上下文的栈指针，共享栈模式依赖它计算需要拷贝的栈大小
+#if defined(__x86_64__) || defined(__aarch64__)
+#define SYLAR_CONTEXT_HAS_SP 1
+#endif
+
+namespace sylar {
+
+// 协程上下文：保存一个执行流被切走时的寄存器状态
+class Context
+{
+public:
+	// 协程入口函数，首次切换到该上下文时执行，不允许返回
+	typedef void (*Entry)();
+
+	// 初始化为当前执行流的上下文（用于主协程），失败返回 false
+	bool init();
+
+	// 在 [stack, stack + size) 这段栈上构造一个新的上下文，首次切换到它时执行 entry
+	bool make(void* stack, size_t size, Entry entry);
+
+	// 保存当前执行流到 from，并切换到 to，失败返回 false
+	static bool Swap(Context& from, Context& to);
+
+	// 上下文被切走时的栈指针，只在 SYLAR_CONTEXT_HAS_SP 时可用
+	void* stackPointer() const;
+
+	// 当前使用的后端名称，"asm" 或 "ucontext"
+	static const char* Backend();
+
+	// 新上下文的入口函数开始执行时调用，完成 sanitizer 的切换通知；没有开启 sanitizer 时为空
+#ifdef SYLAR_CONTEXT_SANITIZER
+	static void Entered();
+	~Context();
+#else
+	static void Entered() {}
+#endif
+
+private:
+#ifdef SYLAR_CONTEXT_SANITIZER
+	// make() 时记录栈的范围，切换前通知 sanitizer 目标栈，切换回来后完成通知
+	void onMake(void* stack, size_t size);
+	static void BeforeSwap(Context& from, Context& to, void** fake_stack);
+	static void AfterSwap(void* fake_stack);
+
+	const void* m_stackBottom = nullptr; // 栈的范围，线程原来的栈在第一次被切走之后由 ASan 回填
+	size_t m_stackSize = 0;
+	void* m_tsanFiber = nullptr; // ThreadSanitizer 的协程对象
+	bool m_ownTsanFiber = false; // 是否由 make() 创建，析构时销毁
+#else
+	void onMake(void*, size_t) {}
+#endif
+
+#ifdef SYLAR_CONTEXT_ASM
+	void* m_sp = nullptr; // 被切走时的栈指针，寄存器都保存在栈上
+#else
+	ucontext_t m_ctx;
+	bool m_initialized = false; // m_ctx 是否已经由 getcontext 初始化过
+#endif
+};
+
+}
+
+#endif
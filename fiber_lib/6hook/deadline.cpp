@@ -0,0 +1,164 @@
+#include "deadline.h"
+#include "fiber_local.h"
+#include "timer.h"
+
+#include <cerrno>
+
+namespace sylar {
+
+// 协程的请求上下文，第一次设置截止时间或令牌时才创建
+struct DeadlineContext
+{
+	FiberDeadline::time_point deadline = FiberDeadline::time_point::max();
+	CancelToken::ptr token;
+};
+
+static FiberLocal<DeadlineContext> s_deadline_ctx;
+
+void CancelToken::cancel()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_cancelled.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	m_cancelled.store(true, std::memory_order_release);
+	while(m_head)
+	{
+		CancelWaiter* waiter = m_head;
+		m_head = waiter->next;
+		waiter->linked = false;
+		waiter->cb(waiter);
+	}
+}
+
+bool CancelToken::addWaiter(CancelWaiter* waiter)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_cancelled.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+	waiter->prev = nullptr;
+	waiter->next = m_head;
+	if(m_head)
+	{
+		m_head->prev = waiter;
+	}
+	m_head = waiter;
+	waiter->linked = true;
+	return true;
+}
+
+void CancelToken::removeWaiter(CancelWaiter* waiter)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!waiter->linked) // 已经被 cancel 摘下，回调在锁内执行完了
+	{
+		return;
+	}
+	if(waiter->prev)
+	{
+		waiter->prev->next = waiter->next;
+	}
+	else
+	{
+		m_head = waiter->next;
+	}
+	if(waiter->next)
+	{
+		waiter->next->prev = waiter->prev;
+	}
+	waiter->linked = false;
+}
+
+FiberDeadline::time_point FiberDeadline::Get()
+{
+	DeadlineContext* ctx = s_deadline_ctx.tryGet();
+	return ctx ? ctx->deadline : time_point::max();
+}
+
+CancelToken* FiberDeadline::GetToken()
+{
+	DeadlineContext* ctx = s_deadline_ctx.tryGet();
+	return ctx ? ctx->token.get() : nullptr;
+}
+
+int FiberDeadline::Check()
+{
+	DeadlineContext* ctx = s_deadline_ctx.tryGet();
+	if(!ctx)
+	{
+		return 0;
+	}
+	if(ctx->token && ctx->token->isCancelled())
+	{
+		return ECANCELED;
+	}
+	if(ctx->deadline != time_point::max() && ctx->deadline <= std::chrono::steady_clock::now())
+	{
+		return ETIMEDOUT;
+	}
+	return 0;
+}
+
+uint64_t FiberDeadline::ClampNs(uint64_t timeout_ns)
+{
+	DeadlineContext* ctx = s_deadline_ctx.tryGet();
+	if(!ctx || ctx->deadline == time_point::max())
+	{
+		return timeout_ns;
+	}
+	auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(ctx->deadline - std::chrono::steady_clock::now()).count();
+	uint64_t remain = left > 0 ? (uint64_t)left : 0;
+	return remain < timeout_ns ? remain : timeout_ns;
+}
+
+uint64_t FiberDeadline::Clamp(uint64_t timeout_ms)
+{
+	uint64_t ns = ClampNs(timeout_ms == (uint64_t)-1 ? ~0ull : timeout_ms * 1000000);
+	if(ns == ~0ull)
+	{
+		return (uint64_t)-1;
+	}
+	return (ns + 999999) / 1000000; // 向上取整，不会在截止时间之前超时
+}
+
+DeadlineScope::DeadlineScope(uint64_t timeout_ms)
+	: DeadlineScope(timeout_ms == (uint64_t)-1 ? std::chrono::nanoseconds::max() : std::chrono::milliseconds(timeout_ms))
+{
+}
+
+DeadlineScope::DeadlineScope(std::chrono::nanoseconds timeout)
+{
+	DeadlineContext& ctx = s_deadline_ctx.get();
+	m_prev = ctx.deadline;
+	if(timeout == std::chrono::nanoseconds::max()) // 不超时，只保留外层的截止时间
+	{
+		return;
+	}
+	FiberDeadline::time_point deadline = std::chrono::steady_clock::now() + timeout; // 截止时间按真实时钟计算，调度循环缓存的时间可能已经过时
+	if(deadline < ctx.deadline)
+	{
+		ctx.deadline = deadline;
+	}
+}
+
+DeadlineScope::~DeadlineScope()
+{
+	s_deadline_ctx.get().deadline = m_prev;
+}
+
+CancelScope::CancelScope(CancelToken::ptr token)
+{
+	DeadlineContext& ctx = s_deadline_ctx.get();
+	m_prev = std::move(ctx.token);
+	ctx.token = std::move(token);
+}
+
+CancelScope::~CancelScope()
+{
+	s_deadline_ctx.get().token = std::move(m_prev);
+}
+
+}
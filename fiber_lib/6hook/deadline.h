@@ -0,0 +1,106 @@
+#ifndef _DEADLINE_H_
+#define _DEADLINE_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+namespace sylar {
+
+// 请求级的截止时间和取消：在协程上设置一个截止时间或绑定一个取消令牌后，
+// hook 的 IO（do_io / connect / io_uring）和 sleep 在挂起之前检查它们，等待时间不超过剩余的预算，
+// 预算用完（ETIMEDOUT）或令牌被取消（ECANCELED）时立即取消挂起的事件、恢复协程并返回 -1，不再在后端上继续排队
+//     sylar::DeadlineScope deadline(50);          // 整个请求最多 50 毫秒
+//     sylar::CancelScope cancel(token);           // 客户端断开时 token->cancel()
+//     recv(...); send(...);                       // 每次等待都只用剩下的时间
+
+// 取消令牌上挂起的一个等待者，由挂起的一方放在自己的栈或堆上（侵入式链表，注册和注销都不分配内存）
+// cb 在持有令牌锁时执行，removeWaiter 返回之后 cb 一定已经执行完或者永远不会执行，节点可以安全地销毁
+struct CancelWaiter
+{
+	void (*cb)(CancelWaiter* waiter) = nullptr;
+	CancelWaiter* prev = nullptr;
+	CancelWaiter* next = nullptr;
+	bool linked = false;
+};
+
+// 取消令牌：cancel() 可以在任意线程调用，只生效一次，唤醒所有挂在它上面的等待者
+// 同一个令牌可以绑定到多个协程上（例如一个请求派生的所有子任务）
+class CancelToken
+{
+public:
+	using ptr = std::shared_ptr<CancelToken>;
+
+	static ptr Create() {return std::make_shared<CancelToken>();}
+
+	CancelToken() = default;
+	CancelToken(const CancelToken&) = delete;
+	CancelToken& operator=(const CancelToken&) = delete;
+
+	void cancel();
+	bool isCancelled() const {return m_cancelled.load(std::memory_order_acquire);}
+
+	// 注册等待者，令牌已经取消时不注册并返回 false
+	bool addWaiter(CancelWaiter* waiter);
+	// 注销等待者，cb 正在执行时等它结束
+	void removeWaiter(CancelWaiter* waiter);
+
+private:
+	std::mutex m_mutex;
+	std::atomic<bool> m_cancelled{false};
+	CancelWaiter* m_head = nullptr;
+};
+
+// 当前协程的截止时间和取消令牌，保存在协程局部变量中，协程被调度到其他线程上也跟着走
+// 没有设置过的协程不分配任何东西，hook 中的检查只是读一次协程的槽位
+class FiberDeadline
+{
+public:
+	using time_point = std::chrono::time_point<std::chrono::steady_clock>;
+
+	// 当前协程的截止时间，没有时返回 time_point::max()
+	static time_point Get();
+	// 当前协程的取消令牌，没有时返回 nullptr
+	static CancelToken* GetToken();
+
+	// 0 表示可以继续等待；截止时间已过返回 ETIMEDOUT，令牌已取消返回 ECANCELED
+	static int Check();
+
+	// 把超时时间（毫秒，-1 表示不超时）收紧到剩余的预算以内，剩余不足 1 毫秒时向上取整为 1 毫秒
+	static uint64_t Clamp(uint64_t timeout_ms);
+	// 同上，单位为纳秒，~0ull 表示不超时
+	static uint64_t ClampNs(uint64_t timeout_ns);
+};
+
+// 在作用域内收紧当前协程的截止时间：新的截止时间取 now + timeout 和外层截止时间中较早的一个，析构时恢复外层的
+class DeadlineScope
+{
+public:
+	explicit DeadlineScope(uint64_t timeout_ms);
+	explicit DeadlineScope(std::chrono::nanoseconds timeout);
+	~DeadlineScope();
+	DeadlineScope(const DeadlineScope&) = delete;
+	DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+private:
+	FiberDeadline::time_point m_prev;
+};
+
+// 在作用域内把取消令牌绑定到当前协程，析构时恢复外层的令牌；内层令牌替换外层令牌，外层取消在作用域内不可见
+class CancelScope
+{
+public:
+	explicit CancelScope(CancelToken::ptr token);
+	~CancelScope();
+	CancelScope(const CancelScope&) = delete;
+	CancelScope& operator=(const CancelScope&) = delete;
+
+private:
+	CancelToken::ptr m_prev;
+};
+
+}
+
+#endif
@@ -0,0 +1,645 @@
+#include "dns.h"
+#include "hook.h"
+#include "ioscheduler.h"
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <strings.h>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+
+namespace sylar {
+
+// DnsMgr 单例的静态成员，和 fd_manager.cpp 中的 FdMgr 一样在实现文件中定义
+template<>
+std::atomic<DnsResolver*> Singleton<DnsResolver>::instance = {nullptr};
+
+template<>
+std::mutex Singleton<DnsResolver>::mutex{};
+
+static const int kTypeA = 1;
+static const int kTypeCname = 5;
+static const int kTypeAaaa = 28;
+static const int kTypeOpt = 41;
+static const int kClassIn = 1;
+// EDNS0 声明的 UDP 回复大小，按 DNS Flag Day 2020 的建议取 1232
+static const size_t kUdpSize = 1232;
+
+static uint64_t NowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint16_t RandomId()
+{
+	thread_local std::mt19937 rng(std::random_device{}());
+	return (uint16_t)rng();
+}
+
+static uint16_t Read16(const uint8_t* p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t Read32(const uint8_t* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void Put16(std::string& out, uint16_t v)
+{
+	out.push_back((char)(v >> 8));
+	out.push_back((char)(v & 0xff));
+}
+
+// 小写，去掉结尾的点
+static std::string Normalize(const std::string& name)
+{
+	std::string s = name;
+	std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {return std::tolower(c);});
+	if(!s.empty() && s.back() == '.')
+	{
+		s.pop_back();
+	}
+	return s;
+}
+
+// 把名字编码成 DNS 的标签序列，标签为空或超过 63 字节、总长超过 253 字节时返回 false
+static bool EncodeName(const std::string& name, std::string& out)
+{
+	if(name.empty() || name.size() > 253)
+	{
+		return false;
+	}
+	size_t start = 0;
+	while(start <= name.size())
+	{
+		size_t dot = name.find('.', start);
+		if(dot == std::string::npos)
+		{
+			dot = name.size();
+		}
+		size_t len = dot - start;
+		if(len == 0 || len > 63)
+		{
+			return false;
+		}
+		out.push_back((char)len);
+		out.append(name, start, len);
+		start = dot + 1;
+	}
+	out.push_back(0);
+	return true;
+}
+
+// 跳过报文中 pos 处的名字（可能带压缩指针），越界时返回 false
+static bool SkipName(const uint8_t* msg, size_t len, size_t& pos)
+{
+	while(pos < len)
+	{
+		uint8_t c = msg[pos];
+		if(c == 0)
+		{
+			pos++;
+			return true;
+		}
+		if((c & 0xc0) == 0xc0)
+		{
+			// 压缩指针占两个字节，名字到此结束
+			if(pos + 2 > len)
+			{
+				return false;
+			}
+			pos += 2;
+			return true;
+		}
+		if(c & 0xc0)
+		{
+			return false;
+		}
+		pos += 1 + c;
+	}
+	return false;
+}
+
+static bool MakeAddr(int family, const void* raw, sockaddr_storage& addr)
+{
+	memset(&addr, 0, sizeof(addr));
+	if(family == AF_INET)
+	{
+		sockaddr_in* in = (sockaddr_in*)&addr;
+		in->sin_family = AF_INET;
+		memcpy(&in->sin_addr, raw, 4);
+		return true;
+	}
+	if(family == AF_INET6)
+	{
+		sockaddr_in6* in6 = (sockaddr_in6*)&addr;
+		in6->sin6_family = AF_INET6;
+		memcpy(&in6->sin6_addr, raw, 16);
+		return true;
+	}
+	return false;
+}
+
+// IPv4 / IPv6 字面量
+static bool ParseLiteral(const std::string& s, sockaddr_storage& addr)
+{
+	uint8_t raw[16];
+	if(inet_pton(AF_INET, s.c_str(), raw) == 1)
+	{
+		return MakeAddr(AF_INET, raw, addr);
+	}
+	if(inet_pton(AF_INET6, s.c_str(), raw) == 1)
+	{
+		return MakeAddr(AF_INET6, raw, addr);
+	}
+	return false;
+}
+
+static bool FamilyMatches(int family, const sockaddr_storage& addr)
+{
+	return family == AF_UNSPEC || family == addr.ss_family;
+}
+
+static void SetPort(sockaddr_storage& addr, uint16_t port)
+{
+	if(addr.ss_family == AF_INET)
+	{
+		((sockaddr_in*)&addr)->sin_port = htons(port);
+	}
+	else if(addr.ss_family == AF_INET6)
+	{
+		((sockaddr_in6*)&addr)->sin6_port = htons(port);
+	}
+}
+
+socklen_t DnsResolver::AddrLen(const sockaddr_storage& addr)
+{
+	return addr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+}
+
+DnsResolver::DnsResolver()
+{
+	// 只在构造时读一次文件，之后的查询不再碰磁盘
+	loadResolvConf();
+	loadHosts();
+}
+
+void DnsResolver::loadResolvConf()
+{
+	std::ifstream in("/etc/resolv.conf");
+	std::string line;
+	std::vector<std::string> servers;
+	while(std::getline(in, line))
+	{
+		std::istringstream ss(line);
+		std::string key;
+		ss >> key;
+		if(key == "nameserver")
+		{
+			std::string ip;
+			ss >> ip;
+			servers.push_back(ip);
+		}
+		else if(key == "options")
+		{
+			std::string opt;
+			while(ss >> opt)
+			{
+				if(opt.compare(0, 8, "timeout:") == 0)
+				{
+					m_timeout = std::max(1, atoi(opt.c_str() + 8)) * 1000ull;
+				}
+				else if(opt.compare(0, 9, "attempts:") == 0)
+				{
+					setAttempts(atoi(opt.c_str() + 9));
+				}
+			}
+		}
+	}
+	if(servers.empty() || !setNameservers(servers))
+	{
+		// 和 glibc 一样，没有配置时使用本机
+		setNameservers({"127.0.0.1"});
+	}
+}
+
+void DnsResolver::loadHosts()
+{
+	std::ifstream in("/etc/hosts");
+	std::string line;
+	while(std::getline(in, line))
+	{
+		size_t hash = line.find('#');
+		if(hash != std::string::npos)
+		{
+			line.resize(hash);
+		}
+		std::istringstream ss(line);
+		std::string ip;
+		sockaddr_storage addr;
+		if(!(ss >> ip) || !ParseLiteral(ip, addr))
+		{
+			continue;
+		}
+		std::string name;
+		while(ss >> name)
+		{
+			m_hosts[Normalize(name)].push_back(addr);
+		}
+	}
+}
+
+bool DnsResolver::setNameservers(const std::vector<std::string>& ips)
+{
+	std::vector<sockaddr_storage> servers;
+	for(const std::string& item : ips)
+	{
+		// "ip"、"ipv4:port" 或 "[ipv6]:port"
+		std::string ip = item;
+		int port = 53;
+		size_t colon = item.rfind(':');
+		if(!item.empty() && item[0] == '[')
+		{
+			size_t close_bracket = item.find(']');
+			if(close_bracket != std::string::npos)
+			{
+				ip = item.substr(1, close_bracket - 1);
+				if(close_bracket + 1 < item.size() && item[close_bracket + 1] == ':')
+				{
+					port = atoi(item.c_str() + close_bracket + 2);
+				}
+			}
+		}
+		else if(colon != std::string::npos && item.find(':') == colon)
+		{
+			ip = item.substr(0, colon);
+			port = atoi(item.c_str() + colon + 1);
+		}
+		sockaddr_storage addr;
+		if(!ParseLiteral(ip, addr) || port <= 0 || port > 65535)
+		{
+			std::cerr << "DnsResolver: invalid nameserver " << item << std::endl;
+			return false;
+		}
+		SetPort(addr, port);
+		servers.push_back(addr);
+	}
+	if(servers.empty())
+	{
+		return false;
+	}
+	m_servers.swap(servers);
+	return true;
+}
+
+bool DnsResolver::lookupHosts(const std::string& name, int family, std::vector<sockaddr_storage>& out)
+{
+	auto it = m_hosts.find(name);
+	if(it == m_hosts.end())
+	{
+		return false;
+	}
+	size_t before = out.size();
+	for(const sockaddr_storage& addr : it->second)
+	{
+		if(FamilyMatches(family, addr))
+		{
+			out.push_back(addr);
+		}
+	}
+	return out.size() > before;
+}
+
+int DnsResolver::queryServer(const sockaddr_storage& server, const std::string& name, const int* qtypes, int n, Result& result)
+{
+	int fd = socket(server.ss_family, SOCK_DGRAM, 0);
+	if(fd < 0)
+	{
+		return EIO;
+	}
+	// connect 之后内核只把这个服务器发来的报文交给我们
+	if(connect(fd, (const sockaddr*)&server, AddrLen(server)) != 0)
+	{
+		close(fd);
+		return EIO;
+	}
+
+	std::string packets[2];
+	uint16_t ids[2];
+	size_t question_len[2];
+	bool answered[2] = {false, false};
+	for(int i = 0; i < n; i++)
+	{
+		std::string& q = packets[i];
+		ids[i] = RandomId();
+		Put16(q, ids[i]);
+		Put16(q, 0x0100); // RD
+		Put16(q, 1); // QDCOUNT
+		Put16(q, 0);
+		Put16(q, 0);
+		Put16(q, 1); // ARCOUNT：EDNS0 的 OPT 记录
+		EncodeName(name, q);
+		Put16(q, qtypes[i]);
+		Put16(q, kClassIn);
+		question_len[i] = q.size() - 12;
+		q.push_back(0); // OPT 记录的名字为根
+		Put16(q, kTypeOpt);
+		Put16(q, kUdpSize);
+		Put16(q, 0); // 扩展 RCODE 和版本
+		Put16(q, 0);
+		Put16(q, 0); // RDLENGTH
+		if(send(fd, q.data(), q.size(), 0) < 0)
+		{
+			close(fd);
+			return EIO;
+		}
+	}
+
+	int error = 0;
+	int remaining = n;
+	uint64_t deadline = NowMs() + m_timeout;
+	uint8_t buf[kUdpSize + 512];
+	while(remaining)
+	{
+		uint64_t now = NowMs();
+		if(now >= deadline)
+		{
+			error = ETIMEDOUT;
+			break;
+		}
+		// 开启 hook 时这个超时由 FdCtx 记录，recv 挂起协程；没有开启时由内核实现
+		uint64_t left = deadline - now;
+		timeval tv = {(time_t)(left / 1000), (suseconds_t)(left % 1000 * 1000)};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		ssize_t len = recv(fd, buf, sizeof(buf), 0);
+		if(len < 0)
+		{
+			error = (errno == EAGAIN || errno == ETIMEDOUT) ? ETIMEDOUT : EIO;
+			break;
+		}
+		if(len < 12 || !(buf[2] & 0x80))
+		{
+			continue;
+		}
+		uint16_t id = Read16(buf);
+		int idx = -1;
+		for(int i = 0; i < n; i++)
+		{
+			// 问题部分必须和查询一致（名字不区分大小写），防止伪造的回复
+			if(!answered[i] && ids[i] == id && (size_t)len >= 12 + question_len[i] && strncasecmp((const char*)buf + 12, packets[i].data() + 12, question_len[i]) == 0)
+			{
+				idx = i;
+				break;
+			}
+		}
+		if(idx < 0)
+		{
+			continue;
+		}
+		answered[idx] = true;
+		remaining--;
+
+		int rcode = buf[3] & 0x0f;
+		if(rcode == 3)
+		{
+			// NXDOMAIN：名字不存在，另一个族的查询也不用等了
+			error = ENOENT;
+			break;
+		}
+		if(rcode != 0)
+		{
+			error = EIO;
+			break;
+		}
+		uint16_t ancount = Read16(buf + 6);
+		size_t pos = 12 + question_len[idx];
+		for(uint16_t i = 0; i < ancount; i++)
+		{
+			if(!SkipName(buf, len, pos) || pos + 10 > (size_t)len)
+			{
+				break;
+			}
+			int type = Read16(buf + pos);
+			int cls = Read16(buf + pos + 2);
+			uint32_t ttl = Read32(buf + pos + 4);
+			uint16_t rdlen = Read16(buf + pos + 8);
+			pos += 10;
+			if(pos + rdlen > (size_t)len)
+			{
+				break;
+			}
+			if(cls == kClassIn && (type == kTypeCname || type == qtypes[idx]))
+			{
+				// 缓存时间取整条 CNAME 链和所有地址记录中最小的 TTL
+				result.ttl = std::min(result.ttl, ttl);
+			}
+			sockaddr_storage addr;
+			if(cls == kClassIn && type == kTypeA && qtypes[idx] == kTypeA && rdlen == 4 && MakeAddr(AF_INET, buf + pos, addr))
+			{
+				result.addrs.push_back(addr);
+			}
+			else if(cls == kClassIn && type == kTypeAaaa && qtypes[idx] == kTypeAaaa && rdlen == 16 && MakeAddr(AF_INET6, buf + pos, addr))
+			{
+				result.addrs.push_back(addr);
+			}
+			pos += rdlen;
+		}
+	}
+	close(fd);
+
+	// 同时查 A 和 AAAA 时 IPv4 地址放在前面
+	std::stable_sort(result.addrs.begin(), result.addrs.end(), [](const sockaddr_storage& a, const sockaddr_storage& b)
+	{
+		return a.ss_family == AF_INET && b.ss_family != AF_INET;
+	});
+	if(!result.addrs.empty())
+	{
+		return 0;
+	}
+	return error ? error : ENOENT;
+}
+
+DnsResolver::Result DnsResolver::query(const std::string& name, int family)
+{
+	int qtypes[2];
+	int n = 0;
+	if(family != AF_INET6)
+	{
+		qtypes[n++] = kTypeA;
+	}
+	if(family != AF_INET)
+	{
+		qtypes[n++] = kTypeAaaa;
+	}
+
+	Result result;
+	result.error = ETIMEDOUT;
+	for(int attempt = 0; attempt < m_attempts; attempt++)
+	{
+		for(const sockaddr_storage& server : m_servers)
+		{
+			m_queries.fetch_add(1, std::memory_order_relaxed);
+			Result r;
+			r.ttl = m_maxTtl;
+			r.error = queryServer(server, name, qtypes, n, r);
+			// 拿到地址或者确定名字不存在时就结束，超时和服务器错误换下一个服务器
+			if(r.error == 0 || r.error == ENOENT)
+			{
+				return r;
+			}
+			result.error = r.error;
+		}
+	}
+	return result;
+}
+
+int DnsResolver::resolve(const std::string& raw_name, uint16_t port, std::vector<sockaddr_storage>& out, int family)
+{
+	out.clear();
+	sockaddr_storage literal;
+	if(ParseLiteral(raw_name, literal))
+	{
+		if(!FamilyMatches(family, literal))
+		{
+			return ENOENT;
+		}
+		SetPort(literal, port);
+		out.push_back(literal);
+		return 0;
+	}
+
+	std::string name = Normalize(raw_name);
+	std::string probe;
+	if(!EncodeName(name, probe))
+	{
+		return EINVAL;
+	}
+
+	int error;
+	if(lookupHosts(name, family, out))
+	{
+		error = 0;
+	}
+	else
+	{
+		std::string key = std::to_string(family) + ":" + name;
+		Shard& shard = m_shards[std::hash<std::string>()(key) % kShards];
+		bool in_fiber = is_hook_enable() && IOManager::GetThis();
+		std::shared_ptr<Inflight> flight;
+		bool leader = false;
+		bool hit = false;
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto it = shard.cache.find(key);
+			if(it != shard.cache.end())
+			{
+				if(it->second.expire_ms > NowMs())
+				{
+					m_cacheHits.fetch_add(1, std::memory_order_relaxed);
+					out = it->second.addrs;
+					error = it->second.error;
+					hit = true;
+				}
+				else
+				{
+					shard.cache.erase(it);
+				}
+			}
+			if(!hit && in_fiber)
+			{
+				std::shared_ptr<Inflight>& slot = shard.inflight[key];
+				if(!slot)
+				{
+					slot = std::make_shared<Inflight>();
+					leader = true;
+				}
+				flight = slot;
+			}
+		}
+
+		// 缓存没有命中时才需要查询，或者等别的协程查询的结果
+		if(!hit)
+		{
+			if(flight && !leader)
+			{
+				// 同一个名字已经有协程在查，等它的结果
+				m_coalesced.fetch_add(1, std::memory_order_relaxed);
+				flight->done.wait();
+				out = flight->addrs;
+				error = flight->error;
+			}
+			else
+			{
+				Result r = query(name, family);
+				uint32_t ttl = r.error == 0 ? std::min(r.ttl, m_maxTtl) : (r.error == ENOENT ? m_negativeTtl : 0);
+				std::lock_guard<std::mutex> lock(shard.mutex);
+				if(ttl)
+				{
+					if(shard.cache.size() >= kMaxEntriesPerShard)
+					{
+						// 缓存满了：先清掉过期的，还是满的话随便淘汰一个
+						uint64_t now = NowMs();
+						for(auto it = shard.cache.begin(); it != shard.cache.end();)
+						{
+							it = it->second.expire_ms <= now ? shard.cache.erase(it) : std::next(it);
+						}
+						if(shard.cache.size() >= kMaxEntriesPerShard)
+						{
+							shard.cache.erase(shard.cache.begin());
+						}
+					}
+					shard.cache[key] = CacheEntry{r.error, r.addrs, NowMs() + ttl * 1000ull};
+				}
+				if(flight)
+				{
+					flight->error = r.error;
+					flight->addrs = r.addrs;
+					shard.inflight.erase(key);
+					flight->done.done();
+				}
+				out.swap(r.addrs);
+				error = r.error;
+			}
+		}
+	}
+
+	for(sockaddr_storage& addr : out)
+	{
+		SetPort(addr, port);
+	}
+	return error;
+}
+
+int DnsResolver::resolveOne(const std::string& name, uint16_t port, sockaddr_storage& addr, socklen_t& len, int family)
+{
+	std::vector<sockaddr_storage> addrs;
+	int error = resolve(name, port, addrs, family);
+	if(error)
+	{
+		return error;
+	}
+	addr = addrs[0];
+	len = AddrLen(addr);
+	return 0;
+}
+
+void DnsResolver::clearCache()
+{
+	for(Shard& shard : m_shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.cache.clear();
+	}
+}
+
+}
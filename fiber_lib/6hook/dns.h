@@ -0,0 +1,118 @@
+#ifndef _DNS_H_
+#define _DNS_H_
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "fd_manager.h"
+#include "fiber_sync.h"
+
+namespace sylar {
+
+// 不阻塞工作线程的 DNS 解析：查询通过 hook 的 send / recv 走 UDP，等待回复时挂起的是当前协程
+// 查询顺序为 IP 字面量、/etc/hosts、缓存、名字服务器；结果按记录的最小 TTL 缓存在分片的缓存中（不存在的名字按 setNegativeTtl 缓存）
+// 同一个名字的并发查询只发一次，其余协程在 WaitGroup 上等第一个查询的结果
+// 名字服务器和 timeout / attempts 选项在构造时从 /etc/resolv.conf 读取；不做 search 域的补全，回复被截断（TC）时只使用其中已有的地址，不改用 TCP 重查
+// 在开启 hook 的协程之外调用时，收发是阻塞的（仍然有超时），也不合并并发查询；set* 要在开始解析之前调用
+class DnsResolver
+{
+public:
+	DnsResolver();
+
+	DnsResolver(const DnsResolver&) = delete;
+	DnsResolver& operator=(const DnsResolver&) = delete;
+
+	// 替换名字服务器，每一项为 "ip"、"ipv4:port" 或 "[ipv6]:port"，没有端口时为 53
+	bool setNameservers(const std::vector<std::string>& ips);
+	// 每次尝试等待回复的时间，默认为 resolv.conf 的 timeout（没有时为 1000ms）
+	void setTimeout(uint64_t ms) {m_timeout = ms;}
+	// 每个名字服务器的尝试次数，默认为 resolv.conf 的 attempts（没有时为 2）
+	void setAttempts(int n) {m_attempts = n > 0 ? n : 1;}
+	// 缓存时间的上限（秒），默认 300，0 为不缓存
+	void setMaxTtl(uint32_t s) {m_maxTtl = s;}
+	// 名字不存在或没有该族地址时的缓存时间（秒），默认 30
+	void setNegativeTtl(uint32_t s) {m_negativeTtl = s;}
+
+	// 把 name 解析为地址，每个地址的端口都填为 port；family 为 AF_INET、AF_INET6 或 AF_UNSPEC（两种都查，IPv4 在前）
+	// 返回 0 表示成功；ENOENT 为名字不存在或没有该族的地址，ETIMEDOUT 为名字服务器都没有回复，EINVAL 为名字不合法，EIO 为服务器出错
+	int resolve(const std::string& name, uint16_t port, std::vector<sockaddr_storage>& out, int family = AF_INET);
+	// 只取第一个地址，len 为对应族的 sockaddr 长度
+	int resolveOne(const std::string& name, uint16_t port, sockaddr_storage& addr, socklen_t& len, int family = AF_INET);
+
+	void clearCache();
+
+	uint64_t getQueryCount() const {return m_queries.load(std::memory_order_relaxed);}
+	uint64_t getCacheHits() const {return m_cacheHits.load(std::memory_order_relaxed);}
+	uint64_t getCoalescedCount() const {return m_coalesced.load(std::memory_order_relaxed);}
+
+	static socklen_t AddrLen(const sockaddr_storage& addr);
+
+private:
+	// 解析结果，地址的端口为 0
+	struct Result
+	{
+		int error = 0;
+		std::vector<sockaddr_storage> addrs;
+		uint32_t ttl = 0;
+	};
+
+	struct CacheEntry
+	{
+		int error;
+		std::vector<sockaddr_storage> addrs;
+		uint64_t expire_ms;
+	};
+
+	// 正在进行的查询：第一个协程负责查询，后来的协程等 done
+	struct Inflight
+	{
+		WaitGroup done{1};
+		int error = 0;
+		std::vector<sockaddr_storage> addrs;
+	};
+
+	static const size_t kShards = 16;
+	static const size_t kMaxEntriesPerShard = 1024;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, CacheEntry> cache;
+		std::unordered_map<std::string, std::shared_ptr<Inflight>> inflight;
+	};
+
+	void loadResolvConf();
+	void loadHosts();
+	bool lookupHosts(const std::string& name, int family, std::vector<sockaddr_storage>& out);
+	// 依次向各个名字服务器查询
+	Result query(const std::string& name, int family);
+	// 向一个名字服务器发出 qtypes 中的查询并收齐回复
+	int queryServer(const sockaddr_storage& server, const std::string& name, const int* qtypes, int n, Result& result);
+
+private:
+	std::vector<sockaddr_storage> m_servers;
+	uint64_t m_timeout = 1000;
+	int m_attempts = 2;
+	uint32_t m_maxTtl = 300;
+	uint32_t m_negativeTtl = 30;
+
+	// /etc/hosts：小写的名字 -> 地址，构造后只读
+	std::unordered_map<std::string, std::vector<sockaddr_storage>> m_hosts;
+	Shard m_shards[kShards];
+
+	std::atomic<uint64_t> m_queries = {0};
+	std::atomic<uint64_t> m_cacheHits = {0};
+	std::atomic<uint64_t> m_coalesced = {0};
+};
+
+typedef Singleton<DnsResolver> DnsMgr;
+
+}
+
+#endif
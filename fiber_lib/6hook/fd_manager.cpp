@@ -7,19 +7,23 @@
 
 namespace sylar{
 
-template class Singleton<FdManager>; // FdManager 类有一个全局唯一的单例实例
-
 // 以下四行行代码定义了 Singleton 类模板的静态成员变量 instance 和 mutex，静态成员变量需要在类外部定义和初始化
 template<typename T>
-T* Singleton<T>::instance = nullptr;
+std::atomic<T*> Singleton<T>::instance = {nullptr};
 
 template<typename T>
 std::mutex Singleton<T>::mutex;	
 
+template class Singleton<FdManager>; // FdManager 类有一个全局唯一的单例实例
+
 FdCtx::FdCtx(int fd):
 m_fd(fd)
 {
-	init();
+	m_io.fd = fd;
+	if(fd >= 0) // 表中预先分配的记录在 FdManager 创建时才初始化
+	{
+		init();
+	}
 }
 
 FdCtx::~FdCtx()
@@ -40,11 +44,13 @@ bool FdCtx::init()
 	{
 		m_isInit = false;
 		m_isSocket = false;
+		m_isFile = false;
 	}
 	else
 	{
 		m_isInit = true;	
 		m_isSocket = S_ISSOCK(statbuf.st_mode);	// S_ISSOCK() 用于判断文件类型是否为套接字
+		m_isFile = S_ISREG(statbuf.st_mode) || S_ISBLK(statbuf.st_mode);
 	}
 
 	if(m_isSocket) // 如果是套接字，就设置为非阻塞
@@ -64,6 +70,51 @@ bool FdCtx::init()
 	return m_isInit; // 返回初始化是否成功
 }
 
+// 读取内核中套接字的 SO_RCVTIMEO / SO_SNDTIMEO（毫秒），没有设置（0）或读取失败时返回 -1 表示不超时
+static uint64_t KernelTimeout(int fd, int optname)
+{
+	timeval tv = {0, 0};
+	socklen_t len = sizeof(tv);
+	if(getsockopt_f(fd, SOL_SOCKET, optname, &tv, &len) == -1 || (tv.tv_sec == 0 && tv.tv_usec == 0))
+	{
+		return (uint64_t)-1;
+	}
+	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void FdCtx::reset(InitMode mode)
+{
+	m_isInit = false;
+	m_isSocket = false;
+	m_isFile = false;
+	m_sysNonblock = false;
+	m_userNonblock = false;
+	m_isClosed = false;
+	m_recvTimeout = (uint64_t)-1;
+	m_sendTimeout = (uint64_t)-1;
+	if(mode == INIT_SOCKET)
+	{
+		m_isInit = true;
+		m_isSocket = true;
+		m_sysNonblock = true;
+		return;
+	}
+
+	int flags = mode == INIT_ADOPT ? fcntl_f(m_fd, F_GETFL, 0) : 0;
+	init(); // 重新判断是不是套接字、设置非阻塞
+	if(mode == INIT_ADOPT)
+	{
+		m_isFile = false; // 只有 hook 的 open 打开的文件才交给线程池
+		m_userNonblock = m_isSocket && flags != -1 && (flags & O_NONBLOCK);
+		// 在 hook 之外通过 setsockopt 设置的超时只在内核里，fd 被设置为非阻塞之后内核不再使用它，由 hook 接管
+		if(m_isSocket)
+		{
+			m_recvTimeout = KernelTimeout(m_fd, SO_RCVTIMEO);
+			m_sendTimeout = KernelTimeout(m_fd, SO_SNDTIMEO);
+		}
+	}
+}
+
 // 设置该 fd 的超时时间，type 指定超时类型，包括读事件超时 SO_RCVTIMEO 和写事件超时 SO_SNDTIMEO，v 代表设置的毫秒级超时时间 
 void FdCtx::setTimeout(int type, uint64_t v)
 {
@@ -90,62 +141,100 @@ uint64_t FdCtx::getTimeout(int type)
 	}
 }
 
-FdManager::FdManager()
+FdManager::FdManager():
+m_datas([](FdCtx& ctx, int fd){ctx.m_fd = fd; ctx.m_io.fd = fd;})
 {
-	m_datas.resize(64); // 给 std::vector<std:shared ptr<FdCtx>>m datas 数组分配空间 
 }
 
-// 用于获取 m_datas 数组中指定 fd 对应的 FdCtx 对象
-std::shared_ptr<FdCtx> FdManager::get(int fd, bool auto_create)
+// 用于获取 m_datas 表中指定 fd 对应的 FdCtx 对象
+FdCtx* FdManager::get(int fd, bool auto_create)
 {
 	if(fd == -1) // 文件描述符无效则直接返回
 	{
 		return nullptr;
 	}
 
-	std::shared_lock<std::shared_mutex> read_lock(m_mutex); // 获取读锁
+	// fd 所在的块还没分配，并且 auto_create 为 false，则返回 nullptr，表示没有创建新对象的需求
+	FdCtx* ctx = m_datas.get(fd, auto_create);
+	if(!ctx)
+	{
+		return nullptr;
+	}
 
-	// 如果 fd 超出了 m_datas 的范围（fd 是 m_datas 数组的下标），并且 auto_create 为 false，则返回 nullptr，表示没有创建新对象的需求
-	if(m_datas.size() <= fd) 
+	// 对象已经存在，或者即使不存在也不打算自动创建，则直接返回（可能是 nullptr）
+	bool live = ctx->m_live.load(std::memory_order_acquire);
+	if(live || !auto_create)
 	{
-		if(auto_create == false)
-		{
-			return nullptr;
-		}
+		return live ? ctx : nullptr;
 	}
-	else 
-	// 如果没超出 m_datas 的范围且该 fd 对应的 FdCtx 存在，或者即使不存在也不打算自动创建，则返回该 FdCtx 对象指针（可能是 nullptr）
+
+	return create(fd, FdCtx::INIT_PROBE);
+}
+
+FdCtx* FdManager::addSocket(int fd)
+{
+	if(fd < 0)
 	{
-		if(m_datas[fd] || !auto_create)
-		{
-			return m_datas[fd];
-		}
+		return nullptr;
+	}
+	FdCtx* ctx = m_datas.get(fd, true);
+	if(!ctx || ctx->m_live.load(std::memory_order_acquire))
+	{
+		return ctx;
 	}
+	return create(fd, FdCtx::INIT_SOCKET);
+}
 
-	// 当 fd 的大小超出了 m_data.size 的值，也就是 m_datas[fd] 数组中没找到对应的 FdCtx，并且 auto_create 为 true 时会走到这里
-	read_lock.unlock(); // 释放读锁
-	std::unique_lock<std::shared_mutex> write_lock(m_mutex); // 获取写锁
+FdCtx* FdManager::lookup(int fd)
+{
+	FdCtx* ctx = get(fd);
+	if(ctx || fd < 0)
+	{
+		return ctx;
+	}
+	return create(fd, FdCtx::INIT_ADOPT);
+}
 
-	if(m_datas.size() <= fd)
+FdCtx* FdManager::create(int fd, FdCtx::InitMode mode)
+{
+	FdCtx* ctx = m_datas.get(fd, true);
+	if(!ctx)
 	{
-		m_datas.resize(fd * 1.5); // 先扩展数组大小
+		return nullptr;
 	}
-	m_datas[fd] = std::make_shared<FdCtx>(fd); // 然后通过 make_shared 安全创建 FdCtx 对象指针存放到 m_datas 数组中 
-	
-	return m_datas[fd];
+	// 需要创建时才加锁，加锁后再检查一次，避免重复初始化
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!ctx->m_live.load(std::memory_order_relaxed))
+	{
+		ctx->reset(mode);
+		if(mode == FdCtx::INIT_ADOPT && !ctx->m_isInit) // fd 无效，不留下记录，这个 fd 以后被重新创建时再判断
+		{
+			return nullptr;
+		}
+		ctx->m_live.store(true, std::memory_order_release);
+	}
+	return ctx;
 }
 
 // 删除指定 fd 的 FdCtx 对象 
 void FdManager::del(int fd)
 {
-	std::unique_lock<std::shared_mutex> write_lock(m_mutex); // 获取写锁
-	if(m_datas.size() <= fd)
+	FdCtx* ctx = m_datas.get(fd, false);
+	if(!ctx)
 	{
 		return;
 	}
 
-	// reset() 用于释放 shared_ptr 所管理的对象，减少引用计数，并将智能指针置为 nullptr，当引用计数为0时销毁对象
-	m_datas[fd].reset();
+	// 只是不再对外可见，记录本身保留在表中，已经拿到它的调用者仍然可以安全访问
+	// 不需要和 create 互斥：fd 编号在 close 之前不会被复用，同一个 fd 不会同时在创建和删除
+	ctx->m_live.store(false, std::memory_order_release);
+
+	// 代数跳过 0，0 留给 IOManager 内部 fd 的 epoll 注册
+	uint32_t gen = ctx->m_io.generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+	if(gen == 0)
+	{
+		ctx->m_io.generation.compare_exchange_strong(gen, 1, std::memory_order_acq_rel);
+	}
 }
 
-}
\ No newline at end of file
+}
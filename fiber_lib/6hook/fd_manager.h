@@ -2,35 +2,49 @@
 #define _FD_MANAGER_H_
 
 #include <memory>
-#include <shared_mutex>
+#include <mutex>
+#include <atomic>
 #include "thread.h"
+#include "ioscheduler.h"
+#include "fd_table.h"
 
 
 namespace sylar{
  
 
-// FdCtx 类主要用于记录与文件描述符相关的状态和操作，比如 fd 的非阻塞信息，包括用户显式设置的非阻塞和 hook 内部设置的非阻塞
-class FdCtx : public std::enable_shared_from_this<FdCtx>
+// FdCtx 是每个 fd 唯一的记录：fd 的非阻塞信息（包括用户显式设置的非阻塞和 hook 内部设置的非阻塞）、超时时间，以及 IOManager 中的事件和等待者
+// 按缓存行对齐，hook 的一次 IO 用到的状态都在同一个记录里，不会和相邻 fd 的记录伪共享
+class alignas(64) FdCtx
 {
+	friend class FdManager;
+	friend class IOManager;
+
 private:
 	bool m_isInit = false; // 标记文件描述符是否已初始化 
 	bool m_isSocket = false; // 标记文件描述符是否是一个套接字 
+	bool m_isFile = false; // 是否是普通文件或块设备：读写会阻塞在磁盘上，epoll 等不到它们的事件
 	bool m_sysNonblock = false; // 标记文件描述符是否设置为系统非阻塞模式
 	bool m_userNonblock = false; // 标记文件描述符是否设置为用户非阻塞模式 
 	bool m_isClosed = false; // 标记文件描述符是否已关闭 
+	std::atomic<bool> m_live = {false}; // 是否已经被 FdManager 创建（对 get() 可见），del 之后为 false
 	int m_fd; // 文件描述符的整数值
 
 	uint64_t m_recvTimeout = (uint64_t)-1; // 读事件的超时时间，默认为-1表示没有超时限制
 	uint64_t m_sendTimeout = (uint64_t)-1; // 写事件的超时时间，默认为-1表示没有超时限制
 
+	IOManager::FdContext m_io; // fd 在 IOManager 中注册的事件和等待者，由 IOManager 使用，与 m_live 无关
+
 public:
-	FdCtx(int fd);
+	explicit FdCtx(int fd = -1);
 	~FdCtx();
 
 	bool init(); // 初始化 FdCtx 对象
 	bool isInit() const {return m_isInit;}
 	bool isSocket() const {return m_isSocket;}
+	bool isFile() const {return m_isFile;}
 	bool isClosed() const {return m_isClosed;}
+	// 记录的代数，hook 的 close 时加一；等待之前记下，被唤醒后不相等说明 fd 在等待期间被关闭了
+	uint32_t getGeneration() const {return m_io.generation.load(std::memory_order_acquire);}
 
 	// 设置和获取用户层面的非阻塞状态 
 	void setUserNonblock(bool v) {m_userNonblock = v;}
@@ -43,6 +57,18 @@ public:
 	// 设置和获取超时时间，type 用于区分读事件和写事件，v表示毫秒时间
 	void setTimeout(int type, uint64_t v);
 	uint64_t getTimeout(int type);
+
+private:
+	// 创建记录时调用者已经知道多少
+	enum InitMode
+	{
+		INIT_PROBE, // 一无所知：fstat 判断类型，套接字 fcntl 设置非阻塞
+		INIT_SOCKET, // 已经知道是设置了非阻塞的套接字（SOCK_NONBLOCK / accept4 创建），不再调用 fstat / fcntl
+		INIT_ADOPT // 在 hook 之外创建、第一次经过 hook 的 IO 时才登记的 fd
+	};
+
+	// 把 fd 相关的标志和超时恢复成初始值，再按 mode 重新初始化，用于同一个记录被新的 fd 复用
+	void reset(InitMode mode);
 };
 
 
@@ -53,23 +79,42 @@ public:
 	FdManager();
 
 	// 获取指定文件描述符的 FdCtx 对象，如果 auto_create 为 true，表示如果不存在就自动创建新的 FdCtx 对象
-	std::shared_ptr<FdCtx> get(int fd, bool auto_create = false);
+	// 查找不加锁、不涉及引用计数；FdCtx 由 FdManager 保存到进程结束，返回的指针一直有效
+	FdCtx* get(int fd, bool auto_create = false);
+
+	// 登记一个已经是非阻塞的套接字（accept4 / socket 带 SOCK_NONBLOCK 创建的 fd），和 get(fd, true) 相同，但省掉 fstat 和 fcntl 两次系统调用
+	FdCtx* addSocket(int fd);
 
-	// 删除指定文件描述符的 Fdctx 对象
+	// hook 的 IO 查找 fd 的记录：没有登记过的 fd（socketpair、在 hook 之外创建的套接字等）在这里第一次 fstat 并登记，之后查找不再有系统调用
+	// 原来就是非阻塞的套接字记为用户设置的非阻塞，不改变调用者的 EAGAIN 语义；普通文件不交给阻塞调用线程池；fd 无效时返回 nullptr
+	FdCtx* lookup(int fd);
+
+	// 删除指定文件描述符的 Fdctx 对象，之后 get(fd) 返回 nullptr，记录留给同一个 fd 下一次创建时复用
+	// 同时增加记录的代数，旧 fd 残留的 epoll 事件被丢弃，还在等待的协程醒来后返回 EBADF；不加锁
 	void del(int fd);
 
+	// 获取 fd 的记录，不管 FdManager 有没有创建过它（IOManager 可以在任意 fd 上注册事件），fd 超出范围时返回 nullptr
+	FdCtx* record(int fd, bool create) {return m_datas.get(fd, create);}
+
+	// 对每个已经分配的记录调用 cb
+	template<class Callback>
+	void forEach(Callback cb) {m_datas.forEach(cb);}
+
+private:
+	FdCtx* create(int fd, FdCtx::InitMode mode);
+
 private:
-	std::shared_mutex m_mutex; // 读写锁，用于保护对 m_datas 的访问，支持共享读锁和独占写锁
-	std::vector<std::shared_ptr<FdCtx>> m_datas; // 存储所有 Fdctx 对象的共享指针
+	std::mutex m_mutex; // 只保护创建，查找和删除不加锁
+	FdTable<FdCtx> m_datas; // 下标为 fd
 };
 
-// 懒汉模式 + 互斥锁实现了单例模式，确保一个类只有一个实例，提供全局访问点，并保证线程安全
+// 懒汉模式单例：实例创建之后 GetInstance 只是一次原子读，不加锁；只有第一次创建时用双重检查加锁，保证只创建一个实例
 template<typename T>
 class Singleton
 {
 private:
-    static T* instance; // 对外提供的实例对象
-    static std::mutex mutex; // 互斥锁
+    static std::atomic<T*> instance; // 对外提供的实例对象
+    static std::mutex mutex; // 互斥锁，只用于创建和销毁
 
 protected:
     Singleton() {}  
@@ -82,20 +127,25 @@ public:
 	// 提供对外的访问点
     static T* GetInstance() 
     {
-        std::lock_guard<std::mutex> lock(mutex); // 加锁确保线程安全
-        if(instance == nullptr) 
+        T* p = instance.load(std::memory_order_acquire);
+        if(p == nullptr) 
         {
-            instance = new T();
+            std::lock_guard<std::mutex> lock(mutex); // 加锁后再检查一次，避免重复创建
+            p = instance.load(std::memory_order_relaxed);
+            if(p == nullptr)
+            {
+                p = new T();
+                instance.store(p, std::memory_order_release);
+            }
         }
-        return instance;
+        return p;
     }
 
-	// 销毁实例
+	// 销毁实例，调用者需要保证此时没有其他线程在使用它
     static void DestroyInstance() 
     {
         std::lock_guard<std::mutex> lock(mutex);
-        delete instance;
-        instance = nullptr; // 防止野指针
+        delete instance.exchange(nullptr); // 置空防止野指针
     } 
 };
 
@@ -0,0 +1,111 @@
+#ifndef __SYLAR_FD_TABLE_H__
+#define __SYLAR_FD_TABLE_H__
+
+#include <atomic>
+#include <functional>
+
+namespace sylar {
+
+/**
+ * 按 fd 下标访问的分段表，FdManager 用它存放每个 fd 的 FdCtx 记录
+ * 表由固定大小的块组成，块在第一次访问到其中的 fd 时才分配，用 CAS 安装到块指针数组中，之后直到表析构都不会移动或释放
+ * 所以查找只需要一次原子读，不加锁；已经拿到的元素指针在表的整个生命周期内都有效
+ * 超过 kMaxFd 的 fd 返回 nullptr
+ */
+template<class T>
+class FdTable
+{
+public:
+    static const int kChunkBits = 8; // 每块 256 个元素
+    static const int kChunkSize = 1 << kChunkBits;
+    static const int kMaxChunks = 4096;
+    static const int kMaxFd = kChunkSize * kMaxChunks; // 最多支持约 100 万个 fd
+
+    // init 在块分配时对其中每个元素调用一次，参数为元素和它对应的 fd
+    explicit FdTable(std::function<void(T&, int)> init = nullptr):
+    m_init(std::move(init))
+    {
+        for(auto& chunk : m_chunks)
+        {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable()
+    {
+        for(auto& chunk : m_chunks)
+        {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    FdTable(const FdTable&) = delete;
+    FdTable& operator=(const FdTable&) = delete;
+
+    // 返回 fd 对应的元素，所在的块还没分配时，create 为 true 就分配，否则返回 nullptr
+    T* get(int fd, bool create = false)
+    {
+        if(fd < 0 || fd >= kMaxFd)
+        {
+            return nullptr;
+        }
+        int index = fd >> kChunkBits;
+        T* chunk = m_chunks[index].load(std::memory_order_acquire);
+        if(!chunk)
+        {
+            if(!create)
+            {
+                return nullptr;
+            }
+            chunk = allocChunk(index);
+        }
+        return &chunk[fd & (kChunkSize - 1)];
+    }
+
+    // 对每个已经分配的块中的每个元素调用 cb，与并发的 get 同时进行时，之后才分配的块可能不会被遍历到
+    template<class Callback>
+    void forEach(Callback cb)
+    {
+        for(auto& slot : m_chunks)
+        {
+            T* chunk = slot.load(std::memory_order_acquire);
+            if(!chunk)
+            {
+                continue;
+            }
+            for(int i = 0; i < kChunkSize; i++)
+            {
+                cb(chunk[i]);
+            }
+        }
+    }
+
+private:
+    // 多个线程同时分配同一块时，只有一个能安装成功，其余的释放自己分配的块，使用已经安装的那个
+    T* allocChunk(int index)
+    {
+        T* chunk = new T[kChunkSize];
+        if(m_init)
+        {
+            for(int i = 0; i < kChunkSize; i++)
+            {
+                m_init(chunk[i], index * kChunkSize + i);
+            }
+        }
+        T* expected = nullptr;
+        if(!m_chunks[index].compare_exchange_strong(expected, chunk, std::memory_order_acq_rel))
+        {
+            delete[] chunk;
+            return expected;
+        }
+        return chunk;
+    }
+
+private:
+    std::function<void(T&, int)> m_init;
+    std::atomic<T*> m_chunks[kMaxChunks];
+};
+
+}
+
+#endif
@@ -1,4 +1,13 @@
 #include "fiber.h"
+#include "thread.h"
+#include "metrics.h"
+
+#include <vector>
+#include <cstring>
+#include <thread>
+#ifdef SYLAR_CONTEXT_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
 
 static bool debug = false;
 
@@ -16,6 +25,68 @@ static thread_local Fiber* t_scheduler_fiber = nullptr;
 
 static std::atomic<uint64_t> s_fiber_id{0}; // 全局协程ID计数器
 static std::atomic<uint64_t> s_fiber_count{0}; // 活跃协程计数器
+static std::atomic<size_t> s_stack_bytes{0}; // 私有协程栈的内存总量
+static std::atomic<Fiber::ExceptionHandler> s_exception_handler{nullptr}; // 未捕获异常的处理函数，nullptr 为默认处理
+static std::atomic<uint64_t> s_exception_count{0}; // 因未捕获异常而结束的协程数
+
+static const uint32_t s_default_stacksize = 128000; // 默认栈大小
+
+// 协程缓存
+struct FiberPool
+{
+	std::vector<std::shared_ptr<Fiber>> fibers; // 已终止、可以直接 reset 复用的协程
+	size_t low_water = 0; // 自上次回收以来缓存的最小长度，即这段时间内一直没有被用到的协程数
+};
+static thread_local FiberPool t_fiber_pool;
+
+static std::atomic<size_t> s_pool_per_thread{128}; // 每个线程最多缓存的协程数
+static std::atomic<size_t> s_pool_total_bytes{64 * 1024 * 1024}; // 所有线程缓存的栈内存总量上限
+static std::atomic<size_t> s_pool_bytes{0}; // 当前所有线程缓存的栈内存总量
+
+// 线程的共享栈：同一时刻只有一个共享栈协程（occupant）的栈内容真正放在上面
+// 协程对象持有它的 shared_ptr，所以线程退出后仍被挂起的协程也能安全析构
+struct SharedStack
+{
+	char* base = nullptr;
+	size_t size = 0;
+	std::mutex mutex; // 保护 occupant，占用者可能在其他线程上被析构
+	Fiber* occupant = nullptr;
+
+	~SharedStack();
+};
+
+static MmapStackAllocator s_shared_stack_allocator(false); // 共享栈按需提交物理页，栈底有保护页
+static std::atomic<size_t> s_shared_stack_size{1024 * 1024}; // 共享栈大小
+static thread_local std::shared_ptr<SharedStack> t_shared_stack;
+static thread_local int t_thread_id = -1; // 缓存当前线程ID，避免每次都调用 gettid
+
+SharedStack::~SharedStack()
+{
+	s_shared_stack_allocator.dealloc(base, size);
+}
+
+// 协程局部变量每个槽位的销毁函数，槽位号只分配不回收
+static void (*s_local_destroy[Fiber::kMaxLocals])(void*);
+static std::atomic<size_t> s_local_slots{0};
+
+// 获取当前线程的共享栈，第一次使用时创建
+static const std::shared_ptr<SharedStack>& GetSharedStack()
+{
+	if(!t_shared_stack)
+	{
+		std::shared_ptr<SharedStack> ss = std::make_shared<SharedStack>();
+		ss->size = s_shared_stack_size;
+		ss->base = (char*)s_shared_stack_allocator.alloc(ss->size);
+		if(!ss->base)
+		{
+			std::cerr << "GetSharedStack() alloc shared stack failed\n";
+			pthread_exit(NULL);
+		}
+		t_shared_stack = ss;
+		t_thread_id = Thread::GetThreadId();
+	}
+	return t_shared_stack;
+}
 
 // 设置当前运行的协程
 void Fiber::SetThis(Fiber *f)
@@ -63,14 +134,66 @@ uint64_t Fiber::GetFiberId()
 	return (uint64_t)-1; // 返回-1，并且是(Uint64_t)-1，会转换成UINT64_max，用来表示错误的情况
 }
 
+Fiber* Fiber::GetThisPtr()
+{
+	if(!t_fiber)
+	{
+		GetThis();
+	}
+	return t_fiber;
+}
+
+size_t Fiber::AllocLocalSlot(void (*destroy)(void*))
+{
+	size_t slot = s_local_slots++;
+	assert(slot < kMaxLocals && "too many FiberLocal");
+	s_local_destroy[slot] = destroy;
+	return slot;
+}
+
+void Fiber::setLocal(size_t slot, void* value)
+{
+	m_hasLocals = true;
+	if(slot < kInlineLocals)
+	{
+		m_locals[slot] = value;
+		return;
+	}
+	slot -= kInlineLocals;
+	if(slot >= m_moreLocals.size())
+	{
+		m_moreLocals.resize(slot + 1, nullptr);
+	}
+	m_moreLocals[slot] = value;
+}
+
+void Fiber::clearLocals()
+{
+	// 销毁函数里可能又访问了别的 FiberLocal，重新创建出值来，循环到没有值为止
+	while(m_hasLocals)
+	{
+		m_hasLocals = false;
+		for(size_t i = kInlineLocals + m_moreLocals.size(); i-- > 0; )
+		{
+			void*& value = i < kInlineLocals ? m_locals[i] : m_moreLocals[i - kInlineLocals];
+			if(value)
+			{
+				void* v = value;
+				value = nullptr;
+				s_local_destroy[i](v);
+			}
+		}
+	}
+}
+
 // 创建主协程，设置状态，初始化上下文，并分配ID 
 Fiber::Fiber() // 定义为 private，只能被 GetThis()调用，不允许类外调用
 {
 	SetThis(this); // 将新创建的 fiber 对象设置为 t_fiber 
 	m_state = RUNNING; // 设置协程的状态为运行（因为是主协程，直接跑起来即可）
 	
-	// 若返回值为0，表示 getcontext() 成功地保存了当前协程的上下文
-	if(getcontext(&m_ctx))
+	// 初始化当前执行流的上下文，ucontext 后端会调用 getcontext() 保存当前协程的上下文
+	if(!m_ctx.init())
 	{
 		std::cerr << "Fiber() failed\n";
 		pthread_exit(NULL);
@@ -83,26 +206,42 @@ Fiber::Fiber() // 定义为 private，只能被 GetThis()调用，不允许类
 
 // 创建一个新协程并指定其入口函数、栈的大小和是否受调度，初始化 ucontext_t上下文，分配栈空间，并通过 make 将上下文与入口函数绑定
 // 当 set 或 swap 激活上下文 m_ctx 时，会执行该入口函数
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler):
-m_cb(cb), m_runInScheduler(run_in_scheduler)
+Fiber::Fiber(InlineFunction cb, size_t stacksize, bool run_in_scheduler, StackAllocator* allocator, bool shared_stack):
+m_cb(std::move(cb)), m_runInScheduler(run_in_scheduler)
 {
 	m_state = READY; // 初始化状态为就绪
 
+#ifdef SYLAR_CONTEXT_HAS_SP
+	// 共享栈模式不分配私有栈，上下文要等第一次占用共享栈时才能构造
+	if(shared_stack)
+	{
+		m_useSharedStack = true;
+		m_needMake = true;
+		m_id = s_fiber_id++;
+		s_fiber_count++;
+		if(debug) std::cout << "Fiber(): shared stack child id = " << m_id << std::endl;
+		return;
+	}
+#endif
+
 	// 分配协程栈空间
-	m_stacksize = stacksize ? stacksize : 128000;
-	m_stack = malloc(m_stacksize);
+	m_stacksize = stacksize ? stacksize : s_default_stacksize;
+	m_allocator = allocator ? allocator : StackAllocator::GetDefault();
+	m_stack = m_allocator->alloc(m_stacksize);
+	if(!m_stack)
+	{
+		std::cerr << "Fiber(InlineFunction cb, size_t stacksize, bool run_in_scheduler) alloc stack failed\n";
+		pthread_exit(NULL);
+	}
+	s_stack_bytes += m_stacksize;
 
-	if(getcontext(&m_ctx)) // 存储协程上下文
+	// 在协程栈上构造上下文并与入口函数绑定，运行完该协程入口函数后，协程退出并调用一次 yield 返回主协程 
+	if(!m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc))
 	{
-		std::cerr << "Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler) failed\n";
+		std::cerr << "Fiber(InlineFunction cb, size_t stacksize, bool run_in_scheduler) failed\n";
 		pthread_exit(NULL);
 	}
 	
-	m_ctx.uc_link = nullptr; // 因为没有设置后继，所以在运行完该协程入口函数后，协程退出并调用一次 yield 返回主协程 
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
-	makecontext(&m_ctx, &Fiber::MainFunc, 0); // 将上下文与入口函数绑定
-	
 	m_id = s_fiber_id++;
 	s_fiber_count++;
 	if(debug) std::cout << "Fiber(): child id = " << m_id << std::endl;
@@ -110,48 +249,230 @@ m_cb(cb), m_runInScheduler(run_in_scheduler)
 
 Fiber::~Fiber()
 {
+	clearLocals(); // 挂起期间被销毁的协程，以及线程的主协程，局部变量在这里销毁
 	s_fiber_count--; // 活跃的协程数量-1
 	if(m_stack) // 有独立栈，说明是子协程（关于主协程的析构还没实现）
 	{
-		free(m_stack);
+		m_allocator->dealloc(m_stack, m_stacksize);
+		s_stack_bytes -= m_stacksize;
+	}
+	if(m_sharedStack) // 共享栈协程，如果还占着共享栈需要让出来
+	{
+		detachSharedStack();
 	}
+	free(m_saveBuf);
 	if(debug) std::cout << "~Fiber(): id = " << m_id << std::endl;	
 }
  
 // 复用一个已终止的协程对象：重置协程的入口函数，重新设置上下文，将协程状态从 TERM 改为 READY，从而避免频繁创建和销毁对象带来的开销
-void Fiber::reset(std::function<void()> cb)
+void Fiber::reset(InlineFunction cb)
 {
-	assert(m_stack != nullptr && m_state == TERM); 
+	assert((m_stack != nullptr || m_useSharedStack) && isFinished()); 
 
+	clearLocals();
 	m_state = READY;
-	m_cb = cb;
+	m_cb.swap(cb);
+	m_id = s_fiber_id++; // 复用的协程相当于一个新的协程，重新分配ID
 
-	if(getcontext(&m_ctx))
+	// 共享栈协程的上下文等到下次占用共享栈时再构造
+	if(m_useSharedStack)
+	{
+		m_needMake = true;
+		m_saveSize = 0;
+		return;
+	}
+
+	// m_ctx 在构造时已经初始化过，这里只需要重新绑定入口函数和栈
+	// ucontext 后端也不会再调用 getcontext，省掉一次保存信号掩码的系统调用
+	if(!m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc))
 	{
 		std::cerr << "reset() failed\n";
 		pthread_exit(NULL);
 	}
+}
+
+std::shared_ptr<Fiber> Fiber::GetPooled(InlineFunction cb)
+{
+	FiberPool& pool = t_fiber_pool;
+	std::shared_ptr<Fiber> fiber;
+	while(!pool.fibers.empty() && !fiber)
+	{
+		fiber = std::move(pool.fibers.back());
+		pool.fibers.pop_back();
+		pool.low_water = std::min(pool.low_water, pool.fibers.size());
+		s_pool_bytes -= fiber->m_stacksize;
+
+		// 默认分配器在缓存期间被替换过，旧分配器的协程不再复用
+		if(fiber->m_allocator != StackAllocator::GetDefault())
+		{
+			fiber.reset();
+		}
+	}
+
+	if(!fiber)
+	{
+		return std::make_shared<Fiber>(std::move(cb));
+	}
+
+	fiber->reset(std::move(cb));
+	return fiber;
+}
+
+void Fiber::ReturnToPool(std::shared_ptr<Fiber>&& fiber)
+{
+	// 只缓存没有其他持有者的默认协程，用户自己还持有的协程不能被偷偷复用
+	if(!fiber || !fiber->isFinished() || fiber.use_count() != 1 
+		|| !fiber->m_runInScheduler || fiber->m_useSharedStack || fiber->m_stacksize != s_default_stacksize
+		|| fiber->m_allocator != StackAllocator::GetDefault())
+	{
+		fiber.reset();
+		return;
+	}
+
+	FiberPool& pool = t_fiber_pool;
+	if(pool.fibers.size() >= s_pool_per_thread || s_pool_bytes + fiber->m_stacksize > s_pool_total_bytes)
+	{
+		fiber.reset(); // 超过缓存上限，直接释放
+		return;
+	}
+
+	// 协程在缓存中不会运行，让分配器有机会归还栈占用的物理内存
+	fiber->m_allocator->release(fiber->m_stack, fiber->m_stacksize);
+
+	s_pool_bytes += fiber->m_stacksize;
+	pool.fibers.push_back(std::move(fiber));
+}
+
+void Fiber::TrimPool()
+{
+	FiberPool& pool = t_fiber_pool;
+
+	// 释放一半在上一段时间内从未被用到的协程，负载下降后缓存会逐步收缩，突发流量时又能保留足够的协程
+	size_t release = (pool.low_water + 1) / 2;
+	for(size_t i = 0; i < release && !pool.fibers.empty(); i++)
+	{
+		s_pool_bytes -= pool.fibers.back()->m_stacksize;
+		pool.fibers.pop_back();
+	}
+	pool.low_water = pool.fibers.size();
+}
+
+void Fiber::SetPoolCapacity(size_t per_thread, size_t total_bytes)
+{
+	s_pool_per_thread = per_thread;
+	s_pool_total_bytes = total_bytes;
+}
+
+void Fiber::SetSharedStackSize(size_t size)
+{
+	s_shared_stack_size = size;
+}
+
+void Fiber::attachSharedStack()
+{
+	const std::shared_ptr<SharedStack>& ss = GetSharedStack();
+	if(!m_sharedStack)
+	{
+		m_sharedStack = ss;
+		m_homeThread = t_thread_id;
+	}
+	// 栈上保存的是共享栈的绝对地址，换一个线程的共享栈恢复会破坏所有指向栈上的指针
+	assert(m_sharedStack == ss);
+	// 拷贝共享栈时当前执行流不能运行在共享栈上
+	assert(!t_fiber || !t_fiber->m_useSharedStack);
+
+	std::lock_guard<std::mutex> lock(ss->mutex);
+	if(ss->occupant == this)
+	{
+		return;
+	}
+	if(ss->occupant)
+	{
+		ss->occupant->saveSharedStack();
+	}
+	ss->occupant = this;
+
+	if(m_needMake)
+	{
+		m_needMake = false;
+		if(!m_ctx.make(ss->base, ss->size, &Fiber::MainFunc))
+		{
+			std::cerr << "attachSharedStack() failed\n";
+			pthread_exit(NULL);
+		}
+	}
+	else
+	{
+		// 把之前保存的栈拷贝回原来的位置：[栈顶 - m_saveSize, 栈顶)
+		// ASan 下这段内存上还留着上一个占用者的栈帧红区，拷贝前先清掉
+#ifdef SYLAR_CONTEXT_ASAN
+		ASAN_UNPOISON_MEMORY_REGION(ss->base + ss->size - m_saveSize, m_saveSize);
+#endif
+		memcpy(ss->base + ss->size - m_saveSize, m_saveBuf, m_saveSize);
+	}
+}
+
+void Fiber::saveSharedStack()
+{
+	SharedStack& ss = *m_sharedStack;
+	char* sp = (char*)m_ctx.stackPointer();
+	size_t used = ss.base + ss.size - sp;
+	assert(sp >= ss.base && used <= ss.size);
+
+	if(used > m_saveCap)
+	{
+		m_saveCap = used;
+		m_saveBuf = (char*)realloc(m_saveBuf, m_saveCap);
+	}
+#ifdef SYLAR_CONTEXT_ASAN
+	ASAN_UNPOISON_MEMORY_REGION(sp, used);
+#endif
+	memcpy(m_saveBuf, sp, used);
+	m_saveSize = used;
+}
 
-	m_ctx.uc_link = nullptr;
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
-	makecontext(&m_ctx, &Fiber::MainFunc, 0);
+void Fiber::detachSharedStack()
+{
+	std::lock_guard<std::mutex> lock(m_sharedStack->mutex);
+	if(m_sharedStack->occupant == this)
+	{
+		m_sharedStack->occupant = nullptr;
+	}
 }
 
 // 将协程的状态设置为 RUNNING，并恢复协程的执行
 void Fiber::resume()
 {
-	assert(m_state==READY); // 使用断言确保当前协程的状态是 READY，即协程已经准备好执行
-	
-	m_state = RUNNING;
+	// 用 CAS 抢到恢复权：协程的 IO 事件可能在它 yield 之前就在另一个线程上触发，这时它还是 RUNNING 或 SUSPENDING，
+	// 要等原来的线程把上下文保存完、发布 READY 之后才能切进去；acquire 保证看到保存好的上下文
+	State expected = READY;
+	while(!m_state.compare_exchange_weak(expected, RUNNING, std::memory_order_acquire, std::memory_order_relaxed))
+	{
+		if(expected == TERM || expected == EXCEPT)
+		{
+			return;
+		}
+		// 还在另一个线程上运行或正在切出，稍等再试；compare_exchange_weak 虚假失败时直接重试
+		if(expected != READY)
+		{
+			std::this_thread::yield();
+			expected = READY;
+		}
+	}
+
+	if(m_useSharedStack) // 共享栈协程先占用共享栈，必要时把上一个占用者的栈拷贝出去
+	{
+		attachSharedStack();
+	}
+	Metrics::Add(METRIC_CONTEXT_SWITCHES);
 
 	// 如果 m_runInScheduler 为 true，说明该协程（即调用 resume 方法的协程）受调度协程的调度，则由调度协程 t_scheduler_fiber 切换到该协程恢复执行
 	if(m_runInScheduler) 
 	{
 		SetThis(this); // 将该协程赋值给变量 t_fiber，方便输出调试信息
 
-		// swapcontext 会保存当前协程的上下文 t_scheduler_fiber->m_ctx，并切换到指定协程的上下文 m_ctx 
-		if(swapcontext(&(t_scheduler_fiber->m_ctx), &m_ctx))
+		// 保存当前协程的上下文 t_scheduler_fiber->m_ctx，并切换到指定协程的上下文 m_ctx 
+		if(!Context::Swap(t_scheduler_fiber->m_ctx, m_ctx))
 		{
 			std::cerr << "resume() to t_scheduler_fiber failed\n";
 			pthread_exit(NULL);
@@ -161,28 +482,32 @@ void Fiber::resume()
 	else
 	{
 		SetThis(this);
-		if(swapcontext(&(t_thread_fiber->m_ctx), &m_ctx))
+		if(!Context::Swap(t_thread_fiber->m_ctx, m_ctx))
 		{
 			std::cerr << "resume() to t_thread_fiber failed\n";
 			pthread_exit(NULL);
 		}	
 	}
+
+	// 回到这里时协程已经切出、上下文保存完毕，发布切出后的状态：READY 之后其他线程才能恢复它，TERM / EXCEPT 之后才能回收复用它
+	State next = m_nextState;
+	m_nextState = READY;
+	m_state.store(next, std::memory_order_release);
 }
 
 // 让出该协程的执行权
 void Fiber::yield()
 {
-	assert(m_state==RUNNING || m_state==TERM);
+	assert(m_state.load(std::memory_order_relaxed) == RUNNING);
 
-	if(m_state != TERM)
-	{
-		m_state = READY;
-	}
+	// 还在自己的栈上运行，不能直接改成 READY：别的线程看到 READY 就会切进来，而这里的上下文还没保存
+	m_state.store(SUSPENDING, std::memory_order_relaxed);
+	Metrics::Add(METRIC_CONTEXT_SWITCHES);
 
 	if(m_runInScheduler)
 	{
 		SetThis(t_scheduler_fiber);   
-		if(swapcontext(&m_ctx, &(t_scheduler_fiber->m_ctx))) // 将当前协程的执行权交给调度协程  
+		if(!Context::Swap(m_ctx, t_scheduler_fiber->m_ctx)) // 将当前协程的执行权交给调度协程  
 		{
 			std::cerr << "yield() to to t_scheduler_fiber failed\n";
 			pthread_exit(NULL);
@@ -191,7 +516,7 @@ void Fiber::yield()
 	else
 	{
 		SetThis(t_thread_fiber.get());  
-		if(swapcontext(&m_ctx, &(t_thread_fiber->m_ctx))) // 将当前协程的执行权交给主协程  
+		if(!Context::Swap(m_ctx, t_thread_fiber->m_ctx)) // 将当前协程的执行权交给主协程  
 		{
 			std::cerr << "yield() to t_thread_fiber failed\n";
 			pthread_exit(NULL);
@@ -199,16 +524,90 @@ void Fiber::yield()
 	}	
 }
 
+void Fiber::SetExceptionHandler(ExceptionHandler handler)
+{
+	s_exception_handler = handler;
+}
+
+uint64_t Fiber::GetExceptionCount()
+{
+	return s_exception_count;
+}
+
+uint64_t Fiber::GetFiberCount()
+{
+	return s_fiber_count;
+}
+
+size_t Fiber::GetStackBytes()
+{
+	return s_stack_bytes;
+}
+
+size_t Fiber::GetPooledStackBytes()
+{
+	return s_pool_bytes;
+}
+
+// 调用处理函数；处理函数自己抛出的异常直接丢弃，不能让它越过协程入口
+static void HandleException(uint64_t id, std::exception_ptr e)
+{
+	try
+	{
+		Fiber::ExceptionHandler handler = s_exception_handler.load(std::memory_order_relaxed);
+		if(handler)
+		{
+			handler(id, e);
+			return;
+		}
+		try
+		{
+			std::rethrow_exception(e);
+		}
+		catch(const std::exception& ex)
+		{
+			std::cerr << "Fiber " << id << " terminated by exception: " << ex.what() << std::endl;
+		}
+		catch(...)
+		{
+			std::cerr << "Fiber " << id << " terminated by unknown exception" << std::endl;
+		}
+	}
+	catch(...)
+	{
+	}
+}
+
 // 协程入口函数的真正执行地，在协程恢复执行时会调用这个函数
 // 通过封装入口函数，可以实现协程在结束时自动执行 yield 操作
 void Fiber::MainFunc()
 {
+	Context::Entered();
 	std::shared_ptr<Fiber> curr = GetThis(); // GetThis()的 shared_from_this 方法让引用计数+1
 	assert(curr != nullptr);
 
-	curr->m_cb(); // 执行协程的回调函数
+	// 异常不能越过协程入口传播（上下文是 makecontext 构造的，没有可以展开的调用者），在这里捕获并交给处理函数
+	// 不抛出异常时 try 块没有任何额外开销（零开销异常模型）
+	State end_state = TERM;
+	try
+	{
+		curr->m_cb(); // 执行协程的回调函数
+	}
+	catch(...)
+	{
+		end_state = EXCEPT;
+		s_exception_count++;
+		HandleException(curr->m_id, std::current_exception());
+	}
 	curr->m_cb = nullptr; // 表示协程不再需要执行回调函数，这样做是为了释放回调函数的资源，避免重复执行
-	curr->m_state = TERM; // 表示协程已经执行完毕，生命周期结束
+	curr->clearLocals(); // 协程局部变量在协程自己的上下文里销毁，析构函数中还可以使用 hook 的 IO
+	curr->m_nextState = end_state; // 表示协程已经执行完毕，切出后由恢复它的线程发布为 TERM / EXCEPT
+
+	// 已经结束的共享栈协程不需要再保存栈，直接让出共享栈
+	if(curr->m_useSharedStack)
+	{
+		curr->detachSharedStack();
+	}
 
 	// 运行完毕 -> 让出执行权
 	auto raw_ptr = curr.get(); // 获取当前协程对象的裸指针
@@ -7,42 +7,75 @@
 #include <atomic>       
 #include <functional>   
 #include <cassert>      
-#include <ucontext.h>   
 #include <unistd.h>
 #include <mutex>
+#include <vector>
+#include <exception>
+
+#include "context.h"
+#include "inline_function.h"
+#include "stack_allocator.h"
 
 namespace sylar {
 
+struct SharedStack; // 线程的共享栈，定义在 fiber.cpp
+
 // std::enable_shared_from_this<T> 是C++标准库提供的一个模板类
 // 它允许对象在其成员函数中获取指向自身的智能指针 shared_ptr，避免 shared_ptr 重复管理同一对象，保证了对象生命周期的安全
 class Fiber : public std::enable_shared_from_this<Fiber>
 {
 public:
 	// 定义协程状态，在上下文切换时需要被保存
+	// 切换：READY -(resume 的 CAS)-> RUNNING -(yield)-> SUSPENDING -(上下文保存完、回到恢复它的线程)-> READY / TERM / EXCEPT
 	enum State
 	{
 		READY, 
 		RUNNING, 
-		TERM 
+		SUSPENDING, // 已经调用 yield、上下文还没有保存完，此时其他线程不能恢复它
+		TERM,
+		EXCEPT // 入口函数抛出了未捕获的异常，协程已经结束，和 TERM 一样可以被复用
 	};
 
+	// 入口函数抛出未捕获异常时的处理函数，参数为协程ID和捕获到的异常
+	// 在协程自己的栈上、协程局部变量销毁之前调用，可以读取 FiberLocal 中的请求上下文；不能再抛出异常
+	using ExceptionHandler = void (*)(uint64_t fiber_id, std::exception_ptr e);
+
 private:
 	Fiber(); // 定义为私有函数，只能被 GetThis()调用，用于创建主协程  
 
 public:
 	// 构造函数：指定回调函数、栈大小和 run_in_scheduler(即本协程是否参与调度器的调度，默认为true)
-	Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true); 
+	// allocator 指定协程栈的分配器，为 nullptr 时使用 StackAllocator::GetDefault()
+	// shared_stack 为 true 时协程运行在所在线程的共享栈上，让出时只把用到的那部分栈拷贝出来，此时忽略 stacksize 和 allocator
+	Fiber(InlineFunction cb, size_t stacksize = 0, bool run_in_scheduler = true, StackAllocator* allocator = nullptr, bool shared_stack = false); 
 	~Fiber();
 
 	// 重用一个协程：重置协程状态和入口函数，复用栈空间，不重新创建栈，节约资源
-	void reset(std::function<void()> cb);
+	void reset(InlineFunction cb);
 
 	
-	void resume(); // 恢复执行
+	// 恢复执行：用 CAS 把 READY 改为 RUNNING，协程还在另一个线程上运行或正在切出（事件在它 yield 之前就触发了）时等它切出再恢复，已经结束时直接返回
+	// 同一时刻只有一个线程能恢复成功，调度器不需要再为每次切换加锁
+	void resume();
 	void yield();  // 让出执行权
  
 	uint64_t getId() const {return m_id;} // 获取唯一标识
-	State getState() const {return m_state;} // const 关键字的作用是：限定该函数不会修改类的成员变量 
+	State getState() const {return m_state.load(std::memory_order_acquire);} // const 关键字的作用是：限定该函数不会修改类的成员变量 
+	// 是否已经结束：正常返回（TERM）或者因异常结束（EXCEPT），只有在协程切出之后才会变成 true
+	bool isFinished() const
+	{
+		State state = m_state.load(std::memory_order_acquire);
+		return state == TERM || state == EXCEPT;
+	}
+
+	// 共享栈协程的栈内容保存的是共享栈上的绝对地址，只能在第一次运行它的线程上恢复，返回该线程ID，私有栈协程返回 -1
+	int getHomeThread() const {return m_homeThread;}
+	// 共享栈协程被切走后保存的栈大小
+	size_t getSavedStackSize() const {return m_saveSize;}
+	// 是否运行在共享栈上：挂起期间栈上的对象会被其他协程覆盖，不能把它们的地址交给别人
+	bool isSharedStack() const {return m_useSharedStack;}
+	// 是否受调度器调度（主协程和调度协程为 false）
+	bool isRunInScheduler() const {return m_runInScheduler;}
 
 public:
 	// 设置当前运行的协程
@@ -57,27 +90,108 @@ public:
 	// 获取当前运行的协程ID
 	static uint64_t GetFiberId();
 
+	// 获取当前运行的协程的裸指针，不增加引用计数，当前线程还没有协程时先创建主协程
+	static Fiber* GetThisPtr();
+
 	// 协程的函数入口点
 	static void MainFunc();	
 
+	// 设置未捕获异常的处理函数，nullptr 恢复默认（把协程ID和异常信息打印到 std::cerr）
+	static void SetExceptionHandler(ExceptionHandler handler);
+	// 因未捕获异常而结束的协程总数
+	static uint64_t GetExceptionCount();
+
+	// 存活的协程数（包括每个线程的主协程）
+	static uint64_t GetFiberCount();
+	// 私有协程栈占用的内存总量（按栈大小计），其中在协程缓存中等待复用的部分
+	static size_t GetStackBytes();
+	static size_t GetPooledStackBytes();
+
+public:
+	// 协程缓存：每个线程缓存一批已终止的协程，调度器执行回调任务时优先复用，避免每个任务都 malloc / free 一个协程栈
+
+	// 从当前线程的缓存中取出一个已终止的协程，并用 cb 重置；缓存为空时新建一个协程
+	static std::shared_ptr<Fiber> GetPooled(InlineFunction cb);
+
+	// 将已终止的协程放回当前线程的缓存，只有默认栈大小和默认分配器、受调度器调度且没有其他持有者的协程才会被缓存，否则直接释放
+	static void ReturnToPool(std::shared_ptr<Fiber>&& fiber);
+
+	// 回收当前线程缓存中自上次回收以来一直没有被用到的那部分协程，由调度器在线程空闲时调用
+	static void TrimPool();
+
+	// 设置缓存上限：per_thread 为每个线程最多缓存的协程数，total_bytes 为所有线程缓存的栈内存总量上限
+	static void SetPoolCapacity(size_t per_thread, size_t total_bytes);
+
+	// 设置之后新建的线程共享栈的大小，共享栈协程的调用深度不能超过它
+	static void SetSharedStackSize(size_t size);
+
+public:
+	// 协程局部变量（见 fiber_local.h）：每个 FiberLocal 分配一个全局槽位号，值保存在协程对象的槽位数组中
+	// 前 kInlineLocals 个槽位直接放在协程对象里，之后的放在按需扩容的数组中，最多 kMaxLocals 个
+	static const size_t kInlineLocals = 8;
+	static const size_t kMaxLocals = 256;
+
+	// 分配一个槽位号，destroy 在协程结束、被 reset 或析构时销毁这个槽位上的值
+	static size_t AllocLocalSlot(void (*destroy)(void*));
+
+	void* getLocal(size_t slot) const
+	{
+		if(slot < kInlineLocals)
+		{
+			return m_locals[slot];
+		}
+		slot -= kInlineLocals;
+		return slot < m_moreLocals.size() ? m_moreLocals[slot] : nullptr;
+	}
+	void setLocal(size_t slot, void* value);
+	// 销毁所有槽位上的值，按槽位号从大到小，后分配的先销毁
+	void clearLocals();
+
+private:
+	// 共享栈协程恢复执行前占用所在线程的共享栈：保存上一个占用者用到的栈，再恢复自己的栈
+	void attachSharedStack();
+	// 把自己在共享栈上用到的部分拷贝到 m_saveBuf
+	void saveSharedStack();
+	// 不再占用共享栈（协程结束或析构时），之后的占用者不需要再保存它的栈
+	void detachSharedStack();
+
 private:
 	// 协程唯一标识符
 	uint64_t m_id = 0;
 	// 栈大小
 	uint32_t m_stacksize = 0;
-	// 协程状态(初始为 READY)
-	State m_state = READY;
+	// 协程状态(初始为 READY)，恢复它的线程和唤醒它的线程可能不同，用原子变量
+	std::atomic<State> m_state{READY};
+	// 切出完成后要发布的状态：yield 时为 READY，入口函数返回时为 TERM / EXCEPT；只由运行这个协程的线程读写
+	State m_nextState = READY;
 	// 协程上下文
-	ucontext_t m_ctx;
+	Context m_ctx;
 	// 协程栈指针
 	void* m_stack = nullptr;
+	// 协程栈的分配器
+	StackAllocator* m_allocator = nullptr;
 	// 协程的回调函数
-	std::function<void()> m_cb;
+	InlineFunction m_cb;
 	// 是否受调度协程的调度
-	bool m_runInScheduler;
-
-public:
-	std::mutex m_mutex;
+	bool m_runInScheduler = false;
+
+	// 是否使用共享栈模式
+	bool m_useSharedStack = false;
+	// 共享栈模式：所在线程的共享栈，第一次运行时绑定
+	std::shared_ptr<SharedStack> m_sharedStack;
+	// 共享栈模式：被其他协程挤出共享栈时，用到的那部分栈保存在这里
+	char* m_saveBuf = nullptr;
+	size_t m_saveSize = 0;
+	size_t m_saveCap = 0;
+	// 共享栈模式：上下文需要在第一次占用共享栈时才能构造
+	bool m_needMake = false;
+	// 共享栈模式：第一次运行该协程的线程ID
+	int m_homeThread = -1;
+
+	// 协程局部变量的槽位
+	void* m_locals[kInlineLocals] = {};
+	std::vector<void*> m_moreLocals;
+	bool m_hasLocals = false;
 };
 
 }
@@ -0,0 +1,74 @@
+#ifndef _FIBER_LOCAL_H_
+#define _FIBER_LOCAL_H_
+
+#include "fiber.h"
+
+namespace sylar {
+
+// 协程局部变量：每个协程各有一份 T，类似 thread_local，但跟随协程而不是线程，协程被调度到其他线程上也能看到自己的值
+// 值在协程第一次访问时默认构造，协程结束、被 reset 复用或者析构时销毁；不在任何协程中访问时使用线程主协程的那一份
+// 访问只是从协程对象的槽位数组中取出一个指针，不需要加锁或查表
+// FiberLocal 对象本身应该是全局或静态的：槽位号只分配不回收，最多 Fiber::kMaxLocals 个
+//     static sylar::FiberLocal<std::string> t_trace_id;
+//     *t_trace_id = "abc";
+template<class T>
+class FiberLocal
+{
+public:
+	FiberLocal(): m_slot(Fiber::AllocLocalSlot(&FiberLocal::Destroy)) {}
+	FiberLocal(const FiberLocal&) = delete;
+	FiberLocal& operator=(const FiberLocal&) = delete;
+
+	// 当前协程的值，不存在时默认构造
+	T& get()
+	{
+		Fiber* fiber = Fiber::GetThisPtr();
+		void* value = fiber->getLocal(m_slot);
+		if(!value)
+		{
+			value = new T();
+			fiber->setLocal(m_slot, value);
+		}
+		return *static_cast<T*>(value);
+	}
+
+	// 当前协程的值，不存在时返回 nullptr，不会构造
+	T* tryGet() const
+	{
+		return static_cast<T*>(Fiber::GetThisPtr()->getLocal(m_slot));
+	}
+
+	// 当前协程是否已经有值
+	bool has() const
+	{
+		return Fiber::GetThisPtr()->getLocal(m_slot) != nullptr;
+	}
+
+	// 提前销毁当前协程的值，下次访问时重新构造
+	void reset()
+	{
+		Fiber* fiber = Fiber::GetThisPtr();
+		void* value = fiber->getLocal(m_slot);
+		if(value)
+		{
+			fiber->setLocal(m_slot, nullptr);
+			Destroy(value);
+		}
+	}
+
+	T& operator*() {return get();}
+	T* operator->() {return &get();}
+
+private:
+	static void Destroy(void* value)
+	{
+		delete static_cast<T*>(value);
+	}
+
+private:
+	size_t m_slot;
+};
+
+}
+
+#endif
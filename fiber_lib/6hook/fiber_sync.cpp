@@ -0,0 +1,167 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+
+namespace sylar {
+
+FiberWaiter FiberWaiter::Current()
+{
+	FiberWaiter waiter;
+	waiter.scheduler = Scheduler::GetThis();
+	waiter.fiber = Fiber::GetThis();
+	assert(waiter.scheduler && "fiber sync primitives must wait inside a scheduled fiber");
+	return waiter;
+}
+
+void FiberWaiter::wake()
+{
+	// 共享栈协程由 scheduleLock 自动放回它所在的线程，其他协程可以在任意工作线程上恢复
+	scheduler->scheduleLock(std::move(fiber));
+	scheduler = nullptr;
+}
+
+void WaitQueue::park(std::unique_lock<std::mutex>& lock)
+{
+	FiberWaiter waiter = FiberWaiter::Current();
+	Fiber* self = waiter.fiber.get();
+	m_waiters.push_back(std::move(waiter));
+	lock.unlock();
+	self->yield();
+}
+
+bool WaitQueue::wakeOne()
+{
+	if(m_waiters.empty())
+	{
+		return false;
+	}
+	FiberWaiter waiter;
+	m_waiters.pop_front(waiter);
+	waiter.wake();
+	return true;
+}
+
+void WaitQueue::wakeAll()
+{
+	while(wakeOne());
+}
+
+void FiberMutex::lockSlow()
+{
+	std::unique_lock<std::mutex> lock(m_waitMutex);
+	uint32_t state = m_state.load(std::memory_order_relaxed);
+	while(true)
+	{
+		// 等待者队列的锁保证解锁方和加锁方的慢路径互斥，这里只剩下和快路径的竞争
+		if(state == UNLOCKED)
+		{
+			if(m_state.compare_exchange_weak(state, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				return;
+			}
+			continue;
+		}
+		// 先标记为有等待者，持有者解锁时的 CAS 就会失败，转到慢路径把锁交给队头
+		if(state == LOCKED && !m_state.compare_exchange_weak(state, CONTENDED, std::memory_order_relaxed))
+		{
+			continue;
+		}
+		// 被唤醒时锁已经交给了自己
+		m_waiters.park(lock);
+		return;
+	}
+}
+
+void FiberMutex::unlockSlow()
+{
+	std::unique_lock<std::mutex> lock(m_waitMutex);
+	if(m_waiters.empty())
+	{
+		m_state.store(UNLOCKED, std::memory_order_release);
+		return;
+	}
+	// 锁不释放，直接交给队头的等待者；先改好状态再唤醒，新的持有者只剩自己时解锁可以走快路径
+	m_state.store(m_waiters.size() > 1 ? CONTENDED : LOCKED, std::memory_order_release);
+	m_waiters.wakeOne();
+}
+
+void FiberCondVar::wait(FiberMutex& mutex)
+{
+	// 先入队再释放 mutex，通知方在 mutex 释放之后修改条件并 notify 时，一定能看到这个等待者
+	std::unique_lock<std::mutex> lock(m_waitMutex);
+	mutex.unlock();
+	m_waiters.park(lock);
+	mutex.lock();
+}
+
+void FiberCondVar::notify_one()
+{
+	std::lock_guard<std::mutex> lock(m_waitMutex);
+	m_waiters.wakeOne();
+}
+
+void FiberCondVar::notify_all()
+{
+	std::lock_guard<std::mutex> lock(m_waitMutex);
+	m_waiters.wakeAll();
+}
+
+bool FiberSemaphore::tryWait()
+{
+	int64_t count = m_count.load(std::memory_order_relaxed);
+	while(count > 0)
+	{
+		if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void FiberSemaphore::waitSlow()
+{
+	std::unique_lock<std::mutex> lock(m_waitMutex);
+	if(m_pendingWakeups > 0)
+	{
+		m_pendingWakeups--;
+		return;
+	}
+	m_waiters.park(lock);
+}
+
+void FiberSemaphore::postSlow()
+{
+	std::lock_guard<std::mutex> lock(m_waitMutex);
+	if(!m_waiters.wakeOne())
+	{
+		m_pendingWakeups++;
+	}
+}
+
+void WaitGroup::done()
+{
+	int64_t prev = m_count.fetch_sub(1, std::memory_order_acq_rel);
+	assert(prev > 0);
+	if(prev == 1)
+	{
+		std::lock_guard<std::mutex> lock(m_waitMutex);
+		m_waiters.wakeAll();
+	}
+}
+
+void WaitGroup::wait()
+{
+	if(count() == 0)
+	{
+		return;
+	}
+	// 加锁后再检查一次：done() 归零后要拿到同一把锁才唤醒，挂起前看到的计数不为 0 就不会漏掉唤醒
+	std::unique_lock<std::mutex> lock(m_waitMutex);
+	if(count() == 0)
+	{
+		return;
+	}
+	m_waiters.park(lock);
+}
+
+}
@@ -0,0 +1,194 @@
+#ifndef _FIBER_SYNC_H_
+#define _FIBER_SYNC_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+#include "fiber.h"
+#include "task_queue.h"
+
+namespace sylar {
+
+class Scheduler;
+
+// 协程级的同步原语：拿不到锁或资源时挂起的是当前协程而不是整个工作线程，线程可以继续执行队列里的其他协程
+// 释放方把等待的协程通过 scheduleLock 放回它原来所在的调度器；没有竞争时加锁 / 解锁只有一次原子操作
+// 需要等待时只能在调度器调度的协程中调用，不能在主协程或调度器之外的线程上等待；释放（unlock / notify / post / done）可以在任意线程调用
+
+// 一个挂起的等待者：被唤醒时放回 scheduler 中执行
+struct FiberWaiter
+{
+	Scheduler* scheduler = nullptr;
+	std::shared_ptr<Fiber> fiber;
+
+	// 当前协程作为等待者
+	static FiberWaiter Current();
+	// 把等待的协程放回调度器
+	void wake();
+};
+
+// 等待者队列：由各个原语自己的 m_waitMutex 保护，出队顺序即唤醒顺序（先进先出）
+// 挂起的方式都是先入队、再解锁、最后 yield；唤醒方在 yield 之前就 schedule 也没关系，调度器会等协程让出后再 resume
+class WaitQueue
+{
+public:
+	WaitQueue(): m_waiters(4) {}
+
+	// 当前协程入队，释放 lock 后挂起，被唤醒时返回，返回时不持有 lock
+	void park(std::unique_lock<std::mutex>& lock);
+	// 唤醒一个等待者，返回是否有等待者，调用时需要持有锁
+	bool wakeOne();
+	// 唤醒所有等待者，调用时需要持有锁
+	void wakeAll();
+	bool empty() const {return m_waiters.empty();}
+	size_t size() const {return m_waiters.size();}
+
+private:
+	RingQueue<FiberWaiter> m_waiters;
+};
+
+// 协程互斥锁：不可重入，解锁时把锁直接交给队头的等待者（先进先出，不会被后来的协程抢走）
+class FiberMutex
+{
+public:
+	FiberMutex() = default;
+	FiberMutex(const FiberMutex&) = delete;
+	FiberMutex& operator=(const FiberMutex&) = delete;
+
+	void lock()
+	{
+		uint32_t expected = UNLOCKED;
+		if(m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			return;
+		}
+		lockSlow();
+	}
+
+	bool try_lock()
+	{
+		uint32_t expected = UNLOCKED;
+		return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void unlock()
+	{
+		uint32_t expected = LOCKED;
+		if(m_state.compare_exchange_strong(expected, UNLOCKED, std::memory_order_release, std::memory_order_relaxed))
+		{
+			return;
+		}
+		unlockSlow();
+	}
+
+private:
+	void lockSlow();
+	void unlockSlow();
+
+private:
+	enum : uint32_t
+	{
+		UNLOCKED = 0,
+		LOCKED = 1,
+		CONTENDED = 2 // 已加锁且有协程在等待，解锁需要走慢路径
+	};
+	std::atomic<uint32_t> m_state = {UNLOCKED};
+	std::mutex m_waitMutex;
+	WaitQueue m_waiters;
+};
+
+// 协程条件变量：配合 FiberMutex 使用，和 std::condition_variable 一样可能被虚假唤醒，等待条件要放在循环里判断
+class FiberCondVar
+{
+public:
+	FiberCondVar() = default;
+	FiberCondVar(const FiberCondVar&) = delete;
+	FiberCondVar& operator=(const FiberCondVar&) = delete;
+
+	// 释放 mutex 并挂起，被唤醒后重新加锁再返回
+	void wait(FiberMutex& mutex);
+
+	template<class Predicate>
+	void wait(FiberMutex& mutex, Predicate pred)
+	{
+		while(!pred())
+		{
+			wait(mutex);
+		}
+	}
+
+	void notify_one();
+	void notify_all();
+
+private:
+	std::mutex m_waitMutex;
+	WaitQueue m_waiters;
+};
+
+// 协程信号量：m_count 小于 0 时其绝对值为等待者的个数，wait / post 没有等待者时都只有一次原子操作
+class FiberSemaphore
+{
+public:
+	explicit FiberSemaphore(int64_t count = 0): m_count(count) {}
+	FiberSemaphore(const FiberSemaphore&) = delete;
+	FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+
+	// P 操作
+	void wait()
+	{
+		if(m_count.fetch_sub(1, std::memory_order_acquire) > 0)
+		{
+			return;
+		}
+		waitSlow();
+	}
+
+	// 有剩余资源时取走一个并返回 true，否则不等待直接返回 false
+	bool tryWait();
+
+	// V 操作
+	void post()
+	{
+		if(m_count.fetch_add(1, std::memory_order_release) >= 0)
+		{
+			return;
+		}
+		postSlow();
+	}
+
+private:
+	void waitSlow();
+	void postSlow();
+
+private:
+	std::atomic<int64_t> m_count;
+	std::mutex m_waitMutex;
+	WaitQueue m_waiters;
+	// post 时等待者已经把 m_count 减到负数但还没来得及入队，先把这次唤醒记下来，等待者入队前看到就直接返回
+	int64_t m_pendingWakeups = 0;
+};
+
+// 等待一组任务完成：add(n) 登记 n 个任务，每个任务结束时调用 done()，wait() 挂起到计数归零
+class WaitGroup
+{
+public:
+	explicit WaitGroup(int64_t count = 0): m_count(count) {}
+	WaitGroup(const WaitGroup&) = delete;
+	WaitGroup& operator=(const WaitGroup&) = delete;
+
+	void add(int64_t n = 1) {m_count.fetch_add(n, std::memory_order_relaxed);}
+	void done();
+	void wait();
+
+	int64_t count() const {return m_count.load(std::memory_order_acquire);}
+
+private:
+	std::atomic<int64_t> m_count;
+	std::mutex m_waitMutex;
+	WaitQueue m_waiters;
+};
+
+}
+
+#endif
@@ -4,7 +4,12 @@
 #include <iostream>
 #include <cstdarg>
 #include "fd_manager.h"
+#include "uring.h"
+#include "deadline.h"
+#include "offload.h"
 #include <string.h>
+#include <vector>
+#include <algorithm>
 
 // 宏 HOOK_FUN(XX) 是一个宏展开机制，通过将 XX 依次应用于宏定义中的每一个函数名称来生成一系列代码，可以有效减少重复代码，提高代码的可读性和维护性 
 #define HOOK_FUN(XX) \
@@ -14,21 +19,37 @@
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendmmsg) \
+    XX(sendfile) \
+    XX(splice) \
+    XX(tee) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
-    XX(setsockopt) 
+    XX(setsockopt) \
+    XX(open) \
+    XX(openat) \
+    XX(pread) \
+    XX(pwrite) \
+    XX(fsync) \
+    XX(fdatasync) \
+    XX(poll) \
+    XX(ppoll) \
+    XX(select) \
+    XX(epoll_wait) 
 
 namespace sylar{
 
@@ -77,12 +98,134 @@ static HookIniter s_hook_initer;
 } // end namespace sylar
 
 
-// 跟踪定时器的状态，cancelled 成员变量用于表示定时器是否已经被取消 
-struct timer_info 
+// 协程等待 IO 期间的超时定时器和取消令牌的等待者，直接放在挂起协程的栈上，添加和取消都不分配内存
+// 超时或令牌被取消时取消 fd 上的事件（恢复协程），并在 cancelled 中记下 ETIMEDOUT / ECANCELED，先到的一方生效
+// 两种回调都在各自的锁内执行，协程恢复后先 disarm 再读 cancelled，保证回调已经结束、栈上的节点可以安全销毁
+struct timer_info : public sylar::TimerNode, public sylar::CancelWaiter
 {
-    int cancelled = 0;
+    std::atomic<int> cancelled{0};
+    sylar::IOManager* iom = nullptr;
+    int fd = -1;
+    uint32_t event = 0;
+    bool timed = false;
+    sylar::CancelToken* token = nullptr;
+
+    // 在事件注册成功之后挂上定时器（timeout_ms 为 -1 时不挂）和取消令牌（token 为空时不挂）
+    void arm(sylar::IOManager* manager, int target_fd, uint32_t target_event, uint64_t timeout_ms, sylar::CancelToken* cancel_token)
+    {
+        iom = manager;
+        fd = target_fd;
+        event = target_event;
+        timed = timeout_ms != (uint64_t)-1;
+        if(timed)
+        {
+            sylar::TimerNode::cb = &timer_info::OnTimeout;
+            iom->addTimerNode(this, std::chrono::milliseconds(timeout_ms));
+        }
+        token = cancel_token;
+        if(token)
+        {
+            sylar::CancelWaiter::cb = &timer_info::OnCancel;
+            if(!token->addWaiter(this)) // 检查之后、注册之前被取消了
+            {
+                token = nullptr;
+                fire(ECANCELED);
+            }
+        }
+    }
+
+    // 协程恢复后调用，等两种回调都结束
+    void disarm()
+    {
+        if(timed)
+        {
+            iom->cancelTimerNode(this);
+            timed = false;
+        }
+        if(token)
+        {
+            token->removeWaiter(this);
+            token = nullptr;
+        }
+    }
+
+    void fire(int reason)
+    {
+        int expected = 0;
+        if(cancelled.compare_exchange_strong(expected, reason))
+        {
+            iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
+        }
+    }
+
+    static void OnTimeout(sylar::TimerNode* node)
+    {
+        static_cast<timer_info*>(node)->fire(ETIMEDOUT);
+    }
+
+    static void OnCancel(sylar::CancelWaiter* waiter)
+    {
+        static_cast<timer_info*>(waiter)->fire(ECANCELED);
+    }
 };
 
+// 协程 yield 之后可能被调度到另一个线程上继续执行，而 errno 是线程局部的：__errno_location 被声明为 const 函数，
+// 编译器会把 yield 之前取到的 errno 地址沿用到 yield 之后，读写的就成了原来那个线程的 errno
+// 可能跨过 yield 的路径统一通过这个不参与过程间优化的函数访问 errno
+#if defined(__clang__)
+__attribute__((noinline))
+#else
+__attribute__((noipa))
+#endif
+static int& current_errno()
+{
+    return errno;
+}
+
+// 是否需要 timer_info：有超时、截止时间或取消令牌时都要挂节点
+static bool need_tinfo(uint64_t timeout)
+{
+    return timeout != (uint64_t)-1 || sylar::FiberDeadline::GetToken() || sylar::FiberDeadline::Get() != sylar::FiberDeadline::time_point::max();
+}
+
+// 在阻塞调用线程池中执行文件操作，只挂起当前协程，errno 由线程池带回
+// 协程的截止时间已过或令牌已取消时不再提交；已经提交的操作不能中途取消，会一直等到它完成
+template<typename OriginFun, typename... Args>
+static auto offload_io(OriginFun fun, Args&&... args) -> decltype(fun(args...))
+{
+    if(!sylar::BlockingPool::CanOffload())
+    {
+        return fun(std::forward<Args>(args)...);
+    }
+    int reason = sylar::FiberDeadline::Check();
+    if(reason)
+    {
+        current_errno() = reason;
+        return -1;
+    }
+    decltype(fun(args...)) result = -1;
+    sylar::BlockingPool::GetInstance()->execute([&]()
+    {
+        result = fun(std::forward<Args>(args)...);
+    });
+    return result;
+}
+
+// 只对 hook 开启时打开的普通文件生效的调用（fsync / fdatasync），其他 fd 直接调用原始函数
+template<typename OriginFun, typename... Args>
+static auto do_file_io(int fd, OriginFun fun, Args&&... args) -> decltype(fun(fd, args...))
+{
+    if(sylar::t_hook_enable)
+    {
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
+        if(ctx && !ctx->isClosed() && ctx->isFile())
+        {
+            return offload_io(fun, fd, std::forward<Args>(args)...);
+        }
+    }
+    return fun(fd, std::forward<Args>(args)...);
+}
+
 /**
  * 自定义的系统调用都要将其参数放入 do_io 模板来做统一的规范化处理：
  * do_io 主要是判断全局 hook 是否启用，并且根据文件描述符是否有效和是否设置了非阻塞来选择是否使用原始系统调用
@@ -100,8 +243,8 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    // 获取与文件描述符 fd 相关联的上下文对象 FdCtx，如果上下文不存在，则直接调用原始系统调用
-    std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);  
+    // 获取与文件描述符 fd 相关联的上下文对象 FdCtx，没有登记过的 fd 在这里第一次登记；fd 无效时直接调用原始系统调用
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
     if(!ctx) 
     {
         return fun(fd, std::forward<Args>(args)...);
@@ -113,6 +256,13 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         errno = EBADF; // 表示文件描述符无效或已经关闭
         return -1;
     }
+    uint32_t generation = ctx->getGeneration(); // 挂起之前的代数，被唤醒后用来判断 fd 是否在等待期间被关闭
+
+    // 普通文件和块设备永远不会返回 EAGAIN，读写会阻塞在磁盘上，交给阻塞调用线程池执行，只挂起当前协程
+    if(ctx->isFile())
+    {
+        return offload_io(fun, fd, std::forward<Args>(args)...);
+    }
 
     // 如果文件描述符不是一个 socket 或者用户已经设置了非阻塞模式，则直接调用原始系统调用
     if(!ctx->isSocket() || ctx->getUserNonblock()) 
@@ -120,82 +270,424 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    // 获取超时设置并初始化 timer_info 结构体，用于后续的超时管理和取消操作 
-    uint64_t timeout = ctx->getTimeout(timeout_so);
-    // timer condition
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    // 获取超时设置并初始化 timer_info 结构体，用于后续的超时管理和取消操作
+    // 节点放在当前协程的栈上；共享栈协程挂起后栈会被覆盖，改放到堆上
+    uint64_t so_timeout = ctx->getTimeout(timeout_so);
+    timer_info local_tinfo;
+    std::unique_ptr<timer_info> heap_tinfo;
+    if(sylar::Fiber::GetThis()->isSharedStack() && need_tinfo(so_timeout))
+    {
+        heap_tinfo.reset(new timer_info);
+    }
+    timer_info& tinfo = heap_tinfo ? *heap_tinfo : local_tinfo;
 
 // 调用原始系统调用，如果由于系统中断(EINTR)导致操作失败，函数会重试
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     
-    while(n == -1 && errno == EINTR) 
+    while(n == -1 && current_errno() == EINTR) 
     {
         n = fun(fd, std::forward<Args>(args)...);
     }
     
     // 0.如果 I/O 操作因为资源暂时不可用(EAGAIN)而失败，函数会添加一个事件监听器来等待资源可用
-    // 同时，如果有超时设置，还会启动一个条件计时器来取消事件
-    if(n == -1 && errno == EAGAIN) 
+    // 同时，如果有超时设置，还会挂上一个定时器节点来取消事件
+    if(n == -1 && current_errno() == EAGAIN) 
     {
         sylar::IOManager* iom = sylar::IOManager::GetThis();
-        std::shared_ptr<sylar::Timer> timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
 
-        // 1.如果执行的 read 等函数在 FdManager 管理的 FdCtx 中设置了超时时间，就通过 addConditionTimer 创建条件定时器
-        if(timeout != (uint64_t)-1) // 检查是否设置了超时时间
+        // 协程的截止时间已过或者令牌已经取消，不再挂起等待；否则这次最多等到截止时间
+        int reason = sylar::FiberDeadline::Check();
+        if(reason)
         {
-            timer = iom->addConditionTimer(timeout, [winfo, fd, iom, event]() 
-            {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) // 如果 timer_info 对象已被释放，或者操作已被取消，则直接返回
-                {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT; // 如果超时时间到达并且事件尚未被处理，即 cancelled 仍然是0
-                 
-                // 取消该文件描述符上的事件，并立即触发一次事件(即恢复被挂起的协程)
-                iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-            }, winfo);
+            current_errno() = reason;
+            return -1;
         }
+        uint64_t timeout = sylar::FiberDeadline::Clamp(so_timeout);
+        sylar::CancelToken* token = sylar::FiberDeadline::GetToken();
 
-        // 2.将 fd 和 event 添加到 IOManager 中进行管理，IOManager 会监听这个文件描述符上的事件，当事件触发时，它会调度相应的协程来处理
+        // 1.将 fd 和 event 添加到 IOManager 中进行管理，IOManager 会监听这个文件描述符上的事件，当事件触发时，它会调度相应的协程来处理
         int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
-        if(-1 == rt) // 如果 rt 为-1，说明 addEvent 失败，会打印一条调试信息 
+        if(-1 == rt) // 如果 rt 为-1，说明 addEvent 失败，会打印一条调试信息；IOManager 正在 shutdown 时 errno 为 ECANCELED，不打印
         {
-            std::cout << hook_fun_name << " addEvent("<< fd << ", " << event << ")";
-            if(timer) 
+            if(errno != ECANCELED)
             {
-                timer->cancel(); // 并且因为添加事件失败，所以要取消之前设置的定时器，避免误触发
+                std::cout << hook_fun_name << " addEvent("<< fd << ", " << event << ")";
             }
             return -1;
         } 
-        else 
-        {
-            //如果 addEvent 成功，当前协程会调用 yield() 函数，将自己挂起，让出执行权，等待事件的触发 
-            sylar::Fiber::GetThis()->yield();
+
+        // 2.如果执行的 read 等函数在 FdManager 管理的 FdCtx 中设置了超时时间或者协程有截止时间 / 取消令牌，就挂上定时器节点和令牌
+        // 在 addEvent 之后才挂，超时时一定能取消到这次注册的事件；协程还没 yield 时被恢复也没关系，调度器会等它 yield 之后再 resume
+        tinfo.arm(iom, fd, event, timeout, token);
+
+        // 当前协程调用 yield() 函数，将自己挂起，让出执行权，等待事件的触发 
+        sylar::Fiber::GetThis()->yield();
      
-            // 3.当协程被恢复（例如事件触发后），它会继续执行 yield() 之后的代码，如果之前设置了定时器，则在事件处理完毕后取消该定时器
-            if(timer) 
+        // 3.当协程被恢复（例如事件触发后），它会继续执行 yield() 之后的代码，取消定时器并从令牌上摘下
+        tinfo.disarm();
+
+        // fd 在等待期间被 close 了，编号可能已经属于别的连接，不能再重试
+        if(ctx->getGeneration() != generation)
+        {
+            current_errno() = EBADF;
+            return -1;
+        }
+        
+        // 接下来检査 tinfo.cancelled 是否为 ETIMEDOUT 或 ECANCELED
+        // 如果是，说明该操作因超时或取消而被中止，因此设置 errno 并返回 -1，表示操作失败
+        if(tinfo.cancelled) 
+        {
+            current_errno() = tinfo.cancelled;
+            return -1;
+        }
+        // 如果没有超时，则跳转到 retry 标签，重新尝试这个操作
+        goto retry;
+    }
+    return n;
+}
+
+/**
+ * io_uring 后端：IOManager 开启 use_uring 后，read/recv/send/writev/accept/accept4/connect 不再先试探系统调用再等 epoll，
+ * 而是直接把 IO 作为 SQE 提交到当前线程的 io_uring 并挂起协程，由完成事件恢复，SQE 在 idle() 中成批提交
+ * 超时通过链接超时（IORING_OP_LINK_TIMEOUT）实现，IO 被取消时返回 ETIMEDOUT；被 close 取消时返回 EBADF
+ * 协程的截止时间收紧链接超时；绑定了取消令牌的协程不走 io_uring
+ * 不能走 io_uring 时返回 false，调用者退回 do_io：没有开启、fd 不需要 hook、或者内核对非阻塞 fd 返回了 EAGAIN
+ * prep 是填写 SQE 的 lambda，一路按引用传到 submitIo，不包装成 std::function，没有开启 io_uring 时也不会为它分配内存
+ */
+template<class Prep>
+static bool uring_submit(uint64_t timeout, const Prep& prep, ssize_t& result)
+{
+    // 截止时间只需要收紧链接超时；在途的 SQE 不能被取消令牌取消，绑定了令牌的协程退回 do_io
+    if(sylar::FiberDeadline::GetToken())
+    {
+        return false;
+    }
+    int reason = sylar::FiberDeadline::Check();
+    if(reason)
+    {
+        errno = reason;
+        result = -1;
+        return true;
+    }
+    timeout = sylar::FiberDeadline::Clamp(timeout);
+    int res = sylar::IOManager::GetThis()->submitIo(prep, timeout);
+    if(res == -ENOSYS || res == -EAGAIN)
+    {
+        return false;
+    }
+    if(res < 0)
+    {
+        if(res == -ECANCELED)
+        {
+            res = timeout != (uint64_t)-1 ? -ETIMEDOUT : -EBADF;
+        }
+        current_errno() = -res;
+        result = -1;
+    }
+    else
+    {
+        result = res;
+    }
+    return true;
+}
+
+template<class Prep>
+static bool uring_io(int fd, int timeout_so, const Prep& prep, ssize_t& result)
+{
+    // 与 do_io 中需要挂起协程的条件相同
+    if(!sylar::t_hook_enable)
+    {
+        return false;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || !iom->isUringEnabled())
+    {
+        return false;
+    }
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
+    if(!ctx || ctx->isClosed() || !ctx->isSocket() || ctx->getUserNonblock())
+    {
+        return false;
+    }
+    uint32_t generation = ctx->getGeneration();
+    bool submitted = uring_submit(ctx->getTimeout(timeout_so), prep, result);
+    // 在途时 fd 被 close 了：不管 IO 是被取消、超时还是返回 EAGAIN，都按 close 处理，不再退回 do_io 在编号可能已经被复用的 fd 上重试
+    if((!submitted || result < 0) && ctx->getGeneration() != generation)
+    {
+        current_errno() = EBADF;
+        result = -1;
+        return true;
+    }
+    return submitted;
+}
+
+
+
+
+// sleep 系列的等待节点：定时器到时或者令牌被取消时把协程放回调度器，只有先到的一方放回
+// 和 timer_info 一样放在挂起协程的栈上（共享栈协程放到堆上），恢复之后先摘下定时器和令牌再销毁
+struct sleep_info : public sylar::TimerNode, public sylar::CancelWaiter
+{
+    std::atomic<int> state{-1}; // -1 表示还在睡，否则为醒来的原因：0 睡够了，ETIMEDOUT 到了截止时间，ECANCELED 被取消
+    int timeout_reason = 0; // 定时器到时对应的原因，被截止时间截短时为 ETIMEDOUT
+    sylar::IOManager* iom = nullptr;
+    std::shared_ptr<sylar::Fiber> fiber;
+
+    void wake(int reason)
+    {
+        int expected = -1;
+        if(state.compare_exchange_strong(expected, reason))
+        {
+            iom->scheduleLock(fiber, -1);
+        }
+    }
+
+    static void OnTimeout(sylar::TimerNode* node)
+    {
+        sleep_info* info = static_cast<sleep_info*>(node);
+        info->wake(info->timeout_reason);
+    }
+
+    static void OnCancel(sylar::CancelWaiter* waiter)
+    {
+        static_cast<sleep_info*>(waiter)->wake(ECANCELED);
+    }
+};
+
+// 挂起当前协程 timeout，返回 0 表示睡够了，否则返回提前醒来的原因，left 中为没睡完的时间
+static int fiber_sleep(std::chrono::nanoseconds timeout, std::chrono::nanoseconds* left)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t ns = timeout.count() > 0 ? timeout.count() : 0;
+    int reason = sylar::FiberDeadline::Check();
+    if(reason)
+    {
+        if(left)
+        {
+            *left = std::chrono::nanoseconds(ns);
+        }
+        return reason;
+    }
+    uint64_t clamped = sylar::FiberDeadline::ClampNs(ns);
+    sylar::CancelToken* token = sylar::FiberDeadline::GetToken();
+
+    sleep_info local_info;
+    std::unique_ptr<sleep_info> heap_info;
+    if(sylar::Fiber::GetThis()->isSharedStack())
+    {
+        heap_info.reset(new sleep_info);
+    }
+    sleep_info& info = heap_info ? *heap_info : local_info;
+    info.iom = sylar::IOManager::GetThis();
+    info.fiber = sylar::Fiber::GetThis();
+    info.timeout_reason = clamped < ns ? ETIMEDOUT : 0;
+
+    info.sylar::TimerNode::cb = &sleep_info::OnTimeout;
+    info.iom->addTimerNode(&info, std::chrono::nanoseconds(clamped));
+    if(token)
+    {
+        info.sylar::CancelWaiter::cb = &sleep_info::OnCancel;
+        if(!token->addWaiter(&info))
+        {
+            token = nullptr;
+            info.wake(ECANCELED);
+        }
+    }
+
+    // 主动挂起当前协程的执行，将控制权交还给调度器，等待下一次 resume 恢复
+    info.fiber->yield();
+
+    info.iom->cancelTimerNode(&info);
+    if(token)
+    {
+        token->removeWaiter(&info);
+    }
+    reason = info.state;
+    if(reason && left)
+    {
+        auto slept = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        *left = std::chrono::nanoseconds(slept < (int64_t)ns ? ns - slept : 0);
+    }
+    return reason;
+}
+
+// poll 系列的等待者：fd 上的事件、定时器和取消令牌都可能唤醒协程，只有先到的一方把它放回调度器
+// 事件回调可能在协程恢复之后才执行（已经被调度但还没运行），等待者放在堆上，由回调共同持有
+struct poll_info : public sylar::TimerNode, public sylar::CancelWaiter
+{
+    std::atomic<int> state{-1}; // -1 表示还在等，否则为醒来的原因：0 有事件或者定时器到时，ECANCELED 被取消
+    sylar::IOManager* iom = nullptr;
+    std::shared_ptr<sylar::Fiber> fiber;
+
+    void wake(int reason)
+    {
+        int expected = -1;
+        if(state.compare_exchange_strong(expected, reason))
+        {
+            iom->scheduleLock(fiber, -1);
+        }
+    }
+
+    static void OnTimeout(sylar::TimerNode* node)
+    {
+        static_cast<poll_info*>(node)->wake(0);
+    }
+
+    static void OnCancel(sylar::CancelWaiter* waiter)
+    {
+        static_cast<poll_info*>(waiter)->wake(ECANCELED);
+    }
+};
+
+// poll / select / epoll_wait 的协程版本：timeout_ns 为 -1 时不超时
+// 先用超时为 0 的 ppoll 探测，没有就绪的 fd 时把每个 fd 关心的方向注册到 IOManager，挂起协程，醒来后重新探测
+// 同一个 fd 的同一方向已经有别的协程在等时注册不上，这时最多挂起 kBusyWaitNs 就重新探测一次
+// 到了协程的截止时间返回 -1，errno 为 ETIMEDOUT；取消令牌被取消时 errno 为 ECANCELED
+// 和内核一样至少等满 timeout：经过的时间按真实时钟计算，不用调度循环缓存的 Now()，定时器提前醒来时继续等剩下的时间
+static int fiber_poll(struct pollfd* fds, nfds_t nfds, int64_t timeout_ns, const sigset_t* sigmask)
+{
+    static const uint64_t kBusyWaitNs = 10 * 1000 * 1000;
+    auto start = std::chrono::steady_clock::now();
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    std::vector<std::pair<int, sylar::IOManager::Event>> registered;
+    while(true)
+    {
+        struct timespec zero = {0, 0};
+        int n = ppoll_f(fds, nfds, &zero, sigmask);
+        if(n != 0 || timeout_ns == 0)
+        {
+            return n;
+        }
+
+        uint64_t wait = (uint64_t)-1;
+        if(timeout_ns > 0)
+        {
+            int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            if(elapsed >= timeout_ns)
+            {
+                return 0;
+            }
+            wait = timeout_ns - elapsed;
+        }
+        int reason = sylar::FiberDeadline::Check();
+        if(reason)
+        {
+            current_errno() = reason;
+            return -1;
+        }
+        wait = sylar::FiberDeadline::ClampNs(wait);
+        sylar::CancelToken* token = sylar::FiberDeadline::GetToken();
+
+        std::shared_ptr<poll_info> info = std::make_shared<poll_info>();
+        info->iom = iom;
+        info->fiber = sylar::Fiber::GetThis();
+
+        // 读方向覆盖 POLLIN / POLLPRI，写方向覆盖 POLLOUT；只关心 POLLERR / POLLHUP 时也注册读，这两种状态会同时报告给读写两个方向
+        registered.clear();
+        bool busy = false;
+        for(nfds_t i = 0; i < nfds; i++)
+        {
+            if(fds[i].fd < 0)
+            {
+                continue;
+            }
+            uint32_t events = 0;
+            if(fds[i].events & (POLLIN | POLLPRI | POLLRDNORM | POLLRDBAND))
+            {
+                events |= sylar::IOManager::READ;
+            }
+            if(fds[i].events & (POLLOUT | POLLWRNORM | POLLWRBAND))
+            {
+                events |= sylar::IOManager::WRITE;
+            }
+            if(!events)
+            {
+                events = sylar::IOManager::READ;
+            }
+            for(sylar::IOManager::Event event : {sylar::IOManager::READ, sylar::IOManager::WRITE})
             {
-                timer->cancel();
+                if(!(events & event))
+                {
+                    continue;
+                }
+                std::pair<int, sylar::IOManager::Event> item(fds[i].fd, event);
+                if(iom->addEvent(fds[i].fd, event, [info]() { info->wake(0); }, info.get()) == 0)
+                {
+                    registered.push_back(item);
+                }
+                else if(errno == ECANCELED) // IOManager 正在 shutdown，不再等待
+                {
+                    for(auto& done : registered)
+                    {
+                        iom->delEvent(done.first, done.second, info.get());
+                    }
+                    current_errno() = ECANCELED;
+                    return -1;
+                }
+                else if(std::find(registered.begin(), registered.end(), item) == registered.end()) // 数组里重复出现的 fd 不算
+                {
+                    busy = true;
+                }
             }
-            
-            // 接下来检査 tinfo->cancelled 是否等于 ETIMEDOUT
-            // 如果等于，说明该操作因超时而被取消，因此设置 errno 为 ETIMEDOUT 并返回 -1，表示操作失败
-            if(tinfo->cancelled == ETIMEDOUT) 
+        }
+        if(busy)
+        {
+            wait = std::min<uint64_t>(wait, kBusyWaitNs);
+        }
+
+        bool timed = wait != (uint64_t)-1;
+        if(timed)
+        {
+            info->sylar::TimerNode::cb = &poll_info::OnTimeout;
+            iom->addTimerNode(info.get(), std::chrono::nanoseconds(wait));
+        }
+        if(token)
+        {
+            info->sylar::CancelWaiter::cb = &poll_info::OnCancel;
+            if(!token->addWaiter(info.get()))
             {
-                errno = tinfo->cancelled;
-                return -1;
+                token = nullptr;
+                info->wake(ECANCELED);
             }
-            // 如果没有超时，则跳转到 retry 标签，重新尝试这个操作
-            goto retry;
+        }
+
+        info->fiber->yield();
+
+        // 摘下定时器和令牌，并去掉还没有触发的注册，不让它们之后再唤醒这个协程
+        // 按 info 删除：已经触发的注册可能又被别的协程（例如同一个 fd 上 hook 的 recv）重新注册，不能删掉它的等待
+        if(timed)
+        {
+            iom->cancelTimerNode(info.get());
+        }
+        if(token)
+        {
+            token->removeWaiter(info.get());
+        }
+        for(auto& item : registered)
+        {
+            iom->delEvent(item.first, item.second, info.get());
+        }
+        if(info->state == ECANCELED)
+        {
+            current_errno() = ECANCELED;
+            return -1;
         }
     }
-    return n;
 }
 
+// fcntl / ioctl 不管 hook 是否开启都会经过这里：开启时和 do_io 一样登记没有记录的 fd，
+// 没有开启时只查找已有的记录，不把在 hook 之外使用的阻塞套接字改成非阻塞
+static sylar::FdCtx* hook_lookup(int fd)
+{
+    return sylar::t_hook_enable ? sylar::FdMgr::GetInstance()->lookup(fd) : sylar::FdMgr::GetInstance()->get(fd);
+}
 
+// 能否在协程中等待：hook 开启并且运行在 IOManager 的线程上
+static bool can_fiber_wait()
+{
+    return sylar::t_hook_enable && sylar::IOManager::GetThis();
+}
 
 extern "C"{
 
@@ -205,7 +697,10 @@ extern "C"{
 #undef XX 
 
 
-// 下面三个 sleep 函数的实现过程类似，目的都是将时间转换成毫秒，添加到超时时间堆中，然后让出协程，方便其他任务执行 
+// 下面三个 sleep 函数的实现过程类似，目的都是把休眠时间作为定时器添加到超时时间堆中，然后让出协程，方便其他任务执行 
+// usleep / nanosleep 按 std::chrono 时长添加定时器，开启 IOManager::setPreciseTimer 后可以精确到微秒
+// 协程有截止时间时最多睡到截止时间，返回 -1 并设置 errno 为 ETIMEDOUT；取消令牌被取消时立即醒来，errno 为 ECANCELED
+// sleep 没有 errno 约定，提前醒来时返回没睡完的秒数
 
 // 实现了一个协程版本的 sleep，通过 hook 机制拦截 sleep 的调用，并将其改为使用协程来实现非阻塞的休眠
 unsigned int sleep(unsigned int seconds)
@@ -215,18 +710,14 @@ unsigned int sleep(unsigned int seconds)
 		return sleep_f(seconds);
 	}
 
-    // 获取当前正在执行的协程，将其保存到 fiber 变量中
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-    
-    // 获取 IOManager 实例
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	
-    // 添加一个定时器模拟睡眠，注意要转换为微秒
-	iom->addTimer(seconds*1000, [fiber, iom](){iom->scheduleLock(fiber, -1);});  
-	
-    // 主动挂起当前协程的执行，将控制权交还给调度器，等待下一次 resume 恢复
-	fiber->yield();  
-
+    // 挂起当前协程，到时由定时器节点把它放回调度器
+	std::chrono::nanoseconds left;
+	int reason = fiber_sleep(std::chrono::seconds(seconds), &left);
+	if(reason)
+	{
+		errno = reason;
+		return (left.count() + 999999999) / 1000000000;
+	}
 	return 0;
 }
 
@@ -238,14 +729,13 @@ int usleep(useconds_t usec)
 		return usleep_f(usec);
 	}
 
-    // 和上面的 sleep 类似
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-
-	iom->addTimer(usec/1000, [fiber, iom](){iom->scheduleLock(fiber);}); // 转换为毫秒
- 
-	fiber->yield();
-
+    // 和上面的 sleep 类似，按微秒添加，不再截断为毫秒
+	int reason = fiber_sleep(std::chrono::microseconds(usec), nullptr);
+	if(reason)
+	{
+		errno = reason;
+		return -1;
+	}
 	return 0;
 }
 
@@ -257,15 +747,21 @@ int nanosleep(const struct timespec* req, struct timespec* rem)
 		return nanosleep_f(req, rem);
 	}	
 
-	int timeout_ms = req->tv_sec*1000 + req->tv_nsec/1000/1000; // 转换为毫秒
-
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	 
-	iom->addTimer(timeout_ms, [fiber, iom](){iom->scheduleLock(fiber, -1);});
-	 
-	fiber->yield();	
+	// 按纳秒添加，不再截断为毫秒
+	std::chrono::nanoseconds timeout = std::chrono::seconds(req->tv_sec) + std::chrono::nanoseconds(req->tv_nsec);
 
+	std::chrono::nanoseconds left;
+	int reason = fiber_sleep(timeout, &left);
+	if(reason)
+	{
+		if(rem)
+		{
+			rem->tv_sec = left.count() / 1000000000;
+			rem->tv_nsec = left.count() % 1000000000;
+		}
+		errno = reason;
+		return -1;
+	}
 	return 0;
 }
 
@@ -277,17 +773,21 @@ int socket(int domain, int type, int protocol)
 		return socket_f(domain, type, protocol);
 	}	
 
-    //如果 hook 启用了，则通过调用原始的 socket 函数创建套接字 
-	int fd = socket_f(domain, type, protocol);
+    // 如果 hook 启用了，则通过调用原始的 socket 函数创建套接字，直接带上 SOCK_NONBLOCK，不用之后再 fcntl 设置
+	int fd = socket_f(domain, type | SOCK_NONBLOCK, protocol);
 	if(fd == -1) // 如果 socket 创建失败
 	{
 		std::cerr << "socket() failed:" << strerror(errno) << std::endl;
 		return fd;
 	}
 
-    // 如果 socket 创建成功，会利用 FdManager 的文件描述符管理类来进行管理，判断是否在其管理的文件描述符中 
-    // 如果不在则扩展存储文件描述数组大小并自动创建 FdCtx 对象，并且通过 FdCtx 的初始化判断是是不是套接字，是不是系统非阻塞模式
-	sylar::FdMgr::GetInstance()->get(fd, true);
+    // 如果 socket 创建成功，登记到 FdManager：已经知道它是非阻塞的套接字，不再 fstat / fcntl
+    // 和 accept4 一样，调用者自己要求 SOCK_NONBLOCK 时记为用户设置的非阻塞
+	sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->addSocket(fd);
+	if(ctx && (type & SOCK_NONBLOCK))
+	{
+		ctx->setUserNonblock(true);
+	}
 
 	return fd;
 }
@@ -302,7 +802,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd); // 获取该文件描述符的上下文信息对象 FdCtx
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd); // 获取该文件描述符的上下文信息对象 FdCtx，没有登记过的 fd 在这里登记
     
     // 检查文件描述符上下文是否存在或是否已关闭
     if(!ctx || ctx->isClosed()) 
@@ -322,6 +822,20 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
+    // io_uring 后端直接提交 connect，由完成事件返回连接结果
+    sylar::IOManager* uring_iom = sylar::IOManager::GetThis();
+    if(uring_iom && uring_iom->isUringEnabled())
+    {
+        ssize_t result;
+        if(uring_submit(timeout_ms, [fd, addr, addrlen](io_uring_sqe* sqe)
+        {
+            sylar::IoUring::PrepRw(sqe, IORING_OP_CONNECT, fd, addr, 0, addrlen);
+        }, result))
+        {
+            return result;
+        }
+    }
+
     // 尝试进行 connect 操作 
     int n = connect_f(fd, addr, addrlen);
     if(n == 0) 
@@ -335,51 +849,56 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
 
     // wait for write event is ready -> connect succeeds
     sylar::IOManager* iom = sylar::IOManager::GetThis(); // 获取当前线程的 IOManager 实例 
-    std::shared_ptr<sylar::Timer> timer; // 声明一个定时器对象
-    std::shared_ptr<timer_info> tinfo(new timer_info); // 创建一个追踪定时器是否取消的对象
-    std::weak_ptr<timer_info> winfo(tinfo); // 判断追踪定时器对象是否存在
 
-    // 如果指定了超时时间，则创建一个定时器
-    if(timeout_ms != (uint64_t)-1) 
+    // 和 do_io 一样，截止时间已过或令牌已取消时不再等待，否则最多等到截止时间
+    int reason = sylar::FiberDeadline::Check();
+    if(reason)
     {
-        // 添加一个定时器，当超时时间到达时，取消事件监听并设置 cancelled 状态 
-        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() 
-        {
-            auto t = winfo.lock(); 
-            // 判断追踪定时器对象是否存在或者追踪定时器的成员变量是否大于0，大于0就意味着取消了
-            if(!t || t->cancelled) 
-            {
-                return;
-            }
-            t->cancelled = ETIMEDOUT; // 如果超时了但事件仍未处理
-            iom->cancelEvent(fd, sylar::IOManager::WRITE); // 将指定的 fd 的事件触发，将事件处理
-        }, winfo);
+        errno = reason;
+        return -1;
+    }
+    timeout_ms = sylar::FiberDeadline::Clamp(timeout_ms);
+    sylar::CancelToken* token = sylar::FiberDeadline::GetToken();
+
+    // 超时定时器节点，放在当前协程的栈上；共享栈协程挂起后栈会被覆盖，改放到堆上
+    timer_info local_tinfo;
+    std::unique_ptr<timer_info> heap_tinfo;
+    if((timeout_ms != (uint64_t)-1 || token) && sylar::Fiber::GetThis()->isSharedStack())
+    {
+        heap_tinfo.reset(new timer_info);
     }
+    timer_info& tinfo = heap_tinfo ? *heap_tinfo : local_tinfo;
 
-    // 为文件描述符 fd 添加一个写事件监听器，目的是为了上面的回调函数处理指定文件描述符
+    // 为文件描述符 fd 添加一个写事件监听器，连接建立或失败时 fd 变为可写
+    uint32_t generation = ctx->getGeneration();
     int rt = iom->addEvent(fd, sylar::IOManager::WRITE); 
     if(rt == 0) // 表示添加事件成功
     {
+        // 如果指定了超时时间，挂上定时器节点，超时时取消写事件并设置 cancelled 状态；有取消令牌时同样挂上
+        tinfo.arm(iom, fd, sylar::IOManager::WRITE, timeout_ms, token);
+
         sylar::Fiber::GetThis()->yield();
 
         // resume either by addEvent or cancelEvent
-        if(timer) // 如果有定时器，取消定时器 
+        tinfo.disarm(); // 取消定时器，从令牌上摘下
+
+        if(ctx->getGeneration() != generation) // 等待期间 fd 被 close 了，不再检查编号可能已经被复用的 fd
         {
-            timer->cancel();
+            current_errno() = EBADF;
+            return -1;
         }
-
-        if(tinfo->cancelled) // 如果发生超时错误或者用户取消
+        if(tinfo.cancelled) // 如果发生超时错误或者用户取消
         {
-            errno = tinfo->cancelled; // 赋值给 errno，通过其查看具体错误原因 
+            current_errno() = tinfo.cancelled; // 赋值给 errno，通过其查看具体错误原因 
             return -1;
         }
     } 
+    else if(errno == ECANCELED) // IOManager 正在 shutdown，不再等待
+    {
+        return -1;
+    }
     else // 如果添加事件失败
     {
-        if(timer) 
-        {
-            timer->cancel();
-        }
         std::cerr << "connect addEvent(" << fd << ", WRITE) error";
     }
 
@@ -398,7 +917,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     } 
     else // 如果有错误，设置 errno 并返回错误
     {
-        errno = error;
+        current_errno() = error;
         return -1;
     }
 }
@@ -415,26 +934,52 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 
 // 用于处理套接字接受连接的操作，同时支持超时连接控制，和 recv 等函数一样使用了 do_io 的模板，实现了非阻塞的 accpet  
 // 如果成功接受了一个新的连接，则将新的文件描述符 fd 添加到文件描述符管理器 FdManager 中进行跟踪管理 
+// 开启 hook 时转给 accept4：新连接直接以 SOCK_NONBLOCK 创建并登记，每条连接省掉 fstat 和两次 fcntl
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
-	int fd = do_io(sockfd, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);	
-    /* 参数说明：
-    sockfd：监听套接字的文件描述符
-    accept_f：原始的 accpet 系统调用函数指针 
-    "accept"：操作名称，用于调试和日志记录 
-    sylar::IOManager::READ：表示 READ 事件（即有新的连接可接受时触发）
-    SO_RCVTIMEO：接收超时时间选项，用于处理超时逻辑 
-    addr和addrlen：用于保存新连接的客户端地址信息 
-    */
+	return accept4(sockfd, addr, addrlen, 0);
+}
+
+// 与 accept 相同，另外带上调用者的 flags；开启 hook 时新连接总是以 SOCK_NONBLOCK 创建，登记到 FdManager 时不再 fstat / fcntl
+// 调用者自己要求 SOCK_NONBLOCK 时记为用户设置的非阻塞，之后这个 fd 上的 IO 直接返回 EAGAIN，不挂起协程
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+	int sys_flags = sylar::t_hook_enable ? (flags | SOCK_NONBLOCK) : flags;
+	ssize_t result;
+	int fd;
+	if(uring_io(sockfd, SO_RCVTIMEO, [sockfd, addr, addrlen, sys_flags](io_uring_sqe* sqe)
+	{
+		sylar::IoUring::PrepRw(sqe, IORING_OP_ACCEPT, sockfd, addr, 0, (uint64_t)(uintptr_t)addrlen);
+		sqe->accept_flags = sys_flags;
+	}, result))
+	{
+		fd = result;
+	}
+	else
+	{
+		fd = do_io(sockfd, accept4_f, "accept4", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen, sys_flags);
+	}
 	if(fd >= 0)
 	{
-		sylar::FdMgr::GetInstance()->get(fd, true); // 将新连接 fd 添加到文件描述符管理器 FdManager 中
+		sylar::FdCtx* ctx = (sys_flags & SOCK_NONBLOCK) ? sylar::FdMgr::GetInstance()->addSocket(fd) : sylar::FdMgr::GetInstance()->get(fd, true);
+		if(ctx && (flags & SOCK_NONBLOCK))
+		{
+			ctx->setUserNonblock(true);
+		}
 	}
 	return fd;
 }
 
 ssize_t read(int fd, void *buf, size_t count)
 {
+	ssize_t result;
+	if(uring_io(fd, SO_RCVTIMEO, [fd, buf, count](io_uring_sqe* sqe)
+	{
+		sylar::IoUring::PrepRw(sqe, IORING_OP_READ, fd, buf, count, (uint64_t)-1);
+	}, result))
+	{
+		return result;
+	}
 	return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);	
 }
 
@@ -445,6 +990,15 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags)
 {
+	ssize_t result;
+	if(uring_io(sockfd, SO_RCVTIMEO, [sockfd, buf, len, flags](io_uring_sqe* sqe)
+	{
+		sylar::IoUring::PrepRw(sqe, IORING_OP_RECV, sockfd, buf, len, 0);
+		sqe->msg_flags = flags;
+	}, result))
+	{
+		return result;
+	}
 	return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);	
 }
 
@@ -458,6 +1012,11 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
 	return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);	
 }
 
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout)
+{
+	return do_io(sockfd, recvmmsg_f, "recvmmsg", sylar::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
 ssize_t write(int fd, const void *buf, size_t count)
 {
 	return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);	
@@ -465,11 +1024,28 @@ ssize_t write(int fd, const void *buf, size_t count)
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 {
+	ssize_t result;
+	if(uring_io(fd, SO_SNDTIMEO, [fd, iov, iovcnt](io_uring_sqe* sqe)
+	{
+		sylar::IoUring::PrepRw(sqe, IORING_OP_WRITEV, fd, iov, iovcnt, (uint64_t)-1);
+	}, result))
+	{
+		return result;
+	}
 	return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);	
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags)
 {
+	ssize_t result;
+	if(uring_io(sockfd, SO_SNDTIMEO, [sockfd, buf, len, flags](io_uring_sqe* sqe)
+	{
+		sylar::IoUring::PrepRw(sqe, IORING_OP_SEND, sockfd, buf, len, 0);
+		sqe->msg_flags = flags;
+	}, result))
+	{
+		return result;
+	}
 	return do_io(sockfd, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);	
 }
 
@@ -483,6 +1059,40 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags)
 	return do_io(sockfd, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);	
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	return do_io(sockfd, sendmmsg_f, "sendmmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
+// 从文件发送到套接字，等待的是 out_fd 可写，in_fd 一般是普通文件，不会因为它挂起
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+// splice 的两端必须有一端是管道，FdManager 只 hook 套接字：
+// fd_in 是套接字时（套接字 -> 管道）等待它可读，否则（管道 -> 套接字）等待 fd_out 可写
+// 管道一端不会挂起协程，代理程序应该及时把管道排空，或者给管道设置 O_NONBLOCK / 传 SPLICE_F_NONBLOCK
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags)
+{
+	// 和 do_io 一样用 lookup：在 hook 之外创建的套接字在这里第一次登记，不会被当成管道而直接调用原始函数
+	sylar::FdCtx* in = sylar::t_hook_enable ? sylar::FdMgr::GetInstance()->lookup(fd_in) : nullptr;
+	if(in && in->isSocket())
+	{
+		return do_io(fd_in, splice_f, "splice", sylar::IOManager::READ, SO_RCVTIMEO, off_in, fd_out, off_out, len, flags);
+	}
+	return do_io(fd_out, [fd_in, off_in](int out, loff_t* off, size_t n, unsigned int f)
+	{
+		return splice_f(fd_in, off_in, out, off, n, f);
+	}, "splice", sylar::IOManager::WRITE, SO_SNDTIMEO, off_out, len, flags);
+}
+
+// tee 只能用于两个管道之间，管道不由 FdManager 当作套接字管理，do_io 会直接调用原始函数，这里只是让它和 splice 走同一条路
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags)
+{
+	return do_io(fd_in, tee_f, "tee", sylar::IOManager::READ, SO_RCVTIMEO, fd_out, len, flags);
+}
+
 // 调用 IOManager 的 cancelAll 函数将 fd 上的事件全部处理，最后从 FdManger 文件描述符管理中移除该 fd
 int close(int fd)
 {
@@ -491,16 +1101,19 @@ int close(int fd)
 		return close_f(fd);
 	}	
 
-	std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+	sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
 
 	if(ctx)
 	{
+		// 先删除记录（代数加一）再唤醒等待者：被唤醒的协程不管在哪个线程上恢复，都能看到代数已经变了并返回 EBADF，
+		// 不会在 close_f 之后用同一个编号重试，读写到复用这个编号的新连接
+		sylar::FdMgr::GetInstance()->del(fd); 
 		auto iom = sylar::IOManager::GetThis();
 		if(iom)
 		{	
 			iom->cancelAll(fd);
+			iom->cancelIo(fd); // 取消本线程 io_uring 上这个 fd 的在途 IO
 		}
-		sylar::FdMgr::GetInstance()->del(fd); 
 	}
 	return close_f(fd); // 处理完后调用原始系统调用
 }
@@ -517,7 +1130,7 @@ int fcntl(int fd, int cmd, ... /* arg */ )
             {
                 int arg = va_arg(va, int); // 取出可变参数列表的下一个参数
                 va_end(va); // 清理 va 占用的资源，结束对可变参数的访问
-                std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = hook_lookup(fd);
 
                 // 如果 ctx 无效，或者文件描述符关闭或者不是一个套接字，就调用原始调用
                 if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
@@ -545,7 +1158,7 @@ int fcntl(int fd, int cmd, ... /* arg */ )
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd); // 调用原始的 fcntl 函数获取文件描述符的当前状态标志 
-                std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = hook_lookup(fd);
 
                 // 如果上下文无效或文件描述符已关闭或不是套接字，则直接返回状态标志
                 if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
@@ -638,7 +1251,7 @@ int ioctl(int fd, unsigned long request, ...)
     {
         bool user_nonblock = !!*(int*)arg; // !! 是为了确保将其转换成 bool 类型，比如一开始结果是 true，经过一次!转换成了 false，然后再一次!转换成了 true 
 
-        std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+        sylar::FdCtx* ctx = hook_lookup(fd);
 
         // 检查获取的上下文对象是否有效，如果上下文对象无效或文件描述符已关闭或不是一个套接字，则直接调用原始的 ioctl 函数 
         if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
@@ -679,7 +1292,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) 
         {
-            std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(sockfd);
             // 读取传入的 timeval 结构体，将其转化为毫秒数，并调用 ctx->setTimeout 方法，记录超时设置 
             if(ctx) 
             {
@@ -693,4 +1306,220 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     return setsockopt_f(sockfd, level, optname, optval, optlen);	
 }
 
+
+// open / openat：hook 开启时在线程池中打开（路径解析和元数据读取同样可能阻塞在磁盘上），成功后登记到 FdManager，
+// 之后这个 fd 上的读写和 fsync 都交给线程池执行；O_CREAT / O_TMPFILE 时才有第三个参数 mode
+int open(const char *pathname, int flags, ...)
+{
+    mode_t mode = 0;
+    if((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE)
+    {
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, int);
+        va_end(va);
+    }
+    if(!sylar::t_hook_enable)
+    {
+        return open_f(pathname, flags, mode);
+    }
+    int fd = offload_io(open_f, pathname, flags, mode);
+    if(fd >= 0)
+    {
+        sylar::FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
+}
+
+int openat(int dirfd, const char *pathname, int flags, ...)
+{
+    mode_t mode = 0;
+    if((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE)
+    {
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, int);
+        va_end(va);
+    }
+    if(!sylar::t_hook_enable)
+    {
+        return openat_f(dirfd, pathname, flags, mode);
+    }
+    int fd = offload_io(openat_f, dirfd, pathname, flags, mode);
+    if(fd >= 0)
+    {
+        sylar::FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    return do_io(fd, pread_f, "pread", sylar::IOManager::READ, SO_RCVTIMEO, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    return do_io(fd, pwrite_f, "pwrite", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count, offset);
+}
+
+int fsync(int fd)
+{
+    return do_file_io(fd, fsync_f);
+}
+
+int fdatasync(int fd)
+{
+    return do_file_io(fd, fdatasync_f);
+}
+
+// poll / ppoll：超时为 0 或者已经有 fd 就绪时和原始调用一样直接返回，否则只挂起当前协程
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    if(!can_fiber_wait())
+    {
+        return poll_f(fds, nfds, timeout);
+    }
+    return fiber_poll(fds, nfds, timeout < 0 ? -1 : (int64_t)timeout * 1000000, nullptr);
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask)
+{
+    if(!can_fiber_wait())
+    {
+        return ppoll_f(fds, nfds, tmo_p, sigmask);
+    }
+    int64_t timeout_ns = tmo_p ? (int64_t)tmo_p->tv_sec * 1000000000 + tmo_p->tv_nsec : -1;
+    return fiber_poll(fds, nfds, timeout_ns, sigmask);
+}
+
+// select：把三个 fd_set 转换成 pollfd 数组交给 fiber_poll，返回后按内核 select 的规则写回，并和 Linux 一样把剩余时间写回 timeout
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout)
+{
+    if(!can_fiber_wait() || nfds < 0 || nfds > FD_SETSIZE)
+    {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+
+    std::vector<struct pollfd> fds;
+    for(int fd = 0; fd < nfds; fd++)
+    {
+        short events = 0;
+        if(readfds && FD_ISSET(fd, readfds))
+        {
+            events |= POLLIN;
+        }
+        if(writefds && FD_ISSET(fd, writefds))
+        {
+            events |= POLLOUT;
+        }
+        if(exceptfds && FD_ISSET(fd, exceptfds))
+        {
+            events |= POLLPRI;
+        }
+        if(events)
+        {
+            fds.push_back({fd, events, 0});
+        }
+    }
+
+    int64_t timeout_ns = timeout ? (int64_t)timeout->tv_sec * 1000000000 + (int64_t)timeout->tv_usec * 1000 : -1;
+    auto start = std::chrono::steady_clock::now();
+    int n = fiber_poll(fds.data(), fds.size(), timeout_ns, nullptr);
+    if(timeout)
+    {
+        int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        int64_t left = elapsed < timeout_ns ? timeout_ns - elapsed : 0;
+        timeout->tv_sec = left / 1000000000;
+        timeout->tv_usec = left % 1000000000 / 1000;
+    }
+    if(n < 0)
+    {
+        return n;
+    }
+
+    // 和内核的 POLLIN_SET / POLLOUT_SET / POLLEX_SET 一致：挂断和出错同时算作可读，出错也算作可写
+    int count = 0;
+    for(auto& item : fds)
+    {
+        if(item.revents & POLLNVAL)
+        {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    if(readfds)
+    {
+        FD_ZERO(readfds);
+    }
+    if(writefds)
+    {
+        FD_ZERO(writefds);
+    }
+    if(exceptfds)
+    {
+        FD_ZERO(exceptfds);
+    }
+    for(auto& item : fds)
+    {
+        if((item.events & POLLIN) && (item.revents & (POLLIN | POLLRDNORM | POLLRDBAND | POLLHUP | POLLERR)))
+        {
+            FD_SET(item.fd, readfds);
+            count++;
+        }
+        if((item.events & POLLOUT) && (item.revents & (POLLOUT | POLLWRNORM | POLLWRBAND | POLLERR)))
+        {
+            FD_SET(item.fd, writefds);
+            count++;
+        }
+        if((item.events & POLLPRI) && (item.revents & POLLPRI))
+        {
+            FD_SET(item.fd, exceptfds);
+            count++;
+        }
+    }
+    return count;
+}
+
+// epoll_wait：epoll fd 本身有就绪事件时可读，没有事件时挂起协程等它可读，再取出事件；被别的线程抢先取走时继续等
+// IOManager 自己的 idle 调用的是 epoll_wait_f，不经过这里
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    if(!can_fiber_wait())
+    {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+
+    int64_t timeout_ns = timeout < 0 ? -1 : (int64_t)timeout * 1000000;
+    auto start = std::chrono::steady_clock::now();
+    while(true)
+    {
+        int n = epoll_wait_f(epfd, events, maxevents, 0);
+        if(n != 0 || timeout == 0)
+        {
+            return n;
+        }
+        int64_t left = -1;
+        if(timeout_ns > 0)
+        {
+            int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            if(elapsed >= timeout_ns)
+            {
+                return 0;
+            }
+            left = timeout_ns - elapsed;
+        }
+        struct pollfd item = {epfd, POLLIN, 0};
+        int rt = fiber_poll(&item, 1, left, nullptr);
+        if(rt <= 0)
+        {
+            return rt;
+        }
+        if(item.revents & POLLNVAL)
+        {
+            return epoll_wait_f(epfd, events, maxevents, 0); // 让原始调用报告 EBADF / EINVAL
+        }
+    }
+}
+
 }
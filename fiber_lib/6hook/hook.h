@@ -7,6 +7,12 @@
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 
 namespace sylar{
 
@@ -36,6 +42,9 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
 	typedef int (*accept_fun) (int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 	extern accept_fun accept_f;
 
+	typedef int (*accept4_fun) (int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+	extern accept4_fun accept4_f;
+
 	typedef ssize_t (*read_fun) (int fd, void *buf, size_t count);
 	extern read_fun read_f;
 
@@ -51,6 +60,9 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
 	typedef ssize_t (*recvmsg_fun) (int sockfd, struct msghdr *msg, int flags);
 	extern recvmsg_fun recvmsg_f;
 
+	typedef int (*recvmmsg_fun) (int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+	extern recvmmsg_fun recvmmsg_f;
+
 	typedef ssize_t (*write_fun) (int fd, const void *buf, size_t count);
 	extern write_fun write_f;
 
@@ -66,6 +78,19 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
 	typedef ssize_t (*sendmsg_fun) (int sockfd, const struct msghdr *msg, int flags);
 	extern sendmsg_fun sendmsg_f;
 
+	typedef int (*sendmmsg_fun) (int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+	extern sendmmsg_fun sendmmsg_f;
+
+	// 零拷贝
+	typedef ssize_t (*sendfile_fun) (int out_fd, int in_fd, off_t *offset, size_t count);
+	extern sendfile_fun sendfile_f;
+
+	typedef ssize_t (*splice_fun) (int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+	extern splice_fun splice_f;
+
+	typedef ssize_t (*tee_fun) (int fd_in, int fd_out, size_t len, unsigned int flags);
+	extern tee_fun tee_f;
+
 	typedef int (*close_fun) (int fd);
 	extern close_fun close_f;
 
@@ -81,6 +106,38 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
     typedef int (*setsockopt_fun) (int sockfd, int level, int optname, const void *optval, socklen_t optlen);
     extern setsockopt_fun setsockopt_f;
 
+	// 普通文件
+	typedef int (*open_fun) (const char *pathname, int flags, ...);
+	extern open_fun open_f;
+
+	typedef int (*openat_fun) (int dirfd, const char *pathname, int flags, ...);
+	extern openat_fun openat_f;
+
+	typedef ssize_t (*pread_fun) (int fd, void *buf, size_t count, off_t offset);
+	extern pread_fun pread_f;
+
+	typedef ssize_t (*pwrite_fun) (int fd, const void *buf, size_t count, off_t offset);
+	extern pwrite_fun pwrite_f;
+
+	typedef int (*fsync_fun) (int fd);
+	extern fsync_fun fsync_f;
+
+	typedef int (*fdatasync_fun) (int fd);
+	extern fdatasync_fun fdatasync_f;
+
+	// 多路复用
+	typedef int (*poll_fun) (struct pollfd *fds, nfds_t nfds, int timeout);
+	extern poll_fun poll_f;
+
+	typedef int (*ppoll_fun) (struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask);
+	extern ppoll_fun ppoll_f;
+
+	typedef int (*select_fun) (int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+	extern select_fun select_f;
+
+	typedef int (*epoll_wait_fun) (int epfd, struct epoll_event *events, int maxevents, int timeout);
+	extern epoll_wait_fun epoll_wait_f;
+
     // 函数重定义 function prototype -> 对应.h中已经存在 可以省略
 	
 	// sleep function 
@@ -91,7 +148,10 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
 	// socket funciton
 	int socket(int domain, int type, int protocol);
 	int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+	// 带超时的 connect：timeout_ms 内没有连上时返回 -1，errno 为 ETIMEDOUT；connect 使用 s_connect_timeout（默认不超时）
+	int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms);
 	int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+	int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 
 	// read 
 	ssize_t read(int fd, void *buf, size_t count);
@@ -100,6 +160,7 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
     ssize_t recv(int sockfd, void *buf, size_t len, int flags);
     ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
     ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags);
+    int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
 
     // write
     ssize_t write(int fd, const void *buf, size_t count);
@@ -108,6 +169,12 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
     ssize_t send(int sockfd, const void *buf, size_t len, int flags);
     ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
     ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags);
+    int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+    // zero copy
+    ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+    ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+    ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags);
 
     // fd
     int close(int fd);
@@ -118,5 +185,21 @@ extern "C" // 确保正确调用C库中的系统调用，C++ 编译器不会对
 
     int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen);
     int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
+
+    // file
+    int open(const char *pathname, int flags, ...);
+    int openat(int dirfd, const char *pathname, int flags, ...);
+    ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+    ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+    int fsync(int fd);
+    int fdatasync(int fd);
+
+    // multiplexing
+    // 第三方库自己调用的 poll / select / epoll_wait：把关心的 fd 注册到 IOManager 上，只挂起当前协程，超时由定时器实现
+    // ppoll 的 sigmask 只在不阻塞的探测调用中生效，协程挂起期间不改变线程的信号掩码
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+    int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask);
+    int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
 }
 #endif
\ No newline at end of file
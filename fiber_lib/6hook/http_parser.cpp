@@ -0,0 +1,527 @@
+#include "http_parser.h"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace sylar {
+
+static inline bool IsCtl(unsigned char c)
+{
+	return c < 0x20 || c == 0x7f;
+}
+
+// 返回 [p, end) 中第一个控制字符（< 0x20 或 0x7f，包括 \r \n \t）的位置，没有时返回 end
+// 请求行和头部值中的普通字符占绝大多数，向量化之后一次可以跳过 16 / 32 个字节
+static const char* FindCtl(const char* p, const char* end)
+{
+#if defined(__AVX2__)
+	const __m256i ctl = _mm256_set1_epi8(0x1f);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	while(end - p >= 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		__m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v); // 无符号 v <= 0x1f
+		uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(low, _mm256_cmpeq_epi8(v, del)));
+		if(mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 32;
+	}
+#elif defined(__SSE2__)
+	const __m128i ctl = _mm_set1_epi8(0x1f);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	while(end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v);
+		int mask = _mm_movemask_epi8(_mm_or_si128(low, _mm_cmpeq_epi8(v, del)));
+		if(mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t ctl = vdupq_n_u8(0x1f);
+	const uint8x16_t del = vdupq_n_u8(0x7f);
+	while(end - p >= 16)
+	{
+		uint8x16_t v = vld1q_u8((const uint8_t*)p);
+		uint8x16_t hit = vorrq_u8(vcleq_u8(v, ctl), vceqq_u8(v, del));
+		if(vmaxvq_u8(hit))
+		{
+			break; // 在这 16 个字节中，交给下面逐字节找出位置
+		}
+		p += 16;
+	}
+#endif
+	while(p < end && !IsCtl(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+// RFC 9110 的 tchar：方法和头部名称中允许的字符
+struct TokenTable
+{
+	bool table[256];
+	TokenTable()
+	{
+		for(int c = 0; c < 256; c++)
+		{
+			table[c] = c > 0x20 && c < 0x7f && !strchr("\"(),/:;<=>?@[\\]{}", c);
+		}
+	}
+};
+static const TokenTable s_token;
+
+static inline bool IsToken(char c)
+{
+	return s_token.table[(unsigned char)c];
+}
+
+static inline char Lower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+{
+	if(a.size() != b.size())
+	{
+		return false;
+	}
+	for(size_t i = 0; i < a.size(); i++)
+	{
+		if(Lower(a[i]) != Lower(b[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static std::string_view TrimOws(std::string_view s)
+{
+	while(!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+	{
+		s.remove_prefix(1);
+	}
+	while(!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+	{
+		s.remove_suffix(1);
+	}
+	return s;
+}
+
+// 逗号分隔的列表中是否有 token（不区分大小写），用于 Connection
+static bool ListContains(std::string_view list, std::string_view token)
+{
+	while(!list.empty())
+	{
+		size_t comma = list.find(',');
+		std::string_view item = TrimOws(list.substr(0, comma));
+		if(EqualsIgnoreCase(item, token))
+		{
+			return true;
+		}
+		if(comma == std::string_view::npos)
+		{
+			break;
+		}
+		list.remove_prefix(comma + 1);
+	}
+	return false;
+}
+
+// 列表中最后一项是否为 token，用于 Transfer-Encoding（chunked 必须是最后一个编码）
+static bool ListEndsWith(std::string_view list, std::string_view token)
+{
+	size_t comma = list.rfind(',');
+	std::string_view last = TrimOws(comma == std::string_view::npos ? list : list.substr(comma + 1));
+	return EqualsIgnoreCase(last, token);
+}
+
+std::string_view HttpRequest::header(std::string_view name) const
+{
+	for(size_t i = 0; i < headerCount; i++)
+	{
+		if(EqualsIgnoreCase(headers[i].name, name))
+		{
+			return headers[i].value;
+		}
+	}
+	return std::string_view();
+}
+
+// 行尾：\r\n 或单独的 \n，其他控制字符（头部值中的 \t 除外）都是错误；成功时返回下一行的开头
+static const char* ParseLineEnd(const char* p, const char* end)
+{
+	if(*p == '\r')
+	{
+		return (p + 1 < end && p[1] == '\n') ? p + 2 : nullptr;
+	}
+	return *p == '\n' ? p + 1 : nullptr;
+}
+
+int HttpRequestParser::parse(const char* data, size_t len, HttpRequest& req)
+{
+	const char* end = data + len;
+
+	// 请求行之前的空行忽略（RFC 9112 2.2），例如上一个请求的消息体后面多出的 \r\n
+	const char* start = data;
+	while(start < end && (*start == '\r' || *start == '\n'))
+	{
+		start++;
+	}
+
+	// 找头部的结束位置：一个 \n 后面紧跟 \n 或 \r\n；从上次扫描到的位置往回 3 个字节继续找
+	size_t resume = std::max(m_scanned >= 3 ? m_scanned - 3 : 0, (size_t)(start - data));
+	const char* head_end = nullptr;
+	const char* p = data + resume;
+	while(p < end)
+	{
+		const char* nl = (const char*)memchr(p, '\n', end - p);
+		if(!nl)
+		{
+			break;
+		}
+		if(nl + 1 < end && nl[1] == '\n')
+		{
+			head_end = nl + 2;
+			break;
+		}
+		if(nl + 2 < end && nl[1] == '\r' && nl[2] == '\n')
+		{
+			head_end = nl + 3;
+			break;
+		}
+		p = nl + 1;
+	}
+	if(!head_end)
+	{
+		m_scanned = len;
+		return len > m_maxHeaderSize ? kTooLarge : kIncomplete;
+	}
+	if((size_t)(head_end - start) > m_maxHeaderSize)
+	{
+		return kTooLarge;
+	}
+
+	// 请求行：method SP target SP HTTP/1.x
+	p = start;
+	const char* method = p;
+	while(p < head_end && IsToken(*p))
+	{
+		p++;
+	}
+	if(p == method || *p != ' ')
+	{
+		return kError;
+	}
+	req.method = std::string_view(method, p - method);
+	const char* target = ++p;
+	while(p < head_end && *p != ' ' && !IsCtl(*p))
+	{
+		p++;
+	}
+	if(p == target || *p != ' ')
+	{
+		return kError;
+	}
+	req.target = std::string_view(target, p - target);
+	p++;
+	if(head_end - p < 9 || memcmp(p, "HTTP/1.", 7) != 0 || p[7] < '0' || p[7] > '9')
+	{
+		return kError;
+	}
+	req.versionMinor = p[7] - '0';
+	p = ParseLineEnd(p + 8, head_end);
+	if(!p)
+	{
+		return kError;
+	}
+	size_t q = req.target.find('?');
+	req.path = req.target.substr(0, q);
+	req.query = q == std::string_view::npos ? std::string_view() : req.target.substr(q + 1);
+
+	// 头部行：name ":" OWS value OWS，直到空行
+	req.headerCount = 0;
+	req.keepAlive = req.versionMinor >= 1;
+	req.chunked = false;
+	req.contentLength = 0;
+	req.body = std::string_view();
+	bool has_length = false;
+	bool has_encoding = false;
+	while(true)
+	{
+		const char* next = ParseLineEnd(p, head_end);
+		if(next)
+		{
+			p = next; // 空行，头部结束
+			break;
+		}
+		const char* name = p;
+		while(p < head_end && IsToken(*p))
+		{
+			p++;
+		}
+		if(p == name || *p != ':') // 名称和冒号之间不能有空白（RFC 9112 5.1）
+		{
+			return kError;
+		}
+		std::string_view name_view(name, p - name);
+		const char* value = ++p;
+		const char* eol;
+		while(true)
+		{
+			eol = FindCtl(p, head_end);
+			if(eol < head_end && *eol == '\t')
+			{
+				p = eol + 1;
+				continue;
+			}
+			break;
+		}
+		if(eol == head_end)
+		{
+			return kError;
+		}
+		next = ParseLineEnd(eol, head_end);
+		if(!next)
+		{
+			return kError;
+		}
+		if(req.headerCount == HttpRequest::kMaxHeaders)
+		{
+			return kTooLarge;
+		}
+		std::string_view value_view = TrimOws(std::string_view(value, eol - value));
+		req.headers[req.headerCount++] = HttpHeader{name_view, value_view};
+		p = next;
+
+		// 决定消息体长度和连接是否保持的几个头部
+		if(EqualsIgnoreCase(name_view, "content-length"))
+		{
+			if(value_view.empty())
+			{
+				return kError;
+			}
+			uint64_t v = 0;
+			for(char c : value_view)
+			{
+				if(c < '0' || c > '9' || v > (UINT64_MAX - 9) / 10)
+				{
+					return kError;
+				}
+				v = v * 10 + (c - '0');
+			}
+			if(has_length && v != req.contentLength)
+			{
+				return kError;
+			}
+			has_length = true;
+			req.contentLength = v;
+		}
+		else if(EqualsIgnoreCase(name_view, "transfer-encoding"))
+		{
+			has_encoding = true;
+			req.chunked = ListEndsWith(value_view, "chunked");
+		}
+		else if(EqualsIgnoreCase(name_view, "connection"))
+		{
+			if(ListContains(value_view, "close"))
+			{
+				req.keepAlive = false;
+			}
+			else if(ListContains(value_view, "keep-alive"))
+			{
+				req.keepAlive = true;
+			}
+		}
+	}
+
+	// 同时有 Content-Length 和 Transfer-Encoding、或者最后一个编码不是 chunked 时无法确定请求的边界（RFC 9112 6.3），直接拒绝，避免请求走私
+	if(has_encoding && (has_length || !req.chunked))
+	{
+		return kError;
+	}
+	return p - data;
+}
+
+void ChunkedDecoder::reset()
+{
+	m_state = SIZE;
+	m_sizeDigits = false;
+	m_lineEmpty = true;
+	m_chunkLeft = 0;
+	m_src = 0;
+	m_dst = 0;
+}
+
+static inline int HexValue(char c)
+{
+	if(c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	c = Lower(c);
+	if(c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+int ChunkedDecoder::decode(char* data, size_t len)
+{
+	while(m_src < len)
+	{
+		char c = data[m_src];
+		switch(m_state)
+		{
+		case SIZE:
+		{
+			int v = HexValue(c);
+			if(v >= 0)
+			{
+				if(m_chunkLeft > (UINT64_MAX >> 4))
+				{
+					return kError;
+				}
+				m_chunkLeft = m_chunkLeft * 16 + v;
+				m_sizeDigits = true;
+				m_src++;
+				break;
+			}
+			if(!m_sizeDigits)
+			{
+				return kError;
+			}
+			if(c == ';' || c == ' ' || c == '\t')
+			{
+				m_state = EXT;
+			}
+			else if(c == '\r')
+			{
+				m_state = SIZE_LF;
+			}
+			else if(c == '\n')
+			{
+				m_state = m_chunkLeft ? DATA : TRAILER;
+			}
+			else
+			{
+				return kError;
+			}
+			m_src++;
+			break;
+		}
+		case EXT: // 块扩展直接跳过
+			if(c == '\r')
+			{
+				m_state = SIZE_LF;
+			}
+			else if(c == '\n')
+			{
+				m_state = m_chunkLeft ? DATA : TRAILER;
+			}
+			m_src++;
+			break;
+		case SIZE_LF:
+			if(c != '\n')
+			{
+				return kError;
+			}
+			m_state = m_chunkLeft ? DATA : TRAILER;
+			m_src++;
+			break;
+		case DATA:
+		{
+			size_t n = std::min((uint64_t)(len - m_src), m_chunkLeft);
+			if(m_dst != m_src)
+			{
+				memmove(data + m_dst, data + m_src, n);
+			}
+			m_dst += n;
+			m_src += n;
+			m_chunkLeft -= n;
+			if(!m_chunkLeft)
+			{
+				m_state = DATA_CR;
+			}
+			break;
+		}
+		case DATA_CR:
+			if(c == '\r')
+			{
+				m_state = DATA_LF;
+			}
+			else if(c == '\n')
+			{
+				m_state = SIZE;
+				m_sizeDigits = false;
+			}
+			else
+			{
+				return kError;
+			}
+			m_src++;
+			break;
+		case DATA_LF:
+			if(c != '\n')
+			{
+				return kError;
+			}
+			m_state = SIZE;
+			m_sizeDigits = false;
+			m_src++;
+			break;
+		case TRAILER: // trailer 逐行跳过，遇到空行结束
+			m_src++;
+			if(c == '\r')
+			{
+				m_state = TRAILER_LF;
+			}
+			else if(c == '\n')
+			{
+				if(m_lineEmpty)
+				{
+					return kDone;
+				}
+				m_lineEmpty = true;
+			}
+			else
+			{
+				m_lineEmpty = false;
+			}
+			break;
+		case TRAILER_LF:
+			if(c != '\n')
+			{
+				return kError;
+			}
+			m_src++;
+			if(m_lineEmpty)
+			{
+				return kDone;
+			}
+			m_lineEmpty = true;
+			m_state = TRAILER;
+			break;
+		}
+	}
+	return kIncomplete;
+}
+
+}
@@ -0,0 +1,87 @@
+#ifndef _HTTP_PARSER_H_
+#define _HTTP_PARSER_H_
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+namespace sylar {
+
+struct HttpHeader
+{
+	std::string_view name;
+	std::string_view value; // 去掉了两端的空白
+};
+
+// 解析出的请求，所有字段都是指向连接接收缓冲区的 string_view，缓冲区中的数据被移动或覆盖之前有效，不做任何堆分配
+struct HttpRequest
+{
+	static const size_t kMaxHeaders = 64;
+
+	std::string_view method;
+	std::string_view target; // 请求行中的原始目标
+	std::string_view path; // target 中 '?' 之前的部分
+	std::string_view query; // target 中 '?' 之后的部分，没有时为空
+	int versionMinor = 1; // HTTP/1.x 中的 x
+	HttpHeader headers[kMaxHeaders];
+	size_t headerCount = 0;
+
+	bool keepAlive = true; // HTTP/1.1 默认保持连接，HTTP/1.0 需要 Connection: keep-alive
+	bool chunked = false; // Transfer-Encoding 的最后一个编码是 chunked
+	uint64_t contentLength = 0;
+	std::string_view body; // 完整的消息体，chunked 时是原地解码之后的数据
+
+	// 按名称查找头部（不区分大小写），没有时返回空
+	std::string_view header(std::string_view name) const;
+};
+
+// 增量的请求头部解析器：数据不完整时记住已经扫描过的长度，数据增加后从那里继续找头部的结束位置，找到后一次解析整个头部
+// x86-64 上用 SSE2（编译时开启 AVX2 则用 AVX2）、AArch64 上用 NEON 一次检查 16 / 32 个字节中有没有控制字符，来定位行尾和非法字节
+class HttpRequestParser
+{
+public:
+	// 头部（请求行 + 所有头部行 + 空行）的最大长度
+	explicit HttpRequestParser(size_t max_header_size = 8192): m_maxHeaderSize(max_header_size) {}
+
+	static const int kIncomplete = 0; // 数据还不完整
+	static const int kError = -1; // 格式错误，应该回复 400 并关闭连接
+	static const int kTooLarge = -2; // 头部超过 max_header_size 或头部行数超过 HttpRequest::kMaxHeaders，应该回复 431 并关闭连接
+
+	// 解析 [data, data + len) 开头的一个请求头部，成功时返回头部的字节数并填充 req（不包括 body），否则返回上面的状态
+	// 同一个请求的数据增加后用同一个开头再次调用；一个请求处理完之后调用 reset()
+	int parse(const char* data, size_t len, HttpRequest& req);
+	void reset() {m_scanned = 0;}
+
+private:
+	size_t m_maxHeaderSize;
+	size_t m_scanned = 0; // 已经确认不包含头部结束位置的前缀长度
+};
+
+// chunked 消息体原地解码：把各个块的数据依次移到消息体开头，得到连续的消息体；忽略块扩展和 trailer
+class ChunkedDecoder
+{
+public:
+	static const int kIncomplete = 0;
+	static const int kDone = 1;
+	static const int kError = -1;
+
+	// data 指向消息体的开头，len 为目前收到的消息体字节数；同一个消息体的数据增加后用同一个开头再次调用，已经处理过的部分不会重复处理
+	// 返回 kDone 时 decodedSize() 为解码后的长度（位于 [data, data + decodedSize())），consumed() 为消息体在原始数据中占用的字节数
+	int decode(char* data, size_t len);
+	size_t decodedSize() const {return m_dst;}
+	size_t consumed() const {return m_src;}
+	void reset();
+
+private:
+	enum State {SIZE, EXT, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER, TRAILER_LF};
+	State m_state = SIZE;
+	bool m_sizeDigits = false; // 当前块大小至少有一位十六进制数字
+	bool m_lineEmpty = true; // trailer 中当前行是否为空
+	uint64_t m_chunkLeft = 0; // 当前块还没有解码的字节数
+	size_t m_src = 0; // 已经处理的原始字节数
+	size_t m_dst = 0; // 已经解码的字节数
+};
+
+}
+
+#endif
@@ -0,0 +1,336 @@
+#include "http_server.h"
+
+#include <strings.h>
+#include <cstring>
+#include <charconv>
+#include <iostream>
+
+namespace sylar {
+
+// 接收缓冲区的初始大小，放得下一般的请求头部；更大的请求按需翻倍
+static const size_t kInitialBufferSize = 4096;
+// chunked 消息体中块大小行和 CRLF 占用的额外空间
+static const size_t kChunkOverhead = 64 * 1024;
+
+static void AppendNumber(IOBuffer& out, uint64_t n)
+{
+	char digits[24];
+	auto rt = std::to_chars(digits, digits + sizeof(digits), n);
+	out.append(digits, rt.ptr - digits);
+}
+
+static void AppendView(IOBuffer& out, std::string_view s)
+{
+	out.append(s.data(), s.size());
+}
+
+std::string_view HttpResponse::StatusReason(int code)
+{
+	switch(code)
+	{
+		case 100: return "Continue";
+		case 200: return "OK";
+		case 201: return "Created";
+		case 204: return "No Content";
+		case 301: return "Moved Permanently";
+		case 302: return "Found";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 408: return "Request Timeout";
+		case 413: return "Payload Too Large";
+		case 431: return "Request Header Fields Too Large";
+		case 500: return "Internal Server Error";
+		case 501: return "Not Implemented";
+		case 503: return "Service Unavailable";
+		default: return "Unknown";
+	}
+}
+
+void HttpResponse::setHeader(std::string_view name, std::string_view value)
+{
+	m_headers.append(name.data(), name.size());
+	m_headers.append(": ", 2);
+	m_headers.append(value.data(), value.size());
+	m_headers.append("\r\n", 2);
+}
+
+void HttpResponse::reset()
+{
+	m_status = 200;
+	m_reason = std::string_view();
+	m_headers.clear();
+	m_body.clear();
+	m_shared.clear();
+	m_close = false;
+}
+
+void HttpResponse::serialize(IOBuffer& out, bool keep_alive, bool head_only) const
+{
+	AppendView(out, "HTTP/1.1 ");
+	AppendNumber(out, m_status);
+	out.append(" ", 1);
+	AppendView(out, m_reason.empty() ? StatusReason(m_status) : m_reason);
+	out.append("\r\n", 2);
+	out.append(m_headers);
+	// 1xx、204、304 没有消息体，也不带 Content-Length
+	bool no_body = m_status < 200 || m_status == 204 || m_status == 304;
+	if(!no_body)
+	{
+		AppendView(out, "Content-Length: ");
+		AppendNumber(out, m_body.size() + m_shared.size());
+		out.append("\r\n", 2);
+	}
+	AppendView(out, keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+	if(no_body || head_only)
+	{
+		return;
+	}
+	out.append(m_body);
+	if(!m_shared.empty())
+	{
+		out.append(m_shared);
+	}
+}
+
+void HttpRouter::add(std::string_view method, std::string_view path, Handler handler)
+{
+	m_routes.push_back(Route{std::string(method), std::string(path), false, std::move(handler)});
+}
+
+void HttpRouter::addPrefix(std::string_view method, std::string_view prefix, Handler handler)
+{
+	m_routes.push_back(Route{std::string(method), std::string(prefix), true, std::move(handler)});
+}
+
+void HttpRouter::route(const HttpRequest& req, HttpResponse& resp) const
+{
+	const Route* best = nullptr;
+	bool path_matched = false;
+	for(const Route& r : m_routes)
+	{
+		bool match = r.prefix ? req.path.substr(0, r.path.size()) == r.path : req.path == r.path;
+		if(!match)
+		{
+			continue;
+		}
+		path_matched = true;
+		// HEAD 请求交给 GET 的处理函数，服务端发送时去掉消息体
+		bool method_ok = r.method.empty() || req.method == r.method || (req.method == "HEAD" && r.method == "GET");
+		if(!method_ok)
+		{
+			continue;
+		}
+		// 精确匹配优先，其次是更长的前缀
+		if(!best || (best->prefix && (!r.prefix || r.path.size() > best->path.size())))
+		{
+			best = &r;
+		}
+	}
+
+	if(best)
+	{
+		best->handler(req, resp);
+	}
+	else if(path_matched)
+	{
+		resp.setStatus(405);
+	}
+	else if(m_notFound)
+	{
+		m_notFound(req, resp);
+	}
+	else
+	{
+		resp.setStatus(404);
+		resp.append("Not Found");
+	}
+}
+
+HttpServer::HttpServer(IOManager* iom):
+m_self(std::make_shared<std::weak_ptr<HttpServer>>())
+{
+	// 处理函数不捕获 this：HttpServer 先于正在处理的连接析构时，lock() 失败，连接直接关闭
+	std::shared_ptr<std::weak_ptr<HttpServer>> self_ref = m_self;
+	m_tcp = std::make_shared<TcpServer>(iom, [self_ref](TcpConnection& conn)
+	{
+		std::shared_ptr<HttpServer> self = self_ref->lock();
+		if(self)
+		{
+			self->serve(conn);
+		}
+	});
+}
+
+bool HttpServer::start(uint16_t port, int backlog)
+{
+	*m_self = shared_from_this();
+	return m_tcp->start(port, backlog);
+}
+
+bool HttpServer::start(const sockaddr* addr, socklen_t addrlen, int backlog)
+{
+	*m_self = shared_from_this();
+	return m_tcp->start(addr, addrlen, true, backlog);
+}
+
+void HttpServer::sendError(TcpConnection& conn, IOBuffer& out, int code)
+{
+	HttpResponse resp;
+	resp.setStatus(code);
+	resp.append(HttpResponse::StatusReason(code));
+	resp.serialize(out, false, false);
+	conn.write(out);
+}
+
+void HttpServer::serve(TcpConnection& conn)
+{
+	// 缓冲区的上限：头部 + 消息体，chunked 时再加上块大小行占用的空间
+	const size_t limit = m_maxHeaderSize + m_maxBodySize + kChunkOverhead;
+	std::vector<char> buf(kInitialBufferSize);
+	size_t start = 0; // 当前请求在 buf 中的开头
+	size_t end = 0; // 已经收到的数据的结尾
+	size_t head = 0; // 当前请求的头部长度，0 表示还没有解析出头部；缓冲区中的数据移动后要重新解析，让 req 中的 string_view 指向新位置
+	bool continue_sent = false;
+
+	HttpRequestParser parser(m_maxHeaderSize);
+	ChunkedDecoder decoder;
+	HttpRequest req;
+	HttpResponse resp;
+	IOBuffer out;
+
+	while(true)
+	{
+		// 处理缓冲区中所有完整的请求，响应都追加到 out 中，最后一次写出
+		bool keep_alive = true;
+		while(start < end)
+		{
+			char* p = buf.data() + start;
+			size_t avail = end - start;
+			if(!head)
+			{
+				int rt = parser.parse(p, avail, req);
+				if(rt == HttpRequestParser::kIncomplete)
+				{
+					break;
+				}
+				if(rt < 0)
+				{
+					sendError(conn, out, rt == HttpRequestParser::kTooLarge ? 431 : 400);
+					return;
+				}
+				head = rt;
+			}
+
+			size_t total;
+			if(req.chunked)
+			{
+				int rt = decoder.decode(p + head, avail - head);
+				if(rt == ChunkedDecoder::kError)
+				{
+					sendError(conn, out, 400);
+					return;
+				}
+				if(decoder.decodedSize() > m_maxBodySize)
+				{
+					sendError(conn, out, 413);
+					return;
+				}
+				if(rt == ChunkedDecoder::kIncomplete)
+				{
+					break;
+				}
+				req.body = std::string_view(p + head, decoder.decodedSize());
+				total = head + decoder.consumed();
+			}
+			else
+			{
+				if(req.contentLength > m_maxBodySize)
+				{
+					sendError(conn, out, 413);
+					return;
+				}
+				if(avail - head < req.contentLength)
+				{
+					break;
+				}
+				req.body = std::string_view(p + head, req.contentLength);
+				total = head + req.contentLength;
+			}
+
+			resp.reset();
+			m_router.route(req, resp);
+			m_requests.fetch_add(1, std::memory_order_relaxed);
+			keep_alive = req.keepAlive && !resp.isClose() && !conn.isStopping();
+			resp.serialize(out, keep_alive, req.method == "HEAD");
+
+			start += total;
+			head = 0;
+			continue_sent = false;
+			parser.reset();
+			decoder.reset();
+			if(!keep_alive)
+			{
+				break;
+			}
+		}
+
+		// 消息体还没收完，客户端在等 100 Continue 时先回复它
+		if(head && !continue_sent)
+		{
+			std::string_view expect = req.header("Expect");
+			if(expect.size() == 12 && strncasecmp(expect.data(), "100-continue", 12) == 0)
+			{
+				AppendView(out, "HTTP/1.1 100 Continue\r\n\r\n");
+			}
+			continue_sent = true;
+		}
+
+		if(!out.empty() && conn.write(out) < 0)
+		{
+			return;
+		}
+		if(!keep_alive)
+		{
+			return;
+		}
+
+		// 为下一次 recv 腾出空间
+		if(start == end)
+		{
+			start = end = 0;
+		}
+		else if(end == buf.size())
+		{
+			if(start > 0)
+			{
+				memmove(buf.data(), buf.data() + start, end - start);
+				end -= start;
+				start = 0;
+				head = 0;
+			}
+			else if(buf.size() < limit)
+			{
+				buf.resize(std::min(buf.size() * 2, limit));
+				head = 0;
+			}
+			else
+			{
+				// 头部超长时解析器已经返回了 kTooLarge，走到这里说明消息体超过了上限
+				sendError(conn, out, 413);
+				return;
+			}
+		}
+
+		ssize_t n = conn.recv(buf.data() + end, buf.size() - end);
+		if(n <= 0)
+		{
+			return;
+		}
+		end += n;
+	}
+}
+
+}
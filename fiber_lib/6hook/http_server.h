@@ -0,0 +1,124 @@
+#ifndef _HTTP_SERVER_H_
+#define _HTTP_SERVER_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "http_parser.h"
+#include "tcp_server.h"
+#include "iobuffer.h"
+
+namespace sylar {
+
+// 响应：每条连接复用同一个对象，clear 之后字符串保留容量，稳定之后组装响应不再分配内存
+// Content-Length 和 Connection 由服务端填写，处理函数不需要设置
+class HttpResponse
+{
+public:
+	// reason 为空时使用状态码的标准描述
+	void setStatus(int code, std::string_view reason = std::string_view()) {m_status = code; m_reason = reason;}
+	int getStatus() const {return m_status;}
+	void setHeader(std::string_view name, std::string_view value);
+	void setContentType(std::string_view type) {setHeader("Content-Type", type);}
+	// 处理完这个请求后关闭连接
+	void setClose() {m_close = true;}
+	bool isClose() const {return m_close;}
+
+	void append(std::string_view data) {m_body.append(data.data(), data.size());}
+	std::string& body() {return m_body;}
+	// 共享一份已经放在 IOBuffer 中的响应体（例如缓存的大文件），发送时只增加内存块的引用计数；和 append 的内容一起发送时排在后面
+	void setSharedBody(const IOBuffer& body) {m_shared = body;}
+
+	// 下一个请求之前由服务端调用
+	void reset();
+	// 把状态行、头部和响应体追加到 out；head_only 为 true 时（HEAD 请求）不带响应体
+	void serialize(IOBuffer& out, bool keep_alive, bool head_only) const;
+
+	static std::string_view StatusReason(int code);
+
+private:
+	int m_status = 200;
+	std::string_view m_reason;
+	std::string m_headers; // 已经格式化的 "name: value\r\n"
+	std::string m_body;
+	IOBuffer m_shared;
+	bool m_close = false;
+};
+
+// 路由：先按路径精确匹配，再按最长前缀匹配；路径匹配但方法不符时回复 405，都不匹配时调用 notFound（默认回复 404）
+// 路由表在 start() 之前建好，之后只读；匹配按顺序比较 string_view，不分配内存，适合几十条以内的路由
+class HttpRouter
+{
+public:
+	typedef std::function<void(const HttpRequest&, HttpResponse&)> Handler;
+
+	// method 为空时匹配任意方法
+	void add(std::string_view method, std::string_view path, Handler handler);
+	void addPrefix(std::string_view method, std::string_view prefix, Handler handler);
+	void setNotFound(Handler handler) {m_notFound = std::move(handler);}
+
+	void route(const HttpRequest& req, HttpResponse& resp) const;
+
+private:
+	struct Route
+	{
+		std::string method;
+		std::string path;
+		bool prefix;
+		Handler handler;
+	};
+	std::vector<Route> m_routes;
+	Handler m_notFound;
+};
+
+// HTTP/1.1 服务端：在 TcpServer 的每连接协程中循环读取、解析、路由，支持 keep-alive、流水线和 chunked 请求体
+// 每条连接有一个连续的接收缓冲区，请求的各个字段是指向它的 string_view；缓冲区中所有完整的请求处理完后，它们的响应合并成一次 writev 发出
+// 稳定之后处理一个请求不做堆分配（处理函数自己的分配除外）；请求头部超过上限回复 431，消息体超过上限回复 413，格式错误回复 400，之后关闭连接
+// 和 TcpServer 一样必须用 std::make_shared 创建
+//     auto server = std::make_shared<sylar::HttpServer>(&iom);
+//     server->router().add("GET", "/", [](const sylar::HttpRequest&, sylar::HttpResponse& resp) {resp.append("Hello, World!");});
+//     server->start(8080);
+class HttpServer : public std::enable_shared_from_this<HttpServer>
+{
+public:
+	explicit HttpServer(IOManager* iom);
+
+	HttpServer(const HttpServer&) = delete;
+	HttpServer& operator=(const HttpServer&) = delete;
+
+	HttpRouter& router() {return m_router;}
+	// 连接数上限、空闲超时等连接层的设置
+	TcpServer& tcp() {return *m_tcp;}
+	void setMaxHeaderSize(size_t n) {m_maxHeaderSize = n;}
+	void setMaxBodySize(size_t n) {m_maxBodySize = n;}
+
+	bool start(uint16_t port, int backlog = 1024);
+	bool start(const sockaddr* addr, socklen_t addrlen, int backlog = 1024);
+	// 平滑停止，见 TcpServer::stop；停止期间处理完的请求带 Connection: close
+	bool stop(uint64_t timeout_ms = 5000) {return m_tcp->stop(timeout_ms);}
+	uint16_t getPort() const {return m_tcp->getPort();}
+
+	// 累计处理的请求数
+	uint64_t getRequestCount() const {return m_requests.load(std::memory_order_relaxed);}
+
+private:
+	void serve(TcpConnection& conn);
+	// 回复一个错误并关闭连接
+	void sendError(TcpConnection& conn, IOBuffer& out, int code);
+
+private:
+	// TcpServer 的处理函数通过它取得 HttpServer 的弱引用；构造时还不能调用 shared_from_this，start() 时才填上
+	std::shared_ptr<std::weak_ptr<HttpServer>> m_self;
+	std::shared_ptr<TcpServer> m_tcp;
+	HttpRouter m_router;
+	size_t m_maxHeaderSize = 8192;
+	size_t m_maxBodySize = 1024 * 1024;
+	std::atomic<uint64_t> m_requests = {0};
+};
+
+}
+
+#endif
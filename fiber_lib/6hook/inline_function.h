@@ -0,0 +1,166 @@
+#ifndef __SYLAR_INLINE_FUNCTION_H__
+#define __SYLAR_INLINE_FUNCTION_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+
+/**
+ * 只支持 void() 签名、只能移动的小缓冲区可调用对象，用于调度任务、事件回调和协程入口函数
+ * 不超过 kCapacity 字节、移动不抛异常的可调用对象直接放在对象内部，不分配内存，更大的才放到堆上
+ * std::function<void()> 也能原样放进内部缓冲区，所以从 std::function 转换过来同样不分配
+ * 相比之下 std::function 只有 16 字节、并且要求可平凡复制的可调用对象才放在内部，捕获了 shared_ptr 的 lambda 每次都要 new
+ */
+class InlineFunction
+{
+public:
+    static const size_t kCapacity = 48;
+
+    InlineFunction() {}
+    InlineFunction(std::nullptr_t) {}
+
+    // 只接受可以无参调用的对象，避免和 ScheduleTask 等接受指针、shared_ptr 的重载产生歧义
+    template<class F, class Fn = typename std::decay<F>::type,
+             class = typename std::enable_if<!std::is_same<Fn, InlineFunction>::value>::type,
+             class = decltype(std::declval<Fn&>()())>
+    InlineFunction(F&& f)
+    {
+        if(IsEmpty(f))
+        {
+            return;
+        }
+        if constexpr(sizeof(Fn) <= kCapacity && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<Fn>::value)
+        {
+            new (m_buf) Fn(std::forward<F>(f));
+            m_ops = &InlineOps<Fn>::ops;
+        }
+        else
+        {
+            *reinterpret_cast<Fn**>(m_buf) = new Fn(std::forward<F>(f));
+            m_ops = &HeapOps<Fn>::ops;
+        }
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    InlineFunction& operator=(InlineFunction&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction() {reset();}
+
+    void operator()() {m_ops->invoke(m_buf);}
+
+    explicit operator bool() const {return m_ops != nullptr;}
+
+    void swap(InlineFunction& other)
+    {
+        InlineFunction tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void* buf);
+        void (*move)(void* dst, void* src); // 把 src 中的对象移到 dst，并析构 src 中的对象
+        void (*destroy)(void* buf);
+    };
+
+    template<class Fn>
+    struct InlineOps
+    {
+        static void Invoke(void* buf) {(*static_cast<Fn*>(buf))();}
+        static void Move(void* dst, void* src)
+        {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void Destroy(void* buf) {static_cast<Fn*>(buf)->~Fn();}
+        static constexpr Ops ops = {&Invoke, &Move, &Destroy};
+    };
+
+    template<class Fn>
+    struct HeapOps
+    {
+        static void Invoke(void* buf) {(**static_cast<Fn**>(buf))();}
+        static void Move(void* dst, void* src) {*static_cast<Fn**>(dst) = *static_cast<Fn**>(src);}
+        static void Destroy(void* buf) {delete *static_cast<Fn**>(buf);}
+        static constexpr Ops ops = {&Invoke, &Move, &Destroy};
+    };
+
+    // 空的 std::function 和空函数指针不保存，保持 operator bool 与 std::function 一致
+    // 直接传入的函数（而不是函数指针变量）和 lambda 不可能为空，不做比较
+    template<class Fn>
+    struct IsStdFunction : std::false_type {};
+    template<class Sig>
+    struct IsStdFunction<std::function<Sig>> : std::true_type {};
+
+    template<class Fn>
+    static bool IsEmpty(const Fn& f)
+    {
+        if constexpr(std::is_pointer<Fn>::value || std::is_member_pointer<Fn>::value)
+        {
+            return f == nullptr;
+        }
+        else if constexpr(IsStdFunction<Fn>::value)
+        {
+            return !f;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    void moveFrom(InlineFunction& other)
+    {
+        m_ops = other.m_ops;
+        if(m_ops)
+        {
+            m_ops->move(m_buf, other.m_buf);
+            other.m_ops = nullptr;
+        }
+    }
+
+    void reset()
+    {
+        if(m_ops)
+        {
+            const Ops* ops = m_ops;
+            m_ops = nullptr;
+            ops->destroy(m_buf);
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char m_buf[kCapacity];
+    const Ops* m_ops = nullptr;
+};
+
+}
+
+#endif
@@ -0,0 +1,537 @@
+#include "iobuffer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <new>
+
+namespace sylar {
+
+static std::atomic<size_t> s_cache_capacity{256}; // 每个线程最多缓存的内存块数量
+
+// 线程退出时释放缓存的内存块，和 Arena 的块缓存一样，缓存析构之后释放的块直接 free
+static thread_local bool t_cache_dead = false;
+struct BlockCache
+{
+	std::vector<void*> blocks;
+
+	~BlockCache()
+	{
+		for(void* block : blocks)
+		{
+			free(block);
+		}
+		t_cache_dead = true;
+	}
+};
+static thread_local BlockCache t_block_cache;
+
+IOBuffer::Block* IOBuffer::NewBlock()
+{
+	void* mem;
+	if(!t_cache_dead && !t_block_cache.blocks.empty())
+	{
+		mem = t_block_cache.blocks.back();
+		t_block_cache.blocks.pop_back();
+	}
+	else
+	{
+		mem = malloc(kBlockSize);
+		if(!mem)
+		{
+			throw std::bad_alloc();
+		}
+	}
+	Block* block = (Block*)mem;
+	block->refs.store(1, std::memory_order_relaxed);
+	block->used = 0;
+	return block;
+}
+
+void IOBuffer::Unref(Block* block)
+{
+	if(block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+	// 最后一个引用可能在其他线程上释放，块放回释放时所在线程的缓存
+	if(!t_cache_dead && t_block_cache.blocks.size() < s_cache_capacity.load(std::memory_order_relaxed))
+	{
+		t_block_cache.blocks.push_back(block);
+	}
+	else
+	{
+		free(block);
+	}
+}
+
+void IOBuffer::SetCacheCapacity(size_t blocks)
+{
+	s_cache_capacity = blocks;
+}
+
+IOBuffer::~IOBuffer()
+{
+	clear();
+	for(Block* block : m_spare)
+	{
+		Unref(block);
+	}
+}
+
+IOBuffer::IOBuffer(const IOBuffer& other)
+{
+	append(other);
+}
+
+IOBuffer& IOBuffer::operator=(const IOBuffer& other)
+{
+	if(this != &other)
+	{
+		clear();
+		append(other);
+	}
+	return *this;
+}
+
+IOBuffer::IOBuffer(IOBuffer&& other) noexcept
+	: m_slices(std::move(other.m_slices)), m_head(other.m_head), m_spare(std::move(other.m_spare)), m_size(other.m_size)
+{
+	other.m_slices.clear();
+	other.m_spare.clear();
+	other.m_head = 0;
+	other.m_size = 0;
+}
+
+IOBuffer& IOBuffer::operator=(IOBuffer&& other) noexcept
+{
+	if(this != &other)
+	{
+		clear();
+		m_slices.swap(other.m_slices);
+		m_spare.swap(other.m_spare);
+		m_head = other.m_head;
+		m_size = other.m_size;
+		other.m_head = 0;
+		other.m_size = 0;
+	}
+	return *this;
+}
+
+char* IOBuffer::tailSpace(size_t& avail) const
+{
+	avail = 0;
+	if(m_head == m_slices.size())
+	{
+		return nullptr;
+	}
+	const Slice& last = m_slices.back();
+	if(last.end != last.block->used || last.block->refs.load(std::memory_order_acquire) != 1)
+	{
+		return nullptr;
+	}
+	avail = kBlockData - last.end;
+	return last.block->data() + last.end;
+}
+
+void IOBuffer::pushSlice(Block* block, uint32_t begin, uint32_t end)
+{
+	m_slices.push_back(Slice{block, begin, end});
+	m_size += end - begin;
+}
+
+void IOBuffer::popFront()
+{
+	m_head++;
+	if(m_head == m_slices.size())
+	{
+		m_slices.clear();
+		m_head = 0;
+	}
+	else if(m_head >= 16 && m_head * 2 >= m_slices.size())
+	{
+		m_slices.erase(m_slices.begin(), m_slices.begin() + m_head);
+		m_head = 0;
+	}
+}
+
+void IOBuffer::append(const void* data, size_t len)
+{
+	const char* p = (const char*)data;
+	size_t avail;
+	char* tail = tailSpace(avail);
+	if(tail && avail)
+	{
+		size_t n = std::min(avail, len);
+		memcpy(tail, p, n);
+		Slice& last = m_slices.back();
+		last.end += n;
+		last.block->used = last.end;
+		m_size += n;
+		p += n;
+		len -= n;
+	}
+	while(len)
+	{
+		Block* block;
+		if(!m_spare.empty())
+		{
+			block = m_spare.front();
+			m_spare.erase(m_spare.begin());
+		}
+		else
+		{
+			block = NewBlock();
+		}
+		size_t n = std::min(kBlockData, len);
+		memcpy(block->data(), p, n);
+		block->used = n;
+		pushSlice(block, 0, n);
+		p += n;
+		len -= n;
+	}
+}
+
+void IOBuffer::append(const IOBuffer& other)
+{
+	if(&other == this)
+	{
+		IOBuffer copy(other);
+		append(std::move(copy));
+		return;
+	}
+	for(size_t i = other.m_head; i < other.m_slices.size(); i++)
+	{
+		const Slice& s = other.m_slices[i];
+		Ref(s.block);
+		pushSlice(s.block, s.begin, s.end);
+	}
+}
+
+void IOBuffer::append(IOBuffer&& other)
+{
+	if(&other == this)
+	{
+		IOBuffer copy(other);
+		append(std::move(copy));
+		return;
+	}
+	// 直接转移片段，引用计数不变
+	for(size_t i = other.m_head; i < other.m_slices.size(); i++)
+	{
+		const Slice& s = other.m_slices[i];
+		pushSlice(s.block, s.begin, s.end);
+	}
+	other.m_slices.clear();
+	other.m_head = 0;
+	other.m_size = 0;
+}
+
+void IOBuffer::consume(size_t n)
+{
+	while(n && m_head < m_slices.size())
+	{
+		Slice& front = m_slices[m_head];
+		if(n < front.size())
+		{
+			front.begin += n;
+			m_size -= n;
+			return;
+		}
+		n -= front.size();
+		m_size -= front.size();
+		Unref(front.block);
+		popFront();
+	}
+}
+
+IOBuffer IOBuffer::cut(size_t n)
+{
+	IOBuffer result;
+	while(n && m_head < m_slices.size())
+	{
+		Slice& front = m_slices[m_head];
+		if(n < front.size())
+		{
+			// 片段被分成两半，两边各持有一个引用
+			Ref(front.block);
+			result.pushSlice(front.block, front.begin, front.begin + n);
+			front.begin += n;
+			m_size -= n;
+			break;
+		}
+		n -= front.size();
+		m_size -= front.size();
+		result.pushSlice(front.block, front.begin, front.end);
+		popFront();
+	}
+	return result;
+}
+
+IOBuffer IOBuffer::slice(size_t offset, size_t len) const
+{
+	IOBuffer result;
+	for(size_t i = m_head; i < m_slices.size(); i++)
+	{
+		const Slice& s = m_slices[i];
+		if(!len)
+		{
+			break;
+		}
+		if(offset >= s.size())
+		{
+			offset -= s.size();
+			continue;
+		}
+		uint32_t begin = s.begin + offset;
+		uint32_t end = begin + std::min(len, (size_t)(s.end - begin));
+		offset = 0;
+		len -= end - begin;
+		Ref(s.block);
+		result.pushSlice(s.block, begin, end);
+	}
+	return result;
+}
+
+void IOBuffer::clear()
+{
+	for(size_t i = m_head; i < m_slices.size(); i++)
+	{
+		Unref(m_slices[i].block);
+	}
+	m_slices.clear();
+	m_head = 0;
+	m_size = 0;
+}
+
+size_t IOBuffer::copyTo(void* dst, size_t len, size_t offset) const
+{
+	char* out = (char*)dst;
+	size_t copied = 0;
+	for(size_t i = m_head; i < m_slices.size(); i++)
+	{
+		const Slice& s = m_slices[i];
+		if(copied == len)
+		{
+			break;
+		}
+		if(offset >= s.size())
+		{
+			offset -= s.size();
+			continue;
+		}
+		size_t n = std::min(len - copied, s.size() - offset);
+		memcpy(out + copied, s.block->data() + s.begin + offset, n);
+		copied += n;
+		offset = 0;
+	}
+	return copied;
+}
+
+std::string IOBuffer::toString() const
+{
+	std::string str(m_size, '\0');
+	copyTo(&str[0], m_size);
+	return str;
+}
+
+char IOBuffer::at(size_t i) const
+{
+	for(size_t k = m_head; k < m_slices.size(); k++)
+	{
+		const Slice& s = m_slices[k];
+		if(i < s.size())
+		{
+			return s.block->data()[s.begin + i];
+		}
+		i -= s.size();
+	}
+	return '\0';
+}
+
+size_t IOBuffer::find(const char* needle, size_t len, size_t from) const
+{
+	if(len == 0)
+	{
+		return from <= m_size ? from : npos;
+	}
+	size_t base = 0; // 当前片段第一个字节在缓冲区中的位置
+	for(size_t i = m_head; i < m_slices.size(); i++)
+	{
+		const Slice& s = m_slices[i];
+		const char* data = s.block->data() + s.begin;
+		size_t start = from > base ? from - base : 0;
+		while(start < s.size())
+		{
+			// 用 memchr 找第一个字节，完整落在本片段内时直接 memcmp，否则逐字节比较跨越到后面片段的部分
+			const char* hit = (const char*)memchr(data + start, needle[0], s.size() - start);
+			if(!hit)
+			{
+				break;
+			}
+			size_t pos = hit - data;
+			if(pos + len <= s.size())
+			{
+				if(memcmp(hit, needle, len) == 0)
+				{
+					return base + pos;
+				}
+				start = pos + 1;
+				continue;
+			}
+			if(base + pos + len > m_size)
+			{
+				return npos; // 剩下的数据不够 needle 的长度
+			}
+			size_t k = s.size() - pos;
+			if(memcmp(hit, needle, k) == 0)
+			{
+				size_t si = i + 1;
+				size_t off = 0;
+				while(k < len)
+				{
+					const Slice& cur = m_slices[si];
+					if(off == cur.size())
+					{
+						si++;
+						off = 0;
+						continue;
+					}
+					if(cur.block->data()[cur.begin + off] != needle[k])
+					{
+						break;
+					}
+					k++;
+					off++;
+				}
+				if(k == len)
+				{
+					return base + pos;
+				}
+			}
+			start = pos + 1;
+		}
+		base += s.size();
+	}
+	return npos;
+}
+
+int IOBuffer::readableIovecs(struct iovec* iov, int max, size_t len) const
+{
+	int n = 0;
+	for(size_t i = m_head; i < m_slices.size(); i++)
+	{
+		const Slice& s = m_slices[i];
+		if(n == max || len == 0)
+		{
+			break;
+		}
+		size_t take = std::min(len, s.size());
+		iov[n].iov_base = s.block->data() + s.begin;
+		iov[n].iov_len = take;
+		n++;
+		len -= take;
+	}
+	return n;
+}
+
+int IOBuffer::writableIovecs(struct iovec* iov, int max, size_t len)
+{
+	int n = 0;
+	size_t total = 0;
+	size_t avail;
+	char* tail = tailSpace(avail);
+	if(tail && avail && n < max)
+	{
+		iov[n].iov_base = tail;
+		iov[n].iov_len = avail;
+		n++;
+		total += avail;
+	}
+	for(size_t i = 0; n < max && total < len; i++)
+	{
+		if(i == m_spare.size())
+		{
+			m_spare.push_back(NewBlock());
+		}
+		iov[n].iov_base = m_spare[i]->data();
+		iov[n].iov_len = kBlockData;
+		n++;
+		total += kBlockData;
+	}
+	return n;
+}
+
+void IOBuffer::commit(size_t n)
+{
+	size_t avail;
+	char* tail = tailSpace(avail);
+	if(tail && avail)
+	{
+		size_t take = std::min(avail, n);
+		Slice& last = m_slices.back();
+		last.end += take;
+		last.block->used = last.end;
+		m_size += take;
+		n -= take;
+	}
+	size_t used = 0;
+	while(n && used < m_spare.size())
+	{
+		Block* block = m_spare[used++];
+		size_t take = std::min(kBlockData, n);
+		block->used = take;
+		pushSlice(block, 0, take);
+		n -= take;
+	}
+	m_spare.erase(m_spare.begin(), m_spare.begin() + used);
+}
+
+ssize_t IOBuffer::readFrom(int fd, size_t hint)
+{
+	struct iovec iov[kMaxIov];
+	int n = writableIovecs(iov, kMaxIov, hint);
+	ssize_t rt = readv(fd, iov, n);
+	if(rt > 0)
+	{
+		commit(rt);
+	}
+	// 没有用到的块放回线程缓存，空闲连接不占着它们
+	int saved = errno;
+	for(Block* block : m_spare)
+	{
+		Unref(block);
+	}
+	m_spare.clear();
+	errno = saved;
+	return rt;
+}
+
+ssize_t IOBuffer::writeTo(int fd)
+{
+	struct iovec iov[kMaxIov];
+	size_t total = 0;
+	while(m_size)
+	{
+		int n = readableIovecs(iov, kMaxIov);
+		ssize_t rt = writev(fd, iov, n);
+		if(rt < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		if(rt == 0)
+		{
+			break;
+		}
+		consume(rt);
+		total += rt;
+	}
+	return total;
+}
+
+}
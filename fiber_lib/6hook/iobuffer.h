@@ -0,0 +1,118 @@
+#ifndef _IOBUFFER_H_
+#define _IOBUFFER_H_
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace sylar {
+
+// 分块的字节缓冲区：数据存放在固定大小、带引用计数的内存块中，缓冲区只记录引用的片段（块 + 区间）
+// 拷贝、slice、cut、append(const IOBuffer&) 只增加块的引用计数，不拷贝数据，可以把一份响应体同时挂到多个连接的发送缓冲区上
+// readFrom / writeTo 用 hook 的 readv / writev 一次系统调用填满或写出多个块，在协程中调用时 EAGAIN 会挂起协程等待
+// 内存块释放时放回当前线程的缓存，稳定之后不再调用 malloc / free
+// 不同的 IOBuffer 可以在不同线程上使用（块的引用计数是原子的），同一个 IOBuffer 不是线程安全的
+class IOBuffer
+{
+public:
+	// 每个内存块的总大小（包括头部）
+	static const size_t kBlockSize = 8 * 1024;
+	// readFrom / writeTo 一次系统调用最多使用的 iovec 数量
+	static const int kMaxIov = 64;
+	static const size_t npos = (size_t)-1;
+
+	IOBuffer() = default;
+	~IOBuffer();
+	// 拷贝共享内存块，不拷贝数据
+	IOBuffer(const IOBuffer& other);
+	IOBuffer& operator=(const IOBuffer& other);
+	IOBuffer(IOBuffer&& other) noexcept;
+	IOBuffer& operator=(IOBuffer&& other) noexcept;
+
+	// 可读的字节数
+	size_t size() const {return m_size;}
+	bool empty() const {return m_size == 0;}
+	// 可读数据占用的片段数，也就是 writeTo 需要的 iovec 数量
+	size_t sliceCount() const {return m_slices.size() - m_head;}
+
+	// 追加数据：先填满最后一个块的剩余空间（该块没有被其他缓冲区共享时），再申请新块
+	void append(const void* data, size_t len);
+	void append(const std::string& str) {append(str.data(), str.size());}
+	// 追加另一个缓冲区的全部数据，共享它的内存块
+	void append(const IOBuffer& other);
+	void append(IOBuffer&& other);
+
+	// 丢弃开头的 n 个字节
+	void consume(size_t n);
+	// 从开头切下 n 个字节作为一个新的缓冲区返回，本缓冲区中去掉这部分，不拷贝数据
+	IOBuffer cut(size_t n);
+	// 引用 [offset, offset + len) 的新缓冲区，不拷贝数据，本缓冲区不变
+	IOBuffer slice(size_t offset, size_t len) const;
+	void clear();
+
+	// 把 [offset, offset + len) 拷贝到 dst，返回实际拷贝的字节数
+	size_t copyTo(void* dst, size_t len, size_t offset = 0) const;
+	std::string toString() const;
+	// 第 i 个字节，按片段查找，适合偶尔使用
+	char at(size_t i) const;
+	// 从 from 开始查找 needle 第一次出现的位置，可以跨越块的边界，找不到时返回 npos
+	size_t find(const char* needle, size_t len, size_t from = 0) const;
+	size_t find(const std::string& needle, size_t from = 0) const {return find(needle.data(), needle.size(), from);}
+
+	// 可读数据的 iovec 视图（从开头最多 max 个片段、共 len 字节），返回填充的数量；数据被修改或释放之前有效
+	int readableIovecs(struct iovec* iov, int max, size_t len = npos) const;
+	// 准备至少 len 字节的可写空间，返回可写区域的 iovec 视图；写入后调用 commit 使其中开头的 n 个字节变为可读
+	int writableIovecs(struct iovec* iov, int max, size_t len);
+	void commit(size_t n);
+
+	// 用 readv 从 fd 读取，最多 hint 字节，返回值和 readv 相同（0 为对端关闭，-1 为出错）
+	ssize_t readFrom(int fd, size_t hint = 64 * 1024);
+	// 用 writev 把全部数据写到 fd，写出的部分从缓冲区中去掉；返回写出的字节数，出错时返回 -1（已经写出的部分也已经去掉）
+	ssize_t writeTo(int fd);
+
+	// 设置每个线程最多缓存的内存块数量
+	static void SetCacheCapacity(size_t blocks);
+
+private:
+	// 内存块头部，后面紧跟数据
+	struct Block
+	{
+		std::atomic<uint32_t> refs;
+		uint32_t used; // 已经写入的字节数，只有唯一持有者会修改
+		char* data() {return (char*)(this + 1);}
+	};
+	static constexpr size_t kBlockData = kBlockSize - sizeof(Block);
+
+	// 引用块中 [begin, end) 的片段
+	struct Slice
+	{
+		Block* block;
+		uint32_t begin;
+		uint32_t end;
+		size_t size() const {return end - begin;}
+	};
+
+	static Block* NewBlock();
+	static void Ref(Block* block) {block->refs.fetch_add(1, std::memory_order_relaxed);}
+	static void Unref(Block* block);
+
+	// 最后一个块还能原地追加的空间：块只被本缓冲区引用、并且最后一个片段就是块中最后写入的数据
+	char* tailSpace(size_t& avail) const;
+	void pushSlice(Block* block, uint32_t begin, uint32_t end);
+	// 去掉开头的片段：只移动 m_head，积累到一定数量再整体前移
+	void popFront();
+
+private:
+	std::vector<Slice> m_slices; // 可读数据的片段，从 m_head 开始有效
+	size_t m_head = 0;
+	std::vector<Block*> m_spare; // writableIovecs 预先申请、还没有写入的块
+	size_t m_size = 0;
+};
+
+}
+
+#endif
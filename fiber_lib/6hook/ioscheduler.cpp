@@ -1,11 +1,17 @@
 #include <unistd.h>    
 #include <sys/epoll.h> 
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>     
 #include <cstring>
 
 #include "ioscheduler.h"
+#include "fd_manager.h"
+#include "uring.h"
+#include "metrics.h"
+#include "hook.h"
 
-static bool debug = true;
+static bool debug = false;
 
 namespace sylar {
 
@@ -38,10 +44,11 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx)
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.tag = nullptr;
 }
 
 // 在指定的 IO 事件被触发时，执行相应的回调函数，并且在执行完之后清理相关的事件上下文
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, int thread, std::vector<ScheduleTask>* batch) {
     assert(events & event); // 确保 event 中有指定的事件，否则程序中断
 
     // 清理该事件，表示不再关注，也就是说，注册 IO 事件是一次性的 
@@ -52,13 +59,25 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     EventContext& ctx = getEventContext(event);
 
     // 将 fd 绑定的具体读或写任务的回调协程或回调函数，放入到任务队列中等待调度器调度
-    if (ctx.cb) 
+    // 由 idle() 触发时先攒进 batch，整批事件处理完再一起入队；等待者注册在其他调度器上时仍然单独提交
+    if(batch && ctx.scheduler == owner)
     {
-        ctx.scheduler->scheduleLock(&ctx.cb);
+        if(ctx.cb)
+        {
+            batch->emplace_back(&ctx.cb, thread);
+        }
+        else
+        {
+            batch->emplace_back(&ctx.fiber, thread);
+        }
+    }
+    else if (ctx.cb) 
+    {
+        ctx.scheduler->scheduleLock(&ctx.cb, thread);
     } 
     else 
     {
-        ctx.scheduler->scheduleLock(&ctx.fiber);
+        ctx.scheduler->scheduleLock(&ctx.fiber, thread);
     }
 
     // 重置 EventContext 事件的上下文
@@ -66,32 +85,88 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string &name): 
-Scheduler(threads, use_caller, name), TimerManager()
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, TimerManager::Backend timer_backend, bool shard_epoll, bool use_uring, const std::vector<int>& cpus): 
+Scheduler(threads, use_caller, name, cpus), TimerManager(timer_backend, workerCount() + 1)
 {
     // epoll_create 的参数实际上在现代 Linux 内核中已经被忽略，在最早版本的 Linux 中，该参数用于指定 epoll 内部使用的事件表大小
     m_epfd = epoll_create(5000); // 创建 epoll 的 fd
     assert(m_epfd > 0);
 
-    // 创建 pipe
-    int rt = pipe(m_tickleFds); // 创建管道的函数规定了 m_tickleFds[0] 是读端，1是写端
-    assert(!rt);
+    // 创建用于唤醒的 eventfd，非阻塞 + 信号量模式
+    m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+    assert(m_tickleFd >= 0);
 
-    // 将管道的读事件监听注册到 epoll 上
+    // 将 eventfd 的读事件注册到 epoll 上
+    // 使用水平触发：一个线程读走一次唤醒后，计数仍不为0时 epoll 会继续唤醒其他等待的线程
     epoll_event event;
-    event.events  = EPOLLIN | EPOLLET; // 标志位，设置边缘触发和读事件
-    event.data.fd = m_tickleFds[0]; // pipe 管道读端
-
-    // 将管道文件描述符修改为非阻塞，配合边缘触发
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
+    event.events  = EPOLLIN;
+    event.data.u64 = m_tickleFd;
+    int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event);
     assert(!rt);
 
-    // 将 m_tickleFds[0] 作为读事件放入到 event 监听集合中
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
+    // 创建精确定时使用的 timerfd，同样以边缘触发的读事件注册到 epoll 上
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(m_timerFd >= 0);
+    event.events  = EPOLLIN | EPOLLET;
+    event.data.u64 = m_timerFd;
+    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_timerFd, &event);
     assert(!rt);
 
-    // 初始化一个包含 32 个文件描述符上下文的数组
-    contextResize(32);
+    // io_uring 后端：每个工作线程一个 io_uring，全部创建成功才启用，否则退回 epoll
+    // 完成事件通过 eventfd 通知，必须只被拥有这个 io_uring 的线程看到，所以同时打开按线程分片的 epoll
+    std::vector<std::unique_ptr<IoUring>> rings;
+    if(use_uring)
+    {
+        for(size_t i = 0; i < workerCount(); i++)
+        {
+            rings.emplace_back(new IoUring());
+            if(!rings.back()->isValid())
+            {
+                std::cerr << "IOManager: io_uring is unavailable, falling back to epoll" << std::endl;
+                rings.clear();
+                break;
+            }
+        }
+        if(!rings.empty())
+        {
+            m_uringEnabled = true;
+            shard_epoll = true;
+        }
+    }
+
+    // 按线程分片：每个工作线程一个 epoll 实例和一个唤醒用的 eventfd，timerfd 注册到每个实例上
+    if(shard_epoll)
+    {
+        for(size_t i = 0; i < workerCount(); i++)
+        {
+            std::unique_ptr<EpollShard> shard(new EpollShard());
+            shard->epfd = epoll_create1(EPOLL_CLOEXEC);
+            assert(shard->epfd >= 0);
+            shard->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            assert(shard->tickleFd >= 0);
+
+            event.events  = EPOLLIN;
+            event.data.u64 = shard->tickleFd;
+            rt = epoll_ctl(shard->epfd, EPOLL_CTL_ADD, shard->tickleFd, &event);
+            assert(!rt);
+
+            event.events  = EPOLLIN | EPOLLET;
+            event.data.u64 = m_timerFd;
+            rt = epoll_ctl(shard->epfd, EPOLL_CTL_ADD, m_timerFd, &event);
+            assert(!rt);
+
+            if(m_uringEnabled)
+            {
+                shard->uring = std::move(rings[i]);
+                event.events  = EPOLLIN;
+                event.data.u64 = shard->uring->eventFd();
+                rt = epoll_ctl(shard->epfd, EPOLL_CTL_ADD, shard->uring->eventFd(), &event);
+                assert(!rt);
+            }
+            m_shards.push_back(std::move(shard));
+        }
+    }
+    (void)rt; // 只在 assert 中使用，Release 构建（NDEBUG）中 assert 为空
 
     // 启动 Scheduler，开启线程池，准备处理任务
     start();
@@ -100,53 +175,47 @@ Scheduler(threads, use_caller, name), TimerManager()
 IOManager::~IOManager() {
     stop(); // 关闭 scheduler 类中的线程池，让任务全部执行完后线程安全退出
     close(m_epfd); // 关闭 epoll 的句柄
-    close(m_tickleFds[0]); // 关闭管道读端
-    close(m_tickleFds[1]); // 关闭管道写端
-
-    // 将 fdcontext 文件描述符上下文数组中的上下文逐个关闭
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) 
+    close(m_tickleFd); // 关闭用于唤醒的 eventfd
+    close(m_timerFd);
+    for(auto& shard : m_shards)
     {
-        if (m_fdContexts[i]) 
+        close(shard->epfd);
+        close(shard->tickleFd);
+    }
+    // fd 的记录由 FdManager 保存，比这个 IOManager 活得久，清掉归属，避免之后在同一地址上创建的 IOManager 误用分片和持久注册状态
+    FdMgr::GetInstance()->forEach([this](FdCtx& ctx)
+    {
+        FdContext& fd_ctx = ctx.m_io;
+        std::lock_guard<std::mutex> lock(fd_ctx.mutex);
+        if(fd_ctx.owner == this)
         {
-            delete m_fdContexts[i]; 
+            fd_ctx.owner = nullptr;
         }
-    }
+    });
 }
 
-// 主要作用是调整 m_fdContexts 数组的大小，并为新的文件描述符 fd 创建并初始化相应的 FdContext 对象
-void IOManager::contextResize(size_t size) 
+IOManager::FdContext* IOManager::getFdContext(int fd, bool create) 
 {
-    m_fdContexts.resize(size);
-    
-    // 遍历 m_fdContexts 数组，初始化尚未初始化的 FdContext 对象
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) 
-    {
-        if (m_fdContexts[i] == nullptr) 
-        {
-            m_fdContexts[i] = new FdContext();
-            m_fdContexts[i]->fd = i; // 将文件描述符的编号赋值给fd
-        }
-    }
+    FdCtx* ctx = FdMgr::GetInstance()->record(fd, create);
+    return ctx ? &ctx->m_io : nullptr;
 }
 
 // 为分配好的 fd 添加一个 event 事件，并在事件触发时执行指定的回调函数或回调协程，具体的触发是在 triggerEvent
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) 
+int IOManager::addEvent(int fd, Event event, InlineFunction cb, const void* tag) 
 {
-    // 查找 FdContext 对象 
-    FdContext *fd_ctx = nullptr;
-    
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex); // 触发读写锁的读锁
-    if((int)m_fdContexts.size() > fd) // 说明传入的 fd 在数组里面，将对应的 FdContext 赋值给 fd_ctx
+    // shutdown 正在强制结束，不再接受新的等待，否则被取消的 IO 重试之后又会挂起
+    if(m_forced)
     {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
+        errno = ECANCELED;
+        return -1;
     }
-    else // 没在数组里面，则重新分配数组的 size 来初始化 FdContext 的对象
+
+    // 查找 FdContext 对象，所在的块还没分配时分配一块
+    FdContext *fd_ctx = getFdContext(fd, true);
+    if(!fd_ctx) // fd 超出了表的范围
     {
-        read_lock.unlock();
-        std::unique_lock<std::shared_mutex> write_lock(m_mutex); // 触发读写锁的独占写锁
-        contextResize(fd * 1.5); // 扩容
-        fd_ctx = m_fdContexts[fd]; 
+        std::cerr << "addEvent: fd " << fd << " out of range" << std::endl;
+        return -1;
     }
     
     // 找到或者创建好 FdContext 对象后，加上互斥锁，确保 FdContext 的状态不会被其他线程修改
@@ -158,18 +227,55 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         return -1; // 已经存在就返回 -1，因为相同的事件不能重复添加
     }
 
-    // 添加新事件：如果已经存在其它事件就修改已有事件，如果不存在就添加事件
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    // fd 第一次在这个 IOManager 上注册事件，之前的分片和持久注册状态属于别的 IOManager，重新开始
+    if(fd_ctx->owner != this)
+    {
+        if(fd_ctx->events)
+        {
+            std::cerr << "addEvent: fd " << fd << " is waited on by another IOManager" << std::endl;
+            return -1;
+        }
+        fd_ctx->owner = this;
+        fd_ctx->shard = -1;
+        fd_ctx->persistent = false;
+        fd_ctx->ready = NONE;
+    }
 
-    // 添加或修改事件到 epol1 中
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) 
+    if(!fd_ctx->persistent && m_persistentEvents)
     {
-        std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
-        return -1;
+        // 持久注册：第一次使用时把读写两个方向一起加入 epoll，加入时已经就绪的方向会马上报告一次
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events   = EPOLLIN | EPOLLOUT | EPOLLET;
+        epevent.data.u64 = fd_ctx->epollData();
+        int rt = epollCtl(epollFd(fd_ctx), op, fd, &epevent);
+        if(rt && errno == EEXIST) // cancelAll 之后没有关闭又重新使用的 fd
+        {
+            rt = epollCtl(epollFd(fd_ctx), EPOLL_CTL_MOD, fd, &epevent);
+        }
+        if(rt) 
+        {
+            std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
+        fd_ctx->persistent = true;
+        fd_ctx->ready = NONE;
+    }
+    else if(!fd_ctx->persistent)
+    {
+        // 添加新事件：如果已经存在其它事件就修改已有事件，如果不存在就添加事件
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | fd_ctx->events | event;
+        epevent.data.u64 = fd_ctx->epollData();
+
+        // 添加或修改事件到 epol1 中
+        int rt = epollCtl(epollFd(fd_ctx), op, fd, &epevent);
+        if(rt) 
+        {
+            std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
     }
 
     ++m_pendingEventCount; // 原子计数器，待处理的事件+1
@@ -181,7 +287,9 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
     // 设置 event_ctx 事件上下文 
     FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
     assert(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb); // 确保 EventContext 中没有其他正在执行的调度器、协程或回调函数 
-    event_ctx.scheduler = Scheduler::GetThis(); // 设置调度器为当前的调度器实例 
+    // 设置调度器为当前的调度器实例，在调度器之外的线程上注册时由本 IOManager 调度
+    event_ctx.scheduler = Scheduler::GetThis() ? Scheduler::GetThis() : this;
+    event_ctx.tag = tag;
     
     // 如果提供了回调函数，则将其保存到 EventContext 中;否则，将当前正在运行的协程保存到 EventContext 中，并确保协程的状态是正在运行的
     if (cb) 
@@ -193,31 +301,38 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         event_ctx.fiber = Fiber::GetThis();  
         assert(event_ctx.fiber->getState() == Fiber::RUNNING);
     }
+
+    // 持久注册时事件已经在没有等待者时到达，直接触发，不需要等下一次边缘
+    // 等待的是当前协程时，它在 yield 之前被调度也没关系，协程的原子状态保证它 yield 之后才会被恢复；
+    // 不固定到当前线程，弹性扩展的线程和外部线程不是工作线程，固定到它们的任务永远不会被执行
+    if(fd_ctx->ready & event)
+    {
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        fd_ctx->triggerEvent(event, homeThread(fd_ctx));
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
 // 从 IOManager 中删除某个文件描述符的特定事件
-bool IOManager::delEvent(int fd, Event event) {
-    // 查找 FdContext 对象，这几步和上面的 addEvent() 类似
-    FdContext *fd_ctx = nullptr;
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex); // 读锁
-    // 如果找到，则将 fd 对应的 FdContext 赋值给 fd_ctx；否则说明数组中没有这个文件描述符，也就没有它对应的事件，直接返回 false
-    if ((int)m_fdContexts.size() > fd) 
+bool IOManager::delEvent(int fd, Event event, const void* tag) {
+    // 查找 FdContext 对象，所在的块都还没分配说明这个 fd 没有注册过事件，直接返回 false
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) 
     {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
-    }
-    else 
-    {
-        read_lock.unlock();
         return false;
     }
 
     // 添加互斥锁
     std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
-    // 虽然找到了 FdContext 对象，但如果它的事件与参数传来的事件不相同，也返回 false
-    if (!(fd_ctx->events & event)) 
+    // 虽然找到了 FdContext 对象，但如果它的事件与参数传来的事件不相同（或者事件是在别的 IOManager 上注册的），也返回 false
+    if (fd_ctx->owner != this || !(fd_ctx->events & event)) 
+    {
+        return false;
+    }
+    // 这个方向的等待者不是调用者注册的（调用者的注册已经触发，之后被别人重新注册）
+    if (tag && fd_ctx->getEventContext(event).tag != tag)
     {
         return false;
     }
@@ -225,17 +340,21 @@ bool IOManager::delEvent(int fd, Event event) {
     
     // 删除事件：对原有的事件状态取反就是删除原有的事件，比如说传入参数是读事件，我们取反就是删除了这个读事件，但可能还有写事件
     Event new_events = (Event)(fd_ctx->events & ~event);
-    // 如果取反后还剩下其它事件，则修改事件；如果 new_events 为空，说明 fd 上已经没有其它事件了，直接将该 fd 从监听红黑树上移除
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx; // 为了在 epoll 事件触发时能够快速找到与该事件相关联的 FdContext 对象
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) 
+    // 持久注册的 fd 只需要去掉等待者
+    if(!fd_ctx->persistent)
     {
-        std::cerr << "delEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
-        return -1;
+        // 如果取反后还剩下其它事件，则修改事件；如果 new_events 为空，说明 fd 上已经没有其它事件了，直接将该 fd 从监听红黑树上移除
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.u64 = fd_ctx->epollData(); // 为了在 epoll 事件触发时能够快速找到与该事件相关联的 FdContext 对象
+
+        int rt = epollCtl(epollFd(fd_ctx), op, fd, &epevent);
+        if (rt) 
+        {
+            std::cerr << "delEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
     }
 
     --m_pendingEventCount; // 原子计数器，待处理的事件-1
@@ -253,66 +372,70 @@ bool IOManager::delEvent(int fd, Event event) {
 // 与 delEvent 函数的不同之处在于删除事件后，还需要将删除的事件交给 triggerEvent 函数，放入到协程调度器中进行触发 
 bool IOManager::cancelEvent(int fd, Event event) {
     // 依然是查找 FdContext，和 delEvent 一致 
-    FdContext *fd_ctx = nullptr;
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) 
-    {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
-    }
-    else 
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) 
     {
-        read_lock.unlock();
         return false;
     }
 
     std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
     // 如果要取消的事件不存在
-    if(!(fd_ctx->events & event)) 
+    if(fd_ctx->owner != this || !(fd_ctx->events & event)) 
     {
         return false;
     }
 
     // 删除该事件，和上面的 delEvent 一致，只有最后的处理不同：一个是重置，一个是调用 triggerEvent 函数执行事件的回调函数    
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) 
+    if(!fd_ctx->persistent)
     {
-        std::cerr << "cancelEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
-        return -1;
+        Event new_events = (Event)(fd_ctx->events & ~event);
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.u64 = fd_ctx->epollData();
+
+        int rt = epollCtl(epollFd(fd_ctx), op, fd, &epevent);
+        if(rt) 
+        {
+            std::cerr << "cancelEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
     }
 
     --m_pendingEventCount;
 
     // 调用事件的回调函数    
-    fd_ctx->triggerEvent(event); 
+    fd_ctx->triggerEvent(event, homeThread(fd_ctx)); 
     return true;
 }
 
 // 取消指定文件描述符上的所有事件，并且触发这些事件的回调函数
 bool IOManager::cancelAll(int fd) {
     // 依旧查找 FdContext 
-    FdContext *fd_ctx = nullptr;
-    
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) 
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) 
     {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
+        return false;
     }
-    else 
+
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+    if(fd_ctx->owner != this)
     {
-        read_lock.unlock();
         return false;
     }
 
-    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+    // 持久注册的 fd 在这里移出 epoll，之后同一个编号的新 fd 会重新注册
+    bool persistent = fd_ctx->persistent;
+    if(persistent)
+    {
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.u64 = fd_ctx->epollData();
+        epollCtl(epollFd(fd_ctx), EPOLL_CTL_DEL, fd, &epevent); // fd 可能已经被关闭，失败也没有关系
+        fd_ctx->persistent = false;
+        fd_ctx->ready = NONE;
+    }
     
     // 如果该 fd 上没有事件存在
     if (!fd_ctx->events) 
@@ -321,28 +444,32 @@ bool IOManager::cancelAll(int fd) {
     }
 
     // 删除该 fd 上的所有事件
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) 
+    if(!persistent)
     {
-        std::cerr << "IOManager::epoll_ctl failed: " << strerror(errno) << std::endl; 
-        return -1;
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.u64 = fd_ctx->epollData();
+
+        int rt = epollCtl(epollFd(fd_ctx), op, fd, &epevent);
+        if(rt) 
+        {
+            std::cerr << "IOManager::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
     }
 
     // 调用该协程fd 上的所有事件的回调函数    
+    int thread = homeThread(fd_ctx);
     if(fd_ctx->events & READ) 
     {
-        fd_ctx->triggerEvent(READ);
+        fd_ctx->triggerEvent(READ, thread);
         --m_pendingEventCount;
     }
 
     if(fd_ctx->events & WRITE) 
     {
-        fd_ctx->triggerEvent(WRITE);
+        fd_ctx->triggerEvent(WRITE, thread);
         --m_pendingEventCount;
     }
 
@@ -350,20 +477,221 @@ bool IOManager::cancelAll(int fd) {
     return true;
 }
 
-// 重写 scheduler 中的 tickle()：当定时器超时时，通过写入一个字符到写管道 mtickleFds[1] 中，唤醒调度器，
+// 重写 scheduler 中的 tickle()：当有新任务或定时器超时时，向 eventfd 写入 1，唤醒一个阻塞在 epoll_wait 中的线程，
 // 使其立即检查任务队列并执行待处理任务，若没有 tickle，调度器可能因未感知到新任务而持续空转
 void IOManager::tickle() 
 {
-    // 检查当前是否有线程处于空闲状态，如果没有空闲线程，函数直接返回，不执行后续操作
-    if(!hasIdleThreads()) 
+    // 分片模式：从上次的位置开始找一个正在休眠且还没被唤醒的线程，只唤醒它一个
+    if(!m_shards.empty())
+    {
+        size_t n = m_shards.size();
+        size_t start = m_nextWake++;
+        for(size_t i = 0; i < n; i++)
+        {
+            if(wakeShard(*m_shards[(start + i) % n]))
+            {
+                return;
+            }
+        }
+        return;
+    }
+
+    // 已经发出的唤醒足够唤醒所有休眠的线程，就不再写 eventfd，避免大量生产者同时提交任务时每个都产生一次系统调用
+    size_t pending = m_wakePending.load();
+    do
+    {
+        if(pending >= m_sleepers.load())
+        {
+            return;
+        }
+    } while(!m_wakePending.compare_exchange_weak(pending, pending + 1));
+
+    uint64_t one = 1;
+    int rt = write(m_tickleFd, &one, sizeof(one));
+    assert(rt == sizeof(one));
+    (void)rt;
+}
+
+void IOManager::tickleWorker(int index) 
+{
+    if(m_shards.empty())
     {
+        tickle();
         return;
     }
+    wakeShard(*m_shards[index]);
+}
+
+IOManager::EpollShard::~EpollShard() 
+{
+}
+
+namespace {
+
+// 一个提交到 io_uring 的 IO，放在发起 IO 的协程栈上，地址作为 SQE 的 user_data
+struct UringOp
+{
+    int res = 0;
+    std::shared_ptr<Fiber> fiber; // 挂起的协程，完成时交给调度器
+#ifdef SYLAR_HAS_IO_URING
+    __kernel_timespec ts; // 链接超时的时长，内核在提交时读取
+#endif
+};
+
+}
+
+int IOManager::submitIo(void (*prep)(io_uring_sqe* sqe, const void* arg), const void* arg, uint64_t timeout_ms) 
+{
+#ifdef SYLAR_HAS_IO_URING
+    int index = currentWorker();
+    // 共享栈协程挂起后栈会被其他协程覆盖，内核不能异步写它栈上的 UringOp 和缓冲区
+    // 强制结束期间退回 epoll 的流程，在 addEvent 处以 ECANCELED 失败
+    if(!m_uringEnabled || index < 0 || Fiber::GetThis()->isSharedStack() || m_forced)
+    {
+        return -ENOSYS;
+    }
+    EpollShard& shard = *m_shards[index];
+    IoUring& ring = *shard.uring;
+
+    // 带超时的 IO 占两个 SQE，SQ 放不下时先把积攒的提交掉
+    if(ring.sqSpace() < 2)
+    {
+        ring.submit();
+        if(ring.sqSpace() < 2)
+        {
+            return -ENOSYS;
+        }
+    }
+
+    UringOp op;
+    op.fiber = Fiber::GetThis();
+    io_uring_sqe* sqe = ring.getSqe();
+    prep(sqe, arg);
+    sqe->user_data = (uint64_t)(uintptr_t)&op;
+    if(timeout_ms != (uint64_t)-1)
+    {
+        sqe->flags |= IOSQE_IO_LINK;
+        op.ts.tv_sec = timeout_ms / 1000;
+        op.ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        io_uring_sqe* timeout = ring.getSqe();
+        IoUring::PrepRw(timeout, IORING_OP_LINK_TIMEOUT, -1, &op.ts, 1, 0);
+        timeout->user_data = 0;
+    }
+    shard.inflight++;
+    ++m_pendingEventCount;
+
+    // SQE 只会在本线程的 idle() 中提交，完成事件也只由本线程收割，所以挂起之前不会被恢复
+    Fiber::GetThis()->yield();
+    return op.res;
+#else
+    return -ENOSYS;
+#endif
+}
+
+void IOManager::cancelIo(int fd) 
+{
+#ifdef SYLAR_HAS_IO_URING
+    int index = currentWorker();
+    if(!m_uringEnabled || index < 0 || m_shards[index]->inflight == 0)
+    {
+        return;
+    }
+    IoUring& ring = *m_shards[index]->uring;
+    io_uring_sqe* sqe = ring.getSqe();
+    if(!sqe)
+    {
+        ring.submit();
+        sqe = ring.getSqe();
+        if(!sqe)
+        {
+            return;
+        }
+    }
+    IoUring::PrepRw(sqe, IORING_OP_ASYNC_CANCEL, fd, nullptr, 0, 0);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = 0;
+    // 按 fd 的编号取消，必须在 fd 关闭之前提交，否则编号被复用后会误取消新 fd 上的 IO
+    ring.submit();
+#endif
+}
+
+size_t IOManager::reapUring(EpollShard& shard, std::vector<ScheduleTask>& batch) 
+{
+    // 先清空 eventfd 再收割，之后到达的完成事件会再次让它可读，不会漏掉
+    uint64_t value;
+    while(read(shard.uring->eventFd(), &value, sizeof(value)) > 0);
+
+    size_t fired = 0;
+    shard.uring->reap([&shard, &batch, &fired](const io_uring_cqe& cqe)
+    {
+        if(cqe.user_data == 0) // 链接超时和取消请求自己的完成事件
+        {
+            return;
+        }
+        UringOp* op = (UringOp*)(uintptr_t)cqe.user_data;
+        op->res = cqe.res;
+        shard.inflight--;
+        batch.emplace_back(&op->fiber, -1);
+        fired++;
+    });
+    return fired;
+}
+
+int IOManager::epollCtl(int epfd, int op, int fd, epoll_event* event) 
+{
+    m_epollCtlCount.fetch_add(1, std::memory_order_relaxed);
+    return epoll_ctl(epfd, op, fd, event);
+}
+
+bool IOManager::wakeShard(EpollShard& shard) 
+{
+    // 线程没有休眠，它在下次休眠前会自己检查任务；已经有唤醒在路上，也不必重复写
+    if(!shard.sleeping || shard.wakePending.exchange(true))
+    {
+        return false;
+    }
+    uint64_t one = 1;
+    int rt = write(shard.tickleFd, &one, sizeof(one));
+    assert(rt == sizeof(one));
+    (void)rt;
+    return true;
+}
+
+int IOManager::epollFd(FdContext* fd_ctx) 
+{
+    if(m_shards.empty())
+    {
+        return m_epfd;
+    }
+    if(fd_ctx->shard < 0)
+    {
+        // 轮流分配到已经在运行事件循环的线程上；还没有这样的线程时，分配给当前线程
+        // 当前线程不是工作线程时分配给最后一个线程：use_caller 时序号 0 是主线程，它要到 stop() 时才会进入事件循环
+        size_t n = m_shards.size();
+        size_t start = m_nextShard++;
+        for(size_t i = 0; i < n && fd_ctx->shard < 0; i++)
+        {
+            size_t index = (start + i) % n;
+            if(m_shards[index]->active)
+            {
+                fd_ctx->shard = index;
+            }
+        }
+        if(fd_ctx->shard < 0)
+        {
+            fd_ctx->shard = currentWorker() >= 0 ? currentWorker() : n - 1;
+        }
+    }
+    return m_shards[fd_ctx->shard]->epfd;
+}
 
-    // 如果有空闲线程，函数会向写管道 m_tickleFds[1] 写入一个字符"T"
-    // 这个写操作的目的是：向阻塞在读管道 m_tickleFds[0] 的线程发送一个信号，通知它有新任务可以处理了
-    int rt = write(m_tickleFds[1], "T", 1);
-    assert(rt == 1);
+int IOManager::homeThread(FdContext* fd_ctx) 
+{
+    if(m_shards.empty() || fd_ctx->shard < 0)
+    {
+        return -1;
+    }
+    return workerThreadId(fd_ctx->shard);
 }
 
 // 重写了 scheduler 的 stopping()：检查定时器、挂起事件以及调度器状态，以决定是否可以安全地停止运行
@@ -374,6 +702,122 @@ bool IOManager::stopping()
     return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
+// 自旋等待时让出流水线资源，降低功耗，同一核上的超线程也能跑得更快
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+static inline uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void IOManager::addShutdownHook(std::function<void()> cb)
+{
+    std::lock_guard<std::mutex> lock(m_hookMutex);
+    m_shutdownHooks.push_back(std::move(cb));
+}
+
+bool IOManager::shutdown(uint64_t timeout_ms)
+{
+    if(m_draining.exchange(true)) // 已经在停止
+    {
+        stop();
+        return !m_forced;
+    }
+    uint64_t start = nowNs();
+    m_drainDeadline = timeout_ms >= (~0ull - start) / 1000000 ? ~0ull : start + timeout_ms * 1000000;
+
+    // 先停止接收新的工作，再取消周期任务：循环定时器永远不会自己结束，留着它 stop() 就一直等到截止时间
+    std::vector<std::function<void()>> hooks;
+    {
+        std::lock_guard<std::mutex> lock(m_hookMutex);
+        hooks.swap(m_shutdownHooks);
+    }
+    for(auto& hook : hooks)
+    {
+        hook();
+    }
+    cancelRecurring();
+
+    // 截止时间由 idle() 检查，use_caller 时调用线程要在 stop() 中参与调度，这里不能阻塞等待
+    stop();
+
+    if(m_forced)
+    {
+        std::cerr << "IOManager::shutdown: " << getName() << " was forced to stop after " << (nowNs() - start) / 1000000
+                  << " ms, " << Fiber::GetFiberCount() << " fibers still alive in the process" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void IOManager::tickleAll()
+{
+    if(m_shards.empty())
+    {
+        for(size_t i = 0; i < workerCount(); i++)
+        {
+            tickle();
+        }
+        return;
+    }
+    for(auto& shard : m_shards)
+    {
+        wakeShard(*shard);
+    }
+}
+
+void IOManager::forceDrain()
+{
+    // 先在锁内找出本 IOManager 上还有等待者的 fd，再逐个 cancelAll（它自己会加锁）
+    std::vector<int> fds;
+    FdMgr::GetInstance()->forEach([this, &fds](FdCtx& ctx)
+    {
+        FdContext& fd_ctx = ctx.m_io;
+        std::lock_guard<std::mutex> lock(fd_ctx.mutex);
+        if(fd_ctx.owner == this && fd_ctx.events)
+        {
+            fds.push_back(fd_ctx.fd);
+        }
+    });
+    std::cerr << "IOManager::shutdown: " << getName() << " deadline reached with " << fds.size() << " fds still waited on, "
+              << m_pendingEventCount << " pending events" << (hasTimer() ? " and pending timers" : "") << ", cancelling them" << std::endl;
+    for(int fd : fds)
+    {
+        cancelAll(fd);
+    }
+    tickleAll();
+}
+
+void IOManager::cancelAllIo(EpollShard& shard)
+{
+#ifdef SYLAR_HAS_IO_URING
+    IoUring& ring = *shard.uring;
+    io_uring_sqe* sqe = ring.getSqe();
+    if(!sqe)
+    {
+        ring.submit();
+        sqe = ring.getSqe();
+        if(!sqe)
+        {
+            return;
+        }
+    }
+    // IORING_ASYNC_CANCEL_ANY 需要 5.19 以上的内核，更早的内核上取消失败，在途的 IO 只能等它们自己完成
+    IoUring::PrepRw(sqe, IORING_OP_ASYNC_CANCEL, -1, nullptr, 0, 0);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = 0;
+    ring.submit();
+#endif
+    shard.drainCancelled = true;
+}
+
 // 重写 scheduler 中的 idle()，通常在没有任务处理时运行，等待和处理 IO 事件
 // 即使当前没有任务处理，线程也会在 id1e() 中持续休眠并等待新的任务，保证在所有任务完成之前调度器不会退出
 void IOManager::idle() 
@@ -382,6 +826,13 @@ void IOManager::idle()
 
     // 使用 std::unique_ptr 动态分配了一个大小为 MAX_EVENTS 的 epoll_event 数组，用于存储从 epoll_wait 获取的事件
     std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVNETS]);
+    // 一轮唤醒中就绪的所有协程和回调，处理完定时器和全部事件后一次性入队，只加一次锁、最多唤醒一次线程
+    std::vector<ScheduleTask> batch;
+    batch.reserve(MAX_EVNETS);
+    std::vector<std::function<void()>> cbs; // 用于存储超时的回调函数
+    // 忙轮询：本线程最近几次空闲间隔（从进入 idle 到有事件或任务）的指数移动平均，用来决定下一次自旋多久
+    // 初始值让第一次按上限自旋
+    uint64_t avg_idle_ns = m_busyPollNs / 2;
 
     while (true) 
     {
@@ -390,59 +841,235 @@ void IOManager::idle()
         if(stopping()) 
         {
             if(debug) std::cout << "name = " << getName() << " idle exits in thread: " << Thread::GetThreadId() << std::endl;
+            TimerManager::ClearNow();
+            // 其他线程可能在本线程的最后一个任务结束之前就按 5 秒的超时睡下了，叫醒它们重新检查，stop() 不用等它们超时
+            tickleAll();
             break;
         }
 
-        // 阻塞在 epoll_wait 中
-        int rt = 0;
-        while(true)
+        // shutdown 到了截止时间，由第一个看到的线程强制结束
+        if(m_draining && !m_forced && nowNs() >= m_drainDeadline && !m_forced.exchange(true))
         {
-            static const uint64_t MAX_TIMEOUT = 5000; // epoll_wait 的原生超时时间为 5000 毫秒（即五秒）
-            uint64_t next_timeout = getNextTimer(); // 获取最近一个超时的定时器
-            next_timeout = std::min(next_timeout, MAX_TIMEOUT); // 取两者较小值，获取下一个超时时间 
+            forceDrain();
+        }
 
-            // epoll_wait 陷入阻塞，等待 tickle 信号的唤醒，并且使用了上面计算出的下一超时时间作为 epoll_wait 的超时时间
-            rt = epoll_wait(m_epfd, events.get(), MAX_EVNETS, (int)next_timeout);
-            if(rt < 0 && errno == EINTR) // rt 小于0表示无限阻塞，errno 是 EINTR（表示信号中断）
+        int rt = -1;
+        EpollShard* shard = m_shards.empty() ? nullptr : m_shards[std::max(currentWorker(), 0)].get();
+        int epfd = shard ? shard->epfd : m_epfd; // 分片模式下只等待本线程的 epoll 实例
+        if(shard)
+        {
+            shard->active = true;
+        }
+        if(m_forced && shard && shard->uring && shard->inflight && !shard->drainCancelled)
+        {
+            cancelAllIo(*shard);
+        }
+
+        // 忙轮询：空闲间隔的平均值在上限之内时，自旋平均值的两倍（不超过上限），大部分事件在自旋期间就能到达
+        // 自旋期间不登记为休眠线程，tickle() 不会为它写 eventfd，任务的到达由自旋中的队列检查发现
+        uint64_t busy_poll_ns = m_busyPollNs;
+        uint64_t idle_start = busy_poll_ns ? nowNs() : 0;
+        if(busy_poll_ns && avg_idle_ns < busy_poll_ns)
+        {
+            // 自旋不超过最近一个定时器的到期时间，到期的定时器留给下面阻塞的 epoll_wait（超时为0）处理
+            TimerManager::UpdateNow();
+            uint64_t budget = std::min(std::min(busy_poll_ns, avg_idle_ns * 2), getNextTimerNs());
+            if(budget > 0)
             {
-                continue;
-            } 
-            else 
+                if(shard && shard->uring)
+                {
+                    shard->uring->submit();
+                }
+                rt = busyPoll(epfd, events.get(), MAX_EVNETS, budget);
+            }
+        }
+
+        // 阻塞在 epoll_wait 中
+        // 先登记为休眠线程再做最后一次检查，与 tickle() 中先入队再读休眠线程数配合，保证不会漏掉唤醒
+        if(rt < 0)
+        {
+            if(shard)
+            {
+                shard->sleeping = true;
+            }
+            else
             {
-                break; // 超时触发或注册的 fd 有事件发生
+                m_sleepers++;
             }
-        };
+            bool ready = hasRunnableTasks() || stopping();
+            while(true)
+            {
+                static const uint64_t MAX_TIMEOUT = 5000; // epoll_wait 的原生超时时间为 5000 毫秒（即五秒）
+                TimerManager::UpdateNow(); // 刷新缓存的时间，调度器协程执行任务期间时间已经流逝
+                uint64_t next_ns = getNextTimerNs(); // 获取最近一个超时的定时器
+                uint64_t next_timeout = next_ns == ~0ull ? ~0ull : (next_ns + 999999) / 1000000; // 向上取整为毫秒
+                next_timeout = std::min(next_timeout, MAX_TIMEOUT); // 取两者较小值，获取下一个超时时间 
+                // shutdown 期间最多睡到截止时间
+                uint64_t deadline = m_drainDeadline;
+                if(deadline != ~0ull && !m_forced)
+                {
+                    uint64_t now_ns = nowNs();
+                    next_timeout = std::min<uint64_t>(next_timeout, deadline > now_ns ? (deadline - now_ns + 999999) / 1000000 : 0);
+                }
+                if(ready) // 已经有任务可以执行，只收集一下就绪的事件，不阻塞
+                {
+                    next_timeout = 0;
+                }
+
+                // 最近的定时器落在 epoll_wait 的超时时间之内且不在整毫秒上，用 timerfd 提前在精确的时间点唤醒
+                // epoll_wait 的毫秒超时仍然保留，作为 timerfd 被其他线程改写时的兜底
+                if(m_preciseTimer && next_ns < next_timeout * 1000000)
+                {
+                    uint64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(TimerManager::Now().time_since_epoch()).count();
+                    armTimerFd(now_ns + next_ns);
+                }
+
+                // 把这一轮积攒的 io_uring SQE 一次性提交给内核
+                if(shard && shard->uring)
+                {
+                    shard->uring->submit();
+                }
+
+                // epoll_wait 陷入阻塞，等待 tickle 信号的唤醒，并且使用了上面计算出的下一超时时间作为 epoll_wait 的超时时间
+                rt = epoll_wait_f(epfd, events.get(), MAX_EVNETS, (int)next_timeout); // 原始调用，不走协程版本的 epoll_wait
+                if(rt < 0 && errno == EINTR) // rt 小于0表示无限阻塞，errno 是 EINTR（表示信号中断）
+                {
+                    continue;
+                } 
+                else 
+                {
+                    break; // 超时触发或注册的 fd 有事件发生
+                }
+            };
+            if(shard)
+            {
+                shard->sleeping = false;
+            }
+            else
+            {
+                m_sleepers--;
+            }
+        }
+
+        if(rt >= 0)
+        {
+            Metrics::Add(METRIC_EPOLL_WAKEUPS);
+            Metrics::Add(METRIC_EPOLL_EVENTS, rt);
+        }
+        // 开启延迟统计时，本轮就绪的事件都以 epoll_wait 返回的时间作为就绪时间
+        uint64_t ready_ns = Metrics::LatencyTracking() ? Metrics::NowNs() : 0;
+
+        // 本轮循环剩下的定时器操作（包括随后调度执行的任务中添加的定时器）都使用这个时间
+        TimerManager::UpdateNow();
+
+        // 用这次的空闲间隔更新平均值，超过上限很多的间隔按上限的4倍计算，负载重新变高时平均值能很快降下来
+        if(busy_poll_ns)
+        {
+            uint64_t idle_ns = std::min(nowNs() - idle_start, busy_poll_ns * 4);
+            avg_idle_ns = (avg_idle_ns * 7 + idle_ns) / 8;
+        }
 
         // 收集所有超时的定时器 
-        std::vector<std::function<void()>> cbs; // 用于存储超时的回调函数
         listExpiredCb(cbs); // 获取所有超时的定时器的回调函数，并将它们添加到 cbs 数组中
-        if(!cbs.empty()) 
+        if(m_forced) // 强制结束期间所有定时器（包括之后新加的）都立刻到期
         {
-            // 逐个放进协程调度的任务队列中
-            for(const auto& cb : cbs) 
-            {
-                scheduleLock(cb);
-            }
-            cbs.clear();
+            fastForward(cbs);
         }
+        for(auto& cb : cbs) 
+        {
+            batch.emplace_back(&cb, -1);
+        }
+        cbs.clear();
+        size_t timer_tasks = batch.size(); // batch 中前面的是定时器任务，之后的是事件唤醒的任务
         
         // 检查完定时器，就要检查响应事件了：遍历计数器 rt，表示准备好的事件数
+        size_t triggered = 0; // 本轮触发的事件数
         for(int i = 0; i < rt; ++i) 
         {
             epoll_event& event = events[i]; // 获取第i个 epollevent 
 
-            // 先处理可能发生的 tickle 函数，它会唤醒 epoll_wait 并写入管道，因此要循环读数据直至返回-1
-            if(event.data.fd == m_tickleFds[0]) 
+            // 先处理可能发生的 tickle，每个被唤醒的线程只读走一次唤醒，剩下的留给其他线程
+            // 读取失败说明唤醒已经被别的线程读走了（水平触发下多个线程可能同时看到可读）
+            if(shard && event.data.u64 == (uint64_t)shard->tickleFd) 
+            {
+                // 本线程独占的 eventfd，读走全部计数后允许再次被唤醒
+                uint64_t value;
+                while(read(shard->tickleFd, &value, sizeof(value)) > 0);
+                shard->wakePending = false;
+                continue;
+            }
+            if(shard && shard->uring && event.data.u64 == (uint64_t)shard->uring->eventFd()) 
+            {
+                triggered += reapUring(*shard, batch);
+                continue;
+            }
+            if(event.data.u64 == (uint64_t)m_tickleFd) 
             {
-                uint8_t dummy[256];
-                while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0); // 边缘触发 -> exhaust  
+                uint64_t value;
+                if(read(m_tickleFd, &value, sizeof(value)) == sizeof(value))
+                {
+                    m_wakePending--;
+                }
                 continue;
             }
 
-            // 通过 event.data.ptr 获取与当前事件关联的 FdContext 指针 fd_ctx，该指针包含了与文件描述符相关的上下文信息
-            FdContext *fd_ctx = (FdContext *)event.data.ptr;
+            // timerfd 到期只是为了唤醒 epoll_wait，超时的定时器在上面已经处理过了
+            if(event.data.u64 == (uint64_t)m_timerFd) 
+            {
+                uint64_t expirations;
+                while(read(m_timerFd, &expirations, sizeof(expirations)) > 0);
+                continue;
+            }
+
+            // 通过 event.data.u64 中的 fd 找到与当前事件关联的 FdContext，该记录包含了与文件描述符相关的上下文信息
+            FdContext *fd_ctx = getFdContext((int)(uint32_t)event.data.u64, false);
+            if(!fd_ctx)
+            {
+                continue;
+            }
 
             std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+            if(fd_ctx->owner != this) // fd 已经被别的 IOManager 接管，这是残留在本 epoll 中的注册
+            {
+                continue;
+            }
+            // 代数不同：注册它的 fd 已经被关闭，编号可能已经属于别的连接，这个事件不能唤醒新 fd 的等待者
+            if((uint32_t)(event.data.u64 >> 32) != fd_ctx->generation.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+
+            // 持久注册：有等待者就触发，没有就记下来留给下一次等待，都不需要 epoll_ctl
+            if(fd_ctx->persistent)
+            {
+                int fired = NONE;
+                if(event.events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                {
+                    fired |= READ;
+                }
+                if(event.events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                {
+                    fired |= WRITE;
+                }
+                int thread = homeThread(fd_ctx);
+                for(Event ev : {READ, WRITE})
+                {
+                    if(!(fired & ev))
+                    {
+                        continue;
+                    }
+                    if(fd_ctx->events & ev)
+                    {
+                        fd_ctx->triggerEvent(ev, thread, &batch);
+                        triggered++;
+                    }
+                    else
+                    {
+                        fd_ctx->ready = (Event)(fd_ctx->ready | ev);
+                    }
+                }
+                continue;
+            }
 
             // 如果当前事件是错误或挂起（EPOLLERR 或 EPOLLHUP），则将其转换为可读或可写事件（EPOLLIN 或 EPOLLOUT），以便后续处理
             if(event.events & (EPOLLERR | EPOLLHUP)) 
@@ -472,35 +1099,99 @@ void IOManager::idle()
             event.events = EPOLLET | left_events; // 如果 left_event 为空，即没有事件了，那么就只剩下边缘触发了 
 
             // 根据之前计算的操作 op，调用 epoll_ctl 修改或删除 epoll 监听事件
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            int rt2 = epollCtl(epfd, op, fd_ctx->fd, &event);
             if(rt2) 
             {
                 std::cerr << "idle::epoll_ctl failed: " << strerror(errno) << std::endl; 
                 continue;
             }
 
-            // 触发事件执行
+            // 触发事件执行，分片模式下协程回到 fd 所属的线程上执行
+            int thread = homeThread(fd_ctx);
             if(real_events & READ) 
             {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(READ, thread, &batch);
+                triggered++;
             }
             if(real_events & WRITE) 
             {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(WRITE, thread, &batch);
+                triggered++;
             }
         } 
 
+        // 整批入队：开启 runnext 时第一个任务在 idle 让出后直接由本线程执行
+        // 入队之后才减少待处理事件数，否则其他线程可能在任务入队前看到既没有事件也没有任务而提前退出
+        if(ready_ns)
+        {
+            for(size_t i = timer_tasks; i < batch.size(); i++)
+            {
+                batch[i].readyNs = ready_ns;
+                batch[i].ioEvent = true;
+            }
+        }
+        scheduleTasks(batch);
+        m_pendingEventCount -= triggered;
+
         // 调度器协程让出控制权，调度器可以选择执行其它任务或再次进入 idle 状态
         Fiber::GetThis()->yield();
     }  
 }
 
+int IOManager::busyPoll(int epfd, epoll_event* events, int max_events, uint64_t budget_ns) 
+{
+    uint64_t deadline = nowNs() + budget_ns;
+    while(true)
+    {
+        int rt = epoll_wait_f(epfd, events, max_events, 0);
+        if(rt > 0)
+        {
+            return rt;
+        }
+        if(hasRunnableTasks() || stopping())
+        {
+            return 0;
+        }
+        if(nowNs() >= deadline)
+        {
+            return -1;
+        }
+        // 每次 epoll_wait 都是一次系统调用，两次之间先退让一会儿
+        for(int i = 0; i < 64; i++)
+        {
+            cpuRelax();
+        }
+    }
+}
+
+void IOManager::armTimerFd(uint64_t deadline) 
+{
+    if(m_timerFdDeadline.exchange(deadline) == deadline)
+    {
+        return;
+    }
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadline / 1000000000;
+    spec.it_value.tv_nsec = deadline % 1000000000;
+    if(timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr))
+    {
+        std::cerr << "armTimerFd::timerfd_settime failed: " << strerror(errno) << std::endl;
+    }
+}
+
 // 当定时器被插入到最小堆的最前面时，触发 tickle 事件，唤醒阻塞的 epoll_wait ，回收超时的定时任务（回调函数和协程）并放入协程调度器中等待调度
 void IOManager::onTimerInsertedAtFront() 
 {
     tickle(); // 唤醒可能被阻塞的 epoll_wait 调用
 }
 
+// 每个工作线程一个定时器分片，do_io 的超时、sleep 和 idle() 中收集超时定时器都只锁自己的分片
+// 不是工作线程的线程（外部线程、临时线程）共用最后一个分片
+size_t IOManager::getTimerShard() 
+{
+    int index = currentWorker();
+    return index >= 0 ? (size_t)index : workerCount();
+}
+
 }  
\ No newline at end of file
@@ -4,11 +4,19 @@
 #include "scheduler.h"
 #include "timer.h"
 
+struct io_uring_sqe;
+struct epoll_event;
+
 namespace sylar {
 
+class IoUring;
+class FdCtx;
+
 // 1.注册事件 -> 2.等待事件 -> 3.事件触发，调度回调函数 -> 4.从 epoll 中注销事件 -> 5.执行回调函数
 class IOManager : public Scheduler, public TimerManager 
 {
+    friend class FdCtx; // FdContext 嵌在 FdCtx 中
+
 public:
     enum Event 
     {
@@ -19,6 +27,7 @@ public:
 
 private:
     // 每个 socket fd 都对应一个 Fdcontext，包括 fd 的值，fd 上的事件以及 fd 的读写事件的上下文
+    // FdContext 不单独分配，而是嵌在 FdManager 中这个 fd 的 FdCtx 记录里，所有 IOManager 共用，同一时间只属于一个 IOManager
     struct FdContext // 文件描述符的事件上下文（注意这里的上下文不是指协程的那种上下文，而是相当于关联信息） 
     {
         // 具体事件的上下文 
@@ -26,46 +35,117 @@ private:
         {
             Scheduler *scheduler = nullptr; // 关联的调度器
             std::shared_ptr<Fiber> fiber; // 关联的回调协程
-            std::function<void()> cb; // 关联的回调函数（会被封装为协程对象）
+            InlineFunction cb; // 关联的回调函数（会被封装为协程对象）
+            const void* tag = nullptr; // 注册者的标识，delEvent 带上它时只删除同一个注册者的等待
         };
 
         EventContext read; // 读事件的上下文
         EventContext write; // 写事件的上下文
         int fd = 0; // 事件关联的 fd（句柄）
+        // 记录的代数，从 1 开始，hook 的 close 关闭 fd 时加一；和 fd 一起放在 epoll_data 中，编号被复用之后旧 fd 残留的事件在 idle() 中直接丢弃
+        // 等待中的协程被唤醒后发现代数变了，说明 fd 在等待期间被关闭，返回 EBADF，不会在复用这个编号的新连接上重试
+        std::atomic<uint32_t> generation = {1};
+        IOManager* owner = nullptr; // 最近在这个 fd 上注册事件的 IOManager，下面的分片和持久注册状态都只对它有效
+        int shard = -1; // 按线程分片 epoll 时 fd 所属的分片（工作线程序号），第一次注册事件时分配
 
         // 注册事件
         Event events = NONE; // 当前注册的事件，可能是 READ、WRITE 或二者的组合
 
+        // 持久注册：fd 以 EPOLLIN | EPOLLOUT | EPOLLET 一直留在 epoll 中，events 只表示有没有等待者
+        bool persistent = false;
+        Event ready = NONE; // 持久注册时，已经到达但还没有等待者的边缘触发事件
+
         std::mutex mutex;
 
         // 根据事件类型获取相应的事件上下文（如读事件上下文或写事件上下文）
         EventContext& getEventContext(Event event);
         // 重置事件上下文
         void resetEventContext(EventContext &ctx);
-        // 触发事件，根据事件类型调用对应上下文结构的调度器去调度协程或函数
-        void triggerEvent(Event event);        
+        // 触发事件，根据事件类型调用对应上下文结构的调度器去调度协程或函数，thread 指定在哪个线程上执行（-1 表示不指定）
+        // batch 不为空时，属于 owner 的任务追加到 batch 中由调用者成批提交
+        void triggerEvent(Event event, int thread = -1, std::vector<ScheduleTask>* batch = nullptr);        
+        // 注册到 epoll 时的 epoll_data：高 32 位为代数，低 32 位为 fd；代数不为 0，和 eventfd、timerfd 这些内部 fd 的注册区分开
+        uint64_t epollData() const {return ((uint64_t)generation.load(std::memory_order_acquire) << 32) | (uint32_t)fd;}
     };
 
 public:
-    //threads：线程数量，use caller：主线程是否参与调度，name：调度器的名字
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+    //threads：线程数量，use caller：主线程是否参与调度，name：调度器的名字，timer_backend：定时器的存储后端
+    //shard_epoll：每个工作线程使用自己的 epoll 实例，fd 第一次注册事件时分配到一个线程上，之后它的事件和被唤醒的协程都在这个线程上处理
+    //use_uring：hook 的 socket IO 改为提交到每个工作线程自己的 io_uring，会同时打开 shard_epoll；内核不支持时退回 epoll
+    //cpus：工作线程绑定的 CPU，见 Scheduler 的构造函数
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager", TimerManager::Backend timer_backend = TimerManager::HEAP, bool shard_epoll = false, bool use_uring = false, const std::vector<int>& cpus = std::vector<int>());
     ~IOManager();
 
     // 添加一个事件到文件描述符 fd 上，并关联一个回调函数 cb
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    // shutdown 到达截止时间之后不再接受新的等待，返回 -1，errno 为 ECANCELED
+    // tag 标识注册者，之后可以用它调用 delEvent，只删除自己的等待
+    int addEvent(int fd, Event event, InlineFunction cb = nullptr, const void* tag = nullptr);
     // 删除文件描述符 fd 上的某个事件
-    bool delEvent(int fd, Event event);
+    // tag 不为空时，只有等待者是用同一个 tag 注册的才删除：自己的注册已经触发、同一方向又被别的协程注册时不会误删别人的等待
+    bool delEvent(int fd, Event event, const void* tag = nullptr);
     // 取消文件描述符 fd 上的某个事件，并触发回调函数
     bool cancelEvent(int fd, Event event);
     // 取消文件描述符 fd 上的所有事件，并触发所有回调函数
     bool cancelAll(int fd);
 
+    // 优雅停止：先执行 addShutdownHook 注册的操作（Listener / TcpServer 在这里停止接收新连接），取消所有循环定时器，
+    // 然后和 stop() 一样等任务、事件和定时器都结束，最多等 timeout_ms 毫秒
+    // 到了截止时间还没结束时，取消所有 fd 上的等待（等待中的 IO 返回错误），之后的 addEvent 返回 ECANCELED，
+    // 所有定时器立刻到期（sleep 提前醒来，IO 超时），打印剩余的等待和存活的协程数；按时结束返回 true，被强制结束返回 false
+    // 和 stop() 一样，use_caller 为 true 时必须在构造它的线程上调用
+    bool shutdown(uint64_t timeout_ms = 5000);
+
+    // 注册 shutdown 开始时要执行的操作，在调用 shutdown 的线程上按注册顺序执行一次
+    void addShutdownHook(std::function<void()> cb);
+
     static IOManager* GetThis();
 
+    // 是否启用了 io_uring 后端
+    bool isUringEnabled() const {return m_uringEnabled;}
+
+    // 注册了还没有触发的事件数（包括 io_uring 上在途的 IO）
+    size_t getPendingEventCount() const {return m_pendingEventCount;}
+
+    // 在当前工作线程的 io_uring 上提交一个 IO 并挂起当前协程，完成后返回结果（与 CQE 的 res 相同，失败为 -errno）
+    // prep 负责填写 SQE，timeout_ms 不为 -1 时附加一个链接超时，超时后 IO 被取消并返回 -ECANCELED
+    // SQE 不会马上进入内核，而是在本线程下一次进入 idle() 时与其他协程的 SQE 一起提交
+    // 没有开启 io_uring 或者不在工作线程上时返回 -ENOSYS，调用者应该退回 epoll 的流程
+    // prep 只在本函数内同步调用一次，按引用传递，不会被复制到 std::function 中
+    template<class Prep>
+    int submitIo(const Prep& prep, uint64_t timeout_ms)
+    {
+        return submitIo([](io_uring_sqe* sqe, const void* arg){(*static_cast<const Prep*>(arg))(sqe);}, &prep, timeout_ms);
+    }
+    int submitIo(void (*prep)(io_uring_sqe* sqe, const void* arg), const void* arg, uint64_t timeout_ms);
+
+    // 取消当前线程的 io_uring 上 fd 的所有在途 IO，用于关闭 fd 之前
+    void cancelIo(int fd);
+
+    // 开启后，之后第一次注册事件的 fd 使用持久注册：读写两个方向一次性加入 epoll，直到 cancelAll（hook 的 close 会调用）才移除
+    // 事件触发和重新等待都不再调用 epoll_ctl，没有等待者时到达的事件记在 FdContext 中，下一次等待时直接触发
+    // 持久注册的 fd 在关闭前必须调用 cancelAll，否则编号被复用的新 fd 不会被加入 epoll
+    void setPersistentEvents(bool persistent) {m_persistentEvents = persistent;}
+
+    // 累计调用 epoll_ctl 的次数
+    uint64_t getEpollCtlCount() const {return m_epollCtlCount;}
+
+    // 开启后，最近的定时器不在整毫秒上时，额外用 timerfd 在精确的时间点唤醒 epoll_wait，定时精度从 1 毫秒提高到微秒级
+    // 每次最近的超时时间变化都要多一次 timerfd_settime 系统调用，默认关闭；时间轮后端的精度固定为 1 毫秒，开启无效
+    void setPreciseTimer(bool precise) {m_preciseTimer = precise;}
+
+    // 开启忙轮询：线程没有任务时先自旋（不阻塞的 epoll_wait 加任务队列检查，中间用 pause 指令退让），没等到再阻塞在 epoll_wait 中
+    // max_us 为单次自旋的上限，0 表示关闭（默认）；实际自旋时长按每个线程最近的空闲间隔自适应，间隔超过上限时不再自旋
+    // 自旋会一直占用 CPU，只适合工作线程独占 CPU 核、对唤醒延迟敏感的服务
+    void setBusyPoll(uint64_t max_us) {m_busyPollNs = max_us * 1000;}
+
 protected:
     // 通知调度器有任务调度
-    // 写管道让 idle 协程从 epoll_wait 退出，待 idle 协程 yield 之后，scheduler::run 就可以调度其他任务
+    // 写 eventfd 让一个 idle 协程从 epoll_wait 退出，待 idle 协程 yield 之后，scheduler::run 就可以调度其他任务
+    // 已经发出但还没被消费的唤醒数达到休眠线程数时直接返回，不再产生系统调用
     void tickle() override; // 重写 scheduler 类中的虚函数
+
+    // 分片模式下只唤醒目标线程，否则与 tickle() 相同
+    void tickleWorker(int index) override;
     
     // 判断调度器是否可以停止
     // 判断条件是 scheduler::stopping() 外加 I0Manager 的 m_pendingEventcount 为0，表示没有 I0 事件可调度
@@ -78,17 +158,76 @@ protected:
     // 重写 Timer 类的虚函数，当有新的定时器插入到最前面时的处理逻辑
     void onTimerInsertedAtFront() override;
 
-    // 调整文件描述符上下文数组的大小
-    void contextResize(size_t size);
+    // 定时器按工作线程分片，当前线程的分片为它的工作线程序号
+    size_t getTimerShard() override;
+
+    // 获取 fd 的上下文（FdManager 中 fd 记录的一部分），create 为 true 时所在的块不存在就分配，不加锁
+    FdContext* getFdContext(int fd, bool create);
+
+    // 把 timerfd 设置为在 deadline（纳秒）时触发，和上一次设置的时间相同时跳过系统调用
+    void armTimerFd(uint64_t deadline);
+
+private:
+    // 按线程分片时每个工作线程独占的 epoll 实例
+    struct EpollShard
+    {
+        int epfd = -1;
+        int tickleFd = -1; // 只用于唤醒这个线程的 eventfd
+        std::atomic<bool> sleeping = {false}; // 线程正在（或准备）阻塞在 epoll_wait 中
+        std::atomic<bool> wakePending = {false}; // 已经写过 eventfd，线程还没醒来处理
+        std::atomic<bool> active = {false}; // 线程已经开始运行 idle()，只有这样的分片才会分配新的 fd
+        std::unique_ptr<IoUring> uring; // 本线程的 io_uring，只由本线程提交和收割
+        size_t inflight = 0; // 本线程 io_uring 上还没完成的 IO 数
+        bool drainCancelled = false; // shutdown 强制结束时已经取消过在途的 IO
+
+        ~EpollShard();
+    };
+
+    // fd 所在的 epoll 实例，分片模式下 fd 还没有分片时为它分配一个，调用者需要持有 fd_ctx->mutex
+    int epollFd(FdContext* fd_ctx);
+    // 分片模式下 fd 的事件触发后，协程或回调应该在哪个线程上执行，非分片模式返回 -1
+    int homeThread(FdContext* fd_ctx);
+    // 唤醒一个分片的线程，返回是否唤醒
+    bool wakeShard(EpollShard& shard);
+    // 调用 epoll_ctl 并计数
+    int epollCtl(int epfd, int op, int fd, epoll_event* event);
+    // 忙轮询最多 budget_ns 纳秒：拿到就绪事件返回事件数，有任务可以执行或调度器正在停止返回 0，自旋结束仍然没有返回 -1
+    int busyPoll(int epfd, epoll_event* events, int max_events, uint64_t budget_ns);
+    // 收割本线程 io_uring 上的完成事件，被恢复的协程追加到 batch 中，返回完成的 IO 数
+    size_t reapUring(EpollShard& shard, std::vector<ScheduleTask>& batch);
+    // 取消本线程 io_uring 上所有在途的 IO，shutdown 强制结束时使用
+    void cancelAllIo(EpollShard& shard);
+    // 唤醒所有工作线程
+    void tickleAll();
+    // shutdown 到达截止时间：取消所有 fd 上的等待，唤醒所有线程；定时器在之后每一轮 idle 中立刻到期
+    void forceDrain();
 
 private:
     int m_epfd = 0; // 用于 epoll 的文件描述符
-    int m_tickleFds[2]; // 用于线程间通信的管道文件描述符，fd[0]是读端，fd[1]是写端 
+    // 用于唤醒 idle 线程的 eventfd，信号量模式：每次 tickle 写入 1，每个被唤醒的线程只读走 1，正好唤醒对应数量的线程
+    int m_tickleFd = -1;
+    std::atomic<size_t> m_sleepers = {0}; // 正在（或准备）阻塞在 epoll_wait 中的线程数
+    std::atomic<size_t> m_wakePending = {0}; // 已经写入 eventfd 但还没被读走的唤醒数
+    int m_timerFd = -1; // 精确定时使用的 timerfd，基于 CLOCK_MONOTONIC，与定时器的 steady_clock 一致
+    std::atomic<bool> m_preciseTimer = {false}; // 是否开启精确定时
+    std::atomic<uint64_t> m_timerFdDeadline = {0}; // timerfd 当前设置的触发时间（steady_clock 纳秒）
 
     // 使用 atomic 的好处是这个变量进行+或-操作时不会被多线程影响，确保线程安全
     std::atomic<size_t> m_pendingEventCount = {0}; // 原子计数器，用于记录待处理的事件数量
-    std::shared_mutex m_mutex; // 读写锁
-    std::vector<FdContext *> m_fdContexts; // 文件描述符上下文数组，用于存储每个文件描述符的 Fdcontext
+
+    std::vector<std::unique_ptr<EpollShard>> m_shards; // 按线程分片的 epoll 实例，为空表示所有线程共用 m_epfd
+    std::atomic<size_t> m_nextShard = {0}; // 轮流为新 fd 分配分片
+    std::atomic<size_t> m_nextWake = {0}; // 轮流选择要唤醒的分片
+    bool m_uringEnabled = false; // 每个分片都有可用的 io_uring
+    std::atomic<bool> m_persistentEvents = {false}; // 新注册的 fd 是否使用持久注册
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    std::atomic<uint64_t> m_busyPollNs = {0}; // 单次忙轮询的上限（纳秒），0 表示关闭
+
+    std::atomic<bool> m_draining = {false}; // 已经调用 shutdown
+    std::atomic<bool> m_forced = {false}; // shutdown 已经到达截止时间，正在强制结束
+    std::atomic<uint64_t> m_drainDeadline = {~0ull}; // shutdown 的截止时间（steady_clock 纳秒）
+    std::mutex m_hookMutex;
+    std::vector<std::function<void()>> m_shutdownHooks;
 };
 
 }  
@@ -0,0 +1,195 @@
+#include "listener.h"
+#include "hook.h"
+#include "fd_manager.h"
+
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+namespace sylar {
+
+Listener::Listener(IOManager* iom, const sockaddr* addr, socklen_t addrlen, std::function<void(int)> cb, bool use_accept4, int backlog):
+m_iom(iom), m_addrlen(addrlen), m_cb(std::move(cb)), m_useAccept4(use_accept4), m_backlog(backlog)
+{
+	assert(addrlen <= sizeof(m_addr));
+	memset(&m_addr, 0, sizeof(m_addr));
+	memcpy(&m_addr, addr, addrlen);
+}
+
+Listener::~Listener()
+{
+	// 接收协程还没有运行过（例如 IOManager 没有调度到它就停止了），监听套接字由这里关闭
+	for(int fd : m_fds)
+	{
+		if(fd >= 0)
+		{
+			FdMgr::GetInstance()->del(fd);
+			close_f(fd);
+		}
+	}
+}
+
+bool Listener::start()
+{
+	// 参与调度的主线程要到 stop() 中才执行任务，分到它的套接字上的连接会一直积压，所以不给它开监听套接字
+	std::vector<int> threads;
+	for(int id : m_iom->getThreadIds())
+	{
+		if(id != m_iom->getRootThreadId())
+		{
+			threads.push_back(id);
+		}
+	}
+	assert(m_fds.empty());
+	if(threads.empty())
+	{
+		std::cerr << "Listener::start no worker thread" << std::endl;
+		return false;
+	}
+
+	for(size_t i = 0; i < threads.size(); i++)
+	{
+		int fd = socket_f(m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(fd < 0)
+		{
+			std::cerr << "Listener::start socket failed: " << strerror(errno) << std::endl;
+			return false;
+		}
+		m_fds.push_back(fd);
+
+		int yes = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)))
+		{
+			std::cerr << "Listener::start SO_REUSEPORT failed: " << strerror(errno) << std::endl;
+			return false;
+		}
+		if(bind(fd, (sockaddr*)&m_addr, m_addrlen) || listen(fd, m_backlog))
+		{
+			std::cerr << "Listener::start bind/listen failed: " << strerror(errno) << std::endl;
+			return false;
+		}
+
+		// 端口为 0 时第一个套接字由内核选择端口，之后的套接字都绑定到这个端口上
+		if(i == 0)
+		{
+			sockaddr_storage bound;
+			socklen_t len = sizeof(bound);
+			getsockname(fd, (sockaddr*)&bound, &len);
+			if(bound.ss_family == AF_INET6)
+			{
+				m_port = ntohs(((sockaddr_in6*)&bound)->sin6_port);
+				((sockaddr_in6*)&m_addr)->sin6_port = htons(m_port);
+			}
+			else
+			{
+				m_port = ntohs(((sockaddr_in*)&bound)->sin_port);
+				((sockaddr_in*)&m_addr)->sin_port = htons(m_port);
+			}
+		}
+		FdMgr::GetInstance()->addSocket(fd);
+	}
+
+	// 每个接收协程固定在一个工作线程上，分片模式下监听套接字也就注册在这个线程自己的 epoll 中
+	std::shared_ptr<Listener> self = shared_from_this();
+	for(size_t i = 0; i < threads.size(); i++)
+	{
+		m_iom->scheduleLock([self, i](){self->acceptLoop(i);}, threads[i]);
+	}
+
+	// IOManager::shutdown 时停止接收新连接
+	std::weak_ptr<Listener> weak = self;
+	m_iom->addShutdownHook([weak]()
+	{
+		std::shared_ptr<Listener> listener = weak.lock();
+		if(listener)
+		{
+			listener->stop();
+		}
+	});
+	return true;
+}
+
+void Listener::stop()
+{
+	if(m_stopping.exchange(true))
+	{
+		return;
+	}
+	// 唤醒正在等待新连接的接收协程；还没开始等待的协程注册事件后会看到 m_stopping，自己取消
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(int fd : m_fds)
+	{
+		if(fd >= 0)
+		{
+			m_iom->cancelAll(fd);
+		}
+	}
+}
+
+void Listener::acceptLoop(size_t index)
+{
+	set_hook_enable(true);
+	int lfd = m_fds[index];
+
+	while(!m_stopping)
+	{
+		int fd = m_useAccept4 ? accept4_f(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC) : accept_f(lfd, nullptr, nullptr);
+		if(fd >= 0)
+		{
+			if(m_useAccept4)
+			{
+				FdMgr::GetInstance()->addSocket(fd);
+			}
+			else
+			{
+				FdMgr::GetInstance()->get(fd, true); // fstat 判断套接字并 fcntl 设置非阻塞
+			}
+			m_acceptCount.fetch_add(1, std::memory_order_relaxed);
+
+			// 连接交给新的任务处理，从工作线程提交的任务进入本线程的本地队列，忙的时候可以被其他线程窃取
+			std::shared_ptr<Listener> self = shared_from_this();
+			m_iom->scheduleLock([self, fd]()
+			{
+				set_hook_enable(true);
+				self->m_cb(fd);
+			});
+			continue;
+		}
+
+		if(errno == EINTR || errno == ECONNABORTED)
+		{
+			continue;
+		}
+		if(errno != EAGAIN)
+		{
+			// 例如文件描述符耗尽（EMFILE），监听套接字仍然可读，歇一会儿再试，避免空转
+			std::cerr << "Listener::acceptLoop accept failed: " << strerror(errno) << std::endl;
+			usleep(10000);
+			continue;
+		}
+
+		// 积压的连接都接收完了，等待下一次读事件
+		if(m_iom->addEvent(lfd, IOManager::READ))
+		{
+			std::cerr << "Listener::acceptLoop addEvent failed, fd = " << lfd << std::endl;
+			break;
+		}
+		// 与 stop() 通过 fd 的锁排序：stop() 先置位再 cancelAll，这里先注册再检查，两边至少有一边能取消这次等待
+		if(m_stopping)
+		{
+			m_iom->cancelEvent(lfd, IOManager::READ);
+		}
+		Fiber::GetThis()->yield();
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_iom->cancelAll(lfd);
+	FdMgr::GetInstance()->del(lfd);
+	close_f(lfd);
+	m_fds[index] = -1;
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef _LISTENER_H_
+#define _LISTENER_H_
+
+#include <sys/socket.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
+
+#include "ioscheduler.h"
+
+namespace sylar {
+
+// 多路监听器：为 IOManager 的每个工作线程（参与调度的主线程除外）打开一个 SO_REUSEPORT 监听套接字，由内核把新连接分散到各个套接字上
+// 每个套接字由一个固定在对应线程上的接收协程处理，一次读事件循环 accept 到 EAGAIN 才重新等待，不再每个连接注册一次事件
+// 新连接交给回调 cb(fd)，回调在新的调度任务中执行；fd 已经登记到 FdManager 并设置为非阻塞，回调负责关闭它
+class Listener : public std::enable_shared_from_this<Listener>
+{
+public:
+	// addr 为监听地址，端口为 0 时由第一个套接字选择端口，其余套接字绑定到同一个端口
+	// use_accept4 为 true 时用 accept4(SOCK_NONBLOCK | SOCK_CLOEXEC) 接收连接，登记到 FdManager 时不需要再 fcntl
+	Listener(IOManager* iom, const sockaddr* addr, socklen_t addrlen, std::function<void(int)> cb, bool use_accept4 = true, int backlog = 1024);
+	~Listener();
+
+	Listener(const Listener&) = delete;
+	Listener& operator=(const Listener&) = delete;
+
+	// 创建监听套接字并启动接收协程，必须在 IOManager 启动之后调用，失败时打印错误并返回 false
+	bool start();
+	// 停止接收新连接，接收协程退出时关闭自己的监听套接字，已经接收的连接不受影响
+	void stop();
+
+	// 实际监听的端口，start() 成功之后有效
+	uint16_t getPort() const {return m_port;}
+	// 监听套接字的个数，即接收协程的个数
+	size_t getListenerCount() const {return m_fds.size();}
+	// 累计接收的连接数
+	uint64_t getAcceptCount() const {return m_acceptCount;}
+
+private:
+	// 第 index 个监听套接字的接收循环，运行在它所固定的线程上
+	void acceptLoop(size_t index);
+
+private:
+	IOManager* m_iom;
+	sockaddr_storage m_addr;
+	socklen_t m_addrlen;
+	std::function<void(int)> m_cb;
+	bool m_useAccept4;
+	int m_backlog;
+	uint16_t m_port = 0;
+	std::mutex m_mutex; // 保护 m_fds：stop() 不能取消到已经关闭、编号又被新连接复用的 fd
+	std::vector<int> m_fds; // 每个工作线程一个监听套接字，接收协程关闭它之后置为 -1
+	std::atomic<bool> m_stopping = {false};
+	std::atomic<uint64_t> m_acceptCount = {0};
+};
+
+}
+
+#endif
@@ -1,19 +1,8 @@
 #include "ioscheduler.h"
-#include "hook.h"
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <fcntl.h>
+#include "http_server.h"
 #include <iostream>
-#include <stack>
-#include <cstring>
-#include <chrono>
-#include <thread>
+#include <cstdlib>
 
-static int sock_listen_fd = -1;
-
-void test_accept();
 void error(const char *msg)
 {
     perror(msg);
@@ -21,112 +10,39 @@ void error(const char *msg)
     exit(1);
 }
 
-void watch_io_read()
-{
-    sylar::IOManager::GetThis()->addEvent(sock_listen_fd, sylar::IOManager::READ, test_accept);
-}
-
-void test_accept()
-{
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    socklen_t len = sizeof(addr);
-    int fd = accept(sock_listen_fd, (struct sockaddr *)&addr, &len);
-    if (fd < 0)
-    {
-        //std::cout << "accept failed, fd = " << fd << ", errno = " << errno << std::endl;
-    }
-    else
-    {
-        std::cout << "accepted connection, fd = " << fd << std::endl;
-        fcntl(fd, F_SETFL, O_NONBLOCK);
-        sylar::IOManager::GetThis()->addEvent(fd, sylar::IOManager::READ, [fd]()
-        {
-            char buffer[1024];
-            memset(buffer, 0, sizeof(buffer));
-            while (true)
-            {
-                int ret = recv(fd, buffer, sizeof(buffer), 0);
-                if (ret > 0)
-                {
-                    // 打印接收到的数据
-                    //std::cout << "received data, fd = " << fd << ", data = " << buffer << std::endl;
-                    
-                    // 构建HTTP响应
-                    const char *response = "HTTP/1.1 200 OK\r\n"
-                                           "Content-Type: text/plain\r\n"
-                                           "Content-Length: 13\r\n"
-                                           "Connection: keep-alive\r\n"
-                                           "\r\n"
-                                           "Hello, World!";
-                    
-                    // 发送HTTP响应
-                    ret = send(fd, response, strlen(response), 0);
-                   // std::cout << "sent data, fd = " << fd << ", ret = " << ret << std::endl;
-
-                    // 关闭连接
-                     close(fd);
-                     break;
-                }
-                if (ret <= 0)
-                {
-                    if (ret == 0 || errno != EAGAIN)
-                    {
-                        //std::cout << "closing connection, fd = " << fd << std::endl;
-                        close(fd);
-                        break;
-                    }
-                    else if (errno == EAGAIN)
-                    {
-                        //std::cout << "recv returned EAGAIN, fd = " << fd << std::endl;
-                        //std::this_thread::sleep_for(std::chrono::milliseconds(50)); // 延长睡眠时间，避免繁忙等待
-                    }
-                }
-            }
-        });
-    }
-    sylar::IOManager::GetThis()->addEvent(sock_listen_fd, sylar::IOManager::READ, test_accept);
-}
-
-void test_iomanager()
+void test_http_server(int threads)
 {
     int portno = 8080;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
+    sylar::IOManager iom(threads);
 
-    // 设置套接字
-    sock_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock_listen_fd < 0)
+    // 每条连接一个协程，支持 keep-alive 和流水线
+    auto server = std::make_shared<sylar::HttpServer>(&iom);
+    server->router().add("GET", "/", [](const sylar::HttpRequest&, sylar::HttpResponse& resp)
     {
-        error("Error creating socket..\n");
-    }
-
-    int yes = 1;
-    // 解决 "address already in use" 错误
-    setsockopt(sock_listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-
-    memset((char *)&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(portno);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-
-    // 绑定套接字并监听连接
-    if (bind(sock_listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
-        error("Error binding socket..\n");
+        resp.setContentType("text/plain");
+        resp.append("Hello, World!");
+    });
+    // 把请求体原样返回，方便测试 Content-Length 和 chunked 请求体
+    server->router().add("POST", "/echo", [](const sylar::HttpRequest& req, sylar::HttpResponse& resp)
+    {
+        resp.setContentType("application/octet-stream");
+        resp.append(req.body);
+    });
 
-    if (listen(sock_listen_fd, 1024) < 0)
+    if (!server->start(portno))
     {
         error("Error listening..\n");
     }
+    printf("http server listening for connections on port: %d\n", portno);
 
-    printf("epoll echo server listening for connections on port: %d\n", portno);
-    fcntl(sock_listen_fd, F_SETFL, O_NONBLOCK);
-    sylar::IOManager iom(9);
-    iom.addEvent(sock_listen_fd, sylar::IOManager::READ, test_accept);
+    // 主线程在 stop() 中参与调度，监听一直在等待连接，所以不会返回
+    iom.stop();
 }
 
 int main(int argc, char *argv[])
 {
-    test_iomanager();
+    // 可选参数：IOManager 的线程数，默认 9
+    int threads = argc > 1 ? atoi(argv[1]) : 9;
+    test_http_server(threads > 0 ? threads : 9);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,244 @@
+#include "metrics.h"
+#include "fiber.h"
+#include "ioscheduler.h"
+
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+namespace sylar {
+
+thread_local Metrics::ThreadCounters* Metrics::t_counters = nullptr;
+std::atomic<bool> Metrics::s_latencyTracking{false};
+
+// 所有线程的计数器；退出的线程把计数并入 retired 后注销。不析构：线程可能在 main 返回之后才退出
+struct MetricsRegistry
+{
+	std::mutex mutex;
+	std::vector<Metrics::ThreadCounters*> threads;
+	uint64_t retired[METRIC_COUNTER_NUM] = {0};
+	LatencySnapshot retiredLatency[METRIC_LATENCY_NUM];
+	// 线程的计数器已经注销（线程正在退出）之后的更新记在这里，多个线程同时写时可能丢失少量计数
+	Metrics::ThreadCounters orphan;
+};
+
+static MetricsRegistry& Registry()
+{
+	static MetricsRegistry* s_registry = new MetricsRegistry();
+	return *s_registry;
+}
+
+// 线程退出时注销计数器
+struct CountersHolder
+{
+	Metrics::ThreadCounters counters;
+	~CountersHolder();
+};
+
+static thread_local bool t_counters_dead = false;
+
+// 把一个线程的直方图加到 out 上
+static void MergeHistogram(LatencySnapshot& out, const Metrics::ThreadCounters::Histogram& hist)
+{
+	uint64_t count = hist.count.load(std::memory_order_relaxed);
+	if(count == 0)
+	{
+		return;
+	}
+	for(int b = 0; b < LatencyBuckets::kCount; b++)
+	{
+		out.buckets[b] += hist.buckets[b].load(std::memory_order_relaxed);
+	}
+	out.count += count;
+	out.sumNs += hist.sum.load(std::memory_order_relaxed);
+	out.maxNs = std::max(out.maxNs, hist.max.load(std::memory_order_relaxed));
+}
+
+CountersHolder::~CountersHolder()
+{
+	MetricsRegistry& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for(int i = 0; i < METRIC_COUNTER_NUM; i++)
+	{
+		registry.retired[i] += counters.values[i].load(std::memory_order_relaxed);
+	}
+	for(int h = 0; h < METRIC_LATENCY_NUM; h++)
+	{
+		MergeHistogram(registry.retiredLatency[h], counters.latency[h]);
+	}
+	registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), &counters));
+	// 之后（例如其他 thread_local 的析构函数中）的更新经过 Register 记到 orphan，不再写已经析构的对象
+	Metrics::t_counters = nullptr;
+	t_counters_dead = true;
+}
+
+Metrics::ThreadCounters& Metrics::Register()
+{
+	MetricsRegistry& registry = Registry();
+	if(t_counters_dead)
+	{
+		return registry.orphan;
+	}
+	static thread_local CountersHolder holder;
+	{
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.threads.push_back(&holder.counters);
+	}
+	t_counters = &holder.counters;
+	return holder.counters;
+}
+
+MetricsSnapshot Metrics::Snapshot(Scheduler* scheduler)
+{
+	MetricsSnapshot s;
+	MetricsRegistry& registry = Registry();
+	{
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for(int i = 0; i < METRIC_COUNTER_NUM; i++)
+		{
+			s.counters[i] = registry.retired[i] + registry.orphan.values[i].load(std::memory_order_relaxed);
+			for(auto counters : registry.threads)
+			{
+				s.counters[i] += counters->values[i].load(std::memory_order_relaxed);
+			}
+		}
+		s.latencyTracking = LatencyTracking();
+		for(int h = 0; h < METRIC_LATENCY_NUM; h++)
+		{
+			s.latency[h] = registry.retiredLatency[h];
+			MergeHistogram(s.latency[h], registry.orphan.latency[h]);
+			for(auto counters : registry.threads)
+			{
+				MergeHistogram(s.latency[h], counters->latency[h]);
+			}
+		}
+	}
+
+	s.fibers = Fiber::GetFiberCount();
+	s.stackBytes = Fiber::GetStackBytes();
+	s.pooledStackBytes = Fiber::GetPooledStackBytes();
+
+	if(scheduler)
+	{
+		s.scheduler = scheduler->getName();
+		s.queueDepth = scheduler->getTaskCount();
+		s.activeThreads = scheduler->getActiveThreadCount();
+		s.idleThreads = scheduler->getIdleThreadCount();
+		IOManager* iom = dynamic_cast<IOManager*>(scheduler);
+		if(iom)
+		{
+			s.pendingEvents = iom->getPendingEventCount();
+		}
+	}
+	return s;
+}
+
+uint64_t LatencySnapshot::percentile(double q) const
+{
+	if(count == 0)
+	{
+		return 0;
+	}
+	// 各个桶和 count 是分别读取的，并发更新时两者可能差几个样本，以桶的合计为准
+	uint64_t total = 0;
+	for(int b = 0; b < LatencyBuckets::kCount; b++)
+	{
+		total += buckets[b];
+	}
+	uint64_t rank = (uint64_t)(q * total + 0.5);
+	rank = std::max<uint64_t>(rank, 1);
+	uint64_t seen = 0;
+	for(int b = 0; b < LatencyBuckets::kCount; b++)
+	{
+		seen += buckets[b];
+		if(seen >= rank)
+		{
+			return std::min(LatencyBuckets::UpperBound(b), maxNs);
+		}
+	}
+	return maxNs;
+}
+
+// 输出一个指标：HELP、TYPE 和一行取值
+static void WriteMetric(std::ostringstream& os, const std::string& name, const char* type, const char* help, const std::string& labels, uint64_t value)
+{
+	os << "# HELP " << name << " " << help << "\n";
+	os << "# TYPE " << name << " " << type << "\n";
+	os << name << labels << " " << value << "\n";
+}
+
+std::string Metrics::ToPrometheus(const MetricsSnapshot& s, const std::string& prefix)
+{
+	static const char* const kCounterNames[METRIC_COUNTER_NUM][2] = {
+		{"tasks_run_total", "Tasks executed by scheduler workers."},
+		{"steals_total", "Tasks stolen from another worker's local queue."},
+		{"context_switches_total", "Fiber context switches (resume and yield)."},
+		{"epoll_wakeups_total", "epoll_wait calls that returned."},
+		{"epoll_events_total", "Events returned by epoll_wait."},
+		{"timers_fired_total", "Timers that expired and ran."},
+		{"timers_cancelled_total", "Timers cancelled before expiring."}
+	};
+
+	std::ostringstream os;
+	for(int i = 0; i < METRIC_COUNTER_NUM; i++)
+	{
+		WriteMetric(os, prefix + "_" + kCounterNames[i][0], "counter", kCounterNames[i][1], "", s.counters[i]);
+	}
+	WriteMetric(os, prefix + "_fibers", "gauge", "Live fibers, including each thread's main fiber.", "", s.fibers);
+	WriteMetric(os, prefix + "_stack_bytes", "gauge", "Memory reserved for private fiber stacks.", "", s.stackBytes);
+	WriteMetric(os, prefix + "_pooled_stack_bytes", "gauge", "Stack memory held by finished fibers kept for reuse.", "", s.pooledStackBytes);
+
+	if(!s.scheduler.empty())
+	{
+		// 标签值中的反斜杠、双引号和换行需要转义
+		std::string name;
+		for(char c : s.scheduler)
+		{
+			if(c == '\\' || c == '"')
+			{
+				name += '\\';
+				name += c;
+			}
+			else if(c == '\n')
+			{
+				name += "\\n";
+			}
+			else
+			{
+				name += c;
+			}
+		}
+		std::string labels = "{scheduler=\"" + name + "\"}";
+		WriteMetric(os, prefix + "_queue_depth", "gauge", "Tasks waiting in the scheduler queues.", labels, s.queueDepth);
+		WriteMetric(os, prefix + "_active_threads", "gauge", "Workers currently running a task.", labels, s.activeThreads);
+		WriteMetric(os, prefix + "_idle_threads", "gauge", "Workers waiting in idle.", labels, s.idleThreads);
+		WriteMetric(os, prefix + "_pending_events", "gauge", "Events registered with the IOManager and not yet triggered.", labels, s.pendingEvents);
+	}
+
+	if(s.latencyTracking)
+	{
+		static const char* const kLatencyNames[METRIC_LATENCY_NUM][2] = {
+			{"queue_wait_seconds", "Time from enqueue to the start of execution."},
+			{"event_resume_seconds", "Time from an IO event becoming ready to the waiting fiber resuming."},
+			{"task_run_seconds", "Time a task ran before finishing or yielding."}
+		};
+		static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+		for(int h = 0; h < METRIC_LATENCY_NUM; h++)
+		{
+			const LatencySnapshot& l = s.latency[h];
+			std::string name = prefix + "_" + kLatencyNames[h][0];
+			os << "# HELP " << name << " " << kLatencyNames[h][1] << "\n";
+			os << "# TYPE " << name << " summary\n";
+			for(double q : kQuantiles)
+			{
+				os << name << "{quantile=\"" << q << "\"} " << l.percentile(q) / 1e9 << "\n";
+			}
+			os << name << "_sum " << l.sumNs / 1e9 << "\n";
+			os << name << "_count " << l.count << "\n";
+		}
+	}
+	return os.str();
+}
+
+}
@@ -0,0 +1,189 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <time.h>
+
+namespace sylar {
+
+class Scheduler;
+
+// 运行时指标：调度、上下文切换、epoll 和定时器的计数器，以及协程数、栈内存、队列深度等瞬时值
+// 计数器每个线程一份，只由所在线程更新（一次 relaxed 读 + 写，没有锁前缀的原子指令，也不和其他线程抢缓存行），读取快照时把所有线程的加起来
+//     sylar::MetricsSnapshot s = sylar::Metrics::Snapshot(iom);
+//     std::string text = sylar::Metrics::ToPrometheus(s); // 交给 /metrics 接口返回
+enum MetricCounter
+{
+	METRIC_TASKS_RUN = 0,     // 工作线程执行的任务数
+	METRIC_STEALS,            // 从其他工作线程的本地队列窃取的任务数
+	METRIC_CONTEXT_SWITCHES,  // 协程上下文切换次数（resume 和 yield 各算一次）
+	METRIC_EPOLL_WAKEUPS,     // epoll_wait 返回的次数
+	METRIC_EPOLL_EVENTS,      // epoll_wait 返回的事件总数
+	METRIC_TIMERS_FIRED,      // 到期执行的定时器数
+	METRIC_TIMERS_CANCELLED,  // 被取消的定时器数
+	METRIC_COUNTER_NUM
+};
+
+// 延迟直方图，Metrics::SetLatencyTracking(true) 之后才记录
+enum MetricLatency
+{
+	LATENCY_QUEUE_WAIT = 0,   // 任务从入队到开始执行
+	LATENCY_EVENT_RESUME,     // IO 事件就绪（epoll_wait / io_uring 返回）到等待它的协程恢复执行
+	LATENCY_TASK_RUN,         // 任务每次执行到完成或让出的时间
+	METRIC_LATENCY_NUM
+};
+
+// HDR 风格的对数分桶：按 2 的幂分段，每段再等分为 8 个子桶，相对误差不超过 12.5%，单位为纳秒，超过约 2^42 ns（73 分钟）的值计入最后一个桶
+struct LatencyBuckets
+{
+	static const int kSubBits = 3;
+	static const int kSub = 1 << kSubBits;
+	static const int kCount = kSub * 40;
+
+	static int Index(uint64_t v)
+	{
+		if(v < (uint64_t)kSub)
+		{
+			return (int)v;
+		}
+		int e = 63 - __builtin_clzll(v);
+		int index = (e - kSubBits + 1) * kSub + (int)((v >> (e - kSubBits)) & (kSub - 1));
+		return index < kCount ? index : kCount - 1;
+	}
+	// 下标为 index 的桶中最大的值
+	static uint64_t UpperBound(int index)
+	{
+		if(index < kSub)
+		{
+			return index;
+		}
+		int e = index / kSub + kSubBits - 1;
+		uint64_t sub = index % kSub;
+		return ((kSub + sub + 1) << (e - kSubBits)) - 1;
+	}
+};
+
+// 合并所有线程之后的一个直方图
+struct LatencySnapshot
+{
+	uint64_t buckets[LatencyBuckets::kCount] = {0};
+	uint64_t count = 0;
+	uint64_t sumNs = 0;
+	uint64_t maxNs = 0;
+
+	// 分位数 q（0 到 1），返回所在桶的上界，不超过最大值；没有样本时返回0
+	uint64_t percentile(double q) const;
+	double meanNs() const {return count ? (double)sumNs / count : 0;}
+};
+
+// 某一时刻的指标，计数器是进程启动以来的累计值（已经退出的线程的计数也包括在内）
+struct MetricsSnapshot
+{
+	uint64_t counters[METRIC_COUNTER_NUM] = {0};
+
+	// 进程范围的瞬时值
+	uint64_t fibers = 0;              // 存活的协程数（包括每个线程的主协程）
+	uint64_t stackBytes = 0;          // 私有协程栈占用的内存（按栈大小计，不含共享栈）
+	uint64_t pooledStackBytes = 0;    // 其中在协程缓存中等待复用的部分
+
+	// 调度器的瞬时值，Snapshot 传入调度器时才有
+	std::string scheduler;            // 调度器名称，为空表示没有传入
+	uint64_t queueDepth = 0;          // 排队的任务数
+	uint64_t activeThreads = 0;       // 正在执行任务的线程数
+	uint64_t idleThreads = 0;         // 在 idle 中等待的线程数
+	uint64_t pendingEvents = 0;       // IOManager 中注册的待触发事件数，不是 IOManager 时为0
+
+	// 延迟直方图，进程范围；没有开启延迟统计时为空
+	bool latencyTracking = false;
+	LatencySnapshot latency[METRIC_LATENCY_NUM];
+
+	uint64_t get(MetricCounter c) const {return counters[c];}
+	// 平均每次 epoll_wait 返回的事件数
+	double eventsPerWakeup() const
+	{
+		return counters[METRIC_EPOLL_WAKEUPS] ? (double)counters[METRIC_EPOLL_EVENTS] / counters[METRIC_EPOLL_WAKEUPS] : 0;
+	}
+};
+
+struct CountersHolder;
+
+class Metrics
+{
+	friend struct CountersHolder; // 线程退出时注销计数器并清空 t_counters
+
+public:
+	// 当前线程的计数器，第一次调用时登记，线程退出时计数并入全局累计值
+	struct alignas(64) ThreadCounters
+	{
+		std::atomic<uint64_t> values[METRIC_COUNTER_NUM] = {};
+
+		struct Histogram
+		{
+			std::atomic<uint64_t> buckets[LatencyBuckets::kCount] = {};
+			std::atomic<uint64_t> count = {0};
+			std::atomic<uint64_t> sum = {0};
+			std::atomic<uint64_t> max = {0};
+		};
+		Histogram latency[METRIC_LATENCY_NUM];
+	};
+
+	// 当前线程的计数器加 n，只能由当前线程调用
+	static void Add(MetricCounter c, uint64_t n = 1)
+	{
+		Bump(Local().values[c], n);
+	}
+
+	// 开启 / 关闭延迟统计：开启后调度器在任务入队、开始执行和执行完时各读一次单调时钟，关闭时只多一次 relaxed 读和分支
+	static void SetLatencyTracking(bool enable) {s_latencyTracking.store(enable, std::memory_order_relaxed);}
+	static bool LatencyTracking() {return s_latencyTracking.load(std::memory_order_relaxed);}
+
+	// 单调时钟，纳秒
+	static uint64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	}
+
+	// 在当前线程的直方图中记录一个样本，只能由当前线程调用
+	static void Record(MetricLatency h, uint64_t ns)
+	{
+		ThreadCounters::Histogram& hist = Local().latency[h];
+		Bump(hist.buckets[LatencyBuckets::Index(ns)], 1);
+		Bump(hist.count, 1);
+		Bump(hist.sum, ns);
+		if(ns > hist.max.load(std::memory_order_relaxed))
+		{
+			hist.max.store(ns, std::memory_order_relaxed);
+		}
+	}
+
+	// 读取所有线程的计数器和进程范围的瞬时值；scheduler 不为空时同时读取它的队列深度、线程状态和待触发事件数
+	static MetricsSnapshot Snapshot(Scheduler* scheduler = nullptr);
+
+	// 按 Prometheus 文本格式输出，指标名以 prefix_ 开头，调度器的指标带 scheduler="名称" 标签，延迟直方图输出为 summary（秒）
+	static std::string ToPrometheus(const MetricsSnapshot& snapshot, const std::string& prefix = "coroframe");
+
+private:
+	// 只有所在线程写，读-加-写不需要原子的 fetch_add
+	static void Bump(std::atomic<uint64_t>& v, uint64_t n)
+	{
+		v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	static ThreadCounters& Local()
+	{
+		ThreadCounters* c = t_counters;
+		return c ? *c : Register();
+	}
+	static ThreadCounters& Register();
+
+	static thread_local ThreadCounters* t_counters;
+	static std::atomic<bool> s_latencyTracking;
+};
+
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "numa.h"
+
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <mutex>
+#include <iostream>
+
+namespace sylar {
+
+static const int kMpolPreferred = 1; // <numaif.h> 中的 MPOL_PREFERRED：优先从指定节点分配，不够时再从其他节点分配
+
+static thread_local int t_numa_node = -1;
+
+// 拓扑只读取一次：s_cpu_node[cpu] 为 cpu 所在的节点
+static std::once_flag s_topology_once;
+static std::vector<int> s_cpu_node;
+static int s_node_count = 1;
+
+// 解析 "0-3,8-11" 形式的 CPU 列表
+static void parseCpuList(const char* list, int node)
+{
+	const char* p = list;
+	while(*p && *p != '\n')
+	{
+		char* end;
+		long first = strtol(p, &end, 10);
+		if(end == p)
+		{
+			break;
+		}
+		long last = first;
+		p = end;
+		if(*p == '-')
+		{
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for(long cpu = first; cpu <= last; cpu++)
+		{
+			if((size_t)cpu >= s_cpu_node.size())
+			{
+				s_cpu_node.resize(cpu + 1, 0);
+			}
+			s_cpu_node[cpu] = node;
+		}
+		if(*p == ',')
+		{
+			p++;
+		}
+	}
+}
+
+static void loadTopology()
+{
+	DIR* dir = opendir("/sys/devices/system/node");
+	if(!dir)
+	{
+		return;
+	}
+	int max_node = 0;
+	while(dirent* entry = readdir(dir))
+	{
+		int node;
+		if(sscanf(entry->d_name, "node%d", &node) != 1)
+		{
+			continue;
+		}
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		FILE* fp = fopen(path, "r");
+		if(!fp)
+		{
+			continue;
+		}
+		char list[4096];
+		if(fgets(list, sizeof(list), fp))
+		{
+			parseCpuList(list, node);
+		}
+		fclose(fp);
+		if(node > max_node)
+		{
+			max_node = node;
+		}
+	}
+	closedir(dir);
+	s_node_count = max_node + 1;
+}
+
+int Numa::NodeCount()
+{
+	std::call_once(s_topology_once, loadTopology);
+	return s_node_count;
+}
+
+int Numa::CpuNode(int cpu)
+{
+	std::call_once(s_topology_once, loadTopology);
+	return cpu >= 0 && (size_t)cpu < s_cpu_node.size() ? s_cpu_node[cpu] : 0;
+}
+
+bool Numa::PinThread(int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(sched_setaffinity(0, sizeof(set), &set))
+	{
+		std::cerr << "Numa::PinThread(" << cpu << ") failed: " << strerror(errno) << std::endl;
+		return false;
+	}
+	t_numa_node = CpuNode(cpu);
+	return true;
+}
+
+int Numa::ThreadNode()
+{
+	return t_numa_node;
+}
+
+void Numa::ClearThreadNode()
+{
+	t_numa_node = -1;
+}
+
+void Numa::BindMemory(void* addr, size_t len, int node)
+{
+	const int bits = 8 * sizeof(unsigned long);
+	unsigned long mask[16] = {}; // 最多 1024 个节点
+	if(node < 0 || node >= 16 * bits || NodeCount() <= 1)
+	{
+		return;
+	}
+	mask[node / bits] = 1ul << (node % bits);
+	// 绑定失败（例如内核没有开启 NUMA）不影响正确性，只是退回默认的首次访问分配
+	syscall(SYS_mbind, addr, len, kMpolPreferred, mask, sizeof(mask) * 8, 0);
+}
+
+}
@@ -0,0 +1,31 @@
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <cstddef>
+
+namespace sylar {
+
+// CPU 亲和性与 NUMA 拓扑：直接读取 /sys/devices/system/node 并调用 sched_setaffinity / mbind 系统调用，不依赖 libnuma
+// 单节点的机器（或者读不到拓扑时）所有 CPU 都属于节点 0，内存绑定什么都不做
+class Numa
+{
+public:
+	// NUMA 节点数，至少为 1
+	static int NodeCount();
+	// cpu 所在的节点，读不到时返回 0
+	static int CpuNode(int cpu);
+
+	// 把当前线程绑定到 cpu 上，并记下当前线程所在的节点，失败时返回 false
+	static bool PinThread(int cpu);
+	// 当前线程绑定的节点，没有绑定过时返回 -1
+	static int ThreadNode();
+	// 解除当前线程记下的节点（恢复亲和性的调用者负责恢复 CPU 掩码）
+	static void ClearThreadNode();
+
+	// 让 [addr, addr + len) 优先从 node 分配物理页，必须在第一次访问之前调用；node 小于 0 或只有一个节点时什么都不做
+	static void BindMemory(void* addr, size_t len, int node);
+};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "offload.h"
+#include "scheduler.h"
+
+#include <cerrno>
+
+namespace sylar {
+
+// 一次交给线程池的调用，放在等待的协程栈上（只有私有栈协程会挂起等待，栈在挂起期间保持有效）
+struct BlockingPool::Job
+{
+	InlineFunction fn;
+	Scheduler* scheduler = nullptr;
+	std::shared_ptr<Fiber> fiber;
+	int error = 0;
+	Job* next = nullptr;
+};
+
+// 协程可能在另一个线程上恢复，编译器缓存的 errno 地址属于挂起前的线程，挂起之后要重新取
+__attribute__((noipa)) static int& current_errno()
+{
+	return errno;
+}
+
+BlockingPool* BlockingPool::GetInstance()
+{
+	// 不析构：进程退出时线程池的线程可能还在等待任务
+	static BlockingPool* s_pool = new BlockingPool();
+	return s_pool;
+}
+
+void BlockingPool::setMaxThreads(size_t n)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_maxThreads = n > 0 ? n : 1;
+}
+
+size_t BlockingPool::getThreadCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_threads.size();
+}
+
+bool BlockingPool::CanOffload()
+{
+	Fiber* fiber = Fiber::GetThisPtr();
+	return Scheduler::GetThis() && fiber->isRunInScheduler() && !fiber->isSharedStack();
+}
+
+void BlockingPool::execute(InlineFunction fn)
+{
+	if(!CanOffload())
+	{
+		fn();
+		return;
+	}
+
+	Job job;
+	job.fn = std::move(fn);
+	job.scheduler = Scheduler::GetThis();
+	job.fiber = Fiber::GetThis();
+	Fiber* self = job.fiber.get();
+
+	// 挂起期间调度器不能结束，否则线程池唤醒时协程已经没有地方可去
+	job.scheduler->beginExternalWait();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_tail)
+		{
+			m_tail->next = &job;
+		}
+		else
+		{
+			m_head = &job;
+		}
+		m_tail = &job;
+
+		if(m_idle > 0)
+		{
+			m_cond.notify_one();
+		}
+		else if(m_threads.size() < m_maxThreads)
+		{
+			m_threads.emplace_back(new Thread(std::bind(&BlockingPool::worker, this), "blocking_" + std::to_string(m_threads.size())));
+		}
+	}
+
+	// 和 fiber_sync 一样先入队再 yield，线程池在 yield 之前就唤醒也没关系，调度器会等协程让出后再 resume
+	self->yield();
+	current_errno() = job.error;
+}
+
+void BlockingPool::worker()
+{
+	while(true)
+	{
+		Job* job = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while(!m_head)
+			{
+				m_idle++;
+				m_cond.wait(lock);
+				m_idle--;
+			}
+			job = m_head;
+			m_head = job->next;
+			if(!m_head)
+			{
+				m_tail = nullptr;
+			}
+		}
+
+		errno = 0;
+		job->fn();
+		job->error = errno;
+		job->fn = nullptr;
+
+		// 唤醒之后协程可能马上恢复并销毁 job，先把需要的东西取出来
+		Scheduler* scheduler = job->scheduler;
+		std::shared_ptr<Fiber> fiber = std::move(job->fiber);
+		scheduler->scheduleLock(std::move(fiber));
+		scheduler->endExternalWait();
+	}
+}
+
+}
@@ -0,0 +1,102 @@
+#ifndef _OFFLOAD_H_
+#define _OFFLOAD_H_
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include <condition_variable>
+
+#include "thread.h"
+#include "fiber.h"
+
+namespace sylar {
+
+// 阻塞调用线程池：普通文件的 read / write、fsync，以及第三方库里无法 hook 的阻塞调用都会卡住整个工作线程
+// 交给线程池执行后只挂起调用它的协程，工作线程继续执行其他协程，执行完由线程池用 scheduleLock 把协程放回调度器
+//     std::string text = sylar::runBlocking([&]{ return parse_config(path); });
+// hook 开启时，hook 的 open / openat 打开的普通文件和块设备上的 read / write / readv / writev / pread / pwrite / fsync / fdatasync 自动交给线程池
+class BlockingPool
+{
+public:
+	static BlockingPool* GetInstance();
+
+	// 线程数上限，默认为 4；线程在有任务排队且没有空闲线程时按需创建，创建后常驻
+	void setMaxThreads(size_t n);
+	size_t getMaxThreads() const {return m_maxThreads;}
+	size_t getThreadCount();
+
+	// 在线程池中执行 fn，挂起当前协程直到执行完，fn 执行后的 errno 带回当前协程
+	// 不在调度器调度的协程中、或者在共享栈协程中（挂起后栈上的缓冲区会被覆盖）时直接在当前线程执行
+	void execute(InlineFunction fn);
+
+	// 当前执行流能否挂起等待线程池
+	static bool CanOffload();
+
+private:
+	struct Job;
+
+	BlockingPool() = default;
+	void worker();
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	Job* m_head = nullptr; // 排队的任务，侵入式先进先出链表，任务节点在等待的协程栈上
+	Job* m_tail = nullptr;
+	std::vector<std::shared_ptr<Thread>> m_threads;
+	size_t m_idle = 0; // 正在等待任务的线程数
+	size_t m_maxThreads = 4;
+};
+
+// 在阻塞调用线程池中执行 f 并返回它的结果，f 抛出的异常在当前协程中重新抛出
+template<class F>
+std::invoke_result_t<F&> runBlocking(F&& f)
+{
+	using R = std::invoke_result_t<F&>;
+	std::exception_ptr error;
+	if constexpr(std::is_void_v<R>)
+	{
+		BlockingPool::GetInstance()->execute([&f, &error]()
+		{
+			try
+			{
+				f();
+			}
+			catch(...)
+			{
+				error = std::current_exception();
+			}
+		});
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+	else
+	{
+		std::optional<R> result;
+		BlockingPool::GetInstance()->execute([&f, &error, &result]()
+		{
+			try
+			{
+				result.emplace(f());
+			}
+			catch(...)
+			{
+				error = std::current_exception();
+			}
+		});
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+		return std::move(*result);
+	}
+}
+
+}
+
+#endif
@@ -1,4 +1,14 @@
 #include "scheduler.h"
+#include "numa.h"
+#include "metrics.h"
+
+#include <sched.h>
+#include <chrono>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
 
 static bool debug = false;
 
@@ -6,6 +16,47 @@ namespace sylar {
 
 // t_scheduler 是 thread_local 变量，每个线程都有自己独立的 t_scheduler 指针，指向同一个 Scheduler 
 static thread_local Scheduler* t_scheduler = nullptr;
+// 当前线程在所属调度器中的工作线程序号，-1 表示当前线程不是工作线程（例如还没有进入 run() 的主线程）
+static thread_local int t_worker_index = -1;
+// 当前工作线程的调度计数，用于周期性地检查全局注入队列，防止本地队列一直不空时全局队列中的任务被饿死
+static thread_local uint32_t t_schedule_tick = 0;
+
+// 心跳时间，单调时钟的毫秒数，不会为0
+static uint64_t HeartbeatNowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() + 1;
+}
+
+// 看门狗的 SIGURG 处理函数：在收到信号的线程上输出当时的调用栈
+// 只用异步信号安全的调用，write 可能被 hook，直接走系统调用
+static void WatchdogSignalHandler(int)
+{
+	static const char header[] = "Scheduler watchdog backtrace:\n";
+	syscall(SYS_write, STDERR_FILENO, header, sizeof(header) - 1);
+	void* frames[64];
+	int n = backtrace(frames, 64);
+	backtrace_symbols_fd(frames, n, STDERR_FILENO);
+}
+
+static void InstallWatchdogHandler()
+{
+	static bool installed = []()
+	{
+		// 第一次调用 backtrace 会加载 libgcc 并分配内存，提前在这里完成
+		void* frame;
+		backtrace(&frame, 1);
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = WatchdogSignalHandler;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		return sigaction(SIGURG, &sa, nullptr) == 0;
+	}();
+	if(!installed)
+	{
+		std::cerr << "Scheduler watchdog: sigaction(SIGURG) failed" << std::endl;
+	}
+}
 
 Scheduler* Scheduler::GetThis()
 {
@@ -17,13 +68,44 @@ void Scheduler::SetThis()
 	t_scheduler = this;
 }
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name):
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name, const std::vector<int>& cpus):
 m_useCaller(use_caller), m_name(name)
 {
 	// 断言判断要创建的线程数量是否大于0，并且调度器的对象是否是空指针，是就调用 setThis()进行设置
 	assert(threads > 0 && Scheduler::GetThis() == nullptr); 
 
-	SetThis(); // 设置当前调度器对象
+	// 主线程参与调度时才把它的当前调度器设置为自己；不参与时主线程只是提交任务的外部线程，stop() 也是按这个约定断言的
+	if(use_caller)
+	{
+		SetThis(); // 设置当前调度器对象
+	}
+
+	// 为每个工作线程（包括参与调度的主线程）创建调度上下文
+	for(size_t i = 0; i < threads; i++)
+	{
+		m_workers.emplace_back(new WorkerContext());
+		if(!cpus.empty())
+		{
+			m_workers[i]->cpu = cpus[i % cpus.size()];
+			m_workers[i]->node = Numa::CpuNode(m_workers[i]->cpu);
+		}
+	}
+
+	// 窃取顺序：先是同一节点上的线程，再是其他节点上的线程，各自从下一个序号开始环形排列；没有绑定时所有线程都在节点 0，与原来的环形顺序相同
+	for(size_t i = 0; i < threads; i++)
+	{
+		for(int same = 1; same >= 0; same--)
+		{
+			for(size_t k = 1; k < threads; k++)
+			{
+				size_t victim = (i + k) % threads;
+				if((m_workers[victim]->node == m_workers[i]->node) == (bool)same)
+				{
+					m_workers[i]->stealOrder.push_back(victim);
+				}
+			}
+		}
+	}
 
 	Thread::SetName(m_name); // 设置当前线程的名称为调度器的名称
 
@@ -42,6 +124,10 @@ m_useCaller(use_caller), m_name(name)
 		
 		m_rootThread = Thread::GetThreadId(); // 获取主线程ID
 		m_threadIds.push_back(m_rootThread); // 将主线程加入存储工作线程的数组
+
+		// 主线程固定使用序号0，这样在调度开始前就能接收指定给主线程的任务
+		m_workers[0]->threadId = m_rootThread;
+		m_nextWorker = 1;
 	}
 
 	m_threadCount = threads; // 将需要创建的线程数量赋值给 m_threadcount
@@ -74,6 +160,8 @@ void Scheduler::start()
 		m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
 		m_threadIds.push_back(m_threads[i]->getId());
 	}
+	m_started = true;
+	startMonitor();
 	if(debug) std::cout << "Scheduler::start() success\n";
 }
 
@@ -99,71 +187,59 @@ void Scheduler::run()
 	 */
 	std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this)); // 子协程
 	ScheduleTask task; // 创建任务对象
+
+	// 领取工作线程序号，之后本线程提交的任务都进入自己的本地队列
+	t_worker_index = (thread_id == m_rootThread) ? 0 : m_nextWorker++;
+	assert(t_worker_index < (int)m_workers.size());
+	registerWorker(t_worker_index, thread_id);
+	WorkerContext& worker = *m_workers[t_worker_index];
+
+	// 绑定 CPU：之后这个线程上新建的协程栈（MmapStackAllocator）和首次访问的内存都来自它所在的 NUMA 节点
+	// 主线程在 run() 返回时恢复原来的亲和性，不影响调度器之外的代码
+	cpu_set_t root_affinity;
+	bool restore_affinity = false;
+	int cpu = worker.cpu;
+	if(cpu >= 0)
+	{
+		if(thread_id == m_rootThread)
+		{
+			restore_affinity = sched_getaffinity(0, sizeof(root_affinity), &root_affinity) == 0;
+		}
+		Numa::PinThread(cpu);
+	}
 	
 	while(true)
 	{
 		task.reset(); 
 		bool tickle_me = false; // 是否要唤醒其他线程进行任务调度
-		{
-			std::lock_guard<std::mutex> lock(m_mutex); // 互斥访问任务队列
-			auto it = m_tasks.begin();
-			// 1.遍历任务队列
-			while(it != m_tasks.end())
-			{
-				// 如果任务指定了特定的线程执行且不是当前线程，就跳过该线程，唤醒其他线程
-				if(it->thread != -1 && it->thread != thread_id) 
-				{
-					it++;
-					tickle_me = true;
-					continue;
-				}
 
-				// 2.取出任务
-				assert(it->fiber || it->cb);
-				task = *it;
-				m_tasks.erase(it); 
-				m_activeThreadCount++;
-				break; // 取到任务的线程就直接 break，因此没有遍历到队尾，说明还有剩余任务
-			}	
-			tickle_me = tickle_me || (it != m_tasks.end());
-		}
+		// 1.取出任务，取到任务的线程变为活跃线程
+		dequeue(task, tickle_me);
 
 		if(tickle_me) // 具体的唤醒代码在 ioscheduler.cpp
 		{
 			tickle();
 		}
 
-		// 3.执行任务
-		if(task.fiber) // 如果任务对象是协程
-		{   // 任务协程调用 resume 将执行权从调度协程切换到任务协程 
-			{					
-				std::lock_guard<std::mutex> lock(task.fiber->m_mutex);
-				if(task.fiber->getState() != Fiber::TERM)
-				{
-					task.fiber->resume();	
-				}
-			}
-			// resume 返回时此时任务要么执行完了，要么半路 yield 了，总之任务完成了，活跃线程-1
-			m_activeThreadCount--; // 线程完成任务后就不再处于活跃状态，而是进入空闲状态，因此将活跃线程数-1
-			task.reset();
-		}
-		else if(task.cb) // 如果任务对象是函数，之前解释过函数也应该被调度，具体做法就是先封装成协程再执行
-		{   
-			std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb);
-			{
-				std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
-				cb_fiber->resume();			
-			}
-			m_activeThreadCount--;
-			task.reset();	
+		// 2.执行任务
+		if(task.fiber || task.cb)
+		{
+			runTask(task, worker.heartbeat);
 		}
-		// 4.当前无任务，就执行空闲协程
+		// 3.当前无任务，就执行空闲协程
 		else
 		{		
 			// 系统关闭 -> idle 协程将从死循环跳出并结束 -> 此时的 idle 协程状态为 TERM -> 再次进入将跳出循环并退出 run()
-            if(idle_fiber->getState() == Fiber::TERM) 
+            if(idle_fiber->isFinished()) 
             {	
             	if(debug) std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
+            	worker.running = false;
+            	t_worker_index = -1;
+            	if(restore_affinity)
+            	{
+            		sched_setaffinity(0, sizeof(root_affinity), &root_affinity);
+            		Numa::ClearThreadNode();
+            	}
                 break;
             }
 			/**
@@ -172,6 +248,7 @@ void Scheduler::run()
 			   这样可以确保调度器始终保持活跃，并在有新任务时立即恢复执行，不会因为 sleep 而有延迟
 			   在这里 idle_fiber 就是不断的和调度协程进行交互的子协程
 			 */
+			Fiber::TrimPool(); // 线程空闲时收缩协程缓存，释放这段时间内多余的协程栈
 			m_idleThreadCount++;
 			idle_fiber->resume();				
 			m_idleThreadCount--;
@@ -180,6 +257,371 @@ void Scheduler::run()
 	
 }
 
+void Scheduler::runTask(ScheduleTask& task, Heartbeat& heartbeat)
+{
+	Metrics::Add(METRIC_TASKS_RUN);
+
+	// 开启延迟统计时，开始执行前记录排队（或事件就绪到恢复）的时间，执行完或让出后记录执行时间
+	uint64_t start_ns = 0;
+	if(Metrics::LatencyTracking())
+	{
+		start_ns = Metrics::NowNs();
+		if(task.readyNs)
+		{
+			Metrics::Record(task.ioEvent ? LATENCY_EVENT_RESUME : LATENCY_QUEUE_WAIT, start_ns - task.readyNs);
+		}
+	}
+	// 弹性模式和看门狗需要心跳：执行期间是任务开始的时间
+	bool beat = m_maxExtra > 0 || m_watchdogMs > 0;
+	auto begin = [&heartbeat, beat](const std::shared_ptr<Fiber>& fiber)
+	{
+		if(beat)
+		{
+			heartbeat.fiberId = fiber->getId();
+			heartbeat.busySince = HeartbeatNowMs();
+		}
+	};
+	auto end = [&heartbeat, beat, start_ns]()
+	{
+		if(beat)
+		{
+			heartbeat.busySince = 0;
+		}
+		if(start_ns)
+		{
+			Metrics::Record(LATENCY_TASK_RUN, Metrics::NowNs() - start_ns);
+		}
+	};
+
+	if(task.fiber) // 如果任务对象是协程
+	{   // 任务协程调用 resume 将执行权从调度协程切换到任务协程 
+		begin(task.fiber);
+		// 不用加锁：协程还没在别的线程上切出时 resume 会等它切出，已经结束时直接返回
+		task.fiber->resume();
+		end();
+		// resume 返回时此时任务要么执行完了，要么半路 yield 了，总之任务完成了，活跃线程-1
+		m_activeThreadCount--; // 线程完成任务后就不再处于活跃状态，而是进入空闲状态，因此将活跃线程数-1
+
+		// 执行完毕（包括因异常结束）的协程如果只被当前任务持有（例如由回调协程 yield 后再次被调度），也放回缓存复用
+		if(task.fiber->isFinished())
+		{
+			Fiber::ReturnToPool(std::move(task.fiber));
+		}
+		task.reset();
+	}
+	else if(task.cb) // 如果任务对象是函数，之前解释过函数也应该被调度，具体做法就是先封装成协程再执行
+	{   
+		// 优先复用本线程缓存的已终止协程，省掉协程栈的 malloc / free
+		std::shared_ptr<Fiber> cb_fiber = Fiber::GetPooled(std::move(task.cb));
+		begin(cb_fiber);
+		cb_fiber->resume();
+		end();
+		m_activeThreadCount--;
+		task.reset();	
+
+		// 回调执行完毕或抛出异常结束就把协程放回缓存；半路 yield 的协程还被事件或定时器持有，不能回收
+		if(cb_fiber->isFinished())
+		{
+			Fiber::ReturnToPool(std::move(cb_fiber));
+		}
+	}
+}
+
+bool Scheduler::hasRunnableTasks() const
+{
+	if(t_scheduler == this && t_worker_index >= 0 && m_workers[t_worker_index]->hasNext)
+	{
+		return true;
+	}
+	// 先读任务总数：入队时先放入队列再增加任务数，读到任务数不为0时，下面一定能看到对应的队列不为空
+	if(m_taskCount == 0)
+	{
+		return false;
+	}
+	if(t_scheduler != this || t_worker_index < 0)
+	{
+		return true;
+	}
+	if(!m_tasks.empty() || !m_workers[t_worker_index]->pinned.empty())
+	{
+		return true;
+	}
+	for(auto& worker : m_workers)
+	{
+		if(!worker->local.empty())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+int Scheduler::currentWorker() const
+{
+	return t_scheduler == this ? t_worker_index : -1;
+}
+
+int Scheduler::workerIndex(int thread_id) const
+{
+	for(size_t i = 0; i < m_workers.size(); i++)
+	{
+		if(m_workers[i]->threadId == thread_id)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+void Scheduler::registerWorker(int index, int thread_id)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	WorkerContext& worker = *m_workers[index];
+	worker.threadId = thread_id;
+	worker.running = true;
+
+	// 领走提前指定给本线程的任务，加锁保证与 enqueue 中的二次查找互斥，任务不会丢失
+	for(auto it = m_pendingPinned.begin(); it != m_pendingPinned.end(); )
+	{
+		if(it->thread == thread_id)
+		{
+			worker.pinned.push(std::move(*it));
+			it = m_pendingPinned.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+// 任务入队：
+// 1.未指定线程，且当前线程是本调度器的工作线程 -> 本线程的本地队列
+// 2.未指定线程，由其他线程提交 -> 全局注入队列
+// 3.指定了线程 -> 目标线程的指定任务队列，目标线程还没有进入 run() 时先暂存
+// 已经运行过的共享栈协程总是回到它的所在线程，覆盖任务指定的线程（例如分片 epoll 事件固定的 fd 所属线程）
+bool Scheduler::enqueue(ScheduleTask&& task, int& target)
+{
+	target = -1;
+	bool need_tickle = false;
+	if(Metrics::LatencyTracking() && !task.readyNs)
+	{
+		task.readyNs = Metrics::NowNs();
+	}
+	// 共享栈协程的栈保存的是所在线程共享栈的绝对地址，只能回到它第一次运行的线程上恢复，优先于任务指定的线程
+	if(task.fiber && task.fiber->getHomeThread() != -1)
+	{
+		task.thread = task.fiber->getHomeThread();
+	}
+	if(task.thread == -1)
+	{
+		if(t_scheduler == this && t_worker_index >= 0)
+		{
+			need_tickle = m_workers[t_worker_index]->local.push(std::move(task));
+		}
+		else
+		{
+			// 任务队列为空时，所有调度线程可能都在 idle() 休眠，当有新任务加入时，需要 tickle() 唤醒线程，让它们继续执行任务
+			need_tickle = m_tasks.push(std::move(task));
+		}
+	}
+	else
+	{
+		int index = workerIndex(task.thread);
+		if(index >= 0)
+		{
+			need_tickle = m_workers[index]->pinned.push(std::move(task));
+			target = index;
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			index = workerIndex(task.thread); // 加锁后再查一次，目标线程可能刚刚完成登记
+			if(index >= 0)
+			{
+				need_tickle = m_workers[index]->pinned.push(std::move(task));
+				target = index;
+			}
+			else
+			{
+				m_pendingPinned.push_back(std::move(task));
+			}
+		}
+	}
+	m_taskCount++;
+	return need_tickle;
+}
+
+void Scheduler::scheduleTasks(std::vector<ScheduleTask>& tasks)
+{
+	// 1.丢弃空任务，并和 enqueue 一样让共享栈协程回到它的所在线程；开启延迟统计时整批记录同一个入队时间
+	uint64_t ready_ns = Metrics::LatencyTracking() ? Metrics::NowNs() : 0;
+	size_t n = 0;
+	for(size_t i = 0; i < tasks.size(); i++)
+	{
+		ScheduleTask& task = tasks[i];
+		if(!task.fiber && !task.cb)
+		{
+			continue;
+		}
+		if(ready_ns && !task.readyNs)
+		{
+			task.readyNs = ready_ns;
+		}
+		if(task.fiber && task.fiber->getHomeThread() != -1)
+		{
+			task.thread = task.fiber->getHomeThread();
+		}
+		if(i != n)
+		{
+			tasks[n] = std::move(task);
+		}
+		n++;
+	}
+	if(n == 0)
+	{
+		tasks.clear();
+		return;
+	}
+
+	bool on_worker = t_scheduler == this && t_worker_index >= 0;
+	size_t begin = 0;
+
+	// 2.第一个可以在本线程执行的任务放进 runnext 槽位
+	if(m_runNext && on_worker && !m_workers[t_worker_index]->hasNext)
+	{
+		WorkerContext& worker = *m_workers[t_worker_index];
+		int self = worker.threadId;
+		for(size_t i = 0; i < n; i++)
+		{
+			if(tasks[i].thread == -1 || tasks[i].thread == self)
+			{
+				std::swap(tasks[0], tasks[i]);
+				worker.next = std::move(tasks[0]);
+				worker.hasNext = true;
+				m_nextCount++;
+				begin = 1;
+				break;
+			}
+		}
+	}
+
+	// 3.把任务按目标线程分组：未指定线程的排在前面，指定了线程的按线程ID聚在一起
+	size_t split = begin;
+	for(size_t i = begin; i < n; i++)
+	{
+		if(tasks[i].thread == -1)
+		{
+			std::swap(tasks[split++], tasks[i]);
+		}
+	}
+
+	// 4.未指定线程的任务一次性入队，规则同 enqueue
+	bool need_tickle = false;
+	if(split > begin)
+	{
+		size_t count = split - begin;
+		if(on_worker)
+		{
+			need_tickle = m_workers[t_worker_index]->local.pushBatch(&tasks[begin], count);
+		}
+		else
+		{
+			need_tickle = m_tasks.pushBatch(&tasks[begin], count);
+		}
+		m_taskCount += count;
+	}
+	// runnext 中的任务只有本线程能执行，没有其他任务时不需要唤醒别的线程
+	if(split > begin && (need_tickle || hasIdleThreads()))
+	{
+		tickle();
+	}
+
+	// 5.指定了线程的任务每个目标线程一组
+	for(size_t i = split; i < n; )
+	{
+		int thread = tasks[i].thread;
+		size_t end = i + 1;
+		for(size_t j = i + 1; j < n; j++)
+		{
+			if(tasks[j].thread == thread)
+			{
+				std::swap(tasks[end++], tasks[j]);
+			}
+		}
+		int index = workerIndex(thread);
+		if(index >= 0)
+		{
+			m_workers[index]->pinned.pushBatch(&tasks[i], end - i);
+			m_taskCount += end - i;
+			tickleWorker(index);
+		}
+		else
+		{
+			// 目标线程还没有进入 run()，交给 enqueue 暂存
+			for(size_t j = i; j < end; j++)
+			{
+				int target = -1;
+				enqueue(std::move(tasks[j]), target);
+				if(target >= 0)
+				{
+					tickleWorker(target);
+				}
+			}
+		}
+		i = end;
+	}
+	tasks.clear();
+}
+
+bool Scheduler::dequeue(ScheduleTask& task, bool& tickle_me)
+{
+	WorkerContext& worker = *m_workers[t_worker_index];
+
+	// runnext 槽位中的任务由本线程刚刚成批提交，优先执行
+	if(worker.hasNext)
+	{
+		task = std::move(worker.next);
+		worker.next.reset();
+		worker.hasNext = false;
+		m_activeThreadCount++;
+		m_nextCount--;
+		tickle_me = m_taskCount > 0;
+		return true;
+	}
+
+	// 每调度 61 次优先检查一次全局注入队列，其余时间优先执行本地任务，防止本地队列一直不空时全局队列中的任务被饿死
+	// 同时从本地队列的队头取一个：本地队列后进先出，一个不断重新调度自己再 yield 的协程每次都会被取回，队头的任务会被饿死
+	bool found = false;
+	if(++t_schedule_tick % 61 == 0)
+	{
+		found = m_tasks.pop(task) || worker.pinned.pop(task) || worker.local.steal(task);
+	}
+	found = found || worker.local.pop(task) || worker.pinned.pop(task) || m_tasks.pop(task);
+
+	// 本地队列和全局队列都没有任务，就从其他工作线程的本地队列队头窃取，同一 NUMA 节点上的线程优先
+	for(size_t i = 0; i < worker.stealOrder.size() && !found; i++)
+	{
+		found = m_workers[worker.stealOrder[i]]->local.steal(task);
+		if(found)
+		{
+			Metrics::Add(METRIC_STEALS);
+		}
+	}
+
+	if(found)
+	{
+		assert(task.fiber || task.cb);
+		// 先增加活跃线程数再减少任务数，保证 stopping() 不会在任务转移的间隙误判为可以退出
+		m_activeThreadCount++;
+		m_taskCount--;
+	}
+
+	// 仍有剩余任务（可能是指定给其他线程的任务），说明还需要唤醒其他线程处理
+	tickle_me = m_taskCount > 0;
+	return found;
+}
+
 void Scheduler::stop()
 {
 	if(debug) std::cout << "Schedule::stop() starts in thread: " << Thread::GetThreadId() << std::endl;
@@ -229,6 +671,28 @@ void Scheduler::stop()
 	{
 		i->join();
 	}
+
+	// 工作线程都退出后再停掉监控线程和临时线程：临时线程在 m_stopping 之后取不到任务就退出
+	if(m_monitor)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_elasticMutex);
+			m_monitorStop = true;
+			m_elasticCond.notify_all();
+		}
+		m_monitor->join();
+		m_monitor.reset();
+	}
+	std::vector<std::unique_ptr<ExtraWorker>> extras;
+	{
+		std::lock_guard<std::mutex> lock(m_elasticMutex);
+		extras.swap(m_extras);
+		m_elasticCond.notify_all();
+	}
+	for(auto& extra : extras)
+	{
+		extra->thread->join();
+	}
 	if(debug) std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
 }
 
@@ -236,6 +700,245 @@ void Scheduler::tickle()
 {
 }
 
+void Scheduler::setElastic(size_t max_extra, uint64_t block_ms, uint64_t retire_ms)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_stopping)
+	{
+		std::cerr << "Scheduler is stopped" << std::endl;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> elastic_lock(m_elasticMutex);
+		m_blockMs = block_ms > 0 ? block_ms : 1;
+		m_retireMs = retire_ms;
+		m_maxExtra = max_extra;
+	}
+	// 已经启动的调度器在这里补上监控线程，没有启动的由 start() 创建
+	startMonitor();
+}
+
+void Scheduler::setWatchdog(uint64_t threshold_ms, bool backtrace)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_stopping)
+	{
+		std::cerr << "Scheduler is stopped" << std::endl;
+		return;
+	}
+	if(backtrace)
+	{
+		InstallWatchdogHandler();
+	}
+	m_watchdogBacktrace = backtrace;
+	m_watchdogMs = threshold_ms;
+	{
+		// 唤醒已经在等待的监控线程，按新的阈值计算检查间隔
+		std::lock_guard<std::mutex> elastic_lock(m_elasticMutex);
+		m_elasticCond.notify_all();
+	}
+	startMonitor();
+}
+
+void Scheduler::startMonitor()
+{
+	if(m_started && !m_monitor && (m_maxExtra > 0 || m_watchdogMs > 0))
+	{
+		m_monitor.reset(new Thread(std::bind(&Scheduler::monitor, this), m_name + "_monitor"));
+	}
+}
+
+void Scheduler::checkWatchdog(Heartbeat& heartbeat, int tid, uint64_t now)
+{
+	// now 在读心跳之前取得，任务可能在这之后才开始
+	uint64_t since = heartbeat.busySince;
+	if(since == 0 || since > now || since == heartbeat.reported || now - since < m_watchdogMs)
+	{
+		return;
+	}
+	heartbeat.reported = since;
+	std::cerr << "Scheduler " << m_name << " watchdog: fiber " << heartbeat.fiberId << " on thread " << tid
+		<< " has run for " << now - since << " ms without yielding" << std::endl;
+	// 信号到达时任务可能已经让出，输出的是那时线程上的调用栈
+	if(m_watchdogBacktrace && tid > 0)
+	{
+		syscall(SYS_tgkill, getpid(), tid, SIGURG);
+	}
+}
+
+void Scheduler::monitor()
+{
+	// 检查间隔取阈值的四分之一，卡住的线程最晚在 1.25 倍阈值之后得到补充或被报告
+	size_t serial = 0;
+	std::unique_lock<std::mutex> lock(m_elasticMutex);
+	while(!m_monitorStop)
+	{
+		uint64_t interval = 100; // 两者都已关闭时监控线程只负责回收临时线程
+		uint64_t watchdog_ms = m_watchdogMs;
+		if(m_maxExtra > 0)
+		{
+			interval = m_blockMs / 4;
+		}
+		if(watchdog_ms > 0)
+		{
+			interval = m_maxExtra > 0 ? std::min(interval, watchdog_ms / 4) : watchdog_ms / 4;
+		}
+		m_elasticCond.wait_for(lock, std::chrono::milliseconds(std::max<uint64_t>(interval, 1)));
+		if(m_monitorStop)
+		{
+			break;
+		}
+
+		if(m_watchdogMs > 0)
+		{
+			uint64_t now = HeartbeatNowMs();
+			for(auto& worker : m_workers)
+			{
+				if(worker->running)
+				{
+					checkWatchdog(worker->heartbeat, worker->threadId, now);
+				}
+			}
+			for(auto& extra : m_extras)
+			{
+				checkWatchdog(extra->heartbeat, extra->thread->getId(), now);
+			}
+		}
+
+		// 回收已经退出的临时线程
+		for(auto it = m_extras.begin(); it != m_extras.end(); )
+		{
+			if((*it)->done)
+			{
+				(*it)->thread->join();
+				it = m_extras.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+
+		// 没有排队的任务，或者还有临时线程在等待任务，都不需要增加线程
+		if(m_taskCount == 0 || m_extraIdle > 0 || m_extras.size() >= m_maxExtra)
+		{
+			continue;
+		}
+
+		// 心跳不为0且超过阈值的线程视为卡住；还有没卡住的线程时它会处理排队的任务
+		uint64_t now = HeartbeatNowMs();
+		size_t running = 0, blocked = 0;
+		auto check = [&](const std::atomic<uint64_t>& busy_since)
+		{
+			uint64_t since = busy_since;
+			running++;
+			if(since != 0 && now - since >= m_blockMs)
+			{
+				blocked++;
+			}
+		};
+		for(auto& worker : m_workers)
+		{
+			if(worker->running)
+			{
+				check(worker->heartbeat.busySince);
+			}
+		}
+		for(auto& extra : m_extras)
+		{
+			check(extra->heartbeat.busySince);
+		}
+		if(running == 0 || blocked < running)
+		{
+			continue;
+		}
+
+		ExtraWorker* extra = new ExtraWorker();
+		m_extras.emplace_back(extra);
+		m_extraCount++;
+		extra->thread.reset(new Thread(std::bind(&Scheduler::runExtra, this, extra), m_name + "_extra_" + std::to_string(serial++)));
+		if(debug) std::cout << "Scheduler::monitor() adds an extra worker, total " << m_extras.size() << std::endl;
+	}
+}
+
+void Scheduler::runExtra(ExtraWorker* extra)
+{
+	SetThis();
+	Fiber::GetThis();
+
+	// 临时线程不占用工作线程序号（t_worker_index 为 -1），它提交的任务进入全局注入队列，退出时没有需要转交的本地任务
+	// 调度器停止时，最后一个任务可能在临时线程上结束：工作线程正阻塞在 idle() 中，没人唤醒就要等到超时才发现可以退出
+	auto wake_workers = [this]()
+	{
+		for(size_t i = 0; i < m_workers.size(); i++)
+		{
+			tickleWorker(i);
+		}
+	};
+	ScheduleTask task;
+	uint64_t last_busy = HeartbeatNowMs();
+	while(true)
+	{
+		if(dequeueExtra(task))
+		{
+			runTask(task, extra->heartbeat);
+			last_busy = HeartbeatNowMs();
+			if(m_stopping)
+			{
+				wake_workers();
+			}
+			continue;
+		}
+		if(m_stopping || HeartbeatNowMs() - last_busy >= m_retireMs)
+		{
+			break;
+		}
+
+		// 临时线程不参与 tickle，等待 1 毫秒后再检查一次队列；这里不能用 usleep，任务可能在本线程上开启了 hook
+		std::unique_lock<std::mutex> lock(m_elasticMutex);
+		m_extraIdle++;
+		m_elasticCond.wait_for(lock, std::chrono::milliseconds(1));
+		m_extraIdle--;
+	}
+	m_extraCount--;
+	extra->done = true;
+	if(m_stopping)
+	{
+		wake_workers();
+	}
+}
+
+bool Scheduler::dequeueExtra(ScheduleTask& task)
+{
+	bool found = m_tasks.pop(task);
+	for(size_t i = 0; i < m_workers.size() && !found; i++)
+	{
+		found = m_workers[i]->local.steal(task);
+		if(found)
+		{
+			Metrics::Add(METRIC_STEALS);
+		}
+	}
+	if(!found)
+	{
+		return false;
+	}
+
+	// 共享栈协程第一次运行的线程就是它以后唯一能恢复的线程，不能落在会退出的临时线程上，放回全局队列留给工作线程
+	if(task.fiber && task.fiber->isSharedStack() && task.fiber->getHomeThread() == -1)
+	{
+		if(m_tasks.push(std::move(task)))
+		{
+			tickle(); // 取出和放回之间工作线程可能看到队列为空而休眠
+		}
+		task.reset();
+		return false;
+	}
+	m_activeThreadCount++;
+	m_taskCount--;
+	return true;
+}
+
 void Scheduler::idle()
 {
 	while(!stopping())
@@ -249,13 +952,8 @@ void Scheduler::idle()
 // 判断调度器是否退出，在 stop 函数中如果 stopping 函数返回为 true，代表调度器已经退出，则直接返回 return，不做任何操作
 bool Scheduler::stopping() 
 {
-	/**
-	 * 使用互斥锁的目的是 m_tasks 和 m_activeThreadCount 会被多线程竞争，所以需要互斥锁来保护资源的互斥访问
-	   std::lock_guard<std::mutex> 是 C++11 标准库提供的互斥锁 RAII 封装工具，用于实现互斥访问 
-	   作用域开始时，自动 lock()，作用域结束时（函数返回、异常退出等），自动 unlock()
-	 */
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+	// 任务数量分散在全局注入队列和各个本地队列中，这里通过原子计数器判断，不再需要加锁
+    return m_stopping && m_taskCount == 0 && m_nextCount == 0 && m_activeThreadCount == 0 && m_externalWaits == 0;
 }
 
 }
\ No newline at end of file
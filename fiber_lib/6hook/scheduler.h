@@ -4,9 +4,11 @@
 //#include "hook.h"
 #include "fiber.h"
 #include "thread.h"
+#include "task_queue.h"
 
 #include <mutex>
 #include <vector>
+#include <condition_variable>
 
 namespace sylar {
 
@@ -14,11 +16,18 @@ class Scheduler
 {
 public:
 	// threads 指定线程池的线程数量，use_caller 指定是否将主线程作为工作线程，name 指定调度器的名称
-	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler");
+	// cpus 不为空时，序号为 i 的工作线程（包括参与调度的主线程，序号为0）在进入 run() 时绑定到 cpus[i % cpus.size()] 上，
+	// 窃取任务时优先窃取同一个 NUMA 节点上的线程；主线程在 run() 返回时恢复原来的亲和性
+	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler", const std::vector<int>& cpus = std::vector<int>());
 	virtual ~Scheduler(); // 虚析构：防止出现资源泄露，基类指针删除派生类对象时不完全销毁的情况
 	
 	const std::string& getName() const {return m_name;} // 获取调度器的名称
 
+	// 所有工作线程的线程ID（主线程参与调度时排在第一个），调用 start() 之后才完整，可以用作 scheduleLock 的 thread 参数
+	const std::vector<int>& getThreadIds() const {return m_threadIds;}
+	// 参与调度的主线程ID，use_caller 为 false 时为 -1；主线程要到 stop() 中才开始执行任务
+	int getRootThreadId() const {return m_rootThread;}
+
 public:	
 	// 获取正在运行的调度器
 	static Scheduler* GetThis();
@@ -31,33 +40,75 @@ public:
     template <class FiberOrCb> // Fiberorcb是调度任务类型，可以是协程对象或函数指针
 	
 	// 添加任务到任务队列
+	// 工作线程提交的普通任务进入本线程的本地队列，其他线程提交的任务或指定了线程的任务进入全局注入队列
     void scheduleLock(FiberOrCb fc, int thread = -1) 
     {
-    	bool need_tickle; // 标记任务队列是否为空，从而判断是否需要唤醒线程
+        // 创建 Task 的任务对象，按值传入的回调直接移进任务，不再复制一次
+        ScheduleTask task(std::move(fc), thread);
+        if (!task.fiber && !task.cb) // task 不存在协程对象或函数指针就直接丢弃
+        {
+            return;
+        }
 
-		// 用大括号的作用是缩短锁的作用域
+    	// 标记目标队列原本是否为空，从而判断是否需要唤醒线程
+    	int target = -1;
+    	bool need_tickle = enqueue(std::move(task), target);
+    	
+    	// 指定了线程的任务只需要唤醒目标线程
+    	// 否则如果任务队列原本为空，或者还有线程在休眠，就需要唤醒线程
+    	// 后者让每个新任务都有机会唤醒一个休眠线程，唤醒多少个线程由 tickle() 自己控制，不会超过休眠的线程数
+    	if(target >= 0)
     	{
-			// lock_guard 是 C++11 标准库提供的互斥锁 RAII 封装工具之一，用于实现互斥访问
-			// 在构造时会自动加锁，当 lock 变量离开作用域后，它的析构函数会自动释放锁
-    		std::lock_guard<std::mutex> lock(m_mutex);
-
-    		// 任务队列为空时，所有调度线程可能都在 idle() 休眠，当有新任务加入时，需要 tickle() 唤醒线程，让它们继续执行任务
-    		need_tickle = m_tasks.empty();
-
-	        // 创建 Task 的任务对象
-	        ScheduleTask task(fc, thread);
-	        if (task.fiber || task.cb) // task 存在协程对象或函数指针就加入  
-	        {
-	            m_tasks.push_back(task);
-	        }
+    		tickleWorker(target);
     	}
-    	
-    	if(need_tickle) // 如果任务队列原本为空，但新任务来了，需要唤醒线程
+    	else if(need_tickle || hasIdleThreads())
     	{
     		tickle();
     	}
     }
 	
+	// 成批添加任务：fcs 指向 n 个协程或回调，调用后其中的元素被移走
+	// 整批任务每个目标队列只加一次锁，最多唤醒一次线程，适合一次产生大量就绪任务的场景（如一次 epoll_wait 返回的所有事件）
+	template <class FiberOrCb>
+	void scheduleBatch(FiberOrCb* fcs, size_t n, int thread = -1)
+	{
+		std::vector<ScheduleTask> tasks;
+		tasks.reserve(n);
+		for(size_t i = 0; i < n; i++)
+		{
+			tasks.emplace_back(std::move(fcs[i]), thread);
+		}
+		scheduleTasks(tasks);
+	}
+
+	// 开启后，工作线程成批提交任务时把第一个可以在本线程执行的任务放进本线程的 runnext 槽位，
+	// 当前协程让出后调度协程直接执行它，不经过任务队列，也不会被其他线程窃取；默认关闭，需要在 start() 之前设置
+	void setRunNext(bool enable) {m_runNext = enable;}
+	bool isRunNext() const {return m_runNext;}
+
+	// 弹性线程池：任务中偶尔有不经过 hook 的阻塞调用（磁盘 IO、第三方库）时，所有工作线程可能同时卡住而任务队列越积越长
+	// 开启后由一个监控线程检查每个工作线程的心跳（当前任务的开始时间），所有正在运行的工作线程都卡在同一个任务上超过 block_ms 毫秒、
+	// 且还有排队的任务时，临时增加一个工作线程，最多 max_extra 个；临时线程连续空闲 retire_ms 毫秒后退出
+	// 临时线程只执行全局注入队列和可以窃取的任务，不等待 epoll 和定时器，也不执行还没运行过的共享栈协程；max_extra 为0时不再增加线程，可以在 start() 之后设置
+	void setElastic(size_t max_extra, uint64_t block_ms = 50, uint64_t retire_ms = 1000);
+	// 当前存在的临时工作线程数
+	size_t getExtraThreadCount() const {return m_extraCount;}
+
+	// 看门狗：监控线程发现一个任务执行超过 threshold_ms 毫秒还没有完成或让出时，向 std::cerr 输出协程ID、线程ID和已执行的时间，每次执行只报告一次
+	// backtrace 为 true 时再向该线程发送 SIGURG，由信号处理函数在 std::cerr 上输出它当时的调用栈（链接时加 -rdynamic 才有函数名），
+	// 此时 SIGURG 由调度器占用，被信号打断的阻塞调用（nanosleep、read 等）可能提前返回 EINTR；threshold_ms 为0时关闭，可以在 start() 之后设置
+	void setWatchdog(uint64_t threshold_ms, bool backtrace = false);
+
+	// 运行时指标：排队的任务数（包括 runnext 槽位）、正在执行任务的线程数、在 idle 中等待的线程数
+	size_t getTaskCount() const {return m_taskCount + m_nextCount;}
+	size_t getActiveThreadCount() const {return m_activeThreadCount;}
+	size_t getIdleThreadCount() const {return m_idleThreadCount;}
+
+	// 协程挂起等待调度器之外的线程唤醒（例如阻塞调用线程池）时计数，计数不为0时 stop() 不会结束
+	// endExternalWait 要在把协程放回调度器之后调用，此后不能再访问调度器
+	void beginExternalWait() {m_externalWaits++;}
+	void endExternalWait() {m_externalWaits--;}
+	
 	// 启动线程池，启动调度器
 	virtual void start();
 	// 关闭线程池，停止调度器，等所有调度任务都执行完后再返回
@@ -66,6 +117,9 @@ public:
 protected:
 	// 唤醒线程
 	virtual void tickle();
+
+	// 唤醒指定序号的工作线程，用于指定了线程的任务，默认与 tickle() 相同
+	virtual void tickleWorker(int /*index*/) {tickle();}
 	
 	// 线程函数
 	virtual void run();
@@ -79,13 +133,30 @@ protected:
 	// 返回是否有空闲线程，当调度协程进入 idle 时空闲线程数+1，从 idle 协程返回时空闲线程数-1
 	bool hasIdleThreads() {return m_idleThreadCount>0;}
 
-private:
+	// 当前线程是否有可以执行的任务：全局注入队列、指定给本线程的任务、任意一个可以窃取的本地队列
+	// 指定给其他线程的任务不算，休眠前用它做最后一次检查，避免在任务入队和进入休眠的间隙漏掉唤醒
+	bool hasRunnableTasks() const;
+
+	// 当前线程在本调度器中的工作线程序号，不是本调度器的工作线程时返回 -1
+	int currentWorker() const;
+	// 工作线程的数量
+	size_t workerCount() const {return m_workers.size();}
+	// 序号为 index 的工作线程的线程ID，还没进入 run() 时返回 -1
+	int workerThreadId(int index) const {return m_workers[index]->threadId;}
+	// 序号为 index 的工作线程绑定的 CPU 和所在的 NUMA 节点，没有绑定时分别为 -1 和 0
+	int workerCpu(int index) const {return m_workers[index]->cpu;}
+	int workerNode(int index) const {return m_workers[index]->node;}
+
+protected:
 	// 任务结构体
+	// 回调使用 InlineFunction，捕获不超过 48 字节的回调在入队、出队和交给协程的过程中都不分配内存
 	struct ScheduleTask
 	{
 		std::shared_ptr<Fiber> fiber;
-		std::function<void()> cb;
+		InlineFunction cb;
 		int thread; // 指定该任务被运行在哪个线程ID
+		uint64_t readyNs = 0; // 开启延迟统计时任务可以执行的时间（入队或 IO 事件就绪，纳秒），0 表示没有记录
+		bool ioEvent = false; // 是否由 IO 事件唤醒，决定 readyNs 记入哪个直方图
 
 		ScheduleTask()
 		{
@@ -96,7 +167,7 @@ private:
 
 		ScheduleTask(std::shared_ptr<Fiber> f, int thr)
 		{
-			fiber = f;
+			fiber = std::move(f);
 			thread = thr;
 		}
 
@@ -106,41 +177,125 @@ private:
 			thread = thr;
 		}	
 
-		ScheduleTask(std::function<void()> f, int thr)
+		ScheduleTask(InlineFunction f, int thr)
 		{
-			cb = f;
+			cb = std::move(f);
 			thread = thr;
 		}		
 
-		ScheduleTask(std::function<void()>* f, int thr)
+		ScheduleTask(InlineFunction* f, int thr)
 		{
 			cb.swap(*f); // 同理
 			thread = thr;
 		}
 
+		ScheduleTask(std::function<void()>* f, int thr)
+		{
+			cb = std::move(*f); // std::function 整个放进内部缓冲区，不分配内存
+			*f = nullptr;
+			thread = thr;
+		}
+
 		void reset() // 重置
 		{
 			fiber = nullptr;
 			cb = nullptr;
 			thread = -1;
+			readyNs = 0;
+			ioEvent = false;
 		}	
 	};
 
+	// 成批入队，tasks 中的元素被移走，调用后 tasks 被清空
+	// 未指定线程的任务一次性放进一个队列，指定了线程的任务按目标线程分组，每组加一次锁、唤醒一次目标线程
+	void scheduleTasks(std::vector<ScheduleTask>& tasks);
+
+private:
+	// 正在执行的任务的心跳，由执行任务的线程写，监控线程读；只在开启弹性模式或看门狗时更新
+	struct Heartbeat
+	{
+		std::atomic<uint64_t> busySince = {0}; // 当前任务开始执行的时间（毫秒），没有执行任务时为0
+		std::atomic<uint64_t> fiberId = {0}; // 执行当前任务的协程ID
+		uint64_t reported = 0; // 看门狗已经报告过的 busySince，只由监控线程读写
+	};
+
+	// 每个工作线程的调度上下文
+	struct WorkerContext
+	{
+		ScheduleTask next; // runnext 槽位：只由本线程读写，下一次调度优先执行
+		bool hasNext = false;
+		WorkStealQueue<ScheduleTask> local; // 本地队列：本线程提交的普通任务，可被其他线程窃取
+		LockedQueue<ScheduleTask> pinned; // 指定由本线程执行的任务，不允许被窃取
+		std::atomic<int> threadId = {-1}; // 工作线程的线程ID，进入 run() 之前为 -1
+		std::atomic<bool> running = {false}; // 是否正在 run() 中调度任务
+		Heartbeat heartbeat;
+		int cpu = -1; // 绑定的 CPU，-1 表示不绑定
+		int node = 0; // 所在的 NUMA 节点
+		std::vector<int> stealOrder; // 窃取任务时依次尝试的工作线程序号：同一节点的在前，按序号环形排列
+	};
+
+	// 任务入队，返回目标队列入队前是否为空；指定了线程的任务通过 target 返回目标工作线程的序号，否则为 -1
+	bool enqueue(ScheduleTask&& task, int& target);
+
+	// 为当前工作线程取出一个任务：本地队列 -> 本线程的指定任务 -> 全局注入队列 -> 窃取其他线程的本地队列
+	// tickle_me 表示是否还有剩余任务需要唤醒其他线程处理
+	bool dequeue(ScheduleTask& task, bool& tickle_me);
+
+	// 根据线程ID查找工作线程序号，找不到返回 -1
+	int workerIndex(int thread_id) const;
+
+	// 工作线程进入 run() 时登记自己的线程ID，并领取提前提交给它的指定任务
+	void registerWorker(int index, int thread_id);
+
+	// 在当前线程上执行一个已经出队的任务，执行完（或协程让出）后活跃线程数-1；执行期间更新 heartbeat，开启延迟统计时记录排队和执行时间
+	void runTask(ScheduleTask& task, Heartbeat& heartbeat);
+
+	// 弹性模式的临时工作线程
+	struct ExtraWorker
+	{
+		std::shared_ptr<Thread> thread;
+		Heartbeat heartbeat;
+		std::atomic<bool> done = {false}; // 线程函数已经退出，可以 join
+	};
+
+	// 调度器已经启动、开启了弹性模式或看门狗且还没有监控线程时创建它，调用时持有 m_mutex
+	void startMonitor();
+	// 监控线程：周期性检查心跳，报告执行过久的任务，所有工作线程都卡住时增加临时线程，并回收已经退出的临时线程
+	void monitor();
+	// 看门狗检查一个心跳，超过阈值时报告，tid 是执行任务的线程ID
+	void checkWatchdog(Heartbeat& heartbeat, int tid, uint64_t now);
+	// 临时线程的线程函数
+	void runExtra(ExtraWorker* extra);
+	// 临时线程取任务：全局注入队列 -> 窃取工作线程的本地队列
+	bool dequeueExtra(ScheduleTask& task);
+
 private:
 	// 调度器的名称
 	std::string m_name;
-	// 互斥锁，保护任务队列
+	// 互斥锁，保护线程池和尚未登记的指定任务
 	std::mutex m_mutex;
 	// 线程池，存储初始化好的线程
 	std::vector<std::shared_ptr<Thread>> m_threads;
-	// 任务队列
-	std::vector<ScheduleTask> m_tasks;
+	// 全局注入队列：非工作线程提交的未指定线程的任务
+	LockedQueue<ScheduleTask> m_tasks;
+	// 指定给尚未进入 run() 的线程的任务，由 m_mutex 保护，工作线程登记时领走
+	std::vector<ScheduleTask> m_pendingPinned;
+	// 每个工作线程的调度上下文，下标为工作线程的序号（主线程参与调度时序号为0）
+	std::vector<std::unique_ptr<WorkerContext>> m_workers;
+	// 下一个进入 run() 的工作线程的序号
+	std::atomic<int> m_nextWorker = {0};
+	// 所有队列中的任务总数，用于无锁地判断是否还有任务
+	std::atomic<size_t> m_taskCount = {0};
+	// 所有 runnext 槽位中的任务数，单独计数：这些任务只有所在线程能执行，不能让其他线程误以为还有任务可取而互相唤醒
+	std::atomic<size_t> m_nextCount = {0};
 	// 存储工作线程的线程ID
 	std::vector<int> m_threadIds;
 	// 需要额外创建的线程数
 	size_t m_threadCount = 0;
 	// 活跃线程数
 	std::atomic<size_t> m_activeThreadCount = {0};
+	// 等待外部线程唤醒的协程数
+	std::atomic<size_t> m_externalWaits = {0};
 	// 空闲线程数
 	std::atomic<size_t> m_idleThreadCount = {0};
 
@@ -150,8 +305,30 @@ private:
 	std::shared_ptr<Fiber> m_schedulerFiber;
 	// 如果是，记录主线程的线程ID
 	int m_rootThread = -1;
-	// 是否正在关闭
-	bool m_stopping = false;	
+	// 是否正在关闭，工作线程在 stopping() 中读取
+	std::atomic<bool> m_stopping = {false};
+	// 是否已经调用过 start()
+	bool m_started = false;
+	// 成批提交时是否把第一个任务放进 runnext 槽位
+	bool m_runNext = false;
+
+	// 弹性模式：临时线程数上限（0 表示关闭）、判定卡住的阈值和临时线程的空闲退出时间（毫秒）
+	std::atomic<size_t> m_maxExtra = {0};
+	uint64_t m_blockMs = 50;
+	uint64_t m_retireMs = 1000;
+	// 保护临时线程列表，监控线程和空闲的临时线程在 m_elasticCond 上等待
+	std::mutex m_elasticMutex;
+	std::condition_variable m_elasticCond;
+	std::vector<std::unique_ptr<ExtraWorker>> m_extras;
+	std::shared_ptr<Thread> m_monitor; // 第一次开启弹性模式或看门狗且调度器已经启动时创建
+	bool m_monitorStop = false; // 所有工作线程退出后由 stop() 设置，stop() 中处理剩余任务期间监控线程仍然工作
+	// 存在的临时线程数和其中正在等待任务的数目
+	std::atomic<size_t> m_extraCount = {0};
+	std::atomic<size_t> m_extraIdle = {0};
+
+	// 看门狗的阈值（毫秒，0 表示关闭）和是否输出调用栈
+	std::atomic<uint64_t> m_watchdogMs = {0};
+	std::atomic<bool> m_watchdogBacktrace = {false};
 };
 
 }
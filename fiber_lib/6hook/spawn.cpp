@@ -0,0 +1,123 @@
+#include "spawn.h"
+
+#include <algorithm>
+
+namespace sylar {
+
+// wait_any 的等待者：第一个结束的子任务把它唤醒，之后的通知都忽略
+// 放在堆上由各个子任务的监听列表共同持有，共享栈协程挂起时也可以安全访问
+struct AnyWaiter
+{
+	std::mutex mutex;
+	bool fired = false;
+	FiberWaiter waiter; // 还没挂起时 scheduler 为空，只记下 fired
+
+	void notify()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(fired)
+		{
+			return;
+		}
+		fired = true;
+		if(waiter.scheduler)
+		{
+			waiter.wake();
+		}
+	}
+};
+
+void JoinState::wait()
+{
+	if(isDone())
+	{
+		return;
+	}
+	std::unique_lock<std::mutex> lock(m_waitMutex);
+	if(m_done.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	m_waiters.park(lock);
+}
+
+void JoinState::finish()
+{
+	std::lock_guard<std::mutex> lock(m_waitMutex);
+	m_done.store(true, std::memory_order_release);
+	m_waiters.wakeAll();
+	// 在锁内通知，removeListener 返回之后不会再有通知
+	for(auto& listener : m_listeners)
+	{
+		listener->notify();
+	}
+	m_listeners.clear();
+}
+
+bool JoinState::addListener(const std::shared_ptr<AnyWaiter>& waiter)
+{
+	std::lock_guard<std::mutex> lock(m_waitMutex);
+	if(m_done.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+	m_listeners.push_back(waiter);
+	return true;
+}
+
+void JoinState::removeListener(const std::shared_ptr<AnyWaiter>& waiter)
+{
+	std::lock_guard<std::mutex> lock(m_waitMutex);
+	auto it = std::find(m_listeners.begin(), m_listeners.end(), waiter);
+	if(it != m_listeners.end())
+	{
+		m_listeners.erase(it);
+	}
+}
+
+size_t wait_any_states(JoinState* const* states, size_t n)
+{
+	for(size_t i = 0; i < n; i++)
+	{
+		if(states[i]->isDone())
+		{
+			return i;
+		}
+	}
+
+	// 在所有子任务上注册同一个等待者，注册过程中就有子任务结束时不再挂起
+	auto any = std::make_shared<AnyWaiter>();
+	size_t registered = 0;
+	while(registered < n && states[registered]->addListener(any))
+	{
+		registered++;
+	}
+	if(registered == n)
+	{
+		std::unique_lock<std::mutex> lock(any->mutex);
+		if(!any->fired)
+		{
+			any->waiter = FiberWaiter::Current();
+			Fiber* self = any->waiter.fiber.get();
+			lock.unlock();
+			self->yield();
+		}
+	}
+
+	// 从还没结束的子任务上摘下等待者，避免长时间运行的子任务上堆积监听者
+	for(size_t i = 0; i < registered; i++)
+	{
+		states[i]->removeListener(any);
+	}
+	for(size_t i = 0; i < n; i++)
+	{
+		if(states[i]->isDone())
+		{
+			return i;
+		}
+	}
+	assert(false && "wait_any woke up without a finished task");
+	return n;
+}
+
+}
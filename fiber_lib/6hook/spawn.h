@@ -0,0 +1,176 @@
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include <cassert>
+
+#include "scheduler.h"
+#include "fiber_sync.h"
+
+namespace sylar {
+
+// 结构化并发：spawn 把一个可调用对象作为子任务交给调度器，返回一个可以等待的句柄
+// 父协程 join() 时挂起，直到子任务执行完，拿到它的返回值或者重新抛出它抛出的异常；等待期间工作线程继续执行其他协程
+//     auto a = sylar::spawn([]{ return query("a"); });
+//     auto b = sylar::spawn([]{ return query("b"); });
+//     sylar::wait_all(a, b);
+//     use(a.join(), b.join());
+// 和 fiber_sync.h 的原语一样，等待只能在调度器调度的协程中进行
+
+struct AnyWaiter;
+
+// 子任务的完成状态，与结果类型无关的部分
+class JoinState
+{
+public:
+	JoinState() = default;
+	JoinState(const JoinState&) = delete;
+	JoinState& operator=(const JoinState&) = delete;
+
+	bool isDone() const {return m_done.load(std::memory_order_acquire);}
+
+	// 挂起当前协程直到子任务结束，已经结束时直接返回
+	void wait();
+
+	// 子任务结束：唤醒所有等待者和 wait_any 的监听者，只能调用一次
+	void finish();
+
+	// wait_any 使用：子任务结束时通知 waiter；已经结束时不注册并返回 false
+	bool addListener(const std::shared_ptr<AnyWaiter>& waiter);
+	void removeListener(const std::shared_ptr<AnyWaiter>& waiter);
+
+public:
+	std::exception_ptr exception; // 子任务抛出的异常，finish 之前写入
+
+private:
+	std::atomic<bool> m_done{false};
+	std::mutex m_waitMutex;
+	WaitQueue m_waiters;
+	std::vector<std::shared_ptr<AnyWaiter>> m_listeners;
+};
+
+template<class T>
+struct JoinResult : public JoinState
+{
+	std::optional<T> value;
+};
+
+template<>
+struct JoinResult<void> : public JoinState
+{
+};
+
+// 子任务的句柄，可以复制，所有副本共享同一个完成状态
+template<class T>
+class JoinHandle
+{
+public:
+	JoinHandle() = default;
+	explicit JoinHandle(std::shared_ptr<JoinResult<T>> state): m_state(std::move(state)) {}
+
+	bool valid() const {return (bool)m_state;}
+	bool done() const {return m_state->isDone();}
+
+	// 等待子任务结束，不取结果也不抛出异常
+	void wait() const {m_state->wait();}
+
+	// 等待子任务结束并返回结果，子任务抛出了异常时在这里重新抛出；结果被移走，只能 join 一次
+	T join()
+	{
+		m_state->wait();
+		if(m_state->exception)
+		{
+			std::rethrow_exception(m_state->exception);
+		}
+		if constexpr(!std::is_void_v<T>)
+		{
+			return std::move(*m_state->value);
+		}
+	}
+
+	JoinState* state() const {return m_state.get();}
+
+private:
+	std::shared_ptr<JoinResult<T>> m_state;
+};
+
+// 把 f 作为新任务交给 scheduler（默认为当前调度器），thread 为 -1 时可以在任意工作线程上执行
+template<class F>
+JoinHandle<std::invoke_result_t<std::decay_t<F>&>> spawn(F&& f, Scheduler* scheduler = nullptr, int thread = -1)
+{
+	using R = std::invoke_result_t<std::decay_t<F>&>;
+	if(!scheduler)
+	{
+		scheduler = Scheduler::GetThis();
+	}
+	assert(scheduler && "spawn needs a scheduler");
+	auto state = std::make_shared<JoinResult<R>>();
+	scheduler->scheduleLock([state, fn = std::decay_t<F>(std::forward<F>(f))]() mutable
+	{
+		try
+		{
+			if constexpr(std::is_void_v<R>)
+			{
+				fn();
+			}
+			else
+			{
+				state->value.emplace(fn());
+			}
+		}
+		catch(...)
+		{
+			state->exception = std::current_exception();
+		}
+		state->finish();
+	}, thread);
+	return JoinHandle<R>(std::move(state));
+}
+
+// 挂起当前协程直到 states 中任意一个子任务结束，返回它的下标（同时有多个结束时返回下标最小的）
+size_t wait_any_states(JoinState* const* states, size_t n);
+
+// 等待所有子任务结束，不取结果也不抛出异常
+template<class T>
+void wait_all(const std::vector<JoinHandle<T>>& handles)
+{
+	for(auto& handle : handles)
+	{
+		handle.wait();
+	}
+}
+
+template<class... Handles>
+void wait_all(const Handles&... handles)
+{
+	(handles.wait(), ...);
+}
+
+template<class T>
+size_t wait_any(const std::vector<JoinHandle<T>>& handles)
+{
+	std::vector<JoinState*> states;
+	states.reserve(handles.size());
+	for(auto& handle : handles)
+	{
+		states.push_back(handle.state());
+	}
+	return wait_any_states(states.data(), states.size());
+}
+
+template<class... Handles>
+size_t wait_any(const Handles&... handles)
+{
+	JoinState* states[] = {handles.state()...};
+	return wait_any_states(states, sizeof...(Handles));
+}
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include "stack_allocator.h"
+#include "numa.h"
+
+#include <atomic>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace sylar {
+
+static MallocStackAllocator s_malloc_allocator;
+static std::atomic<StackAllocator*> s_default_allocator{&s_malloc_allocator};
+
+StackAllocator* StackAllocator::GetDefault()
+{
+	return s_default_allocator;
+}
+
+void StackAllocator::SetDefault(StackAllocator* allocator)
+{
+	s_default_allocator = allocator ? allocator : &s_malloc_allocator;
+}
+
+void* MallocStackAllocator::alloc(size_t size)
+{
+	return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void* stack, size_t /*size*/)
+{
+	free(stack);
+}
+
+MmapStackAllocator::MmapStackAllocator(bool decommit):
+m_pageSize(sysconf(_SC_PAGESIZE)), m_decommit(decommit)
+{
+}
+
+size_t MmapStackAllocator::roundUp(size_t size) const
+{
+	return (size + m_pageSize - 1) / m_pageSize * m_pageSize;
+}
+
+void* MmapStackAllocator::alloc(size_t size)
+{
+	// 多映射一页作为保护页，放在栈底（栈从高地址向低地址增长）
+	size_t total = roundUp(size) + m_pageSize;
+	void* base = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if(base == MAP_FAILED)
+	{
+		std::cerr << "MmapStackAllocator::alloc mmap failed: " << strerror(errno) << std::endl;
+		return nullptr;
+	}
+
+	// 物理页在第一次访问时才分配，先让它们优先来自当前线程绑定的 NUMA 节点（线程没有绑定 CPU 时什么都不做）
+	Numa::BindMemory(base, total, Numa::ThreadNode());
+
+	if(mprotect(base, m_pageSize, PROT_NONE))
+	{
+		std::cerr << "MmapStackAllocator::alloc mprotect failed: " << strerror(errno) << std::endl;
+		munmap(base, total);
+		return nullptr;
+	}
+	return (char*)base + m_pageSize;
+}
+
+void MmapStackAllocator::dealloc(void* stack, size_t size)
+{
+	munmap((char*)stack - m_pageSize, roundUp(size) + m_pageSize);
+}
+
+void MmapStackAllocator::release(void* stack, size_t size)
+{
+	if(!m_decommit)
+	{
+		return;
+	}
+
+	// 栈顶的两页在协程重新运行时马上会被用到，保留它们，只归还下面已经提交的物理页
+	size_t len = roundUp(size);
+	size_t keep = 2 * m_pageSize;
+	if(len > keep)
+	{
+		madvise(stack, len - keep, MADV_DONTNEED);
+	}
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef _STACK_ALLOCATOR_H_
+#define _STACK_ALLOCATOR_H_
+
+#include <cstddef>
+
+namespace sylar {
+
+// 协程栈分配器：在 Fiber 构造时选择，决定协程栈从哪里分配、如何释放
+// 分配器对象的生命周期必须长于所有使用它的协程
+class StackAllocator
+{
+public:
+	virtual ~StackAllocator() {}
+
+	// 分配一个可用大小至少为 size 的栈，返回栈的最低地址
+	virtual void* alloc(size_t size) = 0;
+	// 释放 alloc 分配的栈，size 必须与分配时相同
+	virtual void dealloc(void* stack, size_t size) = 0;
+	// 协程被放回缓存、暂时不会运行时调用，分配器可以借此把栈占用的物理内存还给系统，默认什么也不做
+	virtual void release(void* /*stack*/, size_t /*size*/) {}
+
+public:
+	// 获取 / 设置默认的栈分配器，未指定分配器的协程（包括调度器为回调任务创建的协程）都使用它
+	static StackAllocator* GetDefault();
+	static void SetDefault(StackAllocator* allocator);
+};
+
+// 基于 malloc 的栈分配器，为默认实现
+class MallocStackAllocator : public StackAllocator
+{
+public:
+	void* alloc(size_t size) override;
+	void dealloc(void* stack, size_t size) override;
+};
+
+// 基于 mmap 的栈分配器：
+// 1.栈底（低地址）放一个 PROT_NONE 的保护页，栈溢出时直接触发 SIGSEGV，而不是悄悄破坏堆上的其他数据
+// 2.使用 MAP_NORESERVE 映射，物理页在第一次访问时才分配，没有用到的栈空间不占用内存
+// 3.decommit 为 true 时，协程放回缓存会用 madvise(MADV_DONTNEED) 归还栈上已经提交的物理页
+class MmapStackAllocator : public StackAllocator
+{
+public:
+	explicit MmapStackAllocator(bool decommit = true);
+
+	void* alloc(size_t size) override;
+	void dealloc(void* stack, size_t size) override;
+	void release(void* stack, size_t size) override;
+
+private:
+	// 将 size 向上取整到页大小
+	size_t roundUp(size_t size) const;
+
+private:
+	size_t m_pageSize; // 系统页大小
+	bool m_decommit; // 放回缓存时是否归还物理页
+};
+
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef _TASK_QUEUE_H_
+#define _TASK_QUEUE_H_
+
+#include <mutex>
+#include <memory>
+#include <cassert>
+#include <new>
+#include <atomic>
+
+namespace sylar {
+
+// 环形缓冲区实现的双端队列：容量为2的幂，满时翻倍扩容，头尾的入队出队都是 O(1)，不会像 vector::erase(begin) 那样搬移整个队列
+// 槽位是未初始化的原始内存，入队时原地构造、出队时原地析构，及时释放元素持有的资源（如协程的 shared_ptr）
+// 本身不加锁，由外层的锁保护
+template<class T>
+class RingQueue
+{
+public:
+	explicit RingQueue(size_t capacity = 64)
+	{
+		size_t cap = 1;
+		while(cap < capacity)
+		{
+			cap <<= 1;
+		}
+		m_buf = static_cast<T*>(::operator new(cap * sizeof(T)));
+		m_mask = cap - 1;
+	}
+
+	~RingQueue()
+	{
+		for(size_t i = 0; i < m_size; i++)
+		{
+			m_buf[(m_head + i) & m_mask].~T();
+		}
+		::operator delete(m_buf);
+	}
+
+	RingQueue(const RingQueue&) = delete;
+	RingQueue& operator=(const RingQueue&) = delete;
+
+	void push_back(T&& v)
+	{
+		if(m_size == m_mask + 1)
+		{
+			grow();
+		}
+		new (&m_buf[(m_head + m_size) & m_mask]) T(std::move(v));
+		m_size++;
+	}
+
+	// 从队头取出元素
+	void pop_front(T& out)
+	{
+		assert(m_size > 0);
+		out = std::move(m_buf[m_head]);
+		m_buf[m_head].~T();
+		m_head = (m_head + 1) & m_mask;
+		m_size--;
+	}
+
+	// 从队尾取出元素
+	void pop_back(T& out)
+	{
+		assert(m_size > 0);
+		size_t tail = (m_head + m_size - 1) & m_mask;
+		out = std::move(m_buf[tail]);
+		m_buf[tail].~T();
+		m_size--;
+	}
+
+	size_t size() const {return m_size;}
+	bool empty() const {return m_size == 0;}
+
+private:
+	// 扩容为原来的两倍，并把元素按队列顺序搬到新缓冲区的开头
+	void grow()
+	{
+		size_t cap = m_mask + 1;
+		T* buf = static_cast<T*>(::operator new(cap * 2 * sizeof(T)));
+		for(size_t i = 0; i < m_size; i++)
+		{
+			T& old = m_buf[(m_head + i) & m_mask];
+			new (&buf[i]) T(std::move(old));
+			old.~T();
+		}
+		::operator delete(m_buf);
+		m_buf = buf;
+		m_head = 0;
+		m_mask = cap * 2 - 1;
+	}
+
+private:
+	T* m_buf = nullptr;
+	size_t m_head = 0; // 队头下标
+	size_t m_size = 0; // 元素个数
+	size_t m_mask = 0; // 容量-1，用位与代替取模
+};
+
+// 带锁的先进先出队列，用于全局注入队列和指定了线程的任务队列
+template<class T>
+class LockedQueue
+{
+public:
+	// 入队，返回入队前队列是否为空
+	bool push(T&& task)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool was_empty = m_queue.empty();
+		m_queue.push_back(std::move(task));
+		m_size.store(m_queue.size(), std::memory_order_relaxed);
+		return was_empty;
+	}
+
+	// 成批入队，只加一次锁，tasks 中的元素被移走，返回入队前队列是否为空
+	bool pushBatch(T* tasks, size_t n)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool was_empty = m_queue.empty();
+		for(size_t i = 0; i < n; i++)
+		{
+			m_queue.push_back(std::move(tasks[i]));
+		}
+		m_size.store(m_queue.size(), std::memory_order_relaxed);
+		return was_empty;
+	}
+
+	bool pop(T& task)
+	{
+		if(empty()) // 无锁地快速判断，空队列不必加锁
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_queue.empty())
+		{
+			return false;
+		}
+		m_queue.pop_front(task);
+		m_size.store(m_queue.size(), std::memory_order_relaxed);
+		return true;
+	}
+
+	// 近似大小，只用于快速判断和统计，不保证与加锁后的实际大小一致
+	size_t size() const {return m_size.load(std::memory_order_relaxed);}
+	bool empty() const {return size() == 0;}
+
+private:
+	std::mutex m_mutex;
+	RingQueue<T> m_queue;
+	std::atomic<size_t> m_size = {0};
+};
+
+// 工作窃取队列：每个工作线程独占一个，用于存放本线程提交的任务
+// 所有者线程从队尾 push / pop（后进先出，刚提交的任务大概率还在缓存中），其他线程从队头 steal（先进先出，偷走最老的任务）
+// 每个队列有自己的锁，所有者和窃取者只在同一个队列上才会发生竞争，不再争抢调度器的全局锁
+template<class T>
+class WorkStealQueue
+{
+public:
+	// 所有者线程入队，返回入队前队列是否为空（用于判断是否需要唤醒空闲线程来窃取）
+	bool push(T&& task)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool was_empty = m_queue.empty();
+		m_queue.push_back(std::move(task));
+		m_size.store(m_queue.size(), std::memory_order_relaxed);
+		return was_empty;
+	}
+
+	// 成批入队，只加一次锁，tasks 中的元素被移走，返回入队前队列是否为空
+	bool pushBatch(T* tasks, size_t n)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool was_empty = m_queue.empty();
+		for(size_t i = 0; i < n; i++)
+		{
+			m_queue.push_back(std::move(tasks[i]));
+		}
+		m_size.store(m_queue.size(), std::memory_order_relaxed);
+		return was_empty;
+	}
+
+	// 所有者线程出队：从队尾取出最新的任务
+	bool pop(T& task)
+	{
+		if(empty()) // 无锁地快速判断，空队列不必加锁
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_queue.empty())
+		{
+			return false;
+		}
+		m_queue.pop_back(task);
+		m_size.store(m_queue.size(), std::memory_order_relaxed);
+		return true;
+	}
+
+	// 其他线程窃取：从队头取出最老的任务
+	bool steal(T& task)
+	{
+		if(empty())
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_queue.empty())
+		{
+			return false;
+		}
+		m_queue.pop_front(task);
+		m_size.store(m_queue.size(), std::memory_order_relaxed);
+		return true;
+	}
+
+	// 近似大小，只用于快速判断和统计，不保证与加锁后的实际大小一致
+	size_t size() const {return m_size.load(std::memory_order_relaxed);}
+	bool empty() const {return size() == 0;}
+
+private:
+	std::mutex m_mutex;
+	RingQueue<T> m_queue;
+	std::atomic<size_t> m_size = {0};
+};
+
+}
+
+#endif
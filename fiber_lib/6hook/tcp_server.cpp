@@ -0,0 +1,233 @@
+#include "tcp_server.h"
+#include "hook.h"
+#include "fd_manager.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+namespace sylar {
+
+bool TcpConnection::getPeerAddress(sockaddr_storage& addr, socklen_t& len) const
+{
+	len = sizeof(addr);
+	return getpeername(m_fd, (sockaddr*)&addr, &len) == 0;
+}
+
+ssize_t TcpConnection::recv(void* buf, size_t len)
+{
+	return ::recv(m_fd, buf, len, 0);
+}
+
+ssize_t TcpConnection::read(IOBuffer& buf, size_t hint)
+{
+	return buf.readFrom(m_fd, hint);
+}
+
+ssize_t TcpConnection::sendAll(const void* buf, size_t len)
+{
+	const char* p = (const char*)buf;
+	size_t left = len;
+	while(left)
+	{
+		ssize_t rt = ::send(m_fd, p, left, MSG_NOSIGNAL);
+		if(rt < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		p += rt;
+		left -= rt;
+	}
+	return len;
+}
+
+ssize_t TcpConnection::write(IOBuffer& buf)
+{
+	return buf.writeTo(m_fd);
+}
+
+bool TcpConnection::isStopping() const
+{
+	return m_server->isStopping();
+}
+
+TcpServer::TcpServer(IOManager* iom, Handler handler):
+m_iom(iom), m_handler(std::move(handler))
+{
+}
+
+TcpServer::~TcpServer()
+{
+	// 正在处理的连接持有服务端的引用，走到这里时已经没有连接了，只需要停止接收
+	if(m_listener)
+	{
+		m_listener->stop();
+	}
+}
+
+void TcpServer::setKeepAlive(bool enable, int idle_s, int interval_s, int count)
+{
+	m_keepAlive = enable;
+	m_keepIdle = idle_s;
+	m_keepInterval = interval_s;
+	m_keepCount = count;
+}
+
+bool TcpServer::start(const sockaddr* addr, socklen_t addrlen, bool use_accept4, int backlog)
+{
+	assert(!m_listener);
+	// Listener 的回调只持有弱引用，服务端没有连接时可以正常析构
+	std::weak_ptr<TcpServer> weak = shared_from_this();
+	m_listener = std::make_shared<Listener>(m_iom, addr, addrlen, [weak](int fd)
+	{
+		std::shared_ptr<TcpServer> self = weak.lock();
+		if(!self)
+		{
+			close(fd);
+			return;
+		}
+		self->handleClient(fd);
+	}, use_accept4, backlog);
+	if(!m_listener->start())
+	{
+		m_listener->stop();
+		return false;
+	}
+	m_iom->addShutdownHook([weak]()
+	{
+		std::shared_ptr<TcpServer> self = weak.lock();
+		if(self)
+		{
+			self->drain();
+		}
+	});
+	return true;
+}
+
+bool TcpServer::start(uint16_t port, int backlog)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = INADDR_ANY;
+	return start((sockaddr*)&addr, sizeof(addr), true, backlog);
+}
+
+void TcpServer::setupSocket(int fd)
+{
+	if(m_noDelay)
+	{
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	}
+	if(m_keepAlive)
+	{
+		int yes = 1;
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &m_keepIdle, sizeof(m_keepIdle));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &m_keepInterval, sizeof(m_keepInterval));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &m_keepCount, sizeof(m_keepCount));
+	}
+	if(m_idleTimeout)
+	{
+		// 直接设置 FdCtx 的超时，效果和 hook 的 setsockopt(SO_RCVTIMEO / SO_SNDTIMEO) 相同，省掉一次系统调用
+		FdCtx* ctx = FdMgr::GetInstance()->get(fd);
+		if(ctx)
+		{
+			ctx->setTimeout(SO_RCVTIMEO, m_idleTimeout);
+			ctx->setTimeout(SO_SNDTIMEO, m_idleTimeout);
+		}
+	}
+}
+
+void TcpServer::handleClient(int fd)
+{
+	size_t active = m_active.fetch_add(1, std::memory_order_relaxed) + 1;
+	if(m_stopping || (m_maxConnections && active > m_maxConnections))
+	{
+		m_active.fetch_sub(1, std::memory_order_relaxed);
+		m_rejected.fetch_add(1, std::memory_order_relaxed);
+		close(fd);
+		return;
+	}
+	uint64_t id = m_total.fetch_add(1, std::memory_order_relaxed) + 1;
+	setupSocket(fd);
+
+	TcpConnection conn(fd, id, this);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_conns.insert(&conn);
+		// stop() 可能在上面的检查之后、登记之前遍历过 m_conns，这里补上它没有做的 shutdown
+		if(m_stopping)
+		{
+			shutdown(fd, SHUT_RD);
+		}
+	}
+
+	// 处理函数抛出异常时也要注销并关闭连接，异常继续交给协程入口处理
+	struct Guard
+	{
+		TcpServer* server;
+		TcpConnection* conn;
+		~Guard()
+		{
+			{
+				std::lock_guard<std::mutex> lock(server->m_mutex);
+				server->m_conns.erase(conn);
+			}
+			close(conn->getFd());
+			server->m_active.fetch_sub(1, std::memory_order_relaxed);
+		}
+	} guard{this, &conn};
+
+	m_handler(conn);
+}
+
+void TcpServer::drain()
+{
+	if(!m_stopping.exchange(true) && m_listener)
+	{
+		m_listener->stop();
+	}
+
+	// 关闭读方向：缓冲区中已经收到的数据还能读出来，读完之后 recv 返回 0，等待中的协程被 epoll 唤醒
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(TcpConnection* conn : m_conns)
+	{
+		shutdown(conn->getFd(), SHUT_RD);
+	}
+}
+
+bool TcpServer::stop(uint64_t timeout_ms)
+{
+	drain();
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while(m_active.load(std::memory_order_relaxed) && std::chrono::steady_clock::now() < deadline)
+	{
+		usleep(1000);
+	}
+	if(!m_active.load(std::memory_order_relaxed))
+	{
+		return true;
+	}
+
+	// 超时：两个方向都关闭，阻塞在 send 上的协程也会出错返回
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(TcpConnection* conn : m_conns)
+	{
+		shutdown(conn->getFd(), SHUT_RDWR);
+	}
+	return false;
+}
+
+}
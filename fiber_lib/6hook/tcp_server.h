@@ -0,0 +1,124 @@
+#ifndef _TCP_SERVER_H_
+#define _TCP_SERVER_H_
+
+#include <sys/socket.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_set>
+
+#include "ioscheduler.h"
+#include "listener.h"
+#include "iobuffer.h"
+
+namespace sylar {
+
+class TcpServer;
+
+// 一条已接收的连接，只在处理函数的协程中使用；收发都走 hook，没有数据时挂起协程等待，不会空转
+class TcpConnection
+{
+public:
+	TcpConnection(int fd, uint64_t id, TcpServer* server): m_fd(fd), m_id(id), m_server(server) {}
+
+	int getFd() const {return m_fd;}
+	// 服务端内递增的连接编号
+	uint64_t getId() const {return m_id;}
+	// 对端地址，失败时返回 false
+	bool getPeerAddress(sockaddr_storage& addr, socklen_t& len) const;
+
+	// 返回值和 recv / send 相同；空闲超过 TcpServer::setIdleTimeout 设置的时间时返回 -1，errno 为 ETIMEDOUT
+	ssize_t recv(void* buf, size_t len);
+	// 读到 buf 的末尾，最多 hint 字节
+	ssize_t read(IOBuffer& buf, size_t hint = 64 * 1024);
+	// 写完全部数据才返回，返回写出的字节数，出错时返回 -1
+	ssize_t sendAll(const void* buf, size_t len);
+	// 写出 buf 的全部数据并从 buf 中去掉
+	ssize_t write(IOBuffer& buf);
+
+	// 服务端正在停止：处理完当前请求后应该尽快返回（读方向已经被关闭，之后的 recv 在读完缓冲的数据后返回 0）
+	bool isStopping() const;
+
+private:
+	int m_fd;
+	uint64_t m_id;
+	TcpServer* m_server;
+};
+
+// 基于 Listener 的 TCP 服务端：每条连接在自己的协程中运行处理函数，处理函数返回后服务端关闭连接
+// 连接数上限、空闲超时、TCP keepalive 和 TCP_NODELAY 由 set* 设置，在 start() 之前调用
+// 空闲超时作为 fd 的收发超时交给 hook：等待数据或可写的时间超过它时 recv / send 返回 ETIMEDOUT，由 TimerManager 的条件定时器实现
+// 必须用 std::make_shared 创建；正在处理的连接持有服务端的引用，所有连接结束之前服务端不会析构
+//     auto server = std::make_shared<sylar::TcpServer>(&iom, [](sylar::TcpConnection& conn) {...});
+//     server->setIdleTimeout(30000);
+//     server->start(8080);
+class TcpServer : public std::enable_shared_from_this<TcpServer>
+{
+public:
+	typedef std::function<void(TcpConnection&)> Handler;
+
+	TcpServer(IOManager* iom, Handler handler);
+	~TcpServer();
+
+	TcpServer(const TcpServer&) = delete;
+	TcpServer& operator=(const TcpServer&) = delete;
+
+	// 同时存在的连接数上限，超过时新连接接收后立即关闭，0 为不限制
+	void setMaxConnections(size_t n) {m_maxConnections = n;}
+	// 空闲超时（毫秒），0 为不超时
+	void setIdleTimeout(uint64_t ms) {m_idleTimeout = ms;}
+	// TCP keepalive：空闲 idle_s 秒后开始探测，每 interval_s 秒一次，count 次没有响应时断开
+	void setKeepAlive(bool enable, int idle_s = 60, int interval_s = 10, int count = 3);
+	// 是否关闭 Nagle 算法，默认关闭
+	void setNoDelay(bool enable) {m_noDelay = enable;}
+
+	// 开始监听，参数和 Listener 相同；失败时打印错误并返回 false
+	bool start(const sockaddr* addr, socklen_t addrlen, bool use_accept4 = true, int backlog = 1024);
+	// 监听所有 IPv4 地址上的 port，port 为 0 时由内核选择，用 getPort() 取得
+	bool start(uint16_t port, int backlog = 1024);
+
+	// 平滑停止：不再接收新连接，关闭所有连接的读方向，让处理函数处理完手上的请求后返回
+	// 等待 timeout_ms 毫秒后还没有结束的连接被彻底 shutdown，阻塞在收发上的协程会被唤醒并出错返回
+	// 在协程中调用时等待期间会让出协程（hook 的 usleep），返回是否所有连接都在超时之前结束
+	bool stop(uint64_t timeout_ms = 5000);
+	// 启动之后 IOManager::shutdown 会自动做 stop 的前半部分（停止接收、关闭读方向），剩下的由 shutdown 的截止时间兜底
+
+	uint16_t getPort() const {return m_listener ? m_listener->getPort() : 0;}
+	size_t getActiveConnections() const {return m_active.load(std::memory_order_relaxed);}
+	uint64_t getTotalConnections() const {return m_total.load(std::memory_order_relaxed);}
+	// 因为超过连接数上限或正在停止而被拒绝的连接数
+	uint64_t getRejectedConnections() const {return m_rejected.load(std::memory_order_relaxed);}
+	bool isStopping() const {return m_stopping.load(std::memory_order_relaxed);}
+
+private:
+	// 在 Listener 为新连接创建的任务中运行，整个连接的生命周期都在这个协程里
+	void handleClient(int fd);
+	void setupSocket(int fd);
+	// stop 的前半部分：停止接收新连接，关闭所有连接的读方向
+	void drain();
+
+private:
+	IOManager* m_iom;
+	Handler m_handler;
+	std::shared_ptr<Listener> m_listener;
+
+	size_t m_maxConnections = 0;
+	uint64_t m_idleTimeout = 0;
+	bool m_keepAlive = false;
+	int m_keepIdle = 60;
+	int m_keepInterval = 10;
+	int m_keepCount = 3;
+	bool m_noDelay = true;
+
+	std::mutex m_mutex; // 保护 m_conns：stop() shutdown 的 fd 不能已经被关闭、又被新连接复用
+	std::unordered_set<TcpConnection*> m_conns;
+	std::atomic<bool> m_stopping = {false};
+	std::atomic<size_t> m_active = {0};
+	std::atomic<uint64_t> m_total = {0};
+	std::atomic<uint64_t> m_rejected = {0};
+};
+
+}
+
+#endif
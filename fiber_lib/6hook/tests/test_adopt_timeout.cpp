@@ -0,0 +1,89 @@
+// 在 hook 之外创建的套接字（socketpair）第一次经过 hook 时才登记：
+// 1.在协程中用 setsockopt 设置的 SO_RCVTIMEO 要记到记录里，recv 按时超时
+// 2.在 hook 之外（没有开启 hook 的线程）设置的 SO_RCVTIMEO 在登记时从内核读出来
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+static const int kTimeoutMs = 5;
+static const int kRounds = 20;
+
+int main()
+{
+	int inside[2], outside[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, inside) || socketpair(AF_UNIX, SOCK_STREAM, 0, outside))
+	{
+		std::cerr << "socketpair failed" << std::endl;
+		return 1;
+	}
+	timeval tv = {0, kTimeoutMs * 1000};
+	setsockopt(outside[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)); // 主线程没有开启 hook，只设置到内核
+
+	std::atomic<int> timeouts{0};
+	std::atomic<int64_t> max_ms{0};
+	std::atomic<bool> done{false};
+	{
+		sylar::IOManager iom(1, false);
+		iom.scheduleLock([&]()
+		{
+			sylar::set_hook_enable(true);
+			setsockopt(inside[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+			for(int fd : {inside[0], outside[0]})
+			{
+				for(int i = 0; i < kRounds; i++)
+				{
+					char c;
+					auto start = std::chrono::steady_clock::now();
+					ssize_t n = recv(fd, &c, 1, 0);
+					int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+					if(n == -1 && (errno == EAGAIN || errno == ETIMEDOUT))
+					{
+						timeouts++;
+					}
+					if(ms > max_ms)
+					{
+						max_ms = ms;
+					}
+				}
+			}
+			done = true;
+		});
+		// 防止回归时 recv 永远阻塞：超过 5 秒后写入数据把它放出来，计数不会达标
+		iom.scheduleLock([&]()
+		{
+			sylar::set_hook_enable(true);
+			for(int i = 0; i < 500 && !done; i++)
+			{
+				usleep(10000);
+			}
+			if(done)
+			{
+				return;
+			}
+			for(int i = 0; i < kRounds; i++)
+			{
+				::write(inside[1], "x", 1);
+				::write(outside[1], "x", 1);
+			}
+		});
+	}
+
+	close(inside[0]);
+	close(inside[1]);
+	close(outside[0]);
+	close(outside[1]);
+	if(timeouts != 2 * kRounds || max_ms > 1000)
+	{
+		std::cerr << "timeouts " << timeouts << " of " << 2 * kRounds << ", longest recv " << max_ms << " ms" << std::endl;
+		return 1;
+	}
+	std::cout << "ok" << std::endl;
+	return 0;
+}
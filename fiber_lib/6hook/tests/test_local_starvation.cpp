@@ -0,0 +1,38 @@
+// 本地队列后进先出：一个不断重新调度自己再 yield 的协程不能饿死同一个本地队列中更早提交的任务
+// 只有一个工作线程，先在工作线程上提交 setter（进入本地队列），再让 spinner 反复重新调度自己
+#include "ioscheduler.h"
+#include "fiber.h"
+
+#include <atomic>
+#include <iostream>
+
+static const int kMaxSpins = 1000000; // 远大于公平性检查的间隔，超过说明 setter 被饿死了
+
+int main()
+{
+	std::atomic<bool> flag{false};
+	std::atomic<int> spins{0};
+	{
+		sylar::IOManager iom(1, false);
+		iom.scheduleLock([&]()
+		{
+			sylar::Scheduler* scheduler = sylar::Scheduler::GetThis();
+			scheduler->scheduleLock([&flag]() { flag = true; });
+			while(!flag && spins < kMaxSpins)
+			{
+				spins++;
+				scheduler->scheduleLock(sylar::Fiber::GetThis());
+				sylar::Fiber::GetThis()->yield();
+			}
+		});
+	}
+
+	// spinner 到达上限退出之后 setter 总会执行，所以看的是 spinner 是否被迫停下
+	if(spins >= kMaxSpins)
+	{
+		std::cerr << "sibling task starved after " << spins << " spins" << std::endl;
+		return 1;
+	}
+	std::cout << "ok, " << spins << " spins" << std::endl;
+	return 0;
+}
@@ -0,0 +1,73 @@
+// 按线程分片 epoll 时，IO 事件把协程固定到 fd 所属的线程上；共享栈协程只能回到它第一次运行的线程，必须优先于分片的线程
+// 16 个共享栈协程在 socketpair 上 recv，另一个协程分几轮写入，每个协程都应该收到全部数据
+#include "ioscheduler.h"
+#include "hook.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+static const int kFibers = 16;
+static const int kRounds = 3;
+
+int main()
+{
+	int fds[kFibers][2];
+	for(int i = 0; i < kFibers; i++)
+	{
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]))
+		{
+			std::cerr << "socketpair failed" << std::endl;
+			return 1;
+		}
+	}
+
+	std::atomic<int> received{0};
+	{
+		sylar::IOManager iom(4, false, "shard", sylar::TimerManager::HEAP, true);
+		for(int i = 0; i < kFibers; i++)
+		{
+			int fd = fds[i][0];
+			std::shared_ptr<sylar::Fiber> fiber = std::make_shared<sylar::Fiber>([fd, &received]()
+			{
+				sylar::set_hook_enable(true);
+				char buf[16];
+				for(int r = 0; r < kRounds; r++)
+				{
+					if(recv(fd, buf, 1, 0) == 1)
+					{
+						received++;
+					}
+				}
+			}, 0, true, nullptr, true);
+			iom.scheduleLock(fiber);
+		}
+		iom.scheduleLock([&fds]()
+		{
+			sylar::set_hook_enable(true);
+			for(int r = 0; r < kRounds; r++)
+			{
+				usleep(10000); // 让读协程先挂起在 epoll 上
+				for(int i = 0; i < kFibers; i++)
+				{
+					::write(fds[i][1], "x", 1);
+				}
+			}
+		});
+	}
+
+	for(int i = 0; i < kFibers; i++)
+	{
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+	if(received != kFibers * kRounds)
+	{
+		std::cerr << "received " << received << " of " << kFibers * kRounds << std::endl;
+		return 1;
+	}
+	std::cout << "ok" << std::endl;
+	return 0;
+}
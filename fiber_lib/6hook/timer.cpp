@@ -1,119 +1,119 @@
 #include "timer.h"
+#include "timing_wheel.h"
+#include "metrics.h"
+#include <algorithm>
 
 namespace sylar {
 
-// 取消一个定时器，删除该定时器的回调函数并将其从定时器堆中移除
+// 取消一个定时器：只改状态，不加锁，也不从存储中删除
+// do_io / 连接池这类用法中绝大部分定时器都是添加之后很快被取消的，取消路径上不再有锁和 set::find；
+// 留下的墓碑在超时时被跳过，或者在墓碑太多时由持有分片锁的线程成批回收
 bool Timer::cancel() 
 {
-/**
- * std::shared_mutex 是 C++17 引入的一种读写锁，支持：
- *      1.共享锁（std::shared_lock）：多个线程可以同时读取，但不能写入 
- *      2.独占锁（std::unique_lock）：只能有一个线程写入，其他线程必须等待 
- * unique_lock / shared_lock / lock_guard 都是标准库提供的互斥锁 RAII 封装工具
- *      unique_lock 用于获取 shared_mutex 的写锁，它会独占 shared_mutex，让当前线程获得写权限，其他线程无法同时写入 
- *      shared_lock 用于获取 shared_mutex 的读锁，它会共享 shared_mutex，让多个线程获得读权限，支持多个线程同时读取
- *      相比于 lock_guard，unique_lock 更灵活，支持手动解锁  
- */
-    
-    // m_manager->m_mutex 是 shared_mutex 类型，支持读写锁（共享锁和独占锁）
-    // 使用 unique_lock 获取 m_manager->m_mutex 的独占写锁，确保当前线程可以独占访问 m_manager 保护的资源，而其他线程必须等待
-    std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex); // 写锁互斥锁
-
-    if(m_cb == nullptr) 
-    {
-        return false;
-    }
-    else
+    int expected = ARMED;
+    if(!m_state.compare_exchange_strong(expected, CANCELLED, std::memory_order_acq_rel))
     {
-        m_cb = nullptr; // 将回调函数设置为 nullptr
-    }
-
-    auto it = m_manager->m_timers.find(shared_from_this()); // 从定时管理器中找到需要删除的定时器
-    if(it != m_manager->m_timers.end())
-    {
-        m_manager->m_timers.erase(it); // 删除该定时器
+        return false; // 已经取消过，或者已经触发
     }
+    m_manager->m_shards[m_shard]->tombstones.fetch_add(1, std::memory_order_relaxed);
+    Metrics::Add(METRIC_TIMERS_CANCELLED);
     return true;
 }
 
 // 刷新定时器超时时间，这个刷新操作会将定时器的下次触发延后 
 bool Timer::refresh() 
 {
-    std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex); // 触发读写锁的写锁，独占写
+    TimerManager::Shard& shard = *m_manager->m_shards[m_shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
 
-    if(!m_cb) 
+    if(m_state.load(std::memory_order_acquire) != ARMED) 
     {
         return false;
     }
 
-    auto it = m_manager->m_timers.find(shared_from_this()); // 在定时器集合中查找当前定时器
-    if(it == m_manager->m_timers.end())  
+    // 删除当前定时器并更新超时时间
+    if(!m_manager->eraseTimer(shard, this))
     {
         return false;
     }
-
-    // 删除当前定时器并更新超时时间
-    m_manager->m_timers.erase(it);
     
-    // std::chrono::system_clock::now() 是用来获取当前系统时间的标准方法，返回的是系统绝对时间，通常用于记录当前的实际时间点
-    m_next = std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms);
+    // 使用单调时钟计算新的超时时间，系统时间被修改（如 NTP 校时）不会影响定时器
+    m_next = std::chrono::steady_clock::now() + m_interval;
 
-    m_manager->m_timers.insert(shared_from_this()); // 将新的定时器加入到定时器管理类中
+    m_manager->insertTimer(shard, shared_from_this()); // 将新的定时器加入到定时器管理类中
+    m_manager->publish(shard);
     
     return true;
 }
 
 // 重置定时器的超时时间，可以选择从当前时间或上次超时时间开始计算超时时间 
 bool Timer::reset(uint64_t ms, bool from_now) 
-{   // 如果新超时时间 ms 与原来的超时时间 m_ms 相同，并且 from_now == false，说明不需要变更超时时间
-    if(ms == m_ms && !from_now) 
+{
+    return reset(std::chrono::milliseconds(ms), from_now);
+}
+
+bool Timer::reset(std::chrono::nanoseconds interval, bool from_now) 
+{   // 如果新超时时间 interval 与原来的超时时间 m_interval 相同，并且 from_now == false，说明不需要变更超时时间
+    if(interval == m_interval && !from_now) 
     {
         return true; // 表示无需重置
     }
     // 如果不满足上面的条件需要重置，删除当前的定时器然后重新计算超时时间并插入定时器
     {
-        std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex); // 独占写锁
+        TimerManager::Shard& shard = *m_manager->m_shards[m_shard];
+        std::lock_guard<std::mutex> lock(shard.mutex);
     
-        if(!m_cb) // 如果回调函数为空，说明该定时器已被取消或未初始化，因此无法重置
+        if(m_state.load(std::memory_order_acquire) != ARMED) // 定时器已被取消或已经触发，因此无法重置
         {
             return false;
         }
         
-        auto it = m_manager->m_timers.find(shared_from_this()); // 寻找该定时器
-        if(it==m_manager->m_timers.end())  
+        if(!m_manager->eraseTimer(shard, this)) // 删除该定时器
         {
             return false;
-        }   
-        m_manager->m_timers.erase(it); // 删除该定时器
+        }
+        m_manager->publish(shard);
     }
 
     // 如果 from_now 为 true 则从当前时间开始计算超时时间，为 false 就从上一次的起点开始计算超时时间
-    // 这里 m_next 是当前定时器的下一次绝对触发时间点，减去相对超时时间 m_ms，相当于计算出上一次的起点时间点 
-    auto start = from_now ? std::chrono::system_clock::now() : m_next - std::chrono::milliseconds(m_ms);
-    m_ms = ms;
-    m_next = start + std::chrono::milliseconds(m_ms);
-    m_manager->addTimer(shared_from_this()); // 重新插入该定时器
+    // 这里 m_next 是当前定时器的下一次绝对触发时间点，减去相对超时时间 m_interval，相当于计算出上一次的起点时间点 
+    auto start = from_now ? std::chrono::steady_clock::now() : m_next - m_interval;
+    m_interval = interval;
+    m_next = start + m_interval;
+    m_manager->addTimer(shared_from_this()); // 重新插入该定时器（放回原来的分片）
 
     return true;
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager):
-m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) 
+Timer::Timer(std::chrono::nanoseconds interval, std::function<void()> cb, bool recurring, TimerManager* manager):
+m_recurring(recurring), m_interval(interval), m_cb(cb), m_manager(manager) 
 {
-    auto now = std::chrono::system_clock::now();  
-    m_next = now + std::chrono::milliseconds(m_ms); // 绝对超时时间，即该定时器下一次触发的时间点
+    auto now = std::chrono::steady_clock::now(); // 不用缓存的时间，见 TimerManager::Now()
+    m_next = now + m_interval; // 绝对超时时间，即该定时器下一次触发的时间点
 }
 
 // 自定义比较器
 bool Timer::Comparator::operator()(const std::shared_ptr<Timer>& lhs, const std::shared_ptr<Timer>& rhs) const
 {
     assert(lhs != nullptr && rhs != nullptr);
-    return lhs->m_next < rhs->m_next;
+    if(lhs->m_next != rhs->m_next)
+    {
+        return lhs->m_next < rhs->m_next;
+    }
+    return lhs.get() < rhs.get();
 }
 
-TimerManager::TimerManager() 
+TimerManager::TimerManager(Backend backend, size_t shards) 
 {
-    m_previouseTime = std::chrono::system_clock::now(); // 初始化当前系统事件，为后续检查系统时间错误进行校对
+    auto now = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < std::max<size_t>(shards, 1); i++)
+    {
+        m_shards.emplace_back(new Shard());
+        if(backend == WHEEL)
+        {
+            m_shards.back()->wheel.reset(new TimingWheel(now));
+        }
+    }
 }
 
 TimerManager::~TimerManager() 
@@ -128,31 +128,41 @@ TimerManager::~TimerManager()
  */
 std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) 
 {
-    std::shared_ptr<Timer> timer(new Timer(ms, cb, recurring, this));
+    return addTimer(std::chrono::milliseconds(ms), std::move(cb), recurring);
+}
+std::shared_ptr<Timer> TimerManager::addTimer(std::chrono::nanoseconds timeout, std::function<void()> cb, bool recurring) 
+{
+    std::shared_ptr<Timer> timer(new Timer(timeout, std::move(cb), recurring, this));
     addTimer(timer);
     return timer;
 }
 void TimerManager::addTimer(std::shared_ptr<Timer> timer)
 {
-    bool at_front = false;
+    size_t index;
+    Shard* shard;
+    if(timer->m_shard >= 0)
+    {
+        index = timer->m_shard;
+        shard = m_shards[index].get();
+    }
+    else
     {
-        std::unique_lock<std::shared_mutex> write_lock(m_mutex); // 独占写锁
+        shard = &currentShard(index);
+        timer->m_shard = index;
+    }
 
-        // std::pair<iterator, bool> insert(const value_type& val);
-        // insert 返回值为 pair，取 first 是为了获取迭代器
-        auto it = m_timers.insert(timer).first;
+    bool at_front = false;
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
 
-        // 检查新插入的定时器是否排在最前面（即下一个要触发的定时器）
-        at_front = (it == m_timers.begin()) && !m_tickled;
-        
-        // 如果排在最前面，并且没有唤醒过调度线程
-        if(at_front)
-        {
-            m_tickled = true; // 标记已经触发过唤醒，避免重复唤醒，提高性能
-        }
+        // 检查新插入的定时器是否排在最前面（即下一个要触发的定时器），只排在本分片最前面时其他分片里可能还有更早的
+        at_front = insertTimer(*shard, timer) && isGlobalFront(index, timer->m_next);
+        compactIfNeeded(*shard);
+        publish(*shard);
     }
    
-    if(at_front)
+    // 如果排在最前面，并且没有唤醒过调度线程（标记已经触发过唤醒，避免重复唤醒，提高性能）
+    if(at_front && !m_tickled.exchange(true))
     {
         // 唤醒 epoll_wait 或 IO 调度器中的线程
         onTimerInsertedAtFront();
@@ -175,97 +185,599 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) //
 
 // 添加一个条件定时器，并在定时器触发执行 cb 的时候调用 Ontimer，在 Ontimer 中真正执行回调函数
 std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) 
+{
+    return addConditionTimer(std::chrono::milliseconds(ms), std::move(cb), std::move(weak_cond), recurring);
+}
+std::shared_ptr<Timer> TimerManager::addConditionTimer(std::chrono::nanoseconds timeout, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) 
 {
     // 将 OnTimer 的真正指向交给了 addtimer，然后创建 timer 对象
     // bind 将 OnTimer / weak_cond / cb 三者绑定起来，返回一个新的函数对象
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring); 
+    return addTimer(timeout, std::bind(&OnTimer, weak_cond, cb), recurring); 
+}
+
+void TimerManager::addTimerNode(TimerNode* node, std::chrono::nanoseconds timeout)
+{
+    assert(node->index == (size_t)-1 && node->cb);
+    node->next = std::chrono::steady_clock::now() + timeout;
+
+    size_t index;
+    Shard& shard = currentShard(index);
+    node->shard = index;
+    bool at_front = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        node->index = shard.nodes.size();
+        shard.nodes.push_back(node);
+        siftUpNode(shard, node->index);
+
+        // 节点成为堆顶时可能比 epoll_wait 正在等待的时间更早，和 addTimer 一样只唤醒一次
+        at_front = node->index == 0 && node->next.time_since_epoch().count() < shard.earliest.load(std::memory_order_relaxed) && isGlobalFront(index, node->next);
+        publish(shard);
+    }
+
+    if(at_front && !m_tickled.exchange(true))
+    {
+        onTimerInsertedAtFront();
+    }
+}
+
+bool TimerManager::cancelTimerNode(TimerNode* node)
+{
+    // 协程可能在另一个线程上恢复，这时锁的是添加节点的线程的分片
+    Shard& shard = *m_shards[node->shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if(node->index == (size_t)-1) // 已经超时被移出了堆
+    {
+        return false;
+    }
+    removeNode(shard, node->index);
+    publish(shard);
+    Metrics::Add(METRIC_TIMERS_CANCELLED);
+    return true;
+}
+
+void TimerManager::siftUpNode(Shard& shard, size_t index)
+{
+    std::vector<TimerNode*>& nodes = shard.nodes;
+    TimerNode* node = nodes[index];
+    while(index > 0)
+    {
+        size_t parent = (index - 1) / 2;
+        if(nodes[parent]->next <= node->next)
+        {
+            break;
+        }
+        nodes[index] = nodes[parent];
+        nodes[index]->index = index;
+        index = parent;
+    }
+    nodes[index] = node;
+    node->index = index;
+}
+
+void TimerManager::siftDownNode(Shard& shard, size_t index)
+{
+    std::vector<TimerNode*>& nodes = shard.nodes;
+    TimerNode* node = nodes[index];
+    size_t size = nodes.size();
+    while(true)
+    {
+        size_t child = index * 2 + 1;
+        if(child >= size)
+        {
+            break;
+        }
+        if(child + 1 < size && nodes[child + 1]->next < nodes[child]->next)
+        {
+            child++;
+        }
+        if(node->next <= nodes[child]->next)
+        {
+            break;
+        }
+        nodes[index] = nodes[child];
+        nodes[index]->index = index;
+        index = child;
+    }
+    nodes[index] = node;
+    node->index = index;
+}
+
+// 删除下标为 index 的节点：用最后一个节点填补空位，再根据它和原位置的大小关系上浮或下沉
+void TimerManager::removeNode(Shard& shard, size_t index)
+{
+    std::vector<TimerNode*>& nodes = shard.nodes;
+    TimerNode* node = nodes[index];
+    TimerNode* last = nodes.back();
+    nodes.pop_back();
+    node->index = (size_t)-1;
+    if(last == node)
+    {
+        return;
+    }
+    nodes[index] = last;
+    last->index = index;
+    if(index > 0 && last->next < nodes[(index - 1) / 2]->next)
+    {
+        siftUpNode(shard, index);
+    }
+    else
+    {
+        siftDownNode(shard, index);
+    }
+}
+
+bool TimerManager::insertTimer(Shard& shard, const std::shared_ptr<Timer>& timer)
+{
+    if(shard.wheel)
+    {
+        shard.wheelNext = std::min(shard.wheelNext, timer->m_next);
+        return shard.wheel->insert(timer);
+    }
+    // std::pair<iterator, bool> insert(const value_type& val);
+    // insert 返回值为 pair，取 first 是为了获取迭代器
+    auto it = shard.timers.insert(timer).first;
+    return it == shard.timers.begin();
+}
+
+bool TimerManager::eraseTimer(Shard& shard, Timer* timer)
+{
+    if(shard.wheel)
+    {
+        bool erased = shard.wheel->erase(timer);
+        if(shard.wheel->empty())
+        {
+            shard.wheelNext = std::chrono::time_point<std::chrono::steady_clock>::max();
+        }
+        return erased;
+    }
+    auto it = shard.timers.find(timer->shared_from_this()); // 从定时器集合中找到需要删除的定时器
+    if(it == shard.timers.end())
+    {
+        return false;
+    }
+    shard.timers.erase(it);
+    return true;
+}
+
+bool TimerManager::ReclaimCancelled(Timer* timer)
+{
+    if(timer->m_state.load(std::memory_order_acquire) != Timer::CANCELLED)
+    {
+        return false;
+    }
+    timer->m_cb = nullptr; // 回调持有的资源在回收时释放，cancel 本身不碰 m_cb
+    return true;
+}
+
+bool TimerManager::CancelIfRecurring(Timer* timer)
+{
+    if(!timer->m_recurring)
+    {
+        return false;
+    }
+    // 已经是墓碑的留给墓碑的回收逻辑，这样 tombstones 计数不受影响
+    int expected = Timer::ARMED;
+    if(!timer->m_state.compare_exchange_strong(expected, Timer::CANCELLED, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+    timer->m_cb = nullptr;
+    return true;
+}
+
+void TimerManager::compactIfNeeded(Shard& shard)
+{
+    static const int64_t kMinTombstones = 1024;
+    int64_t dead = shard.tombstones.load(std::memory_order_relaxed);
+    int64_t size = shard.wheel ? shard.wheel->size() : shard.timers.size();
+    if(dead < kMinTombstones || dead * 2 < size)
+    {
+        return;
+    }
+    // 扫描是 O(n) 的，但每次至少回收 n / 2 个墓碑，摊到每次取消上是常数
+    size_t removed = 0;
+    if(shard.wheel)
+    {
+        removed = shard.wheel->eraseIf(&TimerManager::ReclaimCancelled);
+    }
+    else
+    {
+        for(auto it = shard.timers.begin(); it != shard.timers.end(); )
+        {
+            if(ReclaimCancelled(it->get()))
+            {
+                it = shard.timers.erase(it);
+                removed++;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    shard.tombstones.fetch_sub(removed, std::memory_order_relaxed);
+}
+
+void TimerManager::publish(Shard& shard)
+{
+    auto time = std::chrono::time_point<std::chrono::steady_clock>::max();
+    if(shard.wheel)
+    {
+        time = shard.wheelNext;
+    }
+    else
+    {
+        // 排在最前面的墓碑直接回收，发布的最早时间总是一个有效的定时器，不会为已经取消的定时器提前醒来
+        size_t removed = 0;
+        while(!shard.timers.empty() && ReclaimCancelled(shard.timers.begin()->get()))
+        {
+            shard.timers.erase(shard.timers.begin());
+            removed++;
+        }
+        if(removed)
+        {
+            shard.tombstones.fetch_sub(removed, std::memory_order_relaxed);
+        }
+        if(!shard.timers.empty())
+        {
+            time = (*shard.timers.begin())->m_next;
+        }
+    }
+    if(!shard.nodes.empty() && shard.nodes[0]->next < time)
+    {
+        time = shard.nodes[0]->next;
+    }
+    int64_t ns = time == std::chrono::time_point<std::chrono::steady_clock>::max() ? INT64_MAX : time.time_since_epoch().count();
+    shard.entries.store((shard.wheel ? shard.wheel->size() : shard.timers.size()) + shard.nodes.size(), std::memory_order_relaxed);
+    shard.earliest.store(ns, std::memory_order_release);
+}
+
+// 分片中只剩墓碑（取消时不加锁，不会重新发布最早时间）时当作没有定时器
+static inline bool HasLive(int64_t entries, int64_t tombstones)
+{
+    return entries > tombstones;
+}
+
+bool TimerManager::isGlobalFront(size_t index, std::chrono::time_point<std::chrono::steady_clock> next) const
+{
+    int64_t ns = next.time_since_epoch().count();
+    for(size_t i = 0; i < m_shards.size(); i++)
+    {
+        if(i != index && m_shards[i]->earliest.load(std::memory_order_acquire) <= ns)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t TimerManager::getTimerShard()
+{
+    // 每个线程第一次使用时领一个序号，普通线程各自落在不同的分片上
+    static std::atomic<size_t> s_next{0};
+    static thread_local size_t t_index = s_next.fetch_add(1, std::memory_order_relaxed);
+    return t_index;
 }
 
 // 获取定时器管理器中下一个定时器的超时时间 
 uint64_t TimerManager::getNextTimer()
 {
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex); // shared_lock 获取 shared_mutex 的读锁
-    
-    // 重置 m_tickled，目的是如果插入的定时器位于堆顶，能正常触发 at_fornt
-    m_tickled = false;
-    
-    if(m_timers.empty())
+    uint64_t ns = getNextTimerNs();
+    if(ns == ~0ull)
     {
-        // 返回最大值
         return ~0ull;
     }
+    // 向上取整：向下取整会让 epoll_wait 提前醒来，在最后不足一毫秒的时间里反复以 0 超时空转
+    return (ns + 999999) / 1000000;
+}
+
+// 获取定时器管理器中下一个定时器的超时时间（纳秒）
+uint64_t TimerManager::getNextTimerNs()
+{
+    // 重置 m_tickled，目的是如果插入的定时器位于堆顶，能正常触发 at_front；已经是 false 时不写，避免每轮都写同一个缓存行
+    if(m_tickled.load(std::memory_order_relaxed))
+    {
+        m_tickled.store(false, std::memory_order_relaxed);
+    }
 
-    auto now = std::chrono::system_clock::now(); // 获取当前系统绝对时间
-    auto time = (*m_timers.begin())->m_next; // 获取最小堆中的第一个定时器的绝对超时时间 
+    auto now = Now(); // 获取当前时间
+    size_t index;
+    Shard& own = currentShard(index);
+    if(own.wheel)
+    {
+        // 时间轮计算唤醒时间时会更新内部状态，需要加锁；顺便把偏早的 wheelNext 修正为准确的唤醒时间
+        std::lock_guard<std::mutex> lock(own.mutex);
+        uint64_t ns = own.wheel->nextTimeout(now);
+        own.wheelNext = ns == ~0ull ? std::chrono::time_point<std::chrono::steady_clock>::max() : now + std::chrono::nanoseconds(ns);
+        publish(own);
+    }
+
+    // 所有分片中最早的超时时间，每个分片一次原子读
+    int64_t earliest = INT64_MAX;
+    for(auto& shard : m_shards)
+    {
+        int64_t time = shard->earliest.load(std::memory_order_acquire);
+        if(time < earliest && HasLive(shard->entries.load(std::memory_order_relaxed), shard->tombstones.load(std::memory_order_relaxed)))
+        {
+            earliest = time;
+        }
+    }
+    if(earliest == INT64_MAX)
+    {
+        // 返回最大值
+        return ~0ull;
+    }
 
     // 判断当前时间是否已经超过了下一个定时器的超时时间
-    if(now >= time)
+    int64_t now_ns = now.time_since_epoch().count();
+    if(now_ns >= earliest)
     {
         // 已经有 timer 超时
         return 0;
     }
+    // 计算从当前时间到下一个定时器超时时间的时间差
+    return static_cast<uint64_t>(earliest - now_ns);
+}
+
+size_t TimerManager::expireShard(Shard& shard, std::chrono::time_point<std::chrono::steady_clock> now, std::vector<std::function<void()>>& cbs)
+{
+    // 超时的侵入式节点直接在锁内执行回调，不产生任务，让 cancelTimerNode 可以确认回调已经结束
+    size_t fired = 0;
+    while(!shard.nodes.empty() && shard.nodes[0]->next <= now)
+    {
+        TimerNode* node = shard.nodes[0];
+        removeNode(shard, 0);
+        node->cb(node);
+        fired++;
+    }
+    size_t first_cb = cbs.size();
+    size_t reclaimed = 0;
+
+    if(shard.wheel)
+    {
+        std::vector<std::shared_ptr<Timer>> expired;
+        shard.wheel->expire(now, expired);
+        for(auto& temp : expired)
+        {
+            if(!TakeExpired(temp.get(), now, cbs))
+            {
+                reclaimed++;
+            }
+            else if(temp->m_recurring)
+            {
+                shard.wheel->insert(temp);
+            }
+        }
+        uint64_t ns = shard.wheel->nextTimeout(now);
+        shard.wheelNext = ns == ~0ull ? std::chrono::time_point<std::chrono::steady_clock>::max() : now + std::chrono::nanoseconds(ns);
+    }
     else
     {
-        // 计算从当前时间到下一个定时器超时时间的时间差，返回一个 std::chrono::milliseconds 对象
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(time - now);
-        return static_cast<uint64_t>(duration.count()); // 将时间差转换为毫秒并返回     
-    }  
+        // 存在超时定时器 -> 清理超时timer（单调时钟不会回退，不再需要检测系统时间回滚）
+        while (!shard.timers.empty() && (*shard.timers.begin())->m_next <= now)
+        {
+            std::shared_ptr<Timer> temp = *shard.timers.begin();
+            shard.timers.erase(shard.timers.begin());
+
+            // 墓碑直接丢弃；循环定时器重新加入时间堆
+            if(!TakeExpired(temp.get(), now, cbs))
+            {
+                reclaimed++;
+            }
+            else if(temp->m_recurring)
+            {
+                shard.timers.insert(temp);
+            }
+        }
+    }
+    if(reclaimed)
+    {
+        shard.tombstones.fetch_sub(reclaimed, std::memory_order_relaxed);
+    }
+    compactIfNeeded(shard);
+    publish(shard);
+    return fired + cbs.size() - first_cb;
+}
+
+bool TimerManager::TakeExpired(Timer* timer, std::chrono::time_point<std::chrono::steady_clock> now, std::vector<std::function<void()>>& cbs)
+{
+    if(timer->m_recurring)
+    {
+        // 循环定时器一直是 ARMED，取消和这里的检查之间没有顺序要求：检查之后才取消的，这一次的回调照常执行
+        if(ReclaimCancelled(timer))
+        {
+            return false;
+        }
+        cbs.push_back(timer->m_cb);
+        // 如果该定时器是循环的，则将 m_next 设置为当前时间加上定时器的相对超时时间 m_interval，由调用者重新插入
+        timer->m_next = now + timer->m_interval;
+        return true;
+    }
+    // 非循环定时器和 cancel 竞争同一个状态，CAS 失败说明已经被取消，是墓碑
+    int expected = Timer::ARMED;
+    if(!timer->m_state.compare_exchange_strong(expected, Timer::FIRED, std::memory_order_acq_rel))
+    {
+        ReclaimCancelled(timer);
+        return false;
+    }
+    cbs.push_back(std::move(timer->m_cb));
+    timer->m_cb = nullptr; // 将回调函数置空
+    return true;
 }
 
 // 处理所有已经超时的定时器，并将它们的回调函数存到 cbs 向量中，该函数还会处理定时器的循环逻辑
 void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs)
 {
-    auto now = std::chrono::system_clock::now();
+    auto now = Now();
+    int64_t now_ns = now.time_since_epoch().count();
 
-    std::unique_lock<std::shared_mutex> write_lock(m_mutex);  // 写锁
+    size_t index;
+    currentShard(index);
 
-    bool rollover = detectClockRollover(); // 判断是否出现系统时间错误
-    
-    // 回滚 -> 清理所有timer || 存在超时定时器 -> 清理超时timer 
-    while (!m_timers.empty() && rollover || !m_timers.empty() && (*m_timers.begin())->m_next <= now)
+    // 按各分片最早的超时时间排序后依次处理，同一轮里超时的定时器大体仍按到期先后执行回调
+    thread_local std::vector<std::pair<int64_t, size_t>> due;
+    due.clear();
+    for(size_t i = 0; i < m_shards.size(); i++)
     {
-        std::shared_ptr<Timer> temp = *m_timers.begin();
-        m_timers.erase(m_timers.begin());
-        
-        cbs.push_back(temp->m_cb); 
+        int64_t time = m_shards[i]->earliest.load(std::memory_order_acquire);
+        if(time <= now_ns)
+        {
+            due.emplace_back(time, i);
+        }
+    }
+    std::sort(due.begin(), due.end());
+
+    size_t fired = 0;
+    for(auto& item : due)
+    {
+        Shard& shard = *m_shards[item.second];
+        // 其他分片的线程可能正忙着执行任务，它们已经超时的定时器由空闲的线程代为处理；
+        // 其他分片的锁被占用说明它的线程正在处理，直接跳过，不在这里等待
+        std::unique_lock<std::mutex> lock(shard.mutex, std::defer_lock);
+        if(item.second == index)
+        {
+            lock.lock();
+        }
+        else if(!lock.try_lock())
+        {
+            continue;
+        }
+        fired += expireShard(shard, now, cbs);
+    }
+    if(fired)
+    {
+        Metrics::Add(METRIC_TIMERS_FIRED, fired);
+    }
+}
+
+size_t TimerManager::cancelRecurring()
+{
+    size_t cancelled = 0;
+    for(auto& ptr : m_shards)
+    {
+        Shard& shard = *ptr;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if(shard.wheel)
+        {
+            cancelled += shard.wheel->eraseIf(&TimerManager::CancelIfRecurring);
+        }
+        else
+        {
+            for(auto it = shard.timers.begin(); it != shard.timers.end(); )
+            {
+                if(CancelIfRecurring(it->get()))
+                {
+                    it = shard.timers.erase(it);
+                    cancelled++;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        publish(shard);
+    }
+    if(cancelled)
+    {
+        Metrics::Add(METRIC_TIMERS_CANCELLED, cancelled);
+    }
+    return cancelled;
+}
+
+size_t TimerManager::fastForward(std::vector<std::function<void()>>& cbs)
+{
+    auto now = Now();
+    size_t fired = 0;
+    std::vector<std::shared_ptr<Timer>> all;
+    for(auto& ptr : m_shards)
+    {
+        Shard& shard = *ptr;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        while(!shard.nodes.empty())
+        {
+            TimerNode* node = shard.nodes[0];
+            removeNode(shard, 0);
+            node->cb(node);
+            fired++;
+        }
 
-        // 如果该定时器是循环的，则将 m_next 设置为当前时间加上定时器的相对超时时间 m_ms，然后重新插入到定时器集合中
-        if(temp->m_recurring)
+        all.clear();
+        if(shard.wheel)
         {
-            // 重新加入时间堆
-            temp->m_next = now + std::chrono::milliseconds(temp->m_ms);
-            m_timers.insert(temp);
+            shard.wheel->takeAll(all);
+            shard.wheelNext = std::chrono::time_point<std::chrono::steady_clock>::max();
         }
         else
         {
-            // 将回调函数置空
-            temp->m_cb = nullptr;
+            all.assign(shard.timers.begin(), shard.timers.end());
+            shard.timers.clear();
+        }
+        size_t reclaimed = 0;
+        for(auto& timer : all)
+        {
+            // 循环定时器只取消，不执行也不再加入；一次性定时器和超时时一样执行回调
+            if(CancelIfRecurring(timer.get()))
+            {
+                continue;
+            }
+            if(timer->m_recurring || !TakeExpired(timer.get(), now, cbs))
+            {
+                ReclaimCancelled(timer.get());
+                reclaimed++;
+            }
+            else
+            {
+                fired++;
+            }
         }
+        if(reclaimed)
+        {
+            shard.tombstones.fetch_sub(reclaimed, std::memory_order_relaxed);
+        }
+        publish(shard);
+    }
+    if(fired)
+    {
+        Metrics::Add(METRIC_TIMERS_FIRED, fired);
     }
+    return fired;
 }
 
-// 检查时间堆是否为空
+// 是否还有定时器
 bool TimerManager::hasTimer() 
 {
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex); // 读锁
-    return !m_timers.empty();
+    for(auto& shard : m_shards)
+    {
+        if(shard->earliest.load(std::memory_order_acquire) != INT64_MAX && HasLive(shard->entries.load(std::memory_order_relaxed), shard->tombstones.load(std::memory_order_relaxed)))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
-// 检测系统时间是否发生了回滚，即时间是否倒退
-bool TimerManager::detectClockRollover() 
-{
-    bool rollover = false;
+// 当前线程缓存的时间，time_point 的默认值（纪元）表示没有缓存
+static thread_local std::chrono::time_point<std::chrono::steady_clock> t_now;
 
-    // 比较当前时间 now 与上次记录的时间 m_previouseTime 减去一个小时的时间量（60 *60* 1000 毫秒）
-    
-    auto now = std::chrono::system_clock::now();
-    if(now < (m_previouseTime - std::chrono::milliseconds(60 * 60 * 1000)))  
+std::chrono::time_point<std::chrono::steady_clock> TimerManager::Now()
+{
+    if(t_now.time_since_epoch().count() != 0)
     {
-        rollover = true; // 如果当前时间 now 小于这个时间值，说明系统时间回滚了
+        return t_now;
     }
-    m_previouseTime = now;
+    return std::chrono::steady_clock::now();
+}
 
-    return rollover;
+void TimerManager::UpdateNow()
+{
+    t_now = std::chrono::steady_clock::now();
+}
+
+void TimerManager::ClearNow()
+{
+    t_now = std::chrono::time_point<std::chrono::steady_clock>();
 }
 
 }
@@ -4,14 +4,16 @@
 #include <memory> // 智能指针头文件
 #include <vector>
 #include <set>
-#include <shared_mutex> // 读写锁头文件
 #include <assert.h> // 断言
 #include <functional> // 函数对象
 #include <mutex> // 互斥锁
+#include <atomic>
+#include <chrono>
 
 namespace sylar {
 
 class TimerManager; // 定时器管理类
+class TimingWheel; // 时间轮，TimerManager 的可选存储后端
 
 /**
  * enable_shared_from_this<T> 是一个辅助基类，它可以让类T在成员函数中安全地获取指向自身的 shared_ptr
@@ -22,82 +24,201 @@ class TimerManager; // 定时器管理类
 class Timer : public std::enable_shared_from_this<Timer> 
 {
     friend class TimerManager; // TimerManager 作为友元类，意味着 TimerManager 可以访问 Timer 的私有成员
+    friend class TimingWheel;
 public:
-    // 从时间堆中删除一个 Timer
+    // 取消 Timer：不加锁，只把状态标记为已取消，回调不会再执行；定时器留在分片中作为墓碑，超时或压缩时统一回收
+    // 返回 false 表示已经被取消过，或者（非循环的）定时器已经触发
     bool cancel();
     // 刷新 Timer
     bool refresh();
     // 重设 Timer 的超时时间，参1 ms 指定时器执行间隔时间，参2 from now 指是否从当前时间开始计算
     bool reset(uint64_t ms, bool from_now);
+    // 同上，间隔时间使用 std::chrono 时长，可以精确到微秒、纳秒
+    bool reset(std::chrono::nanoseconds interval, bool from_now);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+    Timer(std::chrono::nanoseconds interval, std::function<void()> cb, bool recurring, TimerManager* manager);
  
 private:
+    // 定时器的状态：添加后为 ARMED，cancel 改为 CANCELLED，非循环的定时器触发时改为 FIRED，两者用 CAS 竞争，先到的一方生效
+    enum State
+    {
+        ARMED = 0,
+        CANCELLED = 1,
+        FIRED = 2
+    };
+    std::atomic<int> m_state{ARMED};
     // 是否循环
     bool m_recurring = false;
     // 相对超时时间
-    uint64_t m_ms = 0;
-    // 绝对超时时间，即该定时器下一次触发的时间点
-    std::chrono::time_point<std::chrono::system_clock> m_next;
+    std::chrono::nanoseconds m_interval{0};
+    // 绝对超时时间，即该定时器下一次触发的时间点，使用单调时钟，不受系统时间调整的影响
+    std::chrono::time_point<std::chrono::steady_clock> m_next;
     // 超时时触发的回调函数
     std::function<void()> m_cb;
     // 管理该 Timer 的管理器
     TimerManager* m_manager = nullptr;
+    // 所在的分片，第一次加入时确定，之后 refresh / reset / 循环触发都放回同一个分片
+    int m_shard = -1;
+
+    // 时间轮后端使用：所在槽链表的后继（持有引用）和前驱，所在槽的下标（-1 表示不在时间轮中），超时刻度
+    std::shared_ptr<Timer> m_wheelNext;
+    Timer* m_wheelPrev = nullptr;
+    int m_wheelSlot = -1;
+    uint64_t m_tick = 0;
 
 private:
-    // 最小堆的比较函数，用于比较两个 Timer 对象，比较的依据是绝对超时时间
+    // 最小堆的比较函数，用于比较两个 Timer 对象，比较的依据是绝对超时时间，相同时按地址区分，保证 find 找到的是自己
     struct Comparator 
     {
         bool operator()(const std::shared_ptr<Timer>& lhs, const std::shared_ptr<Timer>& rhs) const;
     };
 };
 
+/**
+ * 侵入式定时器节点：存储由使用者提供（比如放在挂起协程的栈上），添加和取消都不分配内存
+ * 节点按超时时间放在 TimerManager 一个分片的二叉堆中，index 记录节点在堆中的位置，取消时直接定位，O(log n)
+ * cb 在超时时由收集超时定时器的线程调用，调用时持有节点所在分片的锁：
+ * 因此 cancelTimerNode() 返回之后 cb 一定已经执行完或者永远不会执行，节点可以安全地销毁；cb 中不能再操作这个 TimerManager
+ */
+struct TimerNode
+{
+    std::chrono::time_point<std::chrono::steady_clock> next; // 绝对超时时间
+    void (*cb)(TimerNode* node) = nullptr; // 超时回调
+    size_t index = (size_t)-1; // 在堆中的下标，-1 表示不在堆中
+    int shard = -1; // 所在的分片，添加时确定
+};
+
 class TimerManager 
 {
     friend class Timer;
 public:
-    TimerManager();  
+    // 定时器的存储后端
+    enum Backend
+    {
+        HEAP = 0, // 有序集合（红黑树），添加和取消都是 O(log n)
+        WHEEL = 1 // 分层时间轮，添加和取消都是 O(1)，精度为 1 毫秒（不支持亚毫秒的定时器）
+    };
+
+    // shards 为分片数：每个分片有自己的锁和存储，线程只在自己的分片上添加定时器，不同线程之间不再争用同一把锁
+    TimerManager(Backend backend = HEAP, size_t shards = 1);  
     virtual ~TimerManager();
 
     // 添加 Timer：参1 ms指定时器执行间隔时间，参2 cb指定时器回调函数，参3 recurring指是否循环定时器
     std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
 
+    // 同上，超时时间使用 std::chrono 时长，如 std::chrono::microseconds(100)
+    std::shared_ptr<Timer> addTimer(std::chrono::nanoseconds timeout, std::function<void()> cb, bool recurring = false);
+
     // 添加条件 Timer
     std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    std::shared_ptr<Timer> addConditionTimer(std::chrono::nanoseconds timeout, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+
+    // 添加侵入式定时器节点，timeout 之后调用 node->cb，节点不能已经在堆中
+    void addTimerNode(TimerNode* node, std::chrono::nanoseconds timeout);
+    // 取消侵入式定时器节点，返回 true 表示在超时之前取消成功；返回 false 表示已经超时，回调已经执行完
+    bool cancelTimerNode(TimerNode* node);
 
-    // 获取堆中最近的超时时间
+    // 获取所有分片中最近的超时时间（毫秒，向上取整，保证按它等待不会早于定时器超时）
     uint64_t getNextTimer();
 
-    // 获取所有超时定时器的回调函数
+    // 获取所有分片中最近的超时时间（纳秒），没有定时器时返回 ~0ull
+    // 只锁当前线程的分片（时间轮后端需要），其他分片读它们发布的最早超时时间，不加锁
+    uint64_t getNextTimerNs();
+
+    // 获取所有超时定时器的回调函数：先处理当前线程的分片，其他分片有超时的定时器且锁空闲时顺便处理
     void listExpiredCb(std::vector<std::function<void()>>& cbs);
 
-    // 堆中是否有定时器，即判断 set 是否为空
+    // 是否还有定时器
     bool hasTimer();
 
+    // 取消所有循环定时器并从存储中删除，返回取消的个数；用于停止时不让周期任务一直拖住调度器
+    size_t cancelRecurring();
+
+    // 让所有定时器立刻到期：侵入式节点的回调直接执行，一次性定时器的回调放入 cbs，循环定时器被取消，返回处理的个数
+    size_t fastForward(std::vector<std::function<void()>>& cbs);
+
+    // 扫描到期定时器使用的当前时间：当前线程有缓存时直接返回缓存，否则读取单调时钟
+    // 缓存只会比真实时间早，用来判断到期最多晚一轮触发；设置相对超时（添加、重置定时器，截止时间）必须读真实时钟，
+    // 否则同一批里排在耗时任务之后添加的定时器会提前触发
+    static std::chrono::time_point<std::chrono::steady_clock> Now();
+    // 刷新当前线程缓存的时间，IOManager::idle 每轮循环调用，同一轮里的到期扫描共用这个时间，不必每次都读时钟
+    static void UpdateNow();
+    // 清除当前线程缓存的时间，线程退出事件循环后恢复为每次读取时钟
+    static void ClearNow();
+
 protected:
     // 当一个最早的 Timer 加入到堆中（即该 Timer 加入了堆顶） -> 调用该函数
     virtual void onTimerInsertedAtFront() {};
 
-    // 添加 Timer
+    // 当前线程使用的分片，返回值对分片数取模；默认每个线程第一次使用时按顺序分配一个，IOManager 按工作线程序号分配
+    virtual size_t getTimerShard();
+
+    // 添加 Timer：已经属于某个分片时放回原来的分片，否则放入当前线程的分片
     void addTimer(std::shared_ptr<Timer> timer);
 
 private:
-    // 当系统时间改变时 -> 调用该函数
-    bool detectClockRollover();
+    // 一个分片：自己的锁、两种后端的存储和侵入式节点堆，按缓存行对齐，不同线程的分片不会伪共享
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
 
-private:
-    std::shared_mutex m_mutex; // 读写锁
+        // 时间堆：存储所有的 Timer 对象，并使用 Timer::Comparator 进行排序，确保最早超时的 Timer 在最前面（堆顶）
+        std::set<std::shared_ptr<Timer>, Timer::Comparator> timers;
+
+        // 时间轮后端，为空时使用 timers
+        std::unique_ptr<TimingWheel> wheel;
+        // 时间轮中最早需要处理的时间：插入时取较小值，删除时不变（只会偏早），nextTimeout / expire 之后重新计算
+        std::chrono::time_point<std::chrono::steady_clock> wheelNext = std::chrono::time_point<std::chrono::steady_clock>::max();
 
-    // 时间堆：存储所有的 Timer 对象，并使用 Timer::Comparator 进行排序，确保最早超时的 Timer 在最前面（堆顶）
-    std::set<std::shared_ptr<Timer>, Timer::Comparator> m_timers;
+        // 侵入式定时器节点的最小堆，与存储后端无关，容量只增不减，稳定之后添加节点不再分配内存
+        std::vector<TimerNode*> nodes;
+
+        // 发布给其他线程的最早超时时间（单调时钟的纳秒数），没有定时器时为 INT64_MAX，持有 mutex 时更新
+        std::atomic<int64_t> earliest{INT64_MAX};
+        // 分片中的定时器和节点总数（包括墓碑），持有 mutex 时更新
+        std::atomic<int64_t> entries{0};
+        // 已经取消但还留在存储中的 Timer（墓碑）数，cancel 不加锁地加一，回收时减去
+        std::atomic<int64_t> tombstones{0};
+    };
+
+    // 以下函数都要求调用者已经持有 shard 的锁
+    // 把定时器放入当前后端，返回它是否成为了分片中最早的定时器
+    bool insertTimer(Shard& shard, const std::shared_ptr<Timer>& timer);
+    // 把定时器从当前后端中删除，不存在时返回 false
+    bool eraseTimer(Shard& shard, Timer* timer);
+    // 侵入式节点堆的上浮和下沉
+    void siftUpNode(Shard& shard, size_t index);
+    void siftDownNode(Shard& shard, size_t index);
+    void removeNode(Shard& shard, size_t index);
+    // 重新计算并发布分片的最早超时时间，顺便回收排在最前面的墓碑
+    void publish(Shard& shard);
+    // 墓碑超过阈值（至少 kMinTombstones 个且超过存储中定时器的一半）时，扫描整个分片回收全部墓碑
+    void compactIfNeeded(Shard& shard);
+    // 定时器已经被取消时释放它的回调并返回 true，用于回收墓碑
+    static bool ReclaimCancelled(Timer* timer);
+    // 循环定时器还没有被取消时取消它、释放回调并返回 true，用于 cancelRecurring 从存储中直接删除
+    static bool CancelIfRecurring(Timer* timer);
+    // 处理一个到期的 Timer：把回调放入 cbs，循环定时器更新下一次的超时时间；是墓碑时回收并返回 false
+    static bool TakeExpired(Timer* timer, std::chrono::time_point<std::chrono::steady_clock> now, std::vector<std::function<void()>>& cbs);
+    // 取出分片中所有已经超时的定时器，侵入式节点的回调直接执行，返回处理的个数
+    size_t expireShard(Shard& shard, std::chrono::time_point<std::chrono::steady_clock> now, std::vector<std::function<void()>>& cbs);
+    // 新的最早时间 next 是否早于其他所有分片，是的话需要唤醒正在按旧的超时时间等待的线程
+    bool isGlobalFront(size_t index, std::chrono::time_point<std::chrono::steady_clock> next) const;
+
+    Shard& currentShard(size_t& index)
+    {
+        index = m_shards.size() == 1 ? 0 : getTimerShard() % m_shards.size();
+        return *m_shards[index];
+    }
+
+private:
+    std::vector<std::unique_ptr<Shard>> m_shards;
 
     // 在下次 getNextTime()执行前，onTimerInsertedAtFront()是否已经被触发了 --> 在此过程中，onTimerInsertedAtFront()只执行一次，防止重复调用
     // m_tickled 是一个标志，用于指示是否需要在定时器插入到时间堆的前端时触发额外的处理操作，例如唤醒一个等待的线程或进行其他管理操作
-    bool m_tickled = false;
-
-    // 上一次检查定时器管理器时的系统绝对时间，用于检测系统时间是否发生了回退
-    std::chrono::time_point<std::chrono::system_clock> m_previouseTime;
+    // 所有分片共用，添加定时器的线程和计算超时时间的线程不同，用原子变量
+    std::atomic<bool> m_tickled{false};
 };
 
 }
@@ -0,0 +1,301 @@
+#include "timing_wheel.h"
+#include "timer.h"
+
+namespace sylar {
+
+TimingWheel::TimingWheel(std::chrono::time_point<std::chrono::steady_clock> base):
+m_base(base)
+{
+}
+
+// 逐个断开链表，避免很长的链表在析构时通过 shared_ptr 递归释放导致栈溢出
+TimingWheel::~TimingWheel()
+{
+    for(int i = 0; i <= kSlots; i++)
+    {
+        std::shared_ptr<Timer> t = std::move(m_slots[i]);
+        while(t)
+        {
+            std::shared_ptr<Timer> next = std::move(t->m_wheelNext);
+            t->m_wheelPrev = nullptr;
+            t->m_wheelSlot = -1;
+            t = std::move(next);
+        }
+    }
+}
+
+uint64_t TimingWheel::toTick(std::chrono::time_point<std::chrono::steady_clock> tp) const
+{
+    if(tp <= m_base)
+    {
+        return 0;
+    }
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp - m_base).count();
+    return (ns + 999999) / 1000000;
+}
+
+bool TimingWheel::insert(const std::shared_ptr<Timer>& timer)
+{
+    timer->m_tick = toTick(timer->m_next);
+    place(timer);
+    return timer->m_tick < m_wakeTick;
+}
+
+void TimingWheel::place(const std::shared_ptr<Timer>& timer)
+{
+    uint64_t tick = timer->m_tick;
+    int slot;
+    if(tick < m_cursor) // 游标已经走过了它的超时刻度
+    {
+        slot = kOverdue;
+    }
+    else
+    {
+        uint64_t delta = tick - m_cursor;
+        if(delta < (1ull << kRootBits))
+        {
+            slot = tick & ((1 << kRootBits) - 1);
+        }
+        else
+        {
+            int level = 1;
+            while(level < kLevels - 1 && delta >= (1ull << shift(level + 1)))
+            {
+                level++;
+            }
+            if(delta >= (1ull << (shift(kLevels - 1) + kLevelBits))) // 超出最高层的范围，先放在最远的槽
+            {
+                tick = m_cursor + (63ull << shift(level));
+            }
+            slot = offset(level) + ((tick >> shift(level)) & ((1 << kLevelBits) - 1));
+        }
+    }
+
+    // 头插法挂到槽的链表上
+    std::shared_ptr<Timer>& head = m_slots[slot];
+    if(head)
+    {
+        head->m_wheelPrev = timer.get();
+    }
+    timer->m_wheelNext = std::move(head);
+    timer->m_wheelPrev = nullptr;
+    timer->m_wheelSlot = slot;
+    head = timer;
+    setBit(slot);
+    m_count++;
+}
+
+bool TimingWheel::erase(Timer* timer)
+{
+    int slot = timer->m_wheelSlot;
+    if(slot < 0)
+    {
+        return false;
+    }
+
+    // 先把自己的引用拿出来，保证摘除过程中 timer 不会被释放
+    std::shared_ptr<Timer> self;
+    std::shared_ptr<Timer> next = std::move(timer->m_wheelNext);
+    if(next)
+    {
+        next->m_wheelPrev = timer->m_wheelPrev;
+    }
+    if(timer->m_wheelPrev)
+    {
+        self = std::move(timer->m_wheelPrev->m_wheelNext);
+        timer->m_wheelPrev->m_wheelNext = std::move(next);
+    }
+    else
+    {
+        self = std::move(m_slots[slot]);
+        m_slots[slot] = std::move(next);
+        if(!m_slots[slot])
+        {
+            clearBit(slot);
+        }
+    }
+    timer->m_wheelPrev = nullptr;
+    timer->m_wheelSlot = -1;
+    m_count--;
+    return true;
+}
+
+size_t TimingWheel::eraseIf(bool (*pred)(Timer* timer))
+{
+    size_t erased = 0;
+    for(int slot = 0; slot <= kSlots; slot++)
+    {
+        if(!m_slots[slot])
+        {
+            continue;
+        }
+        Timer* t = m_slots[slot].get();
+        while(t)
+        {
+            // 后继由前驱（或槽头）持有，摘除 t 之后仍然有效
+            Timer* next = t->m_wheelNext.get();
+            if(pred(t))
+            {
+                erase(t);
+                erased++;
+            }
+            t = next;
+        }
+    }
+    return erased;
+}
+
+void TimingWheel::takeAll(std::vector<std::shared_ptr<Timer>>& out)
+{
+    for(int slot = 0; slot <= kSlots; slot++)
+    {
+        std::shared_ptr<Timer> t = takeSlot(slot);
+        while(t)
+        {
+            std::shared_ptr<Timer> next = std::move(t->m_wheelNext);
+            t->m_wheelPrev = nullptr;
+            t->m_wheelSlot = -1;
+            m_count--;
+            out.push_back(std::move(t));
+            t = std::move(next);
+        }
+    }
+}
+
+std::shared_ptr<Timer> TimingWheel::takeSlot(int slot)
+{
+    clearBit(slot);
+    return std::move(m_slots[slot]);
+}
+
+void TimingWheel::cascade(int level)
+{
+    int slot = offset(level) + ((m_cursor >> shift(level)) & ((1 << kLevelBits) - 1));
+    std::shared_ptr<Timer> t = takeSlot(slot);
+    while(t)
+    {
+        std::shared_ptr<Timer> next = std::move(t->m_wheelNext);
+        t->m_wheelPrev = nullptr;
+        t->m_wheelSlot = -1;
+        m_count--;
+        place(t);
+        t = std::move(next);
+    }
+}
+
+uint64_t TimingWheel::nextTimeout(std::chrono::time_point<std::chrono::steady_clock> now)
+{
+    if(m_count == 0)
+    {
+        m_wakeTick = ~0ull;
+        return ~0ull;
+    }
+
+    if(m_slots[kOverdue]) // 有已经超时的定时器，马上处理
+    {
+        m_wakeTick = 0;
+        return 0;
+    }
+
+    uint64_t wake = ~0ull;
+
+    // 第 0 层：从游标开始找第一个非空的槽，里面的定时器就在这个刻度超时
+    unsigned start = m_cursor & ((1 << kRootBits) - 1);
+    for(unsigned i = 0; i < (1u << kRootBits); )
+    {
+        unsigned slot = (start + i) & ((1 << kRootBits) - 1);
+        uint64_t word = m_bits[slot >> 6] >> (slot & 63);
+        if(word)
+        {
+            wake = m_cursor + i + __builtin_ctzll(word);
+            break;
+        }
+        i += 64 - (slot & 63);
+    }
+
+    // 高层：找下一个非空的槽，它级联的时刻就是需要醒来的时刻
+    for(int level = 1; level < kLevels; level++)
+    {
+        uint64_t word = m_bits[offset(level) >> 6];
+        if(!word)
+        {
+            continue;
+        }
+        // 游标正好在本层的边界上时，当前槽还没有级联，从当前槽开始找，否则从下一个槽开始找
+        uint64_t index = m_cursor >> shift(level);
+        uint64_t first = (m_cursor & ((1ull << shift(level)) - 1)) ? index + 1 : index;
+        // 旋转位图，使第 j 位对应第 first + j 个槽
+        unsigned rot = first & ((1 << kLevelBits) - 1);
+        uint64_t rotated = rot ? (word >> rot) | (word << (64 - rot)) : word;
+        uint64_t tick = (first + __builtin_ctzll(rotated)) << shift(level);
+        if(tick < wake)
+        {
+            wake = tick;
+        }
+    }
+    m_wakeTick = wake;
+
+    uint64_t now_ns = now > m_base ? std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_base).count() : 0;
+    uint64_t wake_ns = wake * 1000000;
+    if(wake_ns <= now_ns)
+    {
+        return 0;
+    }
+    return wake_ns - now_ns;
+}
+
+void TimingWheel::expire(std::chrono::time_point<std::chrono::steady_clock> now, std::vector<std::shared_ptr<Timer>>& out)
+{
+    std::shared_ptr<Timer> overdue = takeSlot(kOverdue);
+    while(overdue)
+    {
+        std::shared_ptr<Timer> next = std::move(overdue->m_wheelNext);
+        overdue->m_wheelPrev = nullptr;
+        overdue->m_wheelSlot = -1;
+        m_count--;
+        out.push_back(std::move(overdue));
+        overdue = std::move(next);
+    }
+
+    uint64_t now_tick = now > m_base ? std::chrono::duration_cast<std::chrono::milliseconds>(now - m_base).count() : 0;
+    while(m_cursor <= now_tick)
+    {
+        if(m_count == 0) // 没有定时器，游标直接跳到当前时间
+        {
+            m_cursor = now_tick + 1;
+            break;
+        }
+
+        // 游标走到上一层槽的边界，逐层向下级联
+        for(int level = 1; level < kLevels; level++)
+        {
+            if(m_cursor & ((1ull << shift(level)) - 1))
+            {
+                break;
+            }
+            cascade(level);
+        }
+
+        int slot = m_cursor & ((1 << kRootBits) - 1);
+        std::shared_ptr<Timer> t = takeSlot(slot);
+        while(t)
+        {
+            std::shared_ptr<Timer> next = std::move(t->m_wheelNext);
+            t->m_wheelPrev = nullptr;
+            t->m_wheelSlot = -1;
+            m_count--;
+            out.push_back(std::move(t));
+            t = std::move(next);
+        }
+        m_cursor++;
+
+        // 第 0 层为空时不必逐个刻度走，直接跳到下一个级联边界
+        if(rootEmpty())
+        {
+            uint64_t boundary = (m_cursor + (1 << kRootBits) - 1) & ~((1ull << kRootBits) - 1);
+            m_cursor = std::min(boundary, now_tick + 1);
+        }
+    }
+}
+
+}
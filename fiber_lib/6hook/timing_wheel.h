@@ -0,0 +1,88 @@
+#ifndef __SYLAR_TIMING_WHEEL_H__
+#define __SYLAR_TIMING_WHEEL_H__
+
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace sylar {
+
+class Timer;
+
+/**
+ * 分层时间轮：TimerManager 的另一种存储后端，添加和取消定时器都是 O(1)
+ * 刻度为 1 毫秒，共 5 层：第 0 层 256 个槽，每槽 1 毫秒；第 1~4 层各 64 个槽，每槽的跨度依次是下一层整圈的长度
+ * 定时器按剩余时间放入能容纳它的最低一层，游标走到上一层槽的边界时，把该槽的定时器重新分配到下面的层（cascade）
+ * 每个槽是一条侵入式双向链表，节点就是 Timer 本身，后继指针持有引用，取消时直接从链表中摘除，不需要查找
+ * 超过最高层范围（约 49 天）的定时器先放在最高层最远的槽，级联时重新计算
+ * 本身不加锁，由 TimerManager 的锁保护
+ */
+class TimingWheel
+{
+public:
+    explicit TimingWheel(std::chrono::time_point<std::chrono::steady_clock> base);
+    ~TimingWheel();
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    // 按 timer->m_next 插入，返回它是否早于上一次 nextTimeout() 算出的唤醒时间
+    bool insert(const std::shared_ptr<Timer>& timer);
+
+    // 从所在的槽中摘除，不在时间轮中返回 false
+    bool erase(Timer* timer);
+
+    // 摘除所有 pred 返回 true 的定时器，返回摘除的个数；遍历所有非空的槽，用于批量回收已经取消的定时器
+    size_t eraseIf(bool (*pred)(Timer* timer));
+
+    // 取出所有定时器（不管是否超时），游标不变
+    void takeAll(std::vector<std::shared_ptr<Timer>>& out);
+
+    // 距离下一次需要处理的时间还有多少纳秒，没有定时器返回 ~0ull
+    // 最近的定时器还在高层时，返回的是下一次级联的时间，比真正的超时时间早，不会晚
+    uint64_t nextTimeout(std::chrono::time_point<std::chrono::steady_clock> now);
+
+    // 把游标推进到 now，取出所有已经超时的定时器
+    void expire(std::chrono::time_point<std::chrono::steady_clock> now, std::vector<std::shared_ptr<Timer>>& out);
+
+    bool empty() const {return m_count == 0;}
+    size_t size() const {return m_count;}
+
+private:
+    static const int kLevels = 5;
+    static const int kRootBits = 8; // 第 0 层 256 个槽
+    static const int kLevelBits = 6; // 第 1~4 层各 64 个槽
+    static const int kSlots = (1 << kRootBits) + (kLevels - 1) * (1 << kLevelBits);
+    static const int kOverdue = kSlots; // 额外的一个槽，存放插入时就已经超时的定时器，下一次 expire() 无条件处理
+
+    // 第 level 层一个槽跨越的刻度数的位数
+    static int shift(int level) {return level == 0 ? 0 : kRootBits + (level - 1) * kLevelBits;}
+    // 第 level 层的槽在 m_slots 中的起始下标
+    static int offset(int level) {return level == 0 ? 0 : (1 << kRootBits) + (level - 1) * (1 << kLevelBits);}
+
+    // 绝对时间转换为刻度，向上取整保证定时器不会提前触发
+    uint64_t toTick(std::chrono::time_point<std::chrono::steady_clock> tp) const;
+    // 把定时器挂到合适的槽上
+    void place(const std::shared_ptr<Timer>& timer);
+    // 摘下整个槽的链表
+    std::shared_ptr<Timer> takeSlot(int slot);
+    // 把第 level 层游标所在的槽重新分配到下面的层
+    void cascade(int level);
+
+    void setBit(int slot) {m_bits[slot >> 6] |= 1ull << (slot & 63);}
+    void clearBit(int slot) {m_bits[slot >> 6] &= ~(1ull << (slot & 63));}
+    bool rootEmpty() const {return !(m_bits[0] | m_bits[1] | m_bits[2] | m_bits[3]);}
+
+private:
+    std::chrono::time_point<std::chrono::steady_clock> m_base; // 第 0 个刻度对应的时间
+    uint64_t m_cursor = 0; // 下一个要处理的刻度，之前的刻度都已经处理完
+    uint64_t m_wakeTick = ~0ull; // 上一次 nextTimeout() 算出的唤醒刻度，用于判断新定时器是否需要唤醒
+    size_t m_count = 0;
+    std::shared_ptr<Timer> m_slots[kSlots + 1]; // 每个槽链表的头节点
+    uint64_t m_bits[kSlots / 64 + 1] = {0}; // 非空槽的位图，用于快速跳过空槽
+};
+
+}
+
+#endif
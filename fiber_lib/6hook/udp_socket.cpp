@@ -0,0 +1,307 @@
+#include "udp_socket.h"
+#include "hook.h"
+#include "fd_manager.h"
+
+#include <netinet/udp.h>
+#include <unistd.h>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+namespace sylar {
+
+// 每项控制消息缓冲区的大小：接收时放 UDP_GRO（int），发送时放 UDP_SEGMENT（uint16_t）
+static const size_t kControlSize = CMSG_SPACE(sizeof(int));
+// 一次 UDP_SEGMENT 发送最多的数据报数（内核的 UDP_MAX_SEGMENTS）和最大的负载
+static const size_t kMaxGsoSegments = 64;
+static const size_t kMaxGsoBytes = 65507;
+// sendSegments 一次 sendmmsg 最多合并的组数
+static const size_t kMaxGsoGroups = 16;
+
+static std::atomic<bool> s_gso_available{true};
+
+UdpBatch::UdpBatch(size_t capacity, size_t datagram_size):
+m_capacity(capacity ? capacity : 1), m_datagramSize(datagram_size ? datagram_size : 1)
+{
+	m_buffer.reset(new char[m_capacity * m_datagramSize]);
+	m_msgs.reset(new mmsghdr[m_capacity]);
+	m_iovs.reset(new iovec[m_capacity]);
+	m_addrs.reset(new sockaddr_storage[m_capacity]);
+	m_control.reset(new char[m_capacity * kControlSize]);
+	m_segments.reset(new uint16_t[m_capacity]);
+	memset(m_msgs.get(), 0, sizeof(mmsghdr) * m_capacity);
+	for(size_t i = 0; i < m_capacity; i++)
+	{
+		m_iovs[i].iov_base = data(i);
+		m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+		m_msgs[i].msg_hdr.msg_iovlen = 1;
+		m_segments[i] = 0;
+	}
+}
+
+void UdpBatch::prepareRecv(size_t i)
+{
+	msghdr& hdr = m_msgs[i].msg_hdr;
+	hdr.msg_name = &m_addrs[i];
+	hdr.msg_namelen = sizeof(sockaddr_storage);
+	hdr.msg_control = m_control.get() + i * kControlSize;
+	hdr.msg_controllen = kControlSize;
+	hdr.msg_flags = 0;
+	m_iovs[i].iov_len = m_datagramSize;
+	m_msgs[i].msg_len = 0;
+	m_segments[i] = 0;
+}
+
+bool UdpBatch::push(const void* buf, size_t len, const sockaddr* addr, socklen_t addrlen)
+{
+	if(m_count == m_capacity || len > m_datagramSize || addrlen > sizeof(sockaddr_storage))
+	{
+		return false;
+	}
+	size_t i = m_count++;
+	memcpy(data(i), buf, len);
+	m_iovs[i].iov_len = len;
+	msghdr& hdr = m_msgs[i].msg_hdr;
+	if(addr)
+	{
+		memcpy(&m_addrs[i], addr, addrlen);
+		hdr.msg_name = &m_addrs[i];
+		hdr.msg_namelen = addrlen;
+	}
+	else
+	{
+		hdr.msg_name = nullptr;
+		hdr.msg_namelen = 0;
+	}
+	hdr.msg_control = nullptr;
+	hdr.msg_controllen = 0;
+	hdr.msg_flags = 0;
+	m_msgs[i].msg_len = len;
+	return true;
+}
+
+UdpSocket::UdpSocket(int family)
+{
+	m_fd = socket_f(family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if(m_fd >= 0)
+	{
+		// 不管是不是在协程中创建都自己登记（已经是非阻塞的套接字，不再 fstat / fcntl），之后在开启 hook 的协程中收发才会挂起而不是阻塞
+		FdMgr::GetInstance()->addSocket(m_fd);
+	}
+}
+
+UdpSocket::~UdpSocket()
+{
+	if(m_fd >= 0)
+	{
+		// 和 Listener 一样不依赖当前线程是否开启 hook：取消登记的事件并删除 FdCtx，否则复用这个 fd 号的新套接字会拿到旧的 FdCtx（以为已经是非阻塞）
+		IOManager* iom = IOManager::GetThis();
+		if(iom)
+		{
+			iom->cancelAll(m_fd);
+		}
+		FdMgr::GetInstance()->del(m_fd);
+		close_f(m_fd);
+	}
+}
+
+bool UdpSocket::bind(const sockaddr* addr, socklen_t addrlen)
+{
+	return ::bind(m_fd, addr, addrlen) == 0;
+}
+
+bool UdpSocket::connect(const sockaddr* addr, socklen_t addrlen)
+{
+	// UDP 的 connect 只记录对端地址，不会挂起
+	return ::connect(m_fd, addr, addrlen) == 0;
+}
+
+uint16_t UdpSocket::getPort() const
+{
+	sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if(getsockname(m_fd, (sockaddr*)&addr, &len) != 0)
+	{
+		return 0;
+	}
+	if(addr.ss_family == AF_INET6)
+	{
+		return ntohs(((sockaddr_in6*)&addr)->sin6_port);
+	}
+	return ntohs(((sockaddr_in*)&addr)->sin_port);
+}
+
+bool UdpSocket::setGro(bool enable)
+{
+	int value = enable ? 1 : 0;
+	return setsockopt(m_fd, SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0;
+}
+
+bool UdpSocket::IsGsoAvailable()
+{
+	return s_gso_available.load(std::memory_order_relaxed);
+}
+
+int UdpSocket::recvBatch(UdpBatch& batch)
+{
+	batch.clear();
+	for(size_t i = 0; i < batch.m_capacity; i++)
+	{
+		batch.prepareRecv(i);
+	}
+	// 非阻塞套接字上 recvmmsg 取走已经到达的数据报就返回；hook 只在一个都没有（EAGAIN）时挂起协程
+	int n = recvmmsg(m_fd, batch.m_msgs.get(), batch.m_capacity, 0, nullptr);
+	if(n < 0)
+	{
+		return -1;
+	}
+	for(int i = 0; i < n; i++)
+	{
+		msghdr& hdr = batch.m_msgs[i].msg_hdr;
+		for(cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+		{
+			if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+			{
+				int segment;
+				memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+				batch.m_segments[i] = segment;
+			}
+		}
+	}
+	batch.m_count = n;
+	return n;
+}
+
+int UdpSocket::sendBatch(UdpBatch& batch)
+{
+	size_t sent = 0;
+	while(sent < batch.m_count)
+	{
+		int n = sendmmsg(m_fd, batch.m_msgs.get() + sent, batch.m_count - sent, 0);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		sent += n;
+	}
+	batch.clear();
+	return sent ? (int)sent : -1;
+}
+
+ssize_t UdpSocket::sendSegmentsFallback(const char* data, size_t len, uint16_t segment, const sockaddr* addr, socklen_t addrlen)
+{
+	mmsghdr msgs[kMaxGsoSegments];
+	iovec iovs[kMaxGsoSegments];
+	size_t offset = 0;
+	while(offset < len)
+	{
+		size_t n = 0;
+		size_t pos = offset;
+		while(n < kMaxGsoSegments && pos < len)
+		{
+			size_t piece = std::min<size_t>(segment, len - pos);
+			iovs[n].iov_base = (void*)(data + pos);
+			iovs[n].iov_len = piece;
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = (void*)addr;
+			msgs[n].msg_hdr.msg_namelen = addr ? addrlen : 0;
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			pos += piece;
+			n++;
+		}
+		int rt = sendmmsg(m_fd, msgs, n, 0);
+		if(rt < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return offset ? (ssize_t)offset : -1;
+		}
+		for(int i = 0; i < rt; i++)
+		{
+			offset += iovs[i].iov_len;
+		}
+	}
+	return offset;
+}
+
+ssize_t UdpSocket::sendSegments(const void* buf, size_t len, uint16_t segment, const sockaddr* addr, socklen_t addrlen)
+{
+	const char* data = (const char*)buf;
+	if(segment == 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(!IsGsoAvailable())
+	{
+		return sendSegmentsFallback(data, len, segment, addr, addrlen);
+	}
+
+	// 每组最多 kMaxGsoSegments 个数据报、kMaxGsoBytes 字节，带一个 UDP_SEGMENT 控制消息
+	size_t group_bytes = std::min<size_t>(kMaxGsoSegments, std::max<size_t>(1, kMaxGsoBytes / segment)) * segment;
+	mmsghdr msgs[kMaxGsoGroups];
+	iovec iovs[kMaxGsoGroups];
+	union
+	{
+		char buf[kControlSize];
+		cmsghdr align;
+	} control[kMaxGsoGroups];
+
+	size_t offset = 0;
+	while(offset < len)
+	{
+		size_t n = 0;
+		size_t pos = offset;
+		while(n < kMaxGsoGroups && pos < len)
+		{
+			size_t piece = std::min(group_bytes, len - pos);
+			iovs[n].iov_base = (void*)(data + pos);
+			iovs[n].iov_len = piece;
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msghdr& hdr = msgs[n].msg_hdr;
+			hdr.msg_name = (void*)addr;
+			hdr.msg_namelen = addr ? addrlen : 0;
+			hdr.msg_iov = &iovs[n];
+			hdr.msg_iovlen = 1;
+			hdr.msg_control = control[n].buf;
+			hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+			cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+			pos += piece;
+			n++;
+		}
+		int rt = sendmmsg(m_fd, msgs, n, 0);
+		if(rt < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			// 内核或网卡不支持 GSO（老内核 ENOPROTOOPT / EINVAL，设备不支持校验和卸载时 EIO），以后都退回逐个发送
+			if(offset == 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP))
+			{
+				s_gso_available.store(false, std::memory_order_relaxed);
+				return sendSegmentsFallback(data, len, segment, addr, addrlen);
+			}
+			return offset ? (ssize_t)offset : -1;
+		}
+		for(int i = 0; i < rt; i++)
+		{
+			offset += iovs[i].iov_len;
+		}
+	}
+	return offset;
+}
+
+}
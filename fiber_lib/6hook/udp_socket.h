@@ -0,0 +1,108 @@
+#ifndef _UDP_SOCKET_H_
+#define _UDP_SOCKET_H_
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <memory>
+#include <vector>
+
+namespace sylar {
+
+// 一批数据报的预分配数组：mmsghdr、iovec、地址、控制消息和数据缓冲区在构造时一次分配，之后每次收发都复用
+// 每个协程持有自己的 UdpBatch（通常是协程函数里的局部变量或成员），不要在协程之间共享
+// 接收时 UdpSocket::recvBatch 填满它；发送时用 push 追加数据报，再交给 UdpSocket::sendBatch
+class UdpBatch
+{
+	friend class UdpSocket;
+public:
+	// capacity 为一批最多的数据报数，datagram_size 为每个数据报的缓冲区大小；开启 GRO 时合并后的数据报可能接近 64KB，datagram_size 要相应调大
+	explicit UdpBatch(size_t capacity = 64, size_t datagram_size = 2048);
+
+	UdpBatch(const UdpBatch&) = delete;
+	UdpBatch& operator=(const UdpBatch&) = delete;
+
+	size_t capacity() const {return m_capacity;}
+	size_t datagramSize() const {return m_datagramSize;}
+	// 当前批中的数据报数
+	size_t size() const {return m_count;}
+	bool empty() const {return m_count == 0;}
+	bool full() const {return m_count == m_capacity;}
+	void clear() {m_count = 0;}
+
+	// 第 i 个数据报的内容和来源地址（接收）或目的地址（发送）
+	char* data(size_t i) {return m_buffer.get() + i * m_datagramSize;}
+	const char* data(size_t i) const {return m_buffer.get() + i * m_datagramSize;}
+	size_t length(size_t i) const {return m_msgs[i].msg_len;}
+	const sockaddr* addr(size_t i) const {return (const sockaddr*)&m_addrs[i];}
+	socklen_t addrLen(size_t i) const {return m_msgs[i].msg_hdr.msg_namelen;}
+	// 接收时数据报被截断（缓冲区不够大）
+	bool truncated(size_t i) const {return m_msgs[i].msg_hdr.msg_flags & MSG_TRUNC;}
+	// 开启 GRO 时内核把同一个流上连续的数据报合并成一个，返回合并前每个数据报的大小（最后一个可以更短），没有合并时为 0
+	uint16_t segmentSize(size_t i) const {return m_segments[i];}
+
+	// 追加一个要发送的数据报，addr 为空时发给 connect 的地址；len 超过 datagram_size 或批已满时返回 false
+	bool push(const void* data, size_t len, const sockaddr* addr = nullptr, socklen_t addrlen = 0);
+
+private:
+	// 为接收或发送重置第 i 项的头部
+	void prepareRecv(size_t i);
+
+private:
+	size_t m_capacity;
+	size_t m_datagramSize;
+	size_t m_count = 0;
+	std::unique_ptr<char[]> m_buffer;
+	std::unique_ptr<mmsghdr[]> m_msgs;
+	std::unique_ptr<iovec[]> m_iovs;
+	std::unique_ptr<sockaddr_storage[]> m_addrs;
+	std::unique_ptr<char[]> m_control; // 每项一个放得下 UDP_GRO / UDP_SEGMENT 的控制消息
+	std::unique_ptr<uint16_t[]> m_segments;
+};
+
+// 非阻塞的 UDP 套接字，收发走 hook 的 recvmmsg / sendmmsg / sendmsg：一次系统调用处理一批数据报，只有套接字读空（或发送缓冲区满）时才挂起协程
+// sendSegments 用 UDP_SEGMENT（GSO）把一大块数据按固定大小切成多个数据报，一次系统调用交给内核在协议栈底部切分；内核不支持时退回 sendmmsg
+// 可以在任意线程创建，在开启 hook 的协程中收发；关闭 hook 时收发是阻塞的
+class UdpSocket
+{
+public:
+	// family 为 AF_INET 或 AF_INET6，失败时 getFd() 返回 -1
+	explicit UdpSocket(int family = AF_INET);
+	~UdpSocket();
+
+	UdpSocket(const UdpSocket&) = delete;
+	UdpSocket& operator=(const UdpSocket&) = delete;
+
+	int getFd() const {return m_fd;}
+	bool bind(const sockaddr* addr, socklen_t addrlen);
+	// 固定对端地址，之后发送时可以不带地址，内核也只收这个地址发来的数据报
+	bool connect(const sockaddr* addr, socklen_t addrlen);
+	// 实际绑定的端口
+	uint16_t getPort() const;
+
+	// 开启 UDP_GRO：接收时内核把同一个流上的多个数据报合并后交上来，见 UdpBatch::segmentSize
+	bool setGro(bool enable);
+
+	// 接收一批数据报：套接字中有数据时不挂起，一次取走最多 batch.capacity() 个；没有数据时挂起到有数据为止
+	// 返回收到的数据报数（batch.size()），出错时返回 -1 并设置 errno（超时为 ETIMEDOUT 或 EAGAIN）
+	int recvBatch(UdpBatch& batch);
+	// 发送 batch 中的全部数据报，发送缓冲区满时挂起；返回发出的数据报数，一个都没发出时返回 -1；发送后 batch 被清空
+	int sendBatch(UdpBatch& batch);
+	// 把 [data, data + len) 按 segment 字节切成数据报发给 addr（为空时发给 connect 的地址），最后一个可以更短
+	// 每 64 个数据报一次 UDP_SEGMENT 发送，多组合在一次 sendmmsg 里；返回发出的字节数，出错时返回 -1
+	ssize_t sendSegments(const void* data, size_t len, uint16_t segment, const sockaddr* addr = nullptr, socklen_t addrlen = 0);
+
+	// 内核是否接受 UDP_SEGMENT，第一次 sendSegments 失败时置为 false，之后直接用 sendmmsg 逐个发送
+	static bool IsGsoAvailable();
+
+private:
+	// 不用 GSO，把切好的数据报用 sendmmsg 分批发出
+	ssize_t sendSegmentsFallback(const char* data, size_t len, uint16_t segment, const sockaddr* addr, socklen_t addrlen);
+
+private:
+	int m_fd = -1;
+};
+
+}
+
+#endif
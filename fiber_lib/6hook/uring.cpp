@@ -0,0 +1,251 @@
+#include "uring.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+
+namespace sylar {
+
+#ifdef SYLAR_HAS_IO_URING
+
+static int io_uring_setup(unsigned entries, io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUring::IoUring(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // 同时在途的 IO 可能远多于 SQ 的大小，CQ 开大一些，减少溢出
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 16;
+
+    int fd = io_uring_setup(entries, &params);
+    if(fd < 0)
+    {
+        return; // 内核不支持或被禁用，isValid() 为 false
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap)
+    {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED)
+    {
+        m_sqRing = nullptr;
+        close(fd);
+        return;
+    }
+    if(single_mmap)
+    {
+        m_cqRing = m_sqRing;
+    }
+    else
+    {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED)
+        {
+            m_cqRing = nullptr;
+            munmap(m_sqRing, m_sqRingSize);
+            m_sqRing = nullptr;
+            close(fd);
+            return;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+    {
+        if(m_cqRing != m_sqRing)
+        {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        munmap(m_sqRing, m_sqRingSize);
+        m_sqRing = m_cqRing = nullptr;
+        close(fd);
+        return;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    m_sqTailPtr = (unsigned*)(sq + params.sq_off.tail);
+    m_sqFlags = (unsigned*)(sq + params.sq_off.flags);
+    m_sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqTail = *m_sqTailPtr;
+    // SQE 按顺序使用，索引数组固定为恒等映射
+    unsigned* array = (unsigned*)(sq + params.sq_off.array);
+    for(unsigned i = 0; i < m_sqEntries; i++)
+    {
+        array[i] = i;
+    }
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    m_cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    m_fd = fd;
+    // 需要 IORING_FEAT_NODROP（5.5）保证 CQ 满时不丢完成事件，并且要支持 hook 用到的所有操作码
+    if(!(params.features & IORING_FEAT_NODROP) || !probe())
+    {
+        std::cerr << "IoUring: kernel lacks required io_uring features" << std::endl;
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_eventFd < 0 || io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) < 0)
+    {
+        std::cerr << "IoUring: register eventfd failed: " << strerror(errno) << std::endl;
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+IoUring::~IoUring()
+{
+    if(m_sqes)
+    {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing)
+    {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing)
+    {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_eventFd >= 0)
+    {
+        close(m_eventFd);
+    }
+    if(m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+bool IoUring::probe()
+{
+    static const int kOps[] = {IORING_OP_READ, IORING_OP_WRITEV, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT,
+                               IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL};
+    const unsigned nr = 256;
+    size_t size = sizeof(io_uring_probe) + nr * sizeof(io_uring_probe_op);
+    io_uring_probe* p = (io_uring_probe*)calloc(1, size);
+    if(!p)
+    {
+        return false;
+    }
+    bool ok = io_uring_register(m_fd, IORING_REGISTER_PROBE, p, nr) == 0; // 注册探测需要 5.6，更老的内核直接退回 epoll
+    for(int op : kOps)
+    {
+        if(!ok)
+        {
+            break;
+        }
+        ok = op <= p->last_op && (p->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(p);
+    return ok;
+}
+
+io_uring_sqe* IoUring::getSqe()
+{
+    if(sqSpace() == 0)
+    {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqTail & m_sqMask];
+    m_sqTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+unsigned IoUring::sqSpace() const
+{
+    return m_sqEntries - (m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE));
+}
+
+unsigned IoUring::pending() const
+{
+    return m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::submit()
+{
+    unsigned count = pending();
+    if(count == 0)
+    {
+        return 0;
+    }
+    __atomic_store_n(m_sqTailPtr, m_sqTail, __ATOMIC_RELEASE);
+    int rt;
+    do
+    {
+        rt = io_uring_enter(m_fd, count, 0, 0);
+    } while(rt < 0 && errno == EINTR);
+    return rt < 0 ? -errno : rt;
+}
+
+bool IoUring::overflowed() const
+{
+    return __atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW;
+}
+
+void IoUring::flushOverflow()
+{
+    io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+}
+
+void IoUring::PrepRw(io_uring_sqe* sqe, int op, int fd, const void* addr, unsigned len, uint64_t off)
+{
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+}
+
+#else
+
+IoUring::IoUring(unsigned entries) {}
+IoUring::~IoUring() {}
+io_uring_sqe* IoUring::getSqe() {return nullptr;}
+unsigned IoUring::sqSpace() const {return 0;}
+unsigned IoUring::pending() const {return 0;}
+int IoUring::submit() {return -ENOSYS;}
+bool IoUring::overflowed() const {return false;}
+void IoUring::flushOverflow() {}
+bool IoUring::probe() {return false;}
+void IoUring::PrepRw(io_uring_sqe* sqe, int op, int fd, const void* addr, unsigned len, uint64_t off) {}
+
+#endif
+
+}
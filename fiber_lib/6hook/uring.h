@@ -0,0 +1,108 @@
+#ifndef __SYLAR_URING_H__
+#define __SYLAR_URING_H__
+
+#include <cstdint>
+#include <cstddef>
+
+// 没有 liburing，直接使用内核头文件和系统调用；头文件太旧时整个后端不可用，IOManager 退回 epoll
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define SYLAR_HAS_IO_URING 1
+#else
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace sylar {
+
+/**
+ * 一个 io_uring 实例：提交队列（SQ）和完成队列（CQ）都通过 mmap 映射到用户态
+ * 只能由一个线程使用（IOManager 中每个工作线程一个），因此内部不加锁
+ * getSqe() 只在用户态填写 SQE，submit() 才把积攒的 SQE 一次性交给内核，完成事件到达时向 eventFd() 写入计数
+ * 内核不支持需要的操作码（或者根本不支持 io_uring）时 isValid() 返回 false
+ */
+class IoUring
+{
+public:
+    explicit IoUring(unsigned entries = 256);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool isValid() const {return m_fd >= 0;}
+
+    // 完成事件到达时变为可读的 eventfd，注册到 epoll 中用于唤醒
+    int eventFd() const {return m_eventFd;}
+
+    // 取一个空闲的 SQE 并清零，SQ 已满时返回 nullptr
+    io_uring_sqe* getSqe();
+    // SQ 中还能放多少个 SQE
+    unsigned sqSpace() const;
+    // 已经填写但还没提交给内核的 SQE 数量
+    unsigned pending() const;
+
+    // 把积攒的 SQE 全部提交给内核，返回提交的数量，失败返回 -errno
+    int submit();
+
+    // 取出所有完成事件，对每个 CQE 调用 cb，返回处理的数量
+    template<class Callback>
+    unsigned reap(Callback cb)
+    {
+        unsigned count = 0;
+        while(true)
+        {
+#ifdef SYLAR_HAS_IO_URING
+            unsigned head = *m_cqHead;
+            unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            for(; head != tail; head++, count++)
+            {
+                cb(m_cqes[head & m_cqMask]);
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+#endif
+            // CQ 曾经满过，内核把放不下的完成事件暂存了起来，让它搬进 CQ 再取一次
+            if(!overflowed())
+            {
+                break;
+            }
+            flushOverflow();
+        }
+        return count;
+    }
+
+    // 填写一个读写类的 SQE 的通用字段
+    static void PrepRw(io_uring_sqe* sqe, int op, int fd, const void* addr, unsigned len, uint64_t off);
+
+private:
+    bool overflowed() const;
+    void flushOverflow();
+    bool probe();
+
+private:
+    int m_fd = -1;
+    int m_eventFd = -1;
+
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr; // 内核支持 IORING_FEAT_SINGLE_MMAP 时与 m_sqRing 相同
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTailPtr = nullptr;
+    unsigned* m_sqFlags = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned m_sqTail = 0; // 本地的 SQ 尾部，submit() 时才发布给内核
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+}
+
+#endif